@@ -0,0 +1,509 @@
+/**
+ * @file
+ * @author Ruben Pena <rubn.pena@gmail.com>
+ * @brief Headless benchmark suite of the renderer. Every scenario runs a fixed
+ * amount of warm up and measured iterations and the percentiles are reported
+ * as JSON, so runs on different commits can be compared
+ */
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <exception>
+#include <filesystem>
+#include <frustum.hh>
+#include <fstream>
+#include <functional>
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+#include <iostream>
+#include <mesh_optimizer.hh>
+#include <nlohmann/json.hpp>
+#include <percentile.hh>
+#include <random>
+#include <rt_app.hh>
+#include <scene.hh>
+#include <stdexcept>
+#include <string>
+#include <unistd.h>
+#include <vector>
+
+/**
+ * @brief Options of the benchmark run. The renderer options are always
+ * headless
+ */
+struct bench_config {
+  rt_app_config app;
+  uint32_t warmup = 2;         // Unmeasured iterations of every scenario
+  uint32_t iterations = 10;    // Measured iterations of every scenario
+  uint32_t steady_frames = 100; // Frames per steady state iteration
+  uint32_t cull_objects = 100000; // Objects of the CPU culling scenarios
+  std::string output_path;     // JSON report, stdout when empty
+  std::string filter;          // Only scenarios whose name contains it
+};
+
+struct scenario_result {
+  std::string name;
+  std::vector<double> samples; // Milliseconds
+};
+
+using bench_clock = std::chrono::steady_clock;
+
+static double elapsed_ms(bench_clock::time_point start) {
+  std::chrono::duration<double, std::milli> elapsed =
+      bench_clock::now() - start;
+  return elapsed.count();
+}
+
+/**
+ * @brief Usage: render-toy-bench [--warmup N] [--iterations N] [--frames N]
+ * [--frames-in-flight N] [--size WxH] [--scene file] [--device N]
+ * [--recording-threads N] [--culling none|cpu|gpu] [--cull-objects N]
+ * [--filter name] [--output file.json]
+ */
+static bench_config parse_args(int argc, char **argv) {
+  bench_config config;
+  config.app.headless = true;
+  config.app.width = 1280;
+  config.app.height = 720;
+  config.app.frames_in_flight = 2;
+  config.app.pipeline_cache_path.clear(); // Runs never warm each other up
+
+  for (int i = 1; i < argc; i++) {
+    std::string arg = argv[i];
+    bool has_value = i + 1 < argc;
+
+    if (arg == "--warmup" && has_value) {
+      config.warmup = static_cast<uint32_t>(std::stoul(argv[++i]));
+    } else if (arg == "--iterations" && has_value) {
+      config.iterations =
+          std::max(1u, static_cast<uint32_t>(std::stoul(argv[++i])));
+    } else if (arg == "--frames" && has_value) {
+      config.steady_frames =
+          std::max(1u, static_cast<uint32_t>(std::stoul(argv[++i])));
+    } else if (arg == "--frames-in-flight" && has_value) {
+      config.app.frames_in_flight =
+          static_cast<uint32_t>(std::stoul(argv[++i]));
+    } else if (arg == "--recording-threads" && has_value) {
+      config.app.recording_threads =
+          static_cast<uint32_t>(std::stoul(argv[++i]));
+    } else if (arg == "--size" && has_value) {
+      std::string size = argv[++i];
+      size_t separator = size.find('x');
+      if (separator == std::string::npos) {
+        throw std::runtime_error("--size expects WIDTHxHEIGHT");
+      }
+      config.app.width =
+          static_cast<uint32_t>(std::stoul(size.substr(0, separator)));
+      config.app.height =
+          static_cast<uint32_t>(std::stoul(size.substr(separator + 1)));
+      if (config.app.width == 0 || config.app.height == 0) {
+        throw std::runtime_error("--size expects a non zero WIDTHxHEIGHT");
+      }
+    } else if (arg == "--scene" && has_value) {
+      config.app.scene_path = argv[++i];
+    } else if (arg == "--device" && has_value) {
+      config.app.device_index = std::stoi(argv[++i]);
+    } else if (arg == "--culling" && has_value) {
+      config.app.culling = parse_cull_mode(argv[++i]);
+    } else if (arg == "--cull-objects" && has_value) {
+      config.cull_objects = static_cast<uint32_t>(std::stoul(argv[++i]));
+    } else if (arg == "--filter" && has_value) {
+      config.filter = argv[++i];
+    } else if (arg == "--output" && has_value) {
+      config.output_path = argv[++i];
+    } else {
+      throw std::runtime_error("unknown or incomplete argument: " + arg);
+    }
+  }
+
+  return config;
+}
+
+static scenario_result run_scenario(const bench_config &config,
+                                    const std::string &name,
+                                    const std::function<double()> &iteration) {
+  scenario_result result;
+  result.name = name;
+
+  for (uint32_t i = 0; i < config.warmup; i++) {
+    iteration();
+  }
+  for (uint32_t i = 0; i < config.iterations; i++) {
+    result.samples.push_back(iteration());
+  }
+
+  std::cerr << name << ": done" << std::endl;
+  return result;
+}
+
+/**
+ * @brief Creating the app, the device and every pipeline, then drawing and
+ * reading back the first frame. The configured scene is loaded too
+ */
+static double startup_to_first_frame(const bench_config &config) {
+  rt_app_config app_config = config.app;
+  app_config.pipeline_cache_path.clear(); // Always a cold start
+
+  auto start = bench_clock::now();
+  rt_app app(app_config);
+  app.init();
+  app.get_vk_loader().wait_pipelines(); // The scene, not the fallback
+  app.get_vk_loader().draw_frame();
+  app.get_vk_loader().read_back_frame();
+  double result = elapsed_ms(start);
+
+  app.shutdown();
+  return result;
+}
+
+/**
+ * @brief Average frame time over steady_frames frames. Frames are pipelined,
+ * only the last one is waited on
+ */
+static double steady_state(const bench_config &config, rt_app &app) {
+  vk_loader &loader = app.get_vk_loader();
+  loader.wait_pipelines();
+  while (loader.get_texture_streamer().is_streaming()) {
+    loader.draw_frame();
+  } // The textures at full resolution, as in a long session
+
+  auto start = bench_clock::now();
+  for (uint32_t i = 0; i < config.steady_frames; i++) {
+    loader.draw_frame();
+  }
+  loader.read_back_frame();
+  return elapsed_ms(start) / config.steady_frames;
+}
+
+/**
+ * @brief Parsing the scene file and uploading it, until the GPU copies are
+ * done
+ */
+static double asset_load(const bench_config &config, rt_app &app) {
+  vk_loader &loader = app.get_vk_loader();
+
+  auto start = bench_clock::now();
+  assets::scene_data scene = assets::load_scene(config.app.scene_path);
+  loader.load_scene(scene);
+  staging_ring &staging = loader.get_staging_ring();
+  staging.wait(staging.flush());
+  double result = elapsed_ms(start);
+
+  loader.draw_frame(); // Takes ownership of the uploads before the next load
+  loader.read_back_frame();
+  return result;
+}
+
+/**
+ * @brief Time spent creating every pipeline of the renderer, from the given
+ * pipeline cache. An empty path starts from an empty in memory cache
+ */
+static double pipeline_creation(const bench_config &config,
+                                const std::string &cache_path) {
+  rt_app_config app_config = config.app;
+  app_config.pipeline_cache_path = cache_path;
+  app_config.scene_path.clear();
+
+  rt_app app(app_config);
+  app.init();
+  app.get_vk_loader().wait_pipelines(); // Including the asynchronous ones
+  double result = app.get_vk_loader().get_pipeline_creation_ms();
+  app.shutdown(); // Writes the cache back
+  return result;
+}
+
+/**
+ * @brief Bounds as a plain array of structs, the layout the SoA culling is
+ * compared against
+ */
+struct aos_bounds {
+  glm::vec4 sphere;
+  glm::vec3 min;
+  glm::vec3 max;
+};
+
+/**
+ * @brief Random objects scattered around the camera, the same on every run,
+ * in both layouts. About a quarter of them end up in view
+ */
+static utils::frustum make_cull_input(uint32_t count,
+                                      std::vector<aos_bounds> &aos,
+                                      utils::bounds_soa &soa) {
+  std::mt19937 rng(42);
+  std::uniform_real_distribution<float> position(-100.0f, 100.0f);
+  std::uniform_real_distribution<float> size(0.1f, 2.0f);
+
+  aos.clear();
+  soa.clear();
+  for (uint32_t i = 0; i < count; i++) {
+    glm::vec3 center(position(rng), position(rng), position(rng));
+    glm::vec3 extent(size(rng), size(rng), size(rng));
+    aos_bounds bounds;
+    bounds.sphere = glm::vec4(center, glm::length(extent));
+    bounds.min = center - extent;
+    bounds.max = center + extent;
+    aos.push_back(bounds);
+    soa.push_back(bounds.sphere, bounds.min, bounds.max);
+  }
+
+  glm::mat4 view = glm::lookAt(glm::vec3(0.0f), glm::vec3(0.0f, 0.0f, -1.0f),
+                               glm::vec3(0.0f, 1.0f, 0.0f));
+  glm::mat4 projection =
+      glm::perspective(glm::radians(90.0f), 16.0f / 9.0f, 0.1f, 150.0f);
+  return utils::extract_frustum(projection * view);
+}
+
+/**
+ * @brief The naive loop: one object at a time, read from an array of structs
+ */
+static double cull_aos(const utils::frustum &view,
+                       const std::vector<aos_bounds> &objects,
+                       std::vector<uint32_t> &visible) {
+  auto start = bench_clock::now();
+  visible.clear();
+  for (size_t i = 0; i < objects.size(); i++) {
+    if (utils::is_visible(view, objects[i].sphere, objects[i].min,
+                          objects[i].max)) {
+      visible.push_back(static_cast<uint32_t>(i));
+    }
+  }
+  return elapsed_ms(start);
+}
+
+static double cull_soa(const utils::frustum &view,
+                       const utils::bounds_soa &objects,
+                       std::vector<uint32_t> &visible) {
+  auto start = bench_clock::now();
+  utils::cull(view, objects, visible);
+  return elapsed_ms(start);
+}
+
+/**
+ * @brief Index list of a grid_size x grid_size grid of quads with its
+ * triangles shuffled, the same on every run. The scrambled order is close to
+ * the worst case of the post-transform cache
+ */
+static std::vector<uint32_t> make_grid_indices(uint32_t grid_size) {
+  std::vector<std::array<uint32_t, 3>> triangles;
+  uint32_t row = grid_size + 1;
+  for (uint32_t y = 0; y < grid_size; y++) {
+    for (uint32_t x = 0; x < grid_size; x++) {
+      uint32_t corner = y * row + x;
+      triangles.push_back({corner, corner + row, corner + 1});
+      triangles.push_back({corner + 1, corner + row, corner + row + 1});
+    }
+  }
+
+  std::mt19937 rng(42);
+  std::shuffle(triangles.begin(), triangles.end(), rng);
+
+  std::vector<uint32_t> indices;
+  for (const auto &triangle : triangles) {
+    indices.insert(indices.end(), triangle.begin(), triangle.end());
+  }
+  return indices;
+}
+
+/**
+ * @brief The triangle reordering the OBJ loader runs on every group, on a
+ * fresh copy of source each time
+ */
+static double vertex_cache(const std::vector<uint32_t> &source,
+                           uint32_t vertex_count,
+                           std::vector<uint32_t> &indices) {
+  indices = source;
+  auto start = bench_clock::now();
+  assets::optimize_vertex_cache(indices.data(),
+                                static_cast<uint32_t>(indices.size()),
+                                vertex_count);
+  return elapsed_ms(start);
+}
+
+static nlohmann::json summarize(const scenario_result &result) {
+  std::vector<double> sorted = result.samples;
+  std::sort(sorted.begin(), sorted.end());
+
+  double total = 0.0;
+  for (double sample : sorted) {
+    total += sample;
+  }
+
+  nlohmann::json summary;
+  summary["name"] = result.name;
+  summary["unit"] = "ms";
+  summary["iterations"] = static_cast<uint32_t>(sorted.size());
+  summary["min"] = sorted.front();
+  summary["p50"] = utils::percentile(sorted, 0.50);
+  summary["p95"] = utils::percentile(sorted, 0.95);
+  summary["p99"] = utils::percentile(sorted, 0.99);
+  summary["max"] = sorted.back();
+  summary["mean"] = total / sorted.size();
+  return summary;
+}
+
+/**
+ * @brief Device memory of the allocator once the scenarios that share an app
+ * are done
+ */
+static nlohmann::json summarize_memory(const allocator_stats &stats) {
+  nlohmann::json memory;
+  memory["device_allocations"] = stats.device_allocations;
+  memory["allocations"] = stats.allocations;
+  memory["reserved_bytes"] = stats.reserved_bytes;
+  memory["used_bytes"] = stats.used_bytes;
+  memory["free_bytes"] = stats.free_bytes;
+  memory["largest_free"] = stats.largest_free;
+  memory["fragmentation"] = stats.fragmentation;
+  return memory;
+}
+
+static std::string get_device_name(vk_loader &loader) {
+  VkPhysicalDeviceProperties properties;
+  vkGetPhysicalDeviceProperties(loader.get_selected_physical_device(),
+                                &properties);
+  return properties.deviceName;
+}
+
+/**
+ * @brief Entry of the benchmark
+ */
+int main(int argc, char **argv) {
+  try {
+    bench_config config = parse_args(argc, argv);
+
+    setenv("MESA_SHADER_CACHE_DISABLE", "true", 0);
+    setenv("__GL_SHADER_DISK_CACHE", "0", 0); // Driver caches skew cold runs
+
+    auto enabled = [&](const std::string &name) {
+      return config.filter.empty() ||
+             name.find(config.filter) != std::string::npos;
+    };
+
+    std::vector<scenario_result> results;
+    std::string device_name;
+    nlohmann::json memory; // null when no scenario kept an app alive
+    nlohmann::json vertex_cache_report;
+
+    if (enabled("startup_to_first_frame")) {
+      results.push_back(run_scenario(config, "startup_to_first_frame", [&]() {
+        return startup_to_first_frame(config);
+      }));
+    }
+
+    if (enabled("steady_state") ||
+        (enabled("asset_load") && !config.app.scene_path.empty())) {
+      rt_app app(config.app);
+      app.init();
+      device_name = get_device_name(app.get_vk_loader());
+
+      if (enabled("steady_state")) {
+        results.push_back(run_scenario(config, "steady_state", [&]() {
+          return steady_state(config, app);
+        }));
+      }
+      if (enabled("asset_load") && !config.app.scene_path.empty()) {
+        results.push_back(run_scenario(config, "asset_load", [&]() {
+          return asset_load(config, app);
+        }));
+      }
+      memory =
+          summarize_memory(app.get_vk_loader().get_allocator().get_stats());
+      app.shutdown();
+    } // Both share one app, they do not measure its creation
+
+    if (enabled("cull_aos") || enabled("cull_soa")) {
+      std::vector<aos_bounds> aos;
+      utils::bounds_soa soa;
+      std::vector<uint32_t> visible;
+      utils::frustum view = make_cull_input(config.cull_objects, aos, soa);
+
+      if (enabled("cull_aos")) {
+        results.push_back(run_scenario(config, "cull_aos", [&]() {
+          return cull_aos(view, aos, visible);
+        }));
+      }
+      if (enabled("cull_soa")) {
+        results.push_back(run_scenario(config, "cull_soa", [&]() {
+          return cull_soa(view, soa, visible);
+        }));
+      }
+    } // CPU only, no device involved
+
+    if (enabled("vertex_cache")) {
+      const uint32_t grid_size = 256;
+      const uint32_t cache_size = 16; // A typical post-transform FIFO
+      uint32_t vertex_count = (grid_size + 1) * (grid_size + 1);
+      std::vector<uint32_t> scrambled = make_grid_indices(grid_size);
+      std::vector<uint32_t> optimized;
+
+      results.push_back(run_scenario(config, "vertex_cache", [&]() {
+        return vertex_cache(scrambled, vertex_count, optimized);
+      }));
+
+      uint32_t index_count = static_cast<uint32_t>(scrambled.size());
+      vertex_cache_report["triangles"] = index_count / 3;
+      vertex_cache_report["cache_size"] = cache_size;
+      vertex_cache_report["acmr_before"] =
+          assets::compute_acmr(scrambled.data(), index_count, cache_size);
+      vertex_cache_report["acmr_after"] =
+          assets::compute_acmr(optimized.data(), index_count, cache_size);
+    } // CPU only, the quality of the order next to its cost
+
+    if (enabled("pipeline_creation_cold")) {
+      results.push_back(run_scenario(config, "pipeline_creation_cold", [&]() {
+        return pipeline_creation(config, "");
+      }));
+    }
+
+    if (enabled("pipeline_creation_warm")) {
+      const std::string cache_path =
+          (std::filesystem::temp_directory_path() /
+           ("render-toy-bench-cache-" + std::to_string(getpid()) + ".bin"))
+              .string(); // Not the cwd, where a later run would find it
+      std::remove(cache_path.c_str());
+      pipeline_creation(config, cache_path); // Fills the cache
+
+      results.push_back(run_scenario(config, "pipeline_creation_warm", [&]() {
+        return pipeline_creation(config, cache_path);
+      }));
+      std::remove(cache_path.c_str());
+    }
+
+    nlohmann::json report;
+    report["device"] = device_name;
+    report["warmup"] = config.warmup;
+    report["iterations"] = config.iterations;
+    report["steady_frames"] = config.steady_frames;
+    report["width"] = config.app.width;
+    report["height"] = config.app.height;
+    report["frames_in_flight"] = config.app.frames_in_flight;
+    report["scene"] = config.app.scene_path;
+    report["cull_objects"] = config.cull_objects;
+    report["memory"] = memory;
+    report["vertex_cache"] = vertex_cache_report;
+
+    nlohmann::json scenarios = nlohmann::json::array();
+    for (const auto &result : results) {
+      scenarios.push_back(summarize(result));
+    }
+    report["scenarios"] = scenarios;
+
+    if (config.output_path.empty()) {
+      std::cout << report.dump(2) << std::endl;
+    } else {
+      std::ofstream file(config.output_path);
+      if (!file) {
+        throw std::runtime_error("failed to open " + config.output_path);
+      }
+      file << report.dump(2) << std::endl;
+    }
+  } catch (const std::exception &e) {
+    std::cerr << e.what() << std::endl;
+    return 1;
+  }
+
+  return 0;
+}
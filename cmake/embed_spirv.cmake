@@ -0,0 +1,65 @@
+# Embeds compiled SPIR-V modules into a C++ source file.
+#
+# Usage: cmake -DOUTPUT=<file.cc> -DSPIRV_FILES=<a.spv,b.spv,...> -P embed_spirv.cmake
+#
+# Every module becomes an aligned constexpr uint32_t array, looked up at runtime
+# with utils::find_embedded_shader("<source file name>"), e.g. "def.vert".
+
+string(REPLACE "," ";" spirv_files "${SPIRV_FILES}")
+
+set(arrays "")
+set(table "")
+
+foreach(spirv_file ${spirv_files})
+  get_filename_component(file_name "${spirv_file}" NAME)
+  string(REGEX REPLACE "\\.spv$" "" shader_name "${file_name}")
+  string(MAKE_C_IDENTIFIER "${shader_name}" symbol)
+
+  file(READ "${spirv_file}" hex HEX)
+  string(LENGTH "${hex}" hex_length)
+  math(EXPR remainder "${hex_length} % 8")
+  if(hex_length EQUAL 0 OR NOT remainder EQUAL 0)
+    message(FATAL_ERROR "${spirv_file} is not a valid SPIR-V module")
+  endif()
+
+  # SPIR-V words are little endian on disk
+  string(REGEX REPLACE
+    "([0-9a-f][0-9a-f])([0-9a-f][0-9a-f])([0-9a-f][0-9a-f])([0-9a-f][0-9a-f])"
+    "0x\\4\\3\\2\\1u," words "${hex}")
+  string(REGEX REPLACE "(0x[0-9a-f]+u,0x[0-9a-f]+u,0x[0-9a-f]+u,0x[0-9a-f]+u,)"
+    "\\1\n    " words "${words}")
+
+  string(APPEND arrays
+    "alignas(4) constexpr uint32_t ${symbol}[] = {\n    ${words}};\n\n")
+  string(APPEND table
+    "    {\"${shader_name}\", ${symbol}, sizeof(${symbol})},\n")
+endforeach()
+
+set(content "// Generated by cmake/embed_spirv.cmake, do not edit.
+
+#include <embedded_shaders.hh>
+
+namespace {
+${arrays}constexpr utils::embedded_shader embedded_shaders[] = {
+${table}};
+} // namespace
+
+namespace utils {
+const embedded_shader *find_embedded_shader(std::string_view name) {
+  for (const auto &shader : embedded_shaders) {
+    if (name == shader.name)
+      return &shader;
+  }
+  return nullptr;
+}
+} // namespace utils
+")
+
+# Only touch the output when it changes so dependents are not rebuilt
+if(EXISTS "${OUTPUT}")
+  file(READ "${OUTPUT}" previous)
+  if(previous STREQUAL content)
+    return()
+  endif()
+endif()
+file(WRITE "${OUTPUT}" "${content}")
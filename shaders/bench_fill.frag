@@ -0,0 +1,7 @@
+#version 450
+
+layout(location = 0) out vec4 out_color;
+
+void main() {
+    out_color = vec4(0.25, 0.5, 0.75, 0.5);
+}
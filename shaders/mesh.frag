@@ -0,0 +1,54 @@
+#version 450
+#extension GL_EXT_nonuniform_qualifier : require
+
+struct material {
+    vec4 base_color;
+    int base_color_texture; // -1: untextured
+};
+
+layout(set = 0, binding = 0) uniform texture2D textures[];
+layout(set = 0, binding = 1) uniform sampler linear_sampler;
+layout(set = 0, binding = 2) readonly buffer materials_buffer {
+    material materials[];
+} buffers[];
+layout(set = 0, binding = 2) readonly buffer lods_buffer {
+    float min_lods[]; // Per bindless image, negative: nothing resident yet
+} lod_buffers[];
+
+layout(push_constant) uniform constants {
+    mat4 view_proj;
+    uint object_buffer;
+    uint material_buffer;
+    uint texture_lod_buffer;
+} pc;
+
+layout(location = 0) in vec3 frag_normal;
+layout(location = 1) in vec2 frag_uv;
+layout(location = 2) flat in uint frag_material;
+layout(location = 0) out vec4 out_color;
+
+const vec3 light_dir = normalize(vec3(0.4, 1.0, 0.6));
+
+void main() {
+    // The material comes from a varying, the texture index is not provably
+    // uniform
+    material mat = buffers[pc.material_buffer].materials[frag_material];
+    vec4 color = mat.base_color;
+    // Textures stream in coarsest levels first, the finer ones are not
+    // sampled until they are resident
+    float min_lod = mat.base_color_texture >= 0
+        ? lod_buffers[pc.texture_lod_buffer].min_lods[mat.base_color_texture]
+        : -1.0;
+    if (min_lod >= 0.0) {
+        int index = mat.base_color_texture;
+        float lod = max(textureQueryLod(
+            sampler2D(textures[nonuniformEXT(index)], linear_sampler),
+            frag_uv).y, min_lod);
+        color *= textureLod(
+            sampler2D(textures[nonuniformEXT(index)], linear_sampler),
+            frag_uv, lod);
+    }
+
+    float diffuse = max(dot(normalize(frag_normal), light_dir), 0.0);
+    out_color = vec4(color.rgb * (0.15 + 0.85 * diffuse), color.a);
+}
@@ -0,0 +1,39 @@
+#version 450
+#extension GL_EXT_nonuniform_qualifier : require
+
+struct object {
+    mat4 transform;
+    vec4 sphere;
+    uint index_count;
+    uint first_index;
+    int vertex_offset;
+    uint material;
+};
+
+layout(set = 0, binding = 2) readonly buffer objects_buffer {
+    object objects[];
+} object_buffers[];
+
+layout(push_constant) uniform constants {
+    mat4 view_proj;
+    uint object_buffer;
+    uint material_buffer;
+    uint texture_lod_buffer;
+} pc;
+
+layout(location = 0) in vec3 in_position;
+layout(location = 1) in vec3 in_normal;
+layout(location = 2) in vec2 in_uv;
+
+layout(location = 0) out vec3 frag_normal;
+layout(location = 1) out vec2 frag_uv;
+layout(location = 2) flat out uint frag_material;
+
+void main() {
+    // firstInstance is the object index, for direct and indirect draws alike
+    object obj = object_buffers[pc.object_buffer].objects[gl_InstanceIndex];
+    gl_Position = pc.view_proj * obj.transform * vec4(in_position, 1.0);
+    frag_normal = mat3(obj.transform) * in_normal;
+    frag_uv = in_uv;
+    frag_material = obj.material;
+}
@@ -0,0 +1,421 @@
+/**
+ * @file
+ * @author Ruben Pena <rubn.pena@gmail.com>
+ * @brief This file contains the implementation of the glTF 2.0 scene loader
+ */
+
+#include <algorithm>
+#include <cstring>
+#include <gltf_loader.hh>
+#include <iostream>
+#include <limits>
+#include <parallel_for.hh>
+#include <stb_image.h>
+#include <stdexcept>
+#include <tiny_gltf.h>
+#include <utility>
+
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+#include <glm/gtc/quaternion.hpp>
+
+namespace assets {
+/**
+ * @brief Typed window into a buffer view, bounds checked once up front
+ */
+struct accessor_view {
+  const uint8_t *data = nullptr;
+  size_t stride = 0;
+  size_t count = 0;
+  int component_type = 0;
+  bool normalized = false;
+};
+
+/**
+ * @brief Keeps the encoded bytes instead of letting tinygltf decode every
+ * image on the parsing thread. They are decoded later in parallel
+ */
+static bool store_encoded_image(tinygltf::Image *image, const int,
+                                std::string *, std::string *, int, int,
+                                const unsigned char *bytes, int size, void *) {
+  image->image.assign(bytes, bytes + size);
+  image->as_is = true;
+  return true;
+}
+
+static accessor_view get_accessor(const tinygltf::Model &model, int index,
+                                  int type) {
+  if (index < 0 || static_cast<size_t>(index) >= model.accessors.size())
+    throw std::runtime_error("gltf: invalid accessor index");
+
+  const tinygltf::Accessor &accessor = model.accessors[index];
+  if (accessor.type != type)
+    throw std::runtime_error("gltf: unexpected accessor type");
+  if (accessor.sparse.isSparse || accessor.bufferView < 0)
+    throw std::runtime_error("gltf: sparse accessors are not supported");
+
+  const tinygltf::BufferView &buffer_view =
+      model.bufferViews.at(accessor.bufferView);
+  const tinygltf::Buffer &buffer = model.buffers.at(buffer_view.buffer);
+
+  int stride = accessor.ByteStride(buffer_view);
+  if (stride <= 0)
+    throw std::runtime_error("gltf: invalid accessor stride");
+
+  size_t element_size =
+      tinygltf::GetComponentSizeInBytes(accessor.componentType) *
+      tinygltf::GetNumComponentsInType(accessor.type);
+  size_t offset = buffer_view.byteOffset + accessor.byteOffset;
+  size_t end = accessor.count == 0
+                   ? offset
+                   : offset + stride * (accessor.count - 1) + element_size;
+  if (end > buffer_view.byteOffset + buffer_view.byteLength ||
+      end > buffer.data.size())
+    throw std::runtime_error("gltf: accessor out of bounds");
+
+  accessor_view view;
+  view.data = buffer.data.data() + offset;
+  view.stride = static_cast<size_t>(stride);
+  view.count = accessor.count;
+  view.component_type = accessor.componentType;
+  view.normalized = accessor.normalized;
+  return view;
+}
+
+/**
+ * @brief Reads n components of element i as floats, applying the glTF rules
+ * for normalized integers
+ */
+static void read_floats(const accessor_view &view, size_t i, float *out,
+                        int n) {
+  const uint8_t *element = view.data + view.stride * i;
+
+  if (view.component_type == TINYGLTF_COMPONENT_TYPE_FLOAT) {
+    std::memcpy(out, element, sizeof(float) * n);
+    return;
+  } // The common case, no conversion
+
+  for (int c = 0; c < n; c++) {
+    float value = 0.0f;
+    switch (view.component_type) {
+    case TINYGLTF_COMPONENT_TYPE_UNSIGNED_BYTE:
+      value = element[c];
+      value = view.normalized ? value / 255.0f : value;
+      break;
+    case TINYGLTF_COMPONENT_TYPE_BYTE:
+      value = static_cast<int8_t>(element[c]);
+      value = view.normalized ? std::max(value / 127.0f, -1.0f) : value;
+      break;
+    case TINYGLTF_COMPONENT_TYPE_UNSIGNED_SHORT: {
+      uint16_t raw;
+      std::memcpy(&raw, element + c * sizeof(raw), sizeof(raw));
+      value = view.normalized ? raw / 65535.0f : raw;
+      break;
+    }
+    case TINYGLTF_COMPONENT_TYPE_SHORT: {
+      int16_t raw;
+      std::memcpy(&raw, element + c * sizeof(raw), sizeof(raw));
+      value = view.normalized ? std::max(raw / 32767.0f, -1.0f) : raw;
+      break;
+    }
+    default:
+      throw std::runtime_error("gltf: unsupported component type");
+    }
+    out[c] = value;
+  }
+}
+
+static uint32_t read_index(const accessor_view &view, size_t i) {
+  const uint8_t *element = view.data + view.stride * i;
+
+  switch (view.component_type) {
+  case TINYGLTF_COMPONENT_TYPE_UNSIGNED_BYTE:
+    return *element;
+  case TINYGLTF_COMPONENT_TYPE_UNSIGNED_SHORT: {
+    uint16_t index;
+    std::memcpy(&index, element, sizeof(index));
+    return index;
+  }
+  case TINYGLTF_COMPONENT_TYPE_UNSIGNED_INT: {
+    uint32_t index;
+    std::memcpy(&index, element, sizeof(index));
+    return index;
+  }
+  default:
+    throw std::runtime_error("gltf: unsupported index type");
+  }
+}
+
+/**
+ * @brief Converts one primitive into its slot of the shared arrays. Slots do
+ * not overlap, so primitives are converted concurrently without locking
+ */
+static void convert_primitive(const tinygltf::Model &model,
+                              const tinygltf::Primitive &source,
+                              scene_data &scene, primitive &target) {
+  accessor_view positions = get_accessor(
+      model, source.attributes.at("POSITION"), TINYGLTF_TYPE_VEC3);
+
+  auto normal_it = source.attributes.find("NORMAL");
+  auto uv_it = source.attributes.find("TEXCOORD_0");
+  bool has_normals = normal_it != source.attributes.end();
+  bool has_uvs = uv_it != source.attributes.end();
+
+  accessor_view normals;
+  accessor_view uvs;
+  if (has_normals) {
+    normals = get_accessor(model, normal_it->second, TINYGLTF_TYPE_VEC3);
+  }
+  if (has_uvs) {
+    uvs = get_accessor(model, uv_it->second, TINYGLTF_TYPE_VEC2);
+  }
+  if ((has_normals && normals.count < positions.count) ||
+      (has_uvs && uvs.count < positions.count))
+    throw std::runtime_error("gltf: attribute counts do not match");
+
+  vertex *vertices = scene.vertices.data() + target.first_vertex;
+
+  for (uint32_t i = 0; i < target.vertex_count; i++) {
+    vertex &v = vertices[i];
+    read_floats(positions, i, &v.position[0], 3);
+    v.normal = glm::vec3(0.0f);
+    v.uv = glm::vec2(0.0f);
+    if (has_normals) {
+      read_floats(normals, i, &v.normal[0], 3);
+    }
+    if (has_uvs) {
+      read_floats(uvs, i, &v.uv[0], 2);
+    }
+  }
+  compute_bounds(scene, target);
+
+  uint32_t *indices = scene.indices.data() + target.first_index;
+  if (source.indices >= 0) {
+    accessor_view index_view =
+        get_accessor(model, source.indices, TINYGLTF_TYPE_SCALAR);
+    for (uint32_t i = 0; i < target.index_count; i++) {
+      indices[i] = read_index(index_view, i);
+      if (indices[i] >= target.vertex_count)
+        throw std::runtime_error("gltf: index out of range");
+    }
+  } else {
+    for (uint32_t i = 0; i < target.index_count; i++) {
+      indices[i] = i;
+    }
+  } // Non indexed primitives draw their vertices in order
+
+  if (!has_normals) {
+    compute_normals(vertices, target.vertex_count, indices,
+                    target.index_count);
+  }
+}
+
+static void decode_image(tinygltf::Image &source, image_data &target) {
+  target.name = source.name.empty() ? source.uri : source.name;
+
+  if (!assets::decode_image(source.image.data(), source.image.size(),
+                            target)) {
+    throw std::runtime_error("gltf: failed to decode image " + target.name +
+                             ": " + stbi_failure_reason());
+  }
+
+  std::vector<unsigned char>().swap(source.image); // Encoded bytes not needed
+}
+
+static glm::mat4 get_local_transform(const tinygltf::Node &node) {
+  glm::mat4 transform(1.0f);
+
+  if (node.matrix.size() == 16) {
+    for (int column = 0; column < 4; column++) {
+      for (int row = 0; row < 4; row++) {
+        transform[column][row] =
+            static_cast<float>(node.matrix[column * 4 + row]);
+      }
+    } // Column major, like glm
+    return transform;
+  }
+
+  if (node.translation.size() == 3) {
+    transform = glm::translate(
+        transform, glm::vec3(static_cast<float>(node.translation[0]),
+                             static_cast<float>(node.translation[1]),
+                             static_cast<float>(node.translation[2])));
+  }
+  if (node.rotation.size() == 4) {
+    glm::quat rotation(static_cast<float>(node.rotation[3]),
+                       static_cast<float>(node.rotation[0]),
+                       static_cast<float>(node.rotation[1]),
+                       static_cast<float>(node.rotation[2])); // w, x, y, z
+    transform = transform * glm::mat4_cast(rotation);
+  }
+  if (node.scale.size() == 3) {
+    transform =
+        glm::scale(transform, glm::vec3(static_cast<float>(node.scale[0]),
+                                        static_cast<float>(node.scale[1]),
+                                        static_cast<float>(node.scale[2])));
+  }
+  return transform;
+}
+
+/**
+ * @brief Walks the node hierarchy of the default scene, emitting an instance
+ * for every node with a mesh. Without scenes every root node is walked
+ */
+static void collect_instances(const tinygltf::Model &model,
+                              const std::vector<int> &mesh_map,
+                              scene_data &scene) {
+  std::vector<int> roots;
+  if (!model.scenes.empty()) {
+    int scene_index = model.defaultScene >= 0 ? model.defaultScene : 0;
+    roots = model.scenes.at(scene_index).nodes;
+  } else {
+    std::vector<bool> is_child(model.nodes.size(), false);
+    for (const auto &node : model.nodes) {
+      for (int child : node.children) {
+        is_child.at(child) = true;
+      }
+    }
+    for (size_t i = 0; i < model.nodes.size(); i++) {
+      if (!is_child[i])
+        roots.push_back(static_cast<int>(i));
+    }
+  }
+
+  std::vector<std::pair<int, glm::mat4>> stack;
+  for (int root : roots) {
+    stack.emplace_back(root, glm::mat4(1.0f));
+  }
+
+  size_t visited = 0;
+  while (!stack.empty()) {
+    if (++visited > model.nodes.size())
+      throw std::runtime_error("gltf: node hierarchy is not a tree");
+
+    auto [node_index, parent] = stack.back();
+    stack.pop_back();
+
+    const tinygltf::Node &node = model.nodes.at(node_index);
+    glm::mat4 transform = parent * get_local_transform(node);
+
+    if (node.mesh >= 0 && mesh_map.at(node.mesh) >= 0) {
+      mesh_instance instance;
+      instance.mesh = static_cast<uint32_t>(mesh_map[node.mesh]);
+      instance.transform = transform;
+      scene.instances.push_back(instance);
+    } // Meshes without triangles were skipped
+
+    for (int child : node.children) {
+      stack.emplace_back(child, transform);
+    }
+  }
+}
+
+scene_data load_gltf(const std::string &path, uint32_t thread_count) {
+  tinygltf::Model model;
+  tinygltf::TinyGLTF loader;
+  loader.SetImageLoader(store_encoded_image, nullptr);
+
+  std::string error;
+  std::string warning;
+  bool binary =
+      path.size() >= 4 && path.compare(path.size() - 4, 4, ".glb") == 0;
+  bool loaded =
+      binary ? loader.LoadBinaryFromFile(&model, &error, &warning, path)
+             : loader.LoadASCIIFromFile(&model, &error, &warning, path);
+  if (!warning.empty()) {
+    std::cerr << "gltf: " << warning << std::endl;
+  }
+  if (!loaded) {
+    throw std::runtime_error("gltf: failed to load " + path + ": " + error);
+  }
+
+  scene_data scene;
+  std::vector<const tinygltf::Primitive *> sources;
+  std::vector<int> mesh_map(model.meshes.size(), -1); // glTF mesh -> ours
+  uint64_t vertex_count = 0;
+  uint64_t index_count = 0;
+
+  for (size_t m = 0; m < model.meshes.size(); m++) {
+    mesh target;
+    target.name = model.meshes[m].name;
+    target.first_primitive = static_cast<uint32_t>(scene.primitives.size());
+
+    for (const auto &source : model.meshes[m].primitives) {
+      bool triangles =
+          source.mode == TINYGLTF_MODE_TRIANGLES || source.mode == -1;
+      auto position = source.attributes.find("POSITION");
+      if (!triangles || position == source.attributes.end())
+        continue;
+
+      primitive range;
+      range.vertex_count = static_cast<uint32_t>(
+          get_accessor(model, position->second, TINYGLTF_TYPE_VEC3).count);
+      range.index_count =
+          source.indices >= 0
+              ? static_cast<uint32_t>(
+                    get_accessor(model, source.indices, TINYGLTF_TYPE_SCALAR)
+                        .count)
+              : range.vertex_count;
+      range.first_vertex = static_cast<uint32_t>(vertex_count);
+      range.first_index = static_cast<uint32_t>(index_count);
+      range.material = source.material;
+      if (range.material >= static_cast<int>(model.materials.size()))
+        throw std::runtime_error("gltf: material out of range");
+
+      vertex_count += range.vertex_count;
+      index_count += range.index_count;
+      if (vertex_count > std::numeric_limits<uint32_t>::max() ||
+          index_count > std::numeric_limits<uint32_t>::max())
+        throw std::runtime_error("gltf: scene too big for 32 bit indices");
+
+      scene.primitives.push_back(range);
+      sources.push_back(&source);
+    } // Offsets are known up front, the conversion writes straight in place
+
+    target.primitive_count =
+        static_cast<uint32_t>(scene.primitives.size()) - target.first_primitive;
+    if (target.primitive_count > 0) {
+      mesh_map[m] = static_cast<int>(scene.meshes.size());
+      scene.meshes.push_back(target);
+    }
+  }
+
+  scene.vertices.resize(vertex_count);
+  scene.indices.resize(index_count);
+  scene.images.resize(model.images.size());
+
+  size_t primitive_tasks = sources.size();
+  utils::parallel_for(
+      primitive_tasks + model.images.size(),
+      [&](size_t task) {
+        if (task < primitive_tasks) {
+          convert_primitive(model, *sources[task], scene,
+                            scene.primitives[task]);
+        } else {
+          size_t image = task - primitive_tasks;
+          decode_image(model.images[image], scene.images[image]);
+        }
+      },
+      thread_count);
+
+  for (const auto &source : model.materials) {
+    material target;
+    const auto &pbr = source.pbrMetallicRoughness;
+    if (pbr.baseColorFactor.size() == 4) {
+      target.base_color = glm::vec4(static_cast<float>(pbr.baseColorFactor[0]),
+                                    static_cast<float>(pbr.baseColorFactor[1]),
+                                    static_cast<float>(pbr.baseColorFactor[2]),
+                                    static_cast<float>(pbr.baseColorFactor[3]));
+    }
+    int texture = pbr.baseColorTexture.index;
+    if (texture >= 0 && static_cast<size_t>(texture) < model.textures.size()) {
+      target.base_color_image = model.textures[texture].source;
+    }
+    scene.materials.push_back(target);
+  }
+
+  collect_instances(model, mesh_map, scene);
+  compute_bounds(scene);
+  return scene;
+}
+} // namespace assets
@@ -0,0 +1,21 @@
+/**
+ * @file
+ * @author Ruben Pena <rubn.pena@gmail.com>
+ * @brief This file contains the glTF 2.0 scene loader.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <scene.hh>
+#include <string>
+
+namespace assets {
+/**
+ * @brief Loads a .gltf or .glb file. The JSON is parsed on the calling thread,
+ * then the primitives are converted into the shared vertex and index arrays
+ * and the images are decoded in parallel on thread_count threads of the job
+ * system (0: all of them). Only triangle lists are imported
+ */
+scene_data load_gltf(const std::string &path, uint32_t thread_count = 0);
+} // namespace assets
@@ -0,0 +1,205 @@
+/**
+ * @file
+ * @author Ruben Pena <rubn.pena@gmail.com>
+ * @brief This file contains the implementation of the mesh reordering passes
+ */
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <mesh_optimizer.hh>
+#include <vector>
+
+namespace assets {
+static constexpr uint32_t CACHE_SIZE = 32; // Modeled cache, not the hardware's
+static constexpr uint32_t MAX_VALENCE = 32; // Tabulated valence scores
+
+/**
+ * @brief Score tables of the Forsyth heuristic. The three vertices of the last
+ * triangle get a fixed score so the next triangle does not just reuse its
+ * edge, older entries decay with their position
+ */
+struct vertex_score_table {
+  float cache[CACHE_SIZE];
+  float valence[MAX_VALENCE];
+
+  vertex_score_table() {
+    for (uint32_t i = 0; i < CACHE_SIZE; i++) {
+      if (i < 3) {
+        cache[i] = 0.75f;
+      } else {
+        float scale = 1.0f / (CACHE_SIZE - 3);
+        cache[i] = std::pow(1.0f - (i - 3) * scale, 1.5f);
+      }
+    }
+    for (uint32_t i = 0; i < MAX_VALENCE; i++) {
+      valence[i] = 2.0f / std::sqrt(static_cast<float>(i + 1));
+    } // Boosts vertices with few triangles left, so they are not stranded
+  }
+
+  float score(int32_t cache_position, uint32_t live_triangles) const {
+    if (live_triangles == 0)
+      return -1.0f; // No triangle left to emit
+
+    float result = cache_position >= 0 ? cache[cache_position] : 0.0f;
+    result += live_triangles <= MAX_VALENCE
+                  ? valence[live_triangles - 1]
+                  : 2.0f / std::sqrt(static_cast<float>(live_triangles));
+    return result;
+  }
+};
+
+void optimize_vertex_cache(uint32_t *indices, uint32_t index_count,
+                           uint32_t vertex_count) {
+  static const vertex_score_table table;
+
+  uint32_t triangle_count = index_count / 3;
+  if (triangle_count == 0)
+    return;
+
+  std::vector<uint32_t> live(vertex_count, 0);
+  for (uint32_t i = 0; i < triangle_count * 3; i++) {
+    live[indices[i]]++;
+  }
+
+  std::vector<uint32_t> offsets(vertex_count + 1, 0);
+  for (uint32_t v = 0; v < vertex_count; v++) {
+    offsets[v + 1] = offsets[v] + live[v];
+  }
+  std::vector<uint32_t> adjacency(triangle_count * 3);
+  std::vector<uint32_t> fill(offsets.begin(), offsets.end() - 1);
+  for (uint32_t i = 0; i < triangle_count * 3; i++) {
+    adjacency[fill[indices[i]]++] = i / 3;
+  } // Triangles of vertex v: the first live[v] at adjacency[offsets[v]]
+
+  std::vector<int32_t> cache_position(vertex_count, -1);
+  std::vector<float> vertex_scores(vertex_count);
+  for (uint32_t v = 0; v < vertex_count; v++) {
+    vertex_scores[v] = table.score(-1, live[v]);
+  }
+
+  std::vector<float> triangle_scores(triangle_count);
+  std::vector<bool> emitted(triangle_count, false);
+  int64_t best = -1;
+  float best_score = std::numeric_limits<float>::lowest();
+  for (uint32_t t = 0; t < triangle_count; t++) {
+    triangle_scores[t] = vertex_scores[indices[t * 3]] +
+                         vertex_scores[indices[t * 3 + 1]] +
+                         vertex_scores[indices[t * 3 + 2]];
+    if (triangle_scores[t] > best_score) {
+      best_score = triangle_scores[t];
+      best = t;
+    }
+  }
+
+  std::vector<uint32_t> output(triangle_count * 3);
+  uint32_t cache[CACHE_SIZE + 3];
+  uint32_t cache_count = 0;
+  uint32_t scan = 0; // Restart point when the cache has nothing left to emit
+
+  for (uint32_t out = 0; out < triangle_count; out++) {
+    if (best < 0) {
+      while (emitted[scan]) {
+        scan++;
+      }
+      best = scan;
+    }
+
+    uint32_t triangle = static_cast<uint32_t>(best);
+    const uint32_t *corners = indices + triangle * 3;
+    emitted[triangle] = true;
+    std::copy(corners, corners + 3, output.data() + out * 3);
+
+    for (int k = 0; k < 3; k++) {
+      uint32_t v = corners[k];
+      uint32_t *begin = adjacency.data() + offsets[v];
+      uint32_t *end = begin + live[v];
+      uint32_t *it = std::find(begin, end, triangle);
+      *it = *(end - 1);
+      live[v]--;
+    } // Swap remove, live triangles stay packed at the front
+
+    uint32_t next[CACHE_SIZE + 3];
+    uint32_t next_count = 0;
+    for (int k = 0; k < 3; k++) {
+      if (std::find(next, next + next_count, corners[k]) == next + next_count)
+        next[next_count++] = corners[k];
+    } // Degenerate triangles repeat vertices
+    for (uint32_t i = 0; i < cache_count; i++) {
+      if (std::find(corners, corners + 3, cache[i]) == corners + 3)
+        next[next_count++] = cache[i];
+    }
+
+    for (uint32_t i = 0; i < next_count; i++) {
+      uint32_t v = next[i];
+      cache_position[v] = i < CACHE_SIZE ? static_cast<int32_t>(i) : -1;
+
+      float score = table.score(cache_position[v], live[v]);
+      float delta = score - vertex_scores[v];
+      vertex_scores[v] = score;
+      for (uint32_t a = 0; a < live[v]; a++) {
+        triangle_scores[adjacency[offsets[v] + a]] += delta;
+      }
+    } // Only vertices that entered, moved or left the cache changed score
+
+    best = -1;
+    best_score = std::numeric_limits<float>::lowest();
+    cache_count = std::min(next_count, CACHE_SIZE);
+    for (uint32_t i = 0; i < cache_count; i++) {
+      uint32_t v = next[i];
+      cache[i] = v;
+      for (uint32_t a = 0; a < live[v]; a++) {
+        uint32_t t = adjacency[offsets[v] + a];
+        if (triangle_scores[t] > best_score) {
+          best_score = triangle_scores[t];
+          best = t;
+        }
+      }
+    } // The best candidate almost always shares a vertex with the cache
+  }
+
+  std::copy(output.begin(), output.end(), indices);
+}
+
+uint32_t optimize_vertex_fetch(vertex *vertices, uint32_t vertex_count,
+                               uint32_t *indices, uint32_t index_count) {
+  constexpr uint32_t unused = std::numeric_limits<uint32_t>::max();
+  std::vector<uint32_t> remap(vertex_count, unused);
+  std::vector<vertex> reordered;
+  reordered.reserve(vertex_count);
+
+  for (uint32_t i = 0; i < index_count; i++) {
+    uint32_t &index = indices[i];
+    if (remap[index] == unused) {
+      remap[index] = static_cast<uint32_t>(reordered.size());
+      reordered.push_back(vertices[index]);
+    }
+    index = remap[index];
+  }
+
+  std::copy(reordered.begin(), reordered.end(), vertices);
+  return static_cast<uint32_t>(reordered.size());
+}
+
+float compute_acmr(const uint32_t *indices, uint32_t index_count,
+                   uint32_t cache_size) {
+  uint32_t triangle_count = index_count / 3;
+  if (triangle_count == 0)
+    return 0.0f;
+
+  uint32_t vertex_count = *std::max_element(indices, indices + index_count) + 1;
+  std::vector<uint32_t> timestamps(vertex_count, 0);
+  uint32_t time = cache_size + 1; // Every vertex starts out of the cache
+  uint32_t misses = 0;
+
+  for (uint32_t i = 0; i < triangle_count * 3; i++) {
+    uint32_t &timestamp = timestamps[indices[i]];
+    if (time - timestamp > cache_size) {
+      timestamp = time++;
+      misses++;
+    }
+  } // A FIFO entry is evicted after cache_size newer misses
+
+  return static_cast<float>(misses) / triangle_count;
+}
+} // namespace assets
@@ -0,0 +1,39 @@
+/**
+ * @file
+ * @author Ruben Pena <rubn.pena@gmail.com>
+ * @brief This file contains the index and vertex reordering passes run on
+ * imported meshes.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <scene.hh>
+
+namespace assets {
+/**
+ * @brief Reorders the triangles of an indexed triangle list so vertices are
+ * reused while they are still in the post-transform cache. Uses Tom Forsyth's
+ * linear-speed algorithm: greedily emits the triangle whose vertices score
+ * highest, favoring recently used vertices and vertices with few triangles
+ * left
+ */
+void optimize_vertex_cache(uint32_t *indices, uint32_t index_count,
+                           uint32_t vertex_count);
+
+/**
+ * @brief Reorders vertices in the order the indices first reference them and
+ * remaps the indices, so the vertex fetch reads memory mostly sequentially.
+ * Unreferenced vertices are dropped, returns the new vertex count
+ */
+uint32_t optimize_vertex_fetch(vertex *vertices, uint32_t vertex_count,
+                               uint32_t *indices, uint32_t index_count);
+
+/**
+ * @brief Average cache miss ratio, transformed vertices per triangle, of a
+ * FIFO post-transform cache of cache_size entries. 3 is the worst, 0.5 the
+ * usual best for a regular grid
+ */
+float compute_acmr(const uint32_t *indices, uint32_t index_count,
+                   uint32_t cache_size);
+} // namespace assets
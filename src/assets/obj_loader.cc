@@ -0,0 +1,311 @@
+/**
+ * @file
+ * @author Ruben Pena <rubn.pena@gmail.com>
+ * @brief This file contains the implementation of the Wavefront OBJ loader
+ */
+
+#include <algorithm>
+#include <iostream>
+#include <limits>
+#include <map>
+#include <mapped_file.hh>
+#include <mesh_optimizer.hh>
+#include <obj_loader.hh>
+#include <parallel_for.hh>
+#include <stdexcept>
+#include <tiny_obj_loader.h>
+#include <unordered_map>
+
+namespace assets {
+/**
+ * @brief Open addressing map from an OBJ corner (position, normal and uv
+ * indices) to the vertex created for it. Sized once for the worst case of
+ * every corner being unique, so it never rehashes, and probes linearly
+ */
+class vertex_map {
+  struct slot {
+    tinyobj::index_t key;
+    uint32_t value;
+  };
+
+  static constexpr uint32_t M_EMPTY = std::numeric_limits<uint32_t>::max();
+
+  std::vector<slot> m_slots;
+  size_t m_mask = 0;
+
+  static uint32_t hash(const tinyobj::index_t &key) {
+    uint32_t h = static_cast<uint32_t>(key.vertex_index) * 0x9e3779b1u;
+    h ^= static_cast<uint32_t>(key.normal_index) * 0x85ebca6bu;
+    h ^= static_cast<uint32_t>(key.texcoord_index) * 0xc2b2ae35u;
+    return h ^ (h >> 15);
+  }
+
+public:
+  explicit vertex_map(size_t count) {
+    size_t capacity = 16;
+    while (capacity < count * 2) {
+      capacity <<= 1;
+    } // Load factor of at most one half keeps the probes short
+    m_slots.resize(capacity, slot{{0, 0, 0}, M_EMPTY});
+    m_mask = capacity - 1;
+  }
+
+  /**
+   * @brief Returns the vertex of key, inserting value if there is none
+   */
+  uint32_t find_or_insert(const tinyobj::index_t &key, uint32_t value) {
+    for (size_t i = hash(key) & m_mask;; i = (i + 1) & m_mask) {
+      slot &entry = m_slots[i];
+      if (entry.value == M_EMPTY) {
+        entry.key = key;
+        entry.value = value;
+        return value;
+      }
+      if (entry.key.vertex_index == key.vertex_index &&
+          entry.key.normal_index == key.normal_index &&
+          entry.key.texcoord_index == key.texcoord_index)
+        return entry.value;
+    }
+  }
+};
+
+/**
+ * @brief Triangles of one shape drawn with one material, as offsets into the
+ * shape's corner indices
+ */
+struct face_group {
+  uint32_t shape = 0;
+  int32_t material = -1;
+  std::vector<uint32_t> corners;
+  std::vector<vertex> vertices; // Filled by build_group
+  std::vector<uint32_t> indices;
+};
+
+static void group_faces(const std::vector<tinyobj::shape_t> &shapes,
+                        std::vector<face_group> &groups,
+                        scene_data &scene) {
+  for (uint32_t s = 0; s < shapes.size(); s++) {
+    const tinyobj::mesh_t &source = shapes[s].mesh;
+    std::map<int, size_t> by_material; // Keeps the primitives sorted
+    size_t first_group = groups.size();
+    uint32_t corner = 0;
+
+    for (size_t f = 0; f < source.num_face_vertices.size(); f++) {
+      uint32_t face_size = source.num_face_vertices[f];
+      int material = f < source.material_ids.size() ? source.material_ids[f]
+                                                    : -1;
+
+      auto [it, inserted] = by_material.try_emplace(material, groups.size());
+      if (inserted) {
+        face_group group;
+        group.shape = s;
+        group.material = material;
+        groups.push_back(std::move(group));
+      }
+
+      std::vector<uint32_t> &corners = groups[it->second].corners;
+      for (uint32_t k = 2; k < face_size; k++) {
+        corners.push_back(corner);
+        corners.push_back(corner + k - 1);
+        corners.push_back(corner + k);
+      } // Faces are already triangulated, this only matters if that failed
+      corner += face_size;
+    }
+
+    if (groups.size() > first_group) {
+      mesh target;
+      target.name = shapes[s].name;
+      target.primitive_count =
+          static_cast<uint32_t>(groups.size() - first_group);
+      scene.meshes.push_back(target);
+    }
+  }
+}
+
+/**
+ * @brief Deduplicates the corners of a group into vertices and optimizes the
+ * resulting indexed triangle list. Groups are independent, so they are built
+ * concurrently
+ */
+static void build_group(const tinyobj::attrib_t &attrib,
+                        const tinyobj::mesh_t &source, face_group &group) {
+  size_t position_count = attrib.vertices.size() / 3;
+  size_t normal_count = attrib.normals.size() / 3;
+  size_t uv_count = attrib.texcoords.size() / 2;
+
+  vertex_map map(group.corners.size());
+  bool has_normals = true;
+  group.indices.reserve(group.corners.size());
+
+  for (uint32_t corner : group.corners) {
+    const tinyobj::index_t &key = source.indices.at(corner);
+    uint32_t next = static_cast<uint32_t>(group.vertices.size());
+    uint32_t index = map.find_or_insert(key, next);
+    group.indices.push_back(index);
+    if (index != next)
+      continue;
+
+    if (key.vertex_index < 0 ||
+        static_cast<size_t>(key.vertex_index) >= position_count ||
+        static_cast<size_t>(key.normal_index + 1) > normal_count ||
+        static_cast<size_t>(key.texcoord_index + 1) > uv_count)
+      throw std::runtime_error("obj: index out of range");
+
+    vertex v;
+    const float *position = &attrib.vertices[key.vertex_index * 3];
+    v.position = glm::vec3(position[0], position[1], position[2]);
+    v.normal = glm::vec3(0.0f);
+    v.uv = glm::vec2(0.0f);
+    if (key.normal_index >= 0) {
+      const float *normal = &attrib.normals[key.normal_index * 3];
+      v.normal = glm::vec3(normal[0], normal[1], normal[2]);
+    } else {
+      has_normals = false;
+    }
+    if (key.texcoord_index >= 0) {
+      const float *uv = &attrib.texcoords[key.texcoord_index * 2];
+      v.uv = glm::vec2(uv[0], 1.0f - uv[1]); // OBJ has v pointing up
+    }
+    group.vertices.push_back(v);
+  }
+  std::vector<uint32_t>().swap(group.corners);
+
+  uint32_t vertex_count = static_cast<uint32_t>(group.vertices.size());
+  uint32_t index_count = static_cast<uint32_t>(group.indices.size());
+  if (!has_normals) {
+    for (auto &v : group.vertices) {
+      v.normal = glm::vec3(0.0f);
+    }
+    compute_normals(group.vertices.data(), vertex_count, group.indices.data(),
+                    index_count);
+  } // Partially missing normals are recomputed for the whole group
+
+  optimize_vertex_cache(group.indices.data(), index_count, vertex_count);
+  vertex_count = optimize_vertex_fetch(group.vertices.data(), vertex_count,
+                                       group.indices.data(), index_count);
+  group.vertices.resize(vertex_count);
+}
+
+static void decode_image(const std::string &path, image_data &target) {
+  utils::mapped_file file;
+  try {
+    file = utils::mapped_file(path);
+  } catch (const std::exception &) {
+    return; // Missing textures are common in OBJ exports, they are skipped
+  }
+  const uint8_t *data = reinterpret_cast<const uint8_t *>(file.data());
+  if (!assets::decode_image(data, file.size(), target)) {
+    target.rgba.clear(); // Reported as missing once loading is done
+  }
+}
+
+scene_data load_obj(const std::string &path, uint32_t thread_count) {
+  tinyobj::ObjReaderConfig config;
+  config.triangulate = true;
+  config.vertex_color = false;
+
+  tinyobj::ObjReader reader;
+  bool loaded = reader.ParseFromFile(path, config);
+  if (!reader.Warning().empty()) {
+    std::cerr << "obj: " << reader.Warning() << std::endl;
+  }
+  if (!loaded || !reader.Valid()) {
+    throw std::runtime_error("obj: failed to load " + path + ": " +
+                             reader.Error());
+  }
+
+  const tinyobj::attrib_t &attrib = reader.GetAttrib();
+  const std::vector<tinyobj::shape_t> &shapes = reader.GetShapes();
+
+  scene_data scene;
+  std::vector<face_group> groups;
+  group_faces(shapes, groups, scene);
+
+  std::string directory = path.substr(0, path.find_last_of("/\\") + 1);
+  std::unordered_map<std::string, int32_t> image_map;
+  for (const auto &source : reader.GetMaterials()) {
+    material target;
+    target.base_color = glm::vec4(source.diffuse[0], source.diffuse[1],
+                                  source.diffuse[2], 1.0f);
+    if (!source.diffuse_texname.empty()) {
+      auto [it, inserted] = image_map.try_emplace(
+          source.diffuse_texname, static_cast<int32_t>(scene.images.size()));
+      if (inserted) {
+        image_data image;
+        image.name = source.diffuse_texname;
+        scene.images.push_back(std::move(image));
+      }
+      target.base_color_image = it->second;
+    }
+    scene.materials.push_back(target);
+  }
+
+  size_t group_tasks = groups.size();
+  utils::parallel_for(
+      group_tasks + scene.images.size(),
+      [&](size_t task) {
+        if (task < group_tasks) {
+          build_group(attrib, shapes[groups[task].shape].mesh, groups[task]);
+        } else {
+          image_data &image = scene.images[task - group_tasks];
+          decode_image(directory + image.name, image);
+        }
+      },
+      thread_count);
+
+  uint64_t vertex_count = 0;
+  uint64_t index_count = 0;
+  for (const auto &group : groups) {
+    primitive range;
+    range.first_vertex = static_cast<uint32_t>(vertex_count);
+    range.first_index = static_cast<uint32_t>(index_count);
+    range.vertex_count = static_cast<uint32_t>(group.vertices.size());
+    range.index_count = static_cast<uint32_t>(group.indices.size());
+    range.material = group.material;
+
+    vertex_count += range.vertex_count;
+    index_count += range.index_count;
+    if (vertex_count > std::numeric_limits<uint32_t>::max() ||
+        index_count > std::numeric_limits<uint32_t>::max())
+      throw std::runtime_error("obj: scene too big for 32 bit indices");
+
+    scene.primitives.push_back(range);
+  } // Groups are in mesh order, so each mesh's primitives are contiguous
+
+  uint32_t first_primitive = 0;
+  for (uint32_t m = 0; m < scene.meshes.size(); m++) {
+    scene.meshes[m].first_primitive = first_primitive;
+    first_primitive += scene.meshes[m].primitive_count;
+
+    mesh_instance instance;
+    instance.mesh = m;
+    scene.instances.push_back(instance);
+  } // OBJ has no hierarchy, every mesh is placed once as is
+
+  scene.vertices.resize(vertex_count);
+  scene.indices.resize(index_count);
+  utils::parallel_for(
+      groups.size(),
+      [&](size_t g) {
+        primitive &range = scene.primitives[g];
+        std::copy(groups[g].vertices.begin(), groups[g].vertices.end(),
+                  scene.vertices.begin() + range.first_vertex);
+        std::copy(groups[g].indices.begin(), groups[g].indices.end(),
+                  scene.indices.begin() + range.first_index);
+        compute_bounds(scene, range);
+      },
+      thread_count);
+
+  for (auto &target : scene.materials) {
+    if (target.base_color_image >= 0 &&
+        scene.images[target.base_color_image].rgba.empty()) {
+      std::cerr << "obj: failed to load texture "
+                << scene.images[target.base_color_image].name << std::endl;
+      target.base_color_image = -1;
+    }
+  } // The empty images stay, so the indices of the others do not move
+
+  compute_bounds(scene);
+  return scene;
+}
+} // namespace assets
@@ -0,0 +1,23 @@
+/**
+ * @file
+ * @author Ruben Pena <rubn.pena@gmail.com>
+ * @brief This file contains the Wavefront OBJ scene loader.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <scene.hh>
+#include <string>
+
+namespace assets {
+/**
+ * @brief Loads a .obj file and its .mtl materials. Every shape becomes a mesh
+ * with one primitive per material. OBJ indexes positions, normals and uvs
+ * separately, so the corners are deduplicated into shared vertices, then the
+ * triangles are reordered for the post-transform cache and the vertices for
+ * fetch locality. Primitives and textures are processed in parallel on
+ * thread_count threads of the job system (0: all of them)
+ */
+scene_data load_obj(const std::string &path, uint32_t thread_count = 0);
+} // namespace assets
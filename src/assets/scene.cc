@@ -0,0 +1,201 @@
+/**
+ * @file
+ * @author Ruben Pena <rubn.pena@gmail.com>
+ * @brief This file contains the helpers shared by the scene loaders
+ */
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstring>
+#include <gltf_loader.hh>
+#include <limits>
+#include <obj_loader.hh>
+#include <scene.hh>
+#include <scene_archive.hh>
+#include <stb_image.h>
+
+#include <glm/glm.hpp>
+
+namespace assets {
+static bool has_extension(const std::string &path, const char *extension) {
+  size_t length = std::strlen(extension);
+  return path.size() >= length &&
+         path.compare(path.size() - length, length, extension) == 0;
+}
+
+scene_data load_scene(const std::string &path, uint32_t thread_count) {
+  if (has_extension(path, ".rta"))
+    return load_archive(path, thread_count);
+  if (has_extension(path, ".obj"))
+    return load_obj(path, thread_count);
+  return load_gltf(path, thread_count);
+}
+
+bool decode_image(const uint8_t *data, size_t size, image_data &target) {
+  int length = static_cast<int>(size);
+  int width = 0;
+  int height = 0;
+  int components = 0;
+  void *texels = nullptr;
+  if (stbi_is_hdr_from_memory(data, length)) {
+    texels = stbi_loadf_from_memory(data, length, &width, &height,
+                                    &components, 4);
+    target.format = pixel_format::rgba32_float;
+  } else {
+    texels = stbi_load_from_memory(data, length, &width, &height,
+                                   &components, 4);
+    target.format = pixel_format::rgba8_srgb;
+  }
+  if (texels == nullptr)
+    return false;
+
+  target.width = static_cast<uint32_t>(width);
+  target.height = static_cast<uint32_t>(height);
+  size_t bytes = static_cast<size_t>(width) * height *
+                 get_texel_size(target.format);
+  target.rgba.resize(bytes);
+  std::memcpy(target.rgba.data(), texels, bytes);
+  stbi_image_free(texels);
+  return true;
+}
+
+uint32_t get_texel_size(pixel_format format) {
+  return format == pixel_format::rgba32_float ? 4 * sizeof(float) : 4;
+}
+
+static float srgb_to_linear(uint8_t value) {
+  float c = value / 255.0f;
+  return c <= 0.04045f ? c / 12.92f : std::pow((c + 0.055f) / 1.055f, 2.4f);
+}
+
+static uint8_t linear_to_srgb(float value) {
+  float c = value <= 0.0031308f ? value * 12.92f
+                                : 1.055f * std::pow(value, 1.0f / 2.4f) -
+                                      0.055f;
+  return static_cast<uint8_t>(std::clamp(c, 0.0f, 1.0f) * 255.0f + 0.5f);
+}
+
+/**
+ * @brief Odd sizes clamp the 2x2 footprint to the last row and column
+ */
+image_data downsample(const image_data &image) {
+  image_data target;
+  target.name = image.name;
+  target.format = image.format;
+  target.width = std::max(image.width / 2, 1u);
+  target.height = std::max(image.height / 2, 1u);
+  target.rgba.resize(static_cast<size_t>(target.width) * target.height *
+                     get_texel_size(image.format));
+
+  static const auto to_linear = []() {
+    std::array<float, 256> table;
+    for (int i = 0; i < 256; i++) {
+      table[i] = srgb_to_linear(static_cast<uint8_t>(i));
+    }
+    return table;
+  }();
+
+  for (uint32_t y = 0; y < target.height; y++) {
+    uint32_t rows[2] = {std::min(y * 2, image.height - 1),
+                        std::min(y * 2 + 1, image.height - 1)};
+    for (uint32_t x = 0; x < target.width; x++) {
+      uint32_t columns[2] = {std::min(x * 2, image.width - 1),
+                             std::min(x * 2 + 1, image.width - 1)};
+      size_t out = static_cast<size_t>(y) * target.width + x;
+
+      float sum[4] = {0.0f, 0.0f, 0.0f, 0.0f};
+      for (uint32_t row : rows) {
+        for (uint32_t column : columns) {
+          size_t in = static_cast<size_t>(row) * image.width + column;
+          for (int c = 0; c < 4; c++) {
+            if (image.format == pixel_format::rgba32_float) {
+              float value;
+              std::memcpy(&value, &image.rgba[(in * 4 + c) * sizeof(float)],
+                          sizeof(float));
+              sum[c] += value;
+            } else {
+              uint8_t value = image.rgba[in * 4 + c];
+              sum[c] += c == 3 ? value / 255.0f : to_linear[value];
+            }
+          }
+        }
+      }
+
+      for (int c = 0; c < 4; c++) {
+        float average = sum[c] * 0.25f;
+        if (image.format == pixel_format::rgba32_float) {
+          std::memcpy(&target.rgba[(out * 4 + c) * sizeof(float)], &average,
+                      sizeof(float));
+        } else {
+          target.rgba[out * 4 + c] =
+              c == 3 ? static_cast<uint8_t>(average * 255.0f + 0.5f)
+                     : linear_to_srgb(average);
+        }
+      }
+    }
+  }
+  return target;
+}
+
+void compute_normals(vertex *vertices, uint32_t vertex_count,
+                     const uint32_t *indices, uint32_t index_count) {
+  for (uint32_t i = 0; i + 2 < index_count; i += 3) {
+    vertex &a = vertices[indices[i]];
+    vertex &b = vertices[indices[i + 1]];
+    vertex &c = vertices[indices[i + 2]];
+    glm::vec3 normal =
+        glm::cross(b.position - a.position, c.position - a.position);
+    a.normal += normal;
+    b.normal += normal;
+    c.normal += normal;
+  } // The cross product length is twice the area, bigger faces weigh more
+
+  for (uint32_t i = 0; i < vertex_count; i++) {
+    float length = glm::length(vertices[i].normal);
+    vertices[i].normal = length > 0.0f ? vertices[i].normal / length
+                                       : glm::vec3(0.0f, 0.0f, 1.0f);
+  }
+}
+
+void compute_bounds(const scene_data &scene, primitive &range) {
+  glm::vec3 bounds_min(std::numeric_limits<float>::max());
+  glm::vec3 bounds_max(std::numeric_limits<float>::lowest());
+
+  for (uint32_t i = 0; i < range.vertex_count; i++) {
+    const glm::vec3 &position = scene.vertices[range.first_vertex + i].position;
+    bounds_min = glm::min(bounds_min, position);
+    bounds_max = glm::max(bounds_max, position);
+  }
+
+  if (range.vertex_count > 0) {
+    range.bounds_min = bounds_min;
+    range.bounds_max = bounds_max;
+  }
+}
+
+void compute_bounds(scene_data &scene) {
+  glm::vec3 bounds_min(std::numeric_limits<float>::max());
+  glm::vec3 bounds_max(std::numeric_limits<float>::lowest());
+
+  for (const auto &instance : scene.instances) {
+    const mesh &source = scene.meshes[instance.mesh];
+    for (uint32_t p = 0; p < source.primitive_count; p++) {
+      const primitive &range = scene.primitives[source.first_primitive + p];
+      for (int corner = 0; corner < 8; corner++) {
+        glm::vec3 local((corner & 1) ? range.bounds_max.x : range.bounds_min.x,
+                        (corner & 2) ? range.bounds_max.y : range.bounds_min.y,
+                        (corner & 4) ? range.bounds_max.z : range.bounds_min.z);
+        glm::vec3 world(instance.transform * glm::vec4(local, 1.0f));
+        bounds_min = glm::min(bounds_min, world);
+        bounds_max = glm::max(bounds_max, world);
+      }
+    }
+  }
+
+  if (!scene.instances.empty()) {
+    scene.bounds_min = bounds_min;
+    scene.bounds_max = bounds_max;
+  }
+}
+} // namespace assets
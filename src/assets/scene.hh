@@ -0,0 +1,133 @@
+/**
+ * @file
+ * @author Ruben Pena <rubn.pena@gmail.com>
+ * @brief This file contains the CPU side description of a loaded scene, in
+ * the layout the GPU buffers are filled with.
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <glm/mat4x4.hpp>
+#include <glm/vec2.hpp>
+#include <glm/vec3.hpp>
+#include <glm/vec4.hpp>
+#include <string>
+#include <vector>
+
+namespace assets {
+/**
+ * @brief Interleaved vertex shared by every mesh, 32 bytes
+ */
+struct vertex {
+  glm::vec3 position;
+  glm::vec3 normal;
+  glm::vec2 uv;
+};
+
+/**
+ * @brief Range of the shared vertex and index arrays drawn with one material.
+ * Indices are relative to first_vertex, which becomes the vertexOffset
+ */
+struct primitive {
+  uint32_t first_index = 0;
+  uint32_t index_count = 0;
+  uint32_t first_vertex = 0;
+  uint32_t vertex_count = 0;
+  int32_t material = -1;
+  glm::vec3 bounds_min = glm::vec3(0.0f); // Object space
+  glm::vec3 bounds_max = glm::vec3(0.0f);
+};
+
+struct mesh {
+  std::string name;
+  uint32_t first_primitive = 0;
+  uint32_t primitive_count = 0;
+};
+
+/**
+ * @brief A mesh placed in the world by a scene node
+ */
+struct mesh_instance {
+  uint32_t mesh = 0;
+  glm::mat4 transform = glm::mat4(1.0f);
+};
+
+struct material {
+  glm::vec4 base_color = glm::vec4(1.0f);
+  int32_t base_color_image = -1; // Index into scene_data::images
+};
+
+enum class pixel_format {
+  rgba8_srgb,  // LDR sources: PNG, JPEG...
+  rgba32_float // HDR sources, linear
+};
+
+/**
+ * @brief Decoded image, tightly packed RGBA texels of the given format.
+ * Baked scenes also carry the mip chain, level 1 first, down to 1x1
+ */
+struct image_data {
+  std::string name;
+  uint32_t width = 0;
+  uint32_t height = 0;
+  pixel_format format = pixel_format::rgba8_srgb;
+  std::vector<uint8_t> rgba;
+  std::vector<std::vector<uint8_t>> mips; // Empty unless baked
+};
+
+/**
+ * @brief Everything a loader produces. The geometry of every mesh is packed in
+ * one vertex and one index array, ready to be copied into a single GPU buffer
+ * each
+ */
+struct scene_data {
+  std::vector<vertex> vertices;
+  std::vector<uint32_t> indices;
+  std::vector<primitive> primitives;
+  std::vector<mesh> meshes;
+  std::vector<mesh_instance> instances;
+  std::vector<material> materials;
+  std::vector<image_data> images;
+  glm::vec3 bounds_min = glm::vec3(0.0f); // World space, every instance
+  glm::vec3 bounds_max = glm::vec3(0.0f);
+};
+
+/**
+ * @brief Loads a .gltf, .glb, .obj or baked .rta file, the loader is picked
+ * from the extension
+ */
+scene_data load_scene(const std::string &path, uint32_t thread_count = 0);
+
+/**
+ * @brief Decodes an encoded image with stb_image, HDR files keep float
+ * texels. Returns false if the format is not recognized
+ */
+bool decode_image(const uint8_t *data, size_t size, image_data &target);
+
+uint32_t get_texel_size(pixel_format format);
+
+/**
+ * @brief The next mip level of image: half the size, rounded down and at
+ * least 1, each texel the average of the 2x2 it covers. sRGB texels are
+ * averaged in linear space
+ */
+image_data downsample(const image_data &image);
+
+/**
+ * @brief Area weighted vertex normals, for meshes that come without them
+ */
+void compute_normals(vertex *vertices, uint32_t vertex_count,
+                     const uint32_t *indices, uint32_t index_count);
+
+/**
+ * @brief Object space bounds of a primitive
+ */
+void compute_bounds(const scene_data &scene, primitive &range);
+
+/**
+ * @brief World space bounds of every instance, from the primitive bounds
+ */
+void compute_bounds(scene_data &scene);
+} // namespace assets
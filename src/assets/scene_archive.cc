@@ -0,0 +1,470 @@
+/**
+ * @file
+ * @author Ruben Pena <rubn.pena@gmail.com>
+ * @brief This file contains the implementation of the bake_scene and
+ * load_archive functions
+ */
+
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <lz_block.hh>
+#include <mapped_file.hh>
+#include <parallel_for.hh>
+#include <scene_archive.hh>
+#include <stdexcept>
+#include <type_traits>
+
+namespace assets {
+static constexpr char MAGIC[4] = {'R', 'T', 'S', 'A'};
+static constexpr uint32_t VERSION = 1;
+static constexpr uint64_t CHUNK_ALIGNMENT = 16; // Any vertex attribute type
+
+enum class chunk_type : uint32_t { scene_info, vertices, indices, image_level };
+enum class chunk_compression : uint32_t { none, lz };
+
+/**
+ * @brief Start of the file. Fields are in the native byte order, archives
+ * are baked for the machine that loads them
+ */
+struct archive_header {
+  char magic[4];
+  uint32_t version = VERSION;
+  uint32_t chunk_count = 0;
+  uint32_t reserved = 0;
+  uint64_t toc_offset = 0; // chunk_count toc_entry, 8 byte aligned
+};
+
+struct toc_entry {
+  chunk_type type = chunk_type::scene_info;
+  chunk_compression compression = chunk_compression::none;
+  uint32_t image = 0; // image_level only
+  uint32_t level = 0;
+  uint64_t offset = 0;      // From the start of the file
+  uint64_t stored_size = 0; // In the file
+  uint64_t size = 0;        // Once decompressed
+};
+
+static_assert(std::is_trivially_copyable_v<vertex> &&
+                  std::is_trivially_copyable_v<primitive> &&
+                  std::is_trivially_copyable_v<mesh_instance> &&
+                  std::is_trivially_copyable_v<material>,
+              "stored as raw bytes");
+
+static uint64_t align(uint64_t offset, uint64_t alignment) {
+  return (offset + alignment - 1) / alignment * alignment;
+}
+
+static uint32_t get_level_count(const image_data &image) {
+  uint32_t levels = 1;
+  while ((std::max(image.width, image.height) >> levels) > 0) {
+    levels++;
+  }
+  return levels;
+}
+
+static size_t get_level_size(const image_data &image, uint32_t level) {
+  return static_cast<size_t>(std::max(image.width >> level, 1u)) *
+         std::max(image.height >> level, 1u) * get_texel_size(image.format);
+}
+
+template <typename T>
+static void put(std::vector<uint8_t> &out, const T &value) {
+  const uint8_t *bytes = reinterpret_cast<const uint8_t *>(&value);
+  out.insert(out.end(), bytes, bytes + sizeof(T));
+}
+
+template <typename T>
+static void put_array(std::vector<uint8_t> &out, const std::vector<T> &values) {
+  put(out, static_cast<uint64_t>(values.size()));
+  const uint8_t *bytes = reinterpret_cast<const uint8_t *>(values.data());
+  out.insert(out.end(), bytes, bytes + values.size() * sizeof(T));
+}
+
+static void put_string(std::vector<uint8_t> &out, const std::string &value) {
+  put(out, static_cast<uint64_t>(value.size()));
+  out.insert(out.end(), value.begin(), value.end());
+}
+
+/**
+ * @brief Reads back what put wrote, throwing instead of reading past the end
+ */
+struct byte_reader {
+  const uint8_t *data = nullptr;
+  size_t size = 0;
+  size_t offset = 0;
+
+  void read(void *target, size_t bytes) {
+    if (bytes > size - offset)
+      throw std::runtime_error("truncated scene info");
+    if (bytes > 0) {
+      std::memcpy(target, data + offset, bytes);
+    }
+    offset += bytes;
+  }
+
+  template <typename T> T get() {
+    T value;
+    read(&value, sizeof(T));
+    return value;
+  }
+
+  template <typename T> void get_array(std::vector<T> &values) {
+    uint64_t count = get<uint64_t>();
+    if (count > (size - offset) / sizeof(T))
+      throw std::runtime_error("truncated scene info");
+    values.resize(count);
+    read(values.data(), count * sizeof(T));
+  }
+
+  std::string get_string() {
+    uint64_t length = get<uint64_t>();
+    if (length > size - offset)
+      throw std::runtime_error("truncated scene info");
+    std::string value(reinterpret_cast<const char *>(data + offset), length);
+    offset += length;
+    return value;
+  }
+};
+
+/**
+ * @brief Everything but the vertices, indices and texels. Images keep their
+ * size and format, texels come in one chunk per level
+ */
+static std::vector<uint8_t> write_info(const scene_data &scene,
+                                       const std::vector<uint32_t> &levels) {
+  std::vector<uint8_t> out;
+  put_array(out, scene.primitives);
+  put(out, static_cast<uint64_t>(scene.meshes.size()));
+  for (const auto &source : scene.meshes) {
+    put_string(out, source.name);
+    put(out, source.first_primitive);
+    put(out, source.primitive_count);
+  }
+  put_array(out, scene.instances);
+  put_array(out, scene.materials);
+  put(out, scene.bounds_min);
+  put(out, scene.bounds_max);
+  put(out, static_cast<uint64_t>(scene.images.size()));
+  for (size_t i = 0; i < scene.images.size(); i++) {
+    const image_data &image = scene.images[i];
+    put_string(out, image.name);
+    put(out, image.width);
+    put(out, image.height);
+    put(out, image.format);
+    put(out, levels[i]); // 0 for the images that failed to decode
+  }
+  return out;
+}
+
+/**
+ * @brief Fills scene from the info chunk. Each image gets room for its
+ * levels, the chunks are copied in later
+ */
+static void read_info(const uint8_t *data, size_t size, scene_data &scene,
+                      std::vector<uint32_t> &levels) {
+  byte_reader reader{data, size};
+  reader.get_array(scene.primitives);
+  uint64_t mesh_count = reader.get<uint64_t>();
+  for (uint64_t i = 0; i < mesh_count; i++) {
+    mesh target;
+    target.name = reader.get_string();
+    target.first_primitive = reader.get<uint32_t>();
+    target.primitive_count = reader.get<uint32_t>();
+    scene.meshes.push_back(std::move(target));
+  }
+  reader.get_array(scene.instances);
+  reader.get_array(scene.materials);
+  scene.bounds_min = reader.get<glm::vec3>();
+  scene.bounds_max = reader.get<glm::vec3>();
+
+  uint64_t image_count = reader.get<uint64_t>();
+  for (uint64_t i = 0; i < image_count; i++) {
+    image_data image;
+    image.name = reader.get_string();
+    image.width = reader.get<uint32_t>();
+    image.height = reader.get<uint32_t>();
+    image.format = reader.get<pixel_format>();
+    uint32_t level_count = reader.get<uint32_t>();
+    if (image.format != pixel_format::rgba8_srgb &&
+        image.format != pixel_format::rgba32_float)
+      throw std::runtime_error("unknown pixel format");
+    if (level_count > 0 && level_count != get_level_count(image))
+      throw std::runtime_error("incomplete mip chain");
+
+    image.mips.resize(level_count > 0 ? level_count - 1 : 0);
+    scene.images.push_back(std::move(image));
+    levels.push_back(level_count);
+  }
+}
+
+/**
+ * @brief A corrupted archive must not send the GPU out of its buffers. The
+ * ranges are checked here, the index values by check_indices once copied
+ */
+static void check_ranges(const scene_data &scene) {
+  for (const auto &range : scene.primitives) {
+    if (uint64_t(range.first_index) + range.index_count >
+            scene.indices.size() ||
+        uint64_t(range.first_vertex) + range.vertex_count >
+            scene.vertices.size() ||
+        range.material >= static_cast<int64_t>(scene.materials.size()))
+      throw std::runtime_error("primitive out of range");
+  }
+  for (const auto &source : scene.meshes) {
+    if (uint64_t(source.first_primitive) + source.primitive_count >
+        scene.primitives.size())
+      throw std::runtime_error("mesh out of range");
+  }
+  for (const auto &instance : scene.instances) {
+    if (instance.mesh >= scene.meshes.size())
+      throw std::runtime_error("instance out of range");
+  }
+  for (const auto &source : scene.materials) {
+    if (source.base_color_image >= static_cast<int64_t>(scene.images.size()))
+      throw std::runtime_error("material out of range");
+  }
+}
+
+/**
+ * @brief Indices are relative to first_vertex, none may reach past the
+ * primitive's vertices
+ */
+static void check_indices(const scene_data &scene, const primitive &range) {
+  const uint32_t *indices = scene.indices.data() + range.first_index;
+  for (uint32_t i = 0; i < range.index_count; i++) {
+    if (indices[i] >= range.vertex_count)
+      throw std::runtime_error("index out of range");
+  }
+}
+
+archive_stats bake_scene(const scene_data &scene, const std::string &path,
+                         bool compress, uint32_t thread_count) {
+  // The mip chains are cut here once, the runtime only copies them
+  std::vector<std::vector<image_data>> chains(scene.images.size());
+  std::vector<uint32_t> levels(scene.images.size(), 0);
+  utils::parallel_for(
+      scene.images.size(),
+      [&](size_t i) {
+        const image_data &image = scene.images[i];
+        if (image.rgba.empty())
+          return;
+        levels[i] = get_level_count(image);
+        if (image.mips.size() + 1 == levels[i])
+          return; // Loaded from an archive, already complete
+
+        while (chains[i].size() + 1 < levels[i]) {
+          const image_data &last = chains[i].empty() ? image : chains[i].back();
+          image_data next = downsample(last);
+          chains[i].push_back(std::move(next));
+        }
+      },
+      thread_count);
+
+  struct chunk {
+    toc_entry entry;
+    const uint8_t *data = nullptr;
+    std::vector<uint8_t> compressed;
+  };
+
+  std::vector<uint8_t> info = write_info(scene, levels);
+  std::vector<chunk> chunks;
+  auto add = [&](chunk_type type, const void *data, size_t size,
+                 uint32_t image = 0, uint32_t level = 0) {
+    chunk target;
+    target.entry.type = type;
+    target.entry.image = image;
+    target.entry.level = level;
+    target.entry.size = size;
+    target.entry.stored_size = size;
+    target.data = static_cast<const uint8_t *>(data);
+    chunks.push_back(std::move(target));
+  };
+  add(chunk_type::scene_info, info.data(), info.size());
+  add(chunk_type::vertices, scene.vertices.data(),
+      scene.vertices.size() * sizeof(vertex));
+  add(chunk_type::indices, scene.indices.data(),
+      scene.indices.size() * sizeof(uint32_t));
+  for (uint32_t i = 0; i < scene.images.size(); i++) {
+    const image_data &image = scene.images[i];
+    for (uint32_t level = 0; level < levels[i]; level++) {
+      const std::vector<uint8_t> &texels =
+          level == 0               ? image.rgba
+          : chains[i].empty()      ? image.mips[level - 1]
+                                   : chains[i][level - 1].rgba;
+      add(chunk_type::image_level, texels.data(), texels.size(), i, level);
+    }
+  }
+
+  if (compress) {
+    utils::parallel_for(
+        chunks.size(),
+        [&](size_t i) {
+          chunk &target = chunks[i];
+          target.compressed =
+              utils::lz_compress(target.data, target.entry.size);
+          if (!target.compressed.empty()) {
+            target.entry.compression = chunk_compression::lz;
+            target.entry.stored_size = target.compressed.size();
+          } // Stored raw unless it shrinks
+        },
+        thread_count);
+  }
+
+  archive_stats stats;
+  uint64_t offset = sizeof(archive_header);
+  for (auto &target : chunks) {
+    offset = align(offset, CHUNK_ALIGNMENT);
+    target.entry.offset = offset;
+    offset += target.entry.stored_size;
+    stats.raw_bytes += target.entry.size;
+    stats.stored_bytes += target.entry.stored_size;
+  }
+
+  archive_header header;
+  std::memcpy(header.magic, MAGIC, sizeof(MAGIC));
+  header.chunk_count = static_cast<uint32_t>(chunks.size());
+  header.toc_offset = align(offset, alignof(toc_entry));
+
+  std::ofstream file(path, std::ios::binary | std::ios::trunc);
+  if (!file)
+    throw std::runtime_error("failed to open " + path);
+
+  const char padding[CHUNK_ALIGNMENT] = {};
+  file.write(reinterpret_cast<const char *>(&header), sizeof(header));
+  offset = sizeof(header);
+  for (const auto &target : chunks) {
+    file.write(padding, target.entry.offset - offset);
+    const uint8_t *data = target.entry.compression == chunk_compression::lz
+                              ? target.compressed.data()
+                              : target.data;
+    file.write(reinterpret_cast<const char *>(data), target.entry.stored_size);
+    offset = target.entry.offset + target.entry.stored_size;
+  }
+  file.write(padding, header.toc_offset - offset);
+  for (const auto &target : chunks) {
+    file.write(reinterpret_cast<const char *>(&target.entry),
+               sizeof(toc_entry));
+  }
+  file.close();
+  if (!file)
+    throw std::runtime_error("failed to write " + path);
+
+  stats.chunk_count = header.chunk_count;
+  stats.file_bytes = header.toc_offset + chunks.size() * sizeof(toc_entry);
+  return stats;
+}
+
+/**
+ * @brief The TOC is validated whole before anything is copied, so each
+ * chunk has exactly one destination, sized from the scene info, and the
+ * copies can run in parallel
+ */
+scene_data load_archive(const std::string &path, uint32_t thread_count) {
+  utils::mapped_file file(path, utils::access_hint::will_need);
+  utils::file_view view = file.view();
+  if (view.size < sizeof(archive_header) ||
+      std::memcmp(view.data, MAGIC, sizeof(MAGIC)) != 0)
+    throw std::runtime_error(path + " is not a scene archive");
+
+  const archive_header &header = *view.as<archive_header>();
+  if (header.version != VERSION) {
+    throw std::runtime_error(path + " is a version " +
+                             std::to_string(header.version) +
+                             " archive, expected " + std::to_string(VERSION));
+  }
+  if (header.toc_offset > view.size ||
+      header.chunk_count > (view.size - header.toc_offset) / sizeof(toc_entry))
+    throw std::runtime_error(path + " is truncated");
+
+  const toc_entry *toc =
+      view.subview(header.toc_offset, header.chunk_count * sizeof(toc_entry))
+          .as<toc_entry>(header.chunk_count);
+  for (uint32_t i = 0; i < header.chunk_count; i++) {
+    const toc_entry &entry = toc[i];
+    if (entry.stored_size > view.size ||
+        entry.offset > view.size - entry.stored_size)
+      throw std::runtime_error(path + " is truncated");
+    if (entry.compression == chunk_compression::lz
+            ? entry.size > utils::lz_max_decompressed_size(entry.stored_size)
+            : entry.compression != chunk_compression::none ||
+                  entry.stored_size != entry.size)
+      throw std::runtime_error(path + " has a malformed chunk");
+  } // Sizes are bounded by the file before anything is allocated from them
+
+  auto unpack = [&](const toc_entry &entry, uint8_t *target) {
+    const uint8_t *source =
+        reinterpret_cast<const uint8_t *>(view.data) + entry.offset;
+    if (entry.compression == chunk_compression::lz) {
+      utils::lz_decompress(source, entry.stored_size, target, entry.size);
+    } else if (entry.size > 0) {
+      std::memcpy(target, source, entry.size);
+    }
+  };
+
+  if (header.chunk_count == 0 || toc[0].type != chunk_type::scene_info)
+    throw std::runtime_error(path + " has no scene info");
+  std::vector<uint8_t> info(toc[0].size);
+  unpack(toc[0], info.data());
+
+  scene_data scene;
+  std::vector<uint32_t> levels;
+  read_info(info.data(), info.size(), scene, levels);
+
+  std::vector<uint8_t *> targets(header.chunk_count, nullptr);
+  bool vertices = false;
+  bool indices = false;
+  for (uint32_t i = 1; i < header.chunk_count; i++) {
+    const toc_entry &entry = toc[i];
+    if (entry.type == chunk_type::vertices && !vertices &&
+        entry.size % sizeof(vertex) == 0) {
+      scene.vertices.resize(entry.size / sizeof(vertex));
+      targets[i] = reinterpret_cast<uint8_t *>(scene.vertices.data());
+      vertices = true;
+    } else if (entry.type == chunk_type::indices && !indices &&
+               entry.size % sizeof(uint32_t) == 0) {
+      scene.indices.resize(entry.size / sizeof(uint32_t));
+      targets[i] = reinterpret_cast<uint8_t *>(scene.indices.data());
+      indices = true;
+    } else if (entry.type == chunk_type::image_level &&
+               entry.image < scene.images.size() &&
+               entry.level < levels[entry.image] &&
+               entry.size ==
+                   get_level_size(scene.images[entry.image], entry.level)) {
+      image_data &image = scene.images[entry.image];
+      std::vector<uint8_t> &texels =
+          entry.level == 0 ? image.rgba : image.mips[entry.level - 1];
+      if (!texels.empty())
+        throw std::runtime_error(path + " has a level twice");
+      texels.resize(entry.size);
+      targets[i] = texels.data();
+    } else {
+      throw std::runtime_error(path + " has a malformed chunk");
+    }
+  }
+  for (size_t i = 0; i < scene.images.size(); i++) {
+    const image_data &image = scene.images[i];
+    bool missing = levels[i] > 0 && image.rgba.empty();
+    for (const auto &texels : image.mips) {
+      missing = missing || texels.empty();
+    }
+    if (missing)
+      throw std::runtime_error(path + " is missing levels of " + image.name);
+  }
+  check_ranges(scene);
+
+  utils::parallel_for(
+      header.chunk_count,
+      [&](size_t i) {
+        if (targets[i] != nullptr) {
+          unpack(toc[i], targets[i]);
+        }
+      },
+      thread_count);
+  utils::parallel_for(
+      scene.primitives.size(),
+      [&](size_t i) { check_indices(scene, scene.primitives[i]); },
+      thread_count);
+  return scene;
+}
+} // namespace assets
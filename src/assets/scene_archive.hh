@@ -0,0 +1,41 @@
+/**
+ * @file
+ * @author Ruben Pena <rubn.pena@gmail.com>
+ * @brief This file contains the bake_scene and load_archive functions, the
+ * baked binary form of a scene_data.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <scene.hh>
+#include <string>
+
+namespace assets {
+struct archive_stats {
+  uint32_t chunk_count = 0;
+  uint64_t raw_bytes = 0;    // Chunks as loaded
+  uint64_t stored_bytes = 0; // Chunks as written, after compression
+  uint64_t file_bytes = 0;
+};
+
+/**
+ * @brief Writes scene to path as a .rta archive: a versioned header, the
+ * chunks and a table of contents. Vertices and indices are stored in the
+ * layout the GPU buffers use, and every image with its whole mip chain, so
+ * loading is a copy. With compress, each chunk the LZ codec shrinks is
+ * stored compressed, the rest raw. Mips and compression run on thread_count
+ * threads of the job system (0: all of them). Throws if path can't be
+ * written
+ */
+archive_stats bake_scene(const scene_data &scene, const std::string &path,
+                         bool compress, uint32_t thread_count = 0);
+
+/**
+ * @brief Loads a .rta archive. The file is memory mapped and each chunk is
+ * copied, or decompressed, straight into its place in the scene, in
+ * parallel. Throws if the archive is truncated, malformed or of another
+ * version
+ */
+scene_data load_archive(const std::string &path, uint32_t thread_count = 0);
+} // namespace assets
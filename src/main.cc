@@ -8,22 +8,133 @@
 #define GLFW_INCLUDE_VULKAN
 #include <GLFW/glfw3.h>
 
-#define GLM_FORCE_RADIANS
-#define GLM_FORCE_DEPTH_ZERO_TO_ONE
-#include <glm/mat4x4.hpp>
-#include <glm/vec4.hpp>
-
 #include <rt_app.hh>
+#include <scene_archive.hh>
 
+#include <chrono>
 #include <iostream>
+#include <stdexcept>
+#include <string>
 
 /**
- * @brief Entry of the program
+ * @brief Parses the command line into the application options
+ * Usage: render-toy [--headless] [--frames N] [--frames-in-flight N]
+ * [--size WxH] [--output file.ppm] [--pipeline-cache file]
+ * [--scene file.gltf|file.glb|file.obj|file.rta] [--profile file.json]
+ * [--pipeline-statistics] [--device N] [--recording-threads N]
+ * [--culling none|cpu|gpu] [--present latency|balanced|throughput]
+ * [--swapchain-images N] [--fps-limit N] [--device-benchmark]
+ * [--device-benchmark-cache file] [--render-passes] [--hot-reload dir]
+ * [--bake file.rta] [--compress]
+ */
+static rt_app_config parse_args(int argc, char **argv) {
+  rt_app_config config;
+
+  for (int i = 1; i < argc; i++) {
+    std::string arg = argv[i];
+    bool has_value = i + 1 < argc;
+
+    if (arg == "--headless") {
+      config.headless = true;
+    } else if (arg == "--frames" && has_value) {
+      config.frame_count = static_cast<uint32_t>(std::stoul(argv[++i]));
+      if (config.frame_count == 0) {
+        throw std::runtime_error("--frames expects at least 1 frame");
+      }
+    } else if (arg == "--frames-in-flight" && has_value) {
+      config.frames_in_flight = static_cast<uint32_t>(std::stoul(argv[++i]));
+    } else if (arg == "--recording-threads" && has_value) {
+      config.recording_threads = static_cast<uint32_t>(std::stoul(argv[++i]));
+    } else if (arg == "--size" && has_value) {
+      std::string size = argv[++i];
+      size_t separator = size.find('x');
+      if (separator == std::string::npos) {
+        throw std::runtime_error("--size expects WIDTHxHEIGHT");
+      }
+      config.width =
+          static_cast<uint32_t>(std::stoul(size.substr(0, separator)));
+      config.height =
+          static_cast<uint32_t>(std::stoul(size.substr(separator + 1)));
+      if (config.width == 0 || config.height == 0) {
+        throw std::runtime_error("--size expects a non zero WIDTHxHEIGHT");
+      }
+    } else if (arg == "--output" && has_value) {
+      config.output_path = argv[++i];
+    } else if (arg == "--pipeline-cache" && has_value) {
+      config.pipeline_cache_path = argv[++i];
+    } else if (arg == "--scene" && has_value) {
+      config.scene_path = argv[++i];
+    } else if (arg == "--profile" && has_value) {
+      config.profile_path = argv[++i];
+    } else if (arg == "--pipeline-statistics") {
+      config.pipeline_statistics = true;
+    } else if (arg == "--device" && has_value) {
+      config.device_index = std::stoi(argv[++i]);
+    } else if (arg == "--device-benchmark") {
+      config.device_benchmark = true;
+    } else if (arg == "--device-benchmark-cache" && has_value) {
+      config.device_benchmark_path = argv[++i];
+    } else if (arg == "--culling" && has_value) {
+      config.culling = parse_cull_mode(argv[++i]);
+    } else if (arg == "--render-passes") {
+      config.dynamic_rendering = false;
+    } else if (arg == "--hot-reload" && has_value) {
+      config.shader_reload_path = argv[++i];
+    } else if (arg == "--present" && has_value) {
+      config.present = parse_present_goal(argv[++i]);
+    } else if (arg == "--swapchain-images" && has_value) {
+      config.swapchain_images = static_cast<uint32_t>(std::stoul(argv[++i]));
+    } else if (arg == "--fps-limit" && has_value) {
+      config.fps_limit = std::stod(argv[++i]);
+    } else if (arg == "--bake" && has_value) {
+      config.bake_path = argv[++i];
+    } else if (arg == "--compress") {
+      config.bake_compress = true;
+    } else {
+      throw std::runtime_error("unknown or incomplete argument: " + arg);
+    }
+  }
+
+  return config;
+}
+
+/**
+ * @brief Offline mode: loads the scene from its source format and writes it
+ * as an archive the renderer loads without parsing or decoding anything
  */
-int main(void) {
-  rt_app app;
+static void bake(const rt_app_config &config) {
+  if (config.scene_path.empty()) {
+    throw std::runtime_error("--bake needs a --scene to bake");
+  }
+
+  using milliseconds = std::chrono::duration<double, std::milli>;
+  auto start = std::chrono::steady_clock::now();
+  assets::scene_data scene = assets::load_scene(config.scene_path);
+  auto loaded = std::chrono::steady_clock::now();
+  assets::archive_stats stats =
+      assets::bake_scene(scene, config.bake_path, config.bake_compress);
+  auto baked = std::chrono::steady_clock::now();
+
+  std::cout << "Loaded " << config.scene_path << " in "
+            << milliseconds(loaded - start).count() << " ms, baked "
+            << stats.chunk_count << " chunks into " << config.bake_path
+            << " in " << milliseconds(baked - loaded).count() << " ms: "
+            << stats.raw_bytes << " bytes, " << stats.stored_bytes
+            << " stored, " << stats.file_bytes << " on disk" << std::endl;
+}
 
+/**
+ * @brief Entry of the program
+ */
+int main(int argc, char **argv) {
   try {
+    rt_app_config config = parse_args(argc, argv);
+    if (!config.bake_path.empty()) {
+      bake(config);
+      return 0;
+    }
+
+    rt_app app(config);
     app.run();
   } catch (const std::exception &e) {
     std::cerr << e.what() << std::endl;
@@ -11,14 +11,38 @@ void window_manager::init_window() {
   glfwInit();
 
   glfwWindowHint(GLFW_CLIENT_API, GLFW_NO_API);
-  glfwWindowHint(GLFW_RESIZABLE, GLFW_FALSE);
+  glfwWindowHint(GLFW_RESIZABLE, GLFW_TRUE);
 
   m_main_window =
       glfwCreateWindow(WIDTH, HEIGHT, "render-toy", nullptr, nullptr);
+  glfwSetWindowUserPointer(m_main_window, this);
+  glfwSetFramebufferSizeCallback(m_main_window, framebuffer_size_callback);
+}
+
+void window_manager::framebuffer_size_callback(GLFWwindow *window, int width,
+                                               int height) {
+  auto *manager =
+      static_cast<window_manager *>(glfwGetWindowUserPointer(window));
+  if (manager->m_resize_callback) {
+    manager->m_resize_callback(width, height);
+  }
 }
 
 GLFWwindow *window_manager::get_main_window() { return m_main_window; }
 
+/**
+ * @brief Called with the new framebuffer size, in pixels, every time the main
+ * window is resized
+ */
+void window_manager::set_resize_callback(
+    const std::function<void(int, int)> &callback) {
+  m_resize_callback = callback;
+}
+
+bool window_manager::is_minimized() {
+  return glfwGetWindowAttrib(m_main_window, GLFW_ICONIFIED) == GLFW_TRUE;
+}
+
 void window_manager::destroy_window() {
   glfwDestroyWindow(m_main_window);
   glfwTerminate();
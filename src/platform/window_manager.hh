@@ -6,6 +6,7 @@
 #pragma once
 
 #include <GLFW/glfw3.h>
+#include <functional>
 
 /**
  * @class
@@ -16,8 +17,15 @@ class window_manager {
   static constexpr int WIDTH = 800;
   static constexpr int HEIGHT = 600;
   GLFWwindow *m_main_window = nullptr; // Main program window
+  std::function<void(int, int)> m_resize_callback;
+
+  static void framebuffer_size_callback(GLFWwindow *window, int width,
+                                        int height);
+
 public:
   void init_window();
   GLFWwindow *get_main_window();
+  void set_resize_callback(const std::function<void(int, int)> &callback);
+  bool is_minimized();
   void destroy_window();
 };
@@ -4,41 +4,272 @@
  * @brief Main loop handler implementation
  */
 
+#include <chrono>
+#include <iostream>
+#include <job_system.hh>
 #include <rt_app.hh>
+#include <scene.hh>
+#include <write_image.hh>
+
+rt_app::rt_app(const rt_app_config &config) : m_config(config) {}
 
 void rt_app::run() {
-  init_window();
-  init_vulkan();
-  main_loop();
+  init();
+  if (m_config.headless) {
+    headless_loop();
+  } else {
+    main_loop();
+  }
   shutdown();
 }
 
-void rt_app::init_window() { m_window_manager.init_window(); }
+/**
+ * @brief Creates the window, unless headless, and every Vulkan object, then
+ * loads the configured scene. The first frame can be drawn right after
+ */
+void rt_app::init() {
+  auto start = std::chrono::steady_clock::now();
+  utils::job_system &jobs = utils::job_system::get();
+  utils::job_counter scene_loaded;
+  assets::scene_data scene;
+
+  if (!m_config.scene_path.empty()) {
+    jobs.run([&]() { scene = assets::load_scene(m_config.scene_path); },
+             &scene_loaded);
+  } // Parsed on the pool while the device is created
+
+  try {
+    if (!m_config.headless) {
+      init_window();
+    }
+    init_vulkan();
+  } catch (...) {
+    try {
+      jobs.wait(scene_loaded);
+    } catch (...) {
+    } // The job writes to scene, it must finish before the stack unwinds
+    throw;
+  }
+
+  jobs.wait(scene_loaded); // Helps with the loading if it is not done yet
+  if (!m_config.scene_path.empty()) {
+    upload_scene(scene, start);
+  }
+}
+
+void rt_app::init_window() {
+  m_window_manager.init_window();
+  m_window_manager.set_resize_callback(
+      [this](int, int) { m_vk_loader.notify_resized(); });
+}
 
 void rt_app::init_vulkan() {
-  m_vk_loader.init_vulkan();
+  m_vk_loader.set_present_goal(m_config.present, m_config.swapchain_images);
+  m_vk_loader.set_frames_in_flight(m_config.frames_in_flight);
+  m_vk_loader.set_recording_threads(m_config.recording_threads);
+  m_vk_loader.set_cull_mode(m_config.culling);
+  m_vk_loader.set_dynamic_rendering(m_config.dynamic_rendering);
+  m_vk_loader.init_vulkan(m_config.headless);
   m_vk_loader.setup_debug_messenger();
-  m_vk_loader.create_surface(m_window_manager.get_main_window());
+  if (!m_config.headless) {
+    m_vk_loader.create_surface(m_window_manager.get_main_window());
+  }
+  m_vk_loader.set_device_benchmark(m_config.device_benchmark,
+                                   m_config.device_benchmark_path);
   m_vk_loader.find_physical_devices();
-  m_vk_loader.pick_best_physical_device(); // TODO: Make something more fancy
-                                           // than selecting the first
-                                           // compatible GPU. A menu for the
-                                           // user to select once in the app?
+  if (m_config.device_index >= 0) {
+    m_vk_loader.pick_physical_device(
+        static_cast<uint32_t>(m_config.device_index));
+  } else {
+    m_vk_loader.pick_best_physical_device(); // TODO: A menu for the user to
+                                             // select once in the app?
+  }
+  report_devices();
   m_vk_loader.create_logical_device();
-  m_vk_loader.create_swap_chain(m_window_manager.get_main_window());
+  m_vk_loader.create_pipeline_cache(m_config.pipeline_cache_path);
+  m_vk_loader.create_staging_ring();
+  m_vk_loader.create_bindless_heap();
+  m_vk_loader.create_texture_streamer();
+  if (m_config.headless) {
+    m_vk_loader.create_offscreen_targets({m_config.width, m_config.height});
+  } else {
+    m_vk_loader.create_swap_chain(m_window_manager.get_main_window());
+  }
   m_vk_loader.create_swap_chain_image_views();
   m_vk_loader.create_render_pass();
   m_vk_loader.create_def_graphics_pipeline();
+  m_vk_loader.create_mesh_pipeline();
+  m_vk_loader.create_cull_pipeline();
+  if (!m_config.shader_reload_path.empty()) {
+    m_vk_loader.start_shader_reload(m_config.shader_reload_path);
+  }
   m_vk_loader.create_framebuffers();
+  m_vk_loader.create_frame_resources();
+  m_vk_loader.create_profiler(m_config.pipeline_statistics);
+}
+
+/**
+ * @brief Prints the suitable devices best first, with the index --device
+ * takes, and marks the one in use
+ */
+void rt_app::report_devices() {
+  VkPhysicalDevice selected = m_vk_loader.get_selected_physical_device();
+  for (const auto &ranked : m_vk_loader.get_device_ranking()) {
+    std::cerr << (ranked.device == selected ? "* " : "  ") << "["
+              << ranked.index << "] " << ranked.name << ", score "
+              << ranked.capability_score;
+    if (ranked.timings.measured) {
+      std::cerr << ", fill " << ranked.timings.fill_gpixels
+                << " Gpixel/s, compute " << ranked.timings.compute_gflops
+                << " GFLOPS";
+    }
+    std::cerr << std::endl;
+  }
+}
+
+/**
+ * @brief Uploads the scene given on the command line and reports how long it
+ * took since its loading started
+ */
+void rt_app::upload_scene(const assets::scene_data &scene,
+                          std::chrono::steady_clock::time_point start) {
+  m_vk_loader.load_scene(scene);
+
+  std::chrono::duration<double, std::milli> elapsed =
+      std::chrono::steady_clock::now() - start;
+  std::cerr << "Loaded " << m_config.scene_path << ": "
+            << scene.meshes.size() << " meshes, " << scene.instances.size()
+            << " instances, " << scene.vertices.size() << " vertices, "
+            << scene.indices.size() / 3 << " triangles, "
+            << scene.images.size() << " images in " << elapsed.count()
+            << " ms" << std::endl;
 }
 
+/**
+ * @brief Paces the frames, samples the input as late as possible before
+ * recording and measures how long it takes to reach the presentation engine
+ */
 void rt_app::main_loop() {
+  m_pacer.set_target_fps(m_config.fps_limit);
+
   while (!glfwWindowShouldClose(m_window_manager.get_main_window())) {
+    m_pacer.wait();
     glfwPollEvents();
+    if (m_window_manager.is_minimized()) {
+      glfwWaitEvents();
+      continue;
+    } // Nothing to draw to, sleep until restored
+    m_pacer.mark_input();
+
+    if (m_vk_loader.draw_frame()) {
+      m_pacer.mark_presented();
+    }
   }
+  report_latency();
+  report_profile();
+}
+
+void rt_app::report_latency() {
+  utils::latency_stats latency = m_pacer.get_latency();
+  if (latency.sample_count == 0)
+    return;
+
+  std::cout << "Input to present: last " << latency.last_ms << " ms, avg "
+            << latency.avg_ms << " ms, p99 " << latency.p99_ms << " ms over "
+            << latency.sample_count << " frames ("
+            << m_vk_loader.get_swapchain_image_count() << " images, "
+            << m_vk_loader.get_frames_in_flight() << " frames in flight)"
+            << std::endl;
 }
 
+/**
+ * @brief Renders the requested amount of frames offscreen and optionally
+ * saves the last one. The pipelines are waited for and the textures streamed
+ * in first, so every frame draws the scene at full resolution
+ */
+void rt_app::headless_loop() {
+  m_vk_loader.wait_pipelines();
+  while (m_vk_loader.get_texture_streamer().is_streaming()) {
+    m_vk_loader.draw_frame();
+  } // Not counted, these frames stream the textures
+  auto start = std::chrono::steady_clock::now();
+
+  for (uint32_t i = 0; i < m_config.frame_count; i++) {
+    m_vk_loader.draw_frame();
+  }
+
+  m_vk_loader.read_back_frame(); // Wait for the last frame to finish
+  report_profile();
+
+  std::chrono::duration<double, std::milli> elapsed =
+      std::chrono::steady_clock::now() - start;
+  std::cout << "Rendered " << m_config.frame_count << " frames in "
+            << elapsed.count() << " ms" << std::endl;
+
+  if (!m_config.output_path.empty()) {
+    VkExtent2D extent = m_vk_loader.get_extent();
+    utils::write_ppm(m_config.output_path, extent.width, extent.height,
+                     m_vk_loader.read_back_frame());
+  }
+}
+
+/**
+ * @brief Prints the shape of the frame graph, the memory usage, the rolling
+ * pass timings, and writes the timings to the profile path
+ */
+void rt_app::report_profile() {
+  render_graph_stats graph = m_vk_loader.get_render_graph_stats();
+  std::cout << "Frame graph: " << graph.pass_count - graph.culled_pass_count
+            << " of " << graph.pass_count << " passes, "
+            << graph.barrier_batches << " barrier batches ("
+            << graph.image_barriers << " image, " << graph.buffer_barriers
+            << " buffer), transients " << graph.transient_bytes / 1024
+            << " KiB aliased from " << graph.unaliased_bytes / 1024 << " KiB"
+            << std::endl;
+
+  pipeline_registry_stats pipelines = m_vk_loader.get_pipeline_registry_stats();
+  std::cout << "Pipelines: " << pipelines.built << " built, "
+            << pipelines.failed << " failed, " << pipelines.pending
+            << " pending, " << pipelines.deduplicated << " of "
+            << pipelines.requests << " requests deduplicated" << std::endl;
+
+  texture_stats textures = m_vk_loader.get_texture_streamer().get_stats();
+  std::cout << "Textures: " << textures.texture_count << ", "
+            << textures.streamed_bytes / (1024 * 1024) << " MiB streamed, "
+            << textures.pending_uploads << " uploads pending, "
+            << textures.blit_mips << " mips blitted, "
+            << textures.compute_mips << " computed" << std::endl;
+
+  allocator_stats memory = m_vk_loader.get_allocator().get_stats();
+  std::cout << "Memory: " << memory.used_bytes / (1024 * 1024) << " of "
+            << memory.reserved_bytes / (1024 * 1024) << " MiB used, "
+            << memory.allocations << " allocations in "
+            << memory.device_allocations << " device allocations, "
+            << memory.fragmentation * 100.0f << "% fragmented" << std::endl;
+
+  gpu_profiler &profiler = m_vk_loader.get_profiler();
+  if (!profiler.is_enabled())
+    return;
+
+  m_vk_loader.wait_idle();
+  profiler.collect_pending(); // The last frames in flight
+
+  for (const auto &pass : profiler.get_stats()) {
+    std::cout << "GPU " << pass.name << ": min " << pass.min_ms << " ms, avg "
+              << pass.avg_ms << " ms, p99 " << pass.p99_ms << " ms over "
+              << pass.sample_count << " frames" << std::endl;
+  }
+
+  if (!m_config.profile_path.empty()) {
+    profiler.write_json(m_config.profile_path);
+  }
+}
+
+vk_loader &rt_app::get_vk_loader() { return m_vk_loader; }
+
 void rt_app::shutdown() {
-  m_window_manager.destroy_window();
+  if (!m_config.headless) {
+    m_window_manager.destroy_window();
+  }
   m_vk_loader.destroy_vulkan();
 }
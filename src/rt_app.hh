@@ -5,18 +5,62 @@
  */
 
 #pragma once
+#include <chrono>
+#include <cstdint>
+#include <frame_pacer.hh>
 #include <platform/window_manager.hh>
+#include <scene.hh>
+#include <string>
 #include <vk_loader.hh>
 
+/**
+ * @brief Launch options of the application
+ */
+struct rt_app_config {
+  bool headless = false;    // Render offscreen, without GLFW or a swap chain
+  uint32_t frame_count = 1; // Frames rendered before exiting in headless mode
+  uint32_t frames_in_flight = 0; // Frames the CPU records ahead, 0: goal's
+  present_goal present = present_goal::balanced;
+  uint32_t swapchain_images = 0; // 0: picked from the present goal
+  double fps_limit = 0.0;        // Frames per second cap, 0: unlimited
+  uint32_t recording_threads = 0; // Draw recording threads, 0: every one
+  uint32_t width = 800;
+  uint32_t height = 600;    // Size of the offscreen targets
+  std::string output_path; // Last headless frame is saved here if not empty
+  std::string pipeline_cache_path = "pipeline_cache.bin"; // Empty: no disk
+  std::string scene_path; // glTF scene drawn instead of the default triangle
+  std::string profile_path;         // Pass timings are written here on exit
+  bool pipeline_statistics = false; // Also gather pipeline statistics
+  int32_t device_index = -1;        // Physical device, -1 picks the best
+  bool device_benchmark = false;    // Rank devices by measured throughput
+  std::string device_benchmark_path = "device_benchmark.json"; // Results
+  cull_mode culling = cull_mode::gpu;
+  bool dynamic_rendering = true; // Render pass objects if false or missing
+  std::string shader_reload_path; // Edited shaders are reloaded if not empty
+  std::string bake_path; // The scene is baked here, and nothing rendered
+  bool bake_compress = false; // LZ compress the baked chunks
+};
+
 class rt_app {
+  rt_app_config m_config;
   vk_loader m_vk_loader;
   window_manager m_window_manager;
+  utils::frame_pacer m_pacer;
 
   void init_window();
   void init_vulkan();
   void main_loop();
-  void shutdown();
+  void headless_loop();
+  void report_devices();
+  void report_profile();
+  void report_latency();
+  void upload_scene(const assets::scene_data &scene,
+                    std::chrono::steady_clock::time_point start);
 
 public:
+  rt_app(const rt_app_config &config = {});
   void run();
+  void init();
+  void shutdown();
+  vk_loader &get_vk_loader();
 };
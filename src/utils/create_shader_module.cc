@@ -9,13 +9,12 @@
 #include <vulkan/vulkan_core.h>
 
 namespace utils {
-
-VkShaderModule crete_shader_module(const std::vector<char> &code,
-                                   VkDevice logical_device) {
+VkShaderModule create_shader_module(const uint32_t *code, size_t code_size,
+                                    VkDevice logical_device) {
   VkShaderModuleCreateInfo create_info{};
   create_info.sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO;
-  create_info.codeSize = code.size();
-  create_info.pCode = reinterpret_cast<const uint32_t *>(code.data());
+  create_info.codeSize = code_size;
+  create_info.pCode = code;
 
   VkShaderModule shader_module;
   if (vkCreateShaderModule(logical_device, &create_info, nullptr,
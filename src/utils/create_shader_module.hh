@@ -6,15 +6,14 @@
  */
 
 #pragma once
-#include <vector>
+#include <cstddef>
+#include <cstdint>
 #include <vulkan/vulkan_core.h>
 
 namespace utils {
-
 /**
- * @brief Creates a shader module based on the provided code
+ * @brief Creates a shader module from SPIR-V words. code_size is in bytes
  */
-
-VkShaderModule crete_shader_module(const std::vector<char> &code,
-                                   VkDevice logical_device);
+VkShaderModule create_shader_module(const uint32_t *code, size_t code_size,
+                                    VkDevice logical_device);
 } // namespace utils
@@ -0,0 +1,30 @@
+/**
+ * @file
+ * @author Ruben Pena <rubn.pena@gmail.com>
+ * @brief This file contains the lookup of the shaders compiled into the binary.
+ * The implementation is generated at build time by cmake/embed_spirv.cmake from
+ * every shader under shaders/
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
+
+namespace utils {
+/**
+ * @brief SPIR-V module embedded in the binary
+ */
+struct embedded_shader {
+  const char *name;     // Source file name, e.g. "def.vert"
+  const uint32_t *code; // 4 byte aligned SPIR-V words
+  size_t size;          // Size in bytes
+};
+
+/**
+ * @brief Finds a built-in shader by its source file name. Returns nullptr if
+ * there is no such shader
+ */
+const embedded_shader *find_embedded_shader(std::string_view name);
+} // namespace utils
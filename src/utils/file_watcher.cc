@@ -0,0 +1,77 @@
+/**
+ * @file
+ * @author Ruben Pena <rubn.pena@gmail.com>
+ * @brief This file contains the implementation of the file_watcher class
+ */
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <file_watcher.hh>
+#include <poll.h>
+#include <stdexcept>
+#include <sys/inotify.h>
+#include <unistd.h>
+
+namespace utils {
+file_watcher::~file_watcher() { close(); }
+
+void file_watcher::watch(const std::string &directory) {
+  close();
+  m_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+  if (m_fd < 0) {
+    throw std::runtime_error(std::string("failed to init inotify: ") +
+                             std::strerror(errno));
+  }
+  if (inotify_add_watch(m_fd, directory.c_str(),
+                        IN_CLOSE_WRITE | IN_MOVED_TO) < 0) {
+    int error = errno;
+    close();
+    throw std::runtime_error("failed to watch " + directory + ": " +
+                             std::strerror(error));
+  }
+}
+
+/**
+ * @brief Blocks up to timeout_ms for changes, then returns the names, without
+ * the directory, of every file changed since the last call. Each name appears
+ * once however many times it was written
+ */
+std::vector<std::string> file_watcher::wait_changes(int timeout_ms) {
+  std::vector<std::string> changed;
+  if (m_fd < 0)
+    return changed;
+
+  pollfd descriptor{m_fd, POLLIN, 0};
+  if (poll(&descriptor, 1, timeout_ms) <= 0)
+    return changed; // Timed out or interrupted
+
+  alignas(inotify_event) char buffer[4096];
+  for (;;) {
+    ssize_t length = read(m_fd, buffer, sizeof(buffer));
+    if (length <= 0)
+      break; // EAGAIN once the queue is drained
+
+    for (ssize_t offset = 0; offset < length;) {
+      const inotify_event *event =
+          reinterpret_cast<const inotify_event *>(buffer + offset);
+      offset += static_cast<ssize_t>(sizeof(inotify_event) + event->len);
+      if (event->len == 0)
+        continue; // The directory itself
+
+      std::string name = event->name;
+      if (std::find(changed.begin(), changed.end(), name) == changed.end()) {
+        changed.push_back(name);
+      }
+    }
+  }
+  return changed;
+}
+
+void file_watcher::close() {
+  if (m_fd >= 0) {
+    ::close(m_fd);
+    m_fd = -1;
+  } // Removes every watch of the descriptor
+}
+} // namespace utils
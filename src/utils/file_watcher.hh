@@ -0,0 +1,35 @@
+/**
+ * @file
+ * @author Ruben Pena <rubn.pena@gmail.com>
+ * @brief This file contains the file_watcher class, change notifications for
+ * the files of a directory. Util functions dont expect usage in a specific
+ * context
+ */
+
+#pragma once
+
+#include <string>
+#include <vector>
+
+namespace utils {
+/**
+ * @class
+ * @brief Watches a directory with inotify. A file counts as changed when it
+ * is closed after being written or moved into the directory, which covers
+ * editors that save through a temporary file and a rename. Closed on
+ * destruction, not copyable
+ */
+class file_watcher {
+  int m_fd = -1;
+
+public:
+  file_watcher() = default;
+  file_watcher(const file_watcher &) = delete;
+  file_watcher &operator=(const file_watcher &) = delete;
+  ~file_watcher();
+
+  void watch(const std::string &directory);
+  std::vector<std::string> wait_changes(int timeout_ms);
+  void close();
+};
+} // namespace utils
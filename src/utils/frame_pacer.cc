@@ -0,0 +1,94 @@
+/**
+ * @file
+ * @author Ruben Pena <rubn.pena@gmail.com>
+ * @brief This file contains the implementation of the utils/frame_pacer class
+ */
+
+#include <algorithm>
+#include <frame_pacer.hh>
+#include <percentile.hh>
+#include <thread>
+
+namespace utils {
+/**
+ * @brief Frames per second wait lets through, 0 or less removes the limit
+ */
+void frame_pacer::set_target_fps(double fps) {
+  if (fps <= 0.0) {
+    m_period = clock::duration::zero();
+    return;
+  }
+  m_period = std::chrono::duration_cast<clock::duration>(
+      std::chrono::duration<double>(1.0 / fps));
+  m_deadline = clock::now();
+}
+
+/**
+ * @brief Blocks until the next frame may start. Sleeps most of the way and
+ * spins the last M_SPIN_MARGIN, sleep granularity alone makes the frame times
+ * uneven. A late frame moves the schedule instead of bursting to catch up
+ */
+void frame_pacer::wait() {
+  if (m_period == clock::duration::zero())
+    return;
+
+  clock::time_point now = clock::now();
+  m_deadline = std::max(m_deadline + m_period, now - m_period);
+
+  if (m_deadline - now > M_SPIN_MARGIN) {
+    std::this_thread::sleep_until(m_deadline - M_SPIN_MARGIN);
+  }
+  while (clock::now() < m_deadline) {
+    std::this_thread::yield();
+  }
+}
+
+/**
+ * @brief The input the next frame reacts to has just been sampled
+ */
+void frame_pacer::mark_input() {
+  m_input_time = clock::now();
+  m_input_marked = true;
+}
+
+/**
+ * @brief The frame has been handed to the presentation engine. What the
+ * display adds after that is not visible to the CPU
+ */
+void frame_pacer::mark_presented() {
+  if (!m_input_marked)
+    return; // The frame was skipped or nothing was sampled
+
+  std::chrono::duration<double, std::milli> latency =
+      clock::now() - m_input_time;
+  m_input_marked = false;
+  m_last_ms = latency.count();
+
+  if (m_history.size() < M_HISTORY) {
+    m_history.push_back(m_last_ms);
+  } else {
+    m_history[m_next_sample] = m_last_ms;
+  }
+  m_next_sample = (m_next_sample + 1) % M_HISTORY;
+}
+
+latency_stats frame_pacer::get_latency() {
+  latency_stats stats;
+  if (m_history.empty())
+    return stats;
+
+  std::vector<double> sorted = m_history;
+  std::sort(sorted.begin(), sorted.end());
+
+  double total = 0.0;
+  for (double sample : sorted) {
+    total += sample;
+  }
+
+  stats.sample_count = static_cast<uint32_t>(sorted.size());
+  stats.last_ms = m_last_ms;
+  stats.avg_ms = total / sorted.size();
+  stats.p99_ms = percentile(sorted, 0.99);
+  return stats;
+}
+} // namespace utils
@@ -0,0 +1,53 @@
+/**
+ * @file
+ * @author Ruben Pena <rubn.pena@gmail.com>
+ * @brief This file contains the frame_pacer class. Util functions dont expect
+ * usage in a specific context
+ */
+
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <vector>
+
+namespace utils {
+/**
+ * @brief Rolling input to present latency, in milliseconds
+ */
+struct latency_stats {
+  uint32_t sample_count = 0;
+  double last_ms = 0.0;
+  double avg_ms = 0.0;
+  double p99_ms = 0.0;
+};
+
+/**
+ * @class
+ * @brief Limits the frame rate to a target with evenly spaced frame starts,
+ * and measures the time from sampling the input to handing the frame to the
+ * presentation engine. The frame loop calls wait, samples the input, calls
+ * mark_input, records and presents, then calls mark_presented
+ */
+class frame_pacer {
+  using clock = std::chrono::steady_clock;
+  static constexpr uint32_t M_HISTORY = 256;
+  static constexpr std::chrono::microseconds M_SPIN_MARGIN{1000};
+
+  clock::duration m_period = clock::duration::zero(); // Zero: unlimited
+  clock::time_point m_deadline;
+  clock::time_point m_input_time;
+  bool m_input_marked = false;
+
+  std::vector<double> m_history; // Ring of the last M_HISTORY samples
+  uint32_t m_next_sample = 0;
+  double m_last_ms = 0.0;
+
+public:
+  void set_target_fps(double fps);
+  void wait();
+  void mark_input();
+  void mark_presented();
+  latency_stats get_latency();
+};
+} // namespace utils
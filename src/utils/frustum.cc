@@ -0,0 +1,220 @@
+/**
+ * @file
+ * @author Ruben Pena <rubn.pena@gmail.com>
+ * @brief This file contains the implementation of the utils/frustum functions
+ */
+
+#include <frustum.hh>
+#include <glm/geometric.hpp>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define RT_CULL_X86
+#include <immintrin.h>
+#endif // AVX2 is picked at runtime, the build only assumes SSE
+
+namespace utils {
+void bounds_soa::clear() {
+  for (auto *array : {&center_x, &center_y, &center_z, &radius, &min_x,
+                      &min_y, &min_z, &max_x, &max_y, &max_z}) {
+    array->clear();
+  }
+}
+
+void bounds_soa::push_back(const glm::vec4 &sphere, const glm::vec3 &min,
+                           const glm::vec3 &max) {
+  center_x.push_back(sphere.x);
+  center_y.push_back(sphere.y);
+  center_z.push_back(sphere.z);
+  radius.push_back(sphere.w);
+  min_x.push_back(min.x);
+  min_y.push_back(min.y);
+  min_z.push_back(min.z);
+  max_x.push_back(max.x);
+  max_y.push_back(max.y);
+  max_z.push_back(max.z);
+}
+
+size_t bounds_soa::size() const { return radius.size(); }
+
+frustum extract_frustum(const glm::mat4 &view_proj) {
+  glm::vec4 rows[4];
+  for (int i = 0; i < 4; i++) {
+    rows[i] = glm::vec4(view_proj[0][i], view_proj[1][i], view_proj[2][i],
+                        view_proj[3][i]);
+  } // glm is column major
+
+  frustum result;
+  result.planes[0] = rows[3] + rows[0];
+  result.planes[1] = rows[3] - rows[0];
+  result.planes[2] = rows[3] + rows[1];
+  result.planes[3] = rows[3] - rows[1];
+  result.planes[4] = rows[2]; // 0 <= z, not -w <= z
+  result.planes[5] = rows[3] - rows[2];
+
+  for (auto &plane : result.planes) {
+    plane /= glm::length(glm::vec3(plane));
+  }
+  return result;
+}
+
+bool is_visible(const frustum &view, const glm::vec4 &sphere,
+                const glm::vec3 &min, const glm::vec3 &max) {
+  for (const auto &plane : view.planes) {
+    if (plane.x * sphere.x + plane.y * sphere.y + plane.z * sphere.z +
+            plane.w <
+        -sphere.w)
+      return false;
+
+    glm::vec3 positive(plane.x >= 0.0f ? max.x : min.x,
+                       plane.y >= 0.0f ? max.y : min.y,
+                       plane.z >= 0.0f ? max.z : min.z);
+    if (plane.x * positive.x + plane.y * positive.y + plane.z * positive.z +
+            plane.w <
+        0.0f)
+      return false;
+  } // The box corner furthest along the normal must be inside
+  return true;
+}
+
+namespace {
+/**
+ * @brief Per plane arrays of the box corner furthest along the normal. The
+ * plane is the same for every lane, so the choice is made once
+ */
+struct plane_corners {
+  const float *x[6];
+  const float *y[6];
+  const float *z[6];
+
+  plane_corners(const frustum &view, const bounds_soa &bounds) {
+    for (int p = 0; p < 6; p++) {
+      const glm::vec4 &plane = view.planes[p];
+      x[p] = plane.x >= 0.0f ? bounds.max_x.data() : bounds.min_x.data();
+      y[p] = plane.y >= 0.0f ? bounds.max_y.data() : bounds.min_y.data();
+      z[p] = plane.z >= 0.0f ? bounds.max_z.data() : bounds.min_z.data();
+    }
+  }
+};
+
+size_t cull_scalar(const frustum &view, const bounds_soa &bounds,
+                   size_t first, std::vector<uint32_t> &visible) {
+  for (size_t i = first; i < bounds.size(); i++) {
+    glm::vec4 sphere(bounds.center_x[i], bounds.center_y[i],
+                     bounds.center_z[i], bounds.radius[i]);
+    glm::vec3 min(bounds.min_x[i], bounds.min_y[i], bounds.min_z[i]);
+    glm::vec3 max(bounds.max_x[i], bounds.max_y[i], bounds.max_z[i]);
+    if (is_visible(view, sphere, min, max)) {
+      visible.push_back(static_cast<uint32_t>(i));
+    }
+  }
+  return bounds.size();
+}
+
+#ifdef RT_CULL_X86
+void push_mask(uint32_t mask, size_t first, std::vector<uint32_t> &visible) {
+  while (mask != 0) {
+    visible.push_back(static_cast<uint32_t>(first + __builtin_ctz(mask)));
+    mask &= mask - 1;
+  }
+}
+
+/**
+ * @brief 4 objects per iteration, returns the first object left untested
+ */
+size_t cull_sse(const frustum &view, const bounds_soa &bounds,
+                std::vector<uint32_t> &visible) {
+  plane_corners corners(view, bounds);
+  const __m128 zero = _mm_setzero_ps();
+  size_t count = bounds.size() & ~size_t(3);
+
+  for (size_t i = 0; i < count; i += 4) {
+    __m128 cx = _mm_loadu_ps(&bounds.center_x[i]);
+    __m128 cy = _mm_loadu_ps(&bounds.center_y[i]);
+    __m128 cz = _mm_loadu_ps(&bounds.center_z[i]);
+    __m128 neg_r = _mm_sub_ps(zero, _mm_loadu_ps(&bounds.radius[i]));
+    __m128 inside = _mm_castsi128_ps(_mm_set1_epi32(-1));
+
+    for (int p = 0; p < 6; p++) {
+      const glm::vec4 &plane = view.planes[p];
+      __m128 nx = _mm_set1_ps(plane.x);
+      __m128 ny = _mm_set1_ps(plane.y);
+      __m128 nz = _mm_set1_ps(plane.z);
+      __m128 nw = _mm_set1_ps(plane.w);
+
+      __m128 sphere_distance = _mm_add_ps(
+          _mm_add_ps(_mm_mul_ps(nx, cx), _mm_mul_ps(ny, cy)),
+          _mm_add_ps(_mm_mul_ps(nz, cz), nw));
+      __m128 box_distance = _mm_add_ps(
+          _mm_add_ps(_mm_mul_ps(nx, _mm_loadu_ps(&corners.x[p][i])),
+                     _mm_mul_ps(ny, _mm_loadu_ps(&corners.y[p][i]))),
+          _mm_add_ps(_mm_mul_ps(nz, _mm_loadu_ps(&corners.z[p][i])), nw));
+
+      inside = _mm_and_ps(inside, _mm_cmpge_ps(sphere_distance, neg_r));
+      inside = _mm_and_ps(inside, _mm_cmpge_ps(box_distance, zero));
+    }
+
+    push_mask(static_cast<uint32_t>(_mm_movemask_ps(inside)), i, visible);
+  }
+  return count;
+}
+
+/**
+ * @brief 8 objects per iteration, returns the first object left untested
+ */
+__attribute__((target("avx2,fma"))) size_t
+cull_avx2(const frustum &view, const bounds_soa &bounds,
+          std::vector<uint32_t> &visible) {
+  plane_corners corners(view, bounds);
+  const __m256 zero = _mm256_setzero_ps();
+  size_t count = bounds.size() & ~size_t(7);
+
+  for (size_t i = 0; i < count; i += 8) {
+    __m256 cx = _mm256_loadu_ps(&bounds.center_x[i]);
+    __m256 cy = _mm256_loadu_ps(&bounds.center_y[i]);
+    __m256 cz = _mm256_loadu_ps(&bounds.center_z[i]);
+    __m256 neg_r = _mm256_sub_ps(zero, _mm256_loadu_ps(&bounds.radius[i]));
+    __m256 inside = _mm256_castsi256_ps(_mm256_set1_epi32(-1));
+
+    for (int p = 0; p < 6; p++) {
+      const glm::vec4 &plane = view.planes[p];
+      __m256 nx = _mm256_set1_ps(plane.x);
+      __m256 ny = _mm256_set1_ps(plane.y);
+      __m256 nz = _mm256_set1_ps(plane.z);
+      __m256 nw = _mm256_set1_ps(plane.w);
+
+      __m256 sphere_distance = _mm256_fmadd_ps(
+          nx, cx, _mm256_fmadd_ps(ny, cy, _mm256_fmadd_ps(nz, cz, nw)));
+      __m256 box_distance = _mm256_fmadd_ps(
+          nx, _mm256_loadu_ps(&corners.x[p][i]),
+          _mm256_fmadd_ps(ny, _mm256_loadu_ps(&corners.y[p][i]),
+                          _mm256_fmadd_ps(nz, _mm256_loadu_ps(&corners.z[p][i]),
+                                          nw)));
+
+      inside = _mm256_and_ps(
+          inside, _mm256_cmp_ps(sphere_distance, neg_r, _CMP_GE_OQ));
+      inside = _mm256_and_ps(inside,
+                             _mm256_cmp_ps(box_distance, zero, _CMP_GE_OQ));
+    }
+
+    push_mask(static_cast<uint32_t>(_mm256_movemask_ps(inside)), i, visible);
+  }
+  return count;
+}
+#endif // RT_CULL_X86
+} // namespace
+
+void cull(const frustum &view, const bounds_soa &bounds,
+          std::vector<uint32_t> &visible) {
+  visible.clear();
+  visible.reserve(bounds.size());
+
+  size_t first = 0;
+#ifdef RT_CULL_X86
+  static const bool has_avx2 =
+      __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+  first = has_avx2 ? cull_avx2(view, bounds, visible)
+                   : cull_sse(view, bounds, visible);
+#endif // Other architectures test every object one by one
+  cull_scalar(view, bounds, first, visible); // Leftovers of the last batch
+}
+} // namespace utils
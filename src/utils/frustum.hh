@@ -0,0 +1,62 @@
+/**
+ * @file
+ * @author Ruben Pena <rubn.pena@gmail.com>
+ * @brief This file contains the frustum struct, its plane extraction and the
+ * frustum culling functions. Util functions dont expect usage in a specific
+ * context
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <glm/mat4x4.hpp>
+#include <glm/vec3.hpp>
+#include <glm/vec4.hpp>
+#include <vector>
+
+namespace utils {
+/**
+ * @brief Six normalized planes, xyz: normal pointing inside, w: distance.
+ * Order: left, right, bottom, top, near, far
+ */
+struct frustum {
+  glm::vec4 planes[6];
+};
+
+/**
+ * @brief Bounding sphere and box of every object, one array per component so
+ * consecutive objects fill a SIMD register
+ */
+struct bounds_soa {
+  std::vector<float> center_x, center_y, center_z, radius;
+  std::vector<float> min_x, min_y, min_z;
+  std::vector<float> max_x, max_y, max_z;
+
+  void clear();
+  void push_back(const glm::vec4 &sphere, const glm::vec3 &min,
+                 const glm::vec3 &max);
+  size_t size() const;
+};
+
+/**
+ * @brief Planes of a view projection matrix with a [0, 1] clip depth range,
+ * in the space the matrix transforms from
+ */
+frustum extract_frustum(const glm::mat4 &view_proj);
+
+/**
+ * @brief Whether the sphere and the box both intersect or are inside the
+ * frustum. Conservative, objects near the corners may pass
+ */
+bool is_visible(const frustum &view, const glm::vec4 &sphere,
+                const glm::vec3 &min, const glm::vec3 &max);
+
+/**
+ * @brief Replaces visible with the indices of the objects is_visible accepts,
+ * up to rounding right on a plane, in increasing order. Tests 8 objects per
+ * iteration with AVX2 when the CPU has it, 4 with SSE otherwise
+ */
+void cull(const frustum &view, const bounds_soa &bounds,
+          std::vector<uint32_t> &visible);
+} // namespace utils
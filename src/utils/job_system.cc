@@ -0,0 +1,268 @@
+/**
+ * @file
+ * @author Ruben Pena <rubn.pena@gmail.com>
+ * @brief This file contains the implementation of the utils/job_system class
+ */
+
+#include <algorithm>
+#include <job_system.hh>
+
+namespace utils {
+namespace {
+thread_local job_system *t_system = nullptr; // Pool the thread works for
+thread_local uint32_t t_queue = 0;
+} // namespace
+
+bool job_counter::is_done() const { return m_pending.load() == 0; }
+
+/**
+ * @brief Starts thread_count workers, 0 starts one per hardware thread but
+ * the calling one, which helps whenever it waits
+ */
+job_system::job_system(uint32_t thread_count) {
+  if (thread_count == 0) {
+    thread_count = std::max(1u, std::thread::hardware_concurrency()) - 1;
+  }
+
+  for (uint32_t i = 0; i <= thread_count; i++) {
+    m_queues.push_back(std::make_unique<job_queue>());
+  }
+  for (uint32_t i = 1; i <= thread_count; i++) {
+    m_threads.emplace_back(&job_system::worker_loop, this, i);
+  }
+}
+
+/**
+ * @brief Stops the workers. Jobs still queued are dropped
+ */
+job_system::~job_system() {
+  {
+    std::lock_guard<std::mutex> lock(m_sleep_mutex);
+    m_stop = true;
+  }
+  m_wake.notify_all();
+
+  for (auto &thread : m_threads) {
+    thread.join();
+  }
+}
+
+/**
+ * @brief The pool shared by loading, culling and recording, sized to the
+ * machine
+ */
+job_system &job_system::get() {
+  static job_system system;
+  return system;
+}
+
+uint32_t job_system::get_queue_index() {
+  return t_system == this ? t_queue : 0;
+}
+
+void job_system::push(job &&new_job) {
+  job_queue &queue = *m_queues[get_queue_index()];
+  {
+    std::lock_guard<std::mutex> lock(queue.mutex);
+    queue.jobs.push_back(std::move(new_job));
+  }
+  m_queued++;
+
+  {
+    std::lock_guard<std::mutex> lock(m_sleep_mutex);
+  } // A worker between its check and its wait would miss the notification
+  m_wake.notify_one();
+}
+
+/**
+ * @brief Pops the newest job of the caller's own queue, or steals the oldest
+ * job of another one
+ */
+bool job_system::try_pop(job &next) {
+  if (m_queued.load() == 0)
+    return false;
+
+  uint32_t own = get_queue_index();
+  {
+    job_queue &queue = *m_queues[own];
+    std::lock_guard<std::mutex> lock(queue.mutex);
+    if (!queue.jobs.empty()) {
+      next = std::move(queue.jobs.back());
+      queue.jobs.pop_back();
+      m_queued--;
+      return true;
+    }
+  }
+
+  size_t queue_count = m_queues.size();
+  for (size_t offset = 1; offset < queue_count; offset++) {
+    job_queue &queue = *m_queues[(own + offset) % queue_count];
+    std::lock_guard<std::mutex> lock(queue.mutex);
+    if (!queue.jobs.empty()) {
+      next = std::move(queue.jobs.front());
+      queue.jobs.pop_front();
+      m_queued--;
+      return true;
+    }
+  } // Start after our own queue, so thieves spread over the victims
+
+  return false;
+}
+
+void job_system::execute(job &current) {
+  try {
+    current.func();
+  } catch (...) {
+    if (current.counter != nullptr) {
+      std::lock_guard<std::mutex> lock(current.counter->m_mutex);
+      if (!current.counter->m_exception) {
+        current.counter->m_exception = std::current_exception();
+      }
+    }
+  }
+
+  job_counter *counter = current.counter;
+  if (counter == nullptr)
+    return;
+
+  uint32_t pending = counter->m_pending.load();
+  while (pending > 1) {
+    if (counter->m_pending.compare_exchange_weak(pending, pending - 1))
+      return;
+  } // Not the last job, the waiter can't be released by this decrement
+
+  std::vector<job_counter::continuation> continuations;
+  {
+    std::lock_guard<std::mutex> lock(counter->m_mutex);
+    if (counter->m_pending.fetch_sub(1) == 1) {
+      continuations.swap(counter->m_continuations);
+    }
+  } // wait takes this lock once it reads zero, the counter may die after it
+  for (auto &continuation : continuations) {
+    push({std::move(continuation.func), continuation.counter});
+  } // The dependency is met, their counters were raised by run_after
+}
+
+void job_system::worker_loop(uint32_t index) {
+  t_system = this;
+  t_queue = index;
+
+  while (true) {
+    job next;
+    if (try_pop(next)) {
+      execute(next);
+      continue;
+    }
+
+    std::unique_lock<std::mutex> lock(m_sleep_mutex);
+    m_wake.wait(lock, [this]() { return m_stop || m_queued.load() > 0; });
+    if (m_stop)
+      return;
+  }
+}
+
+/**
+ * @brief Queues func, counter (if any) is raised until it has run
+ */
+void job_system::run(std::function<void()> func, job_counter *counter) {
+  if (counter != nullptr) {
+    counter->m_pending++;
+  }
+  push({std::move(func), counter});
+}
+
+/**
+ * @brief Queues func once dependency reaches zero, right away if it already
+ * did. counter (if any) is raised from now on
+ */
+void job_system::run_after(job_counter &dependency, std::function<void()> func,
+                           job_counter *counter) {
+  if (counter != nullptr) {
+    counter->m_pending++;
+  }
+
+  {
+    std::lock_guard<std::mutex> lock(dependency.m_mutex);
+    if (dependency.m_pending.load() != 0) {
+      dependency.m_continuations.push_back({std::move(func), counter});
+      return;
+    }
+  } // The last job of the dependency drains the list under the same lock
+
+  push({std::move(func), counter});
+}
+
+/**
+ * @brief Runs queued jobs until counter reaches zero, then rethrows the first
+ * exception of its jobs
+ */
+void job_system::wait(job_counter &counter) {
+  while (counter.m_pending.load() != 0) {
+    job next;
+    if (try_pop(next)) {
+      execute(next);
+    } else {
+      std::this_thread::yield();
+    } // Whatever is left is running on other threads
+  }
+
+  std::exception_ptr exception;
+  {
+    std::lock_guard<std::mutex> lock(counter.m_mutex);
+    exception = counter.m_exception;
+    counter.m_exception = nullptr; // The counter can be reused
+  }
+  if (exception) {
+    std::rethrow_exception(exception);
+  }
+}
+
+/**
+ * @brief Calls func(i) for every i in [0, count) on up to max_threads threads,
+ * the calling one included, 0 uses every thread of the pool. Indices are
+ * handed out one at a time so items of very different cost still balance.
+ * The first exception thrown by func is rethrown once every call stopped
+ */
+void job_system::parallel_for(size_t count,
+                              const std::function<void(size_t)> &func,
+                              uint32_t max_threads) {
+  uint32_t threads = get_thread_count();
+  if (max_threads != 0) {
+    threads = std::min(threads, max_threads);
+  }
+  size_t job_count = std::min<size_t>(threads, count);
+
+  std::atomic<size_t> next{0};
+  std::atomic<bool> failed{false};
+  auto body = [&]() {
+    for (size_t i = next++; i < count && !failed; i = next++) {
+      try {
+        func(i);
+      } catch (...) {
+        failed = true;
+        throw;
+      }
+    }
+  };
+
+  job_counter counter;
+  for (size_t i = 1; i < job_count; i++) {
+    run(body, &counter);
+  }
+
+  try {
+    body(); // The caller works too instead of just waiting
+  } catch (...) {
+    try {
+      wait(counter);
+    } catch (...) {
+    } // Only the first exception is reported
+    throw;
+  }
+  wait(counter);
+}
+
+uint32_t job_system::get_thread_count() {
+  return static_cast<uint32_t>(m_threads.size()) + 1;
+}
+} // namespace utils
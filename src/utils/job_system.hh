@@ -0,0 +1,98 @@
+/**
+ * @file
+ * @author Ruben Pena <rubn.pena@gmail.com>
+ * @brief This file contains the job_system class, a work stealing thread pool.
+ * Util functions dont expect usage in a specific context
+ */
+
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace utils {
+class job_system;
+
+/**
+ * @class
+ * @brief Tracks a group of jobs. It reaches zero once every job ran, and jobs
+ * scheduled with run_after start at that point. The first exception thrown by
+ * its jobs is kept and rethrown by job_system::wait. Must outlive its jobs:
+ * once wait returns, no job touches it any more
+ */
+class job_counter {
+  friend class job_system;
+
+  struct continuation {
+    std::function<void()> func;
+    job_counter *counter;
+  };
+
+  std::atomic<uint32_t> m_pending{0};
+  std::mutex m_mutex; // Guards the continuations and the exception
+  std::vector<continuation> m_continuations;
+  std::exception_ptr m_exception;
+
+public:
+  bool is_done() const;
+};
+
+/**
+ * @class
+ * @brief Work stealing scheduler. Every worker owns a deque: it pushes and
+ * pops its own jobs at the back, in LIFO order while they are still in cache,
+ * and idle workers steal the oldest jobs from the front of the others. Jobs
+ * pushed from outside the pool, like the main thread, go to a shared deque.
+ * Threads that wait on a counter run jobs until it reaches zero instead of
+ * blocking, so waiting from inside a job never deadlocks
+ */
+class job_system {
+  struct job {
+    std::function<void()> func;
+    job_counter *counter = nullptr;
+  };
+
+  struct alignas(64) job_queue {
+    std::mutex mutex;
+    std::deque<job> jobs;
+  }; // Own cache line, no false sharing between workers
+
+  std::vector<std::unique_ptr<job_queue>> m_queues; // 0: external threads
+  std::vector<std::thread> m_threads;
+  std::atomic<size_t> m_queued{0}; // Jobs in every queue
+  std::mutex m_sleep_mutex;
+  std::condition_variable m_wake;
+  bool m_stop = false;
+
+  uint32_t get_queue_index();
+  void push(job &&new_job);
+  bool try_pop(job &next);
+  void execute(job &current);
+  void worker_loop(uint32_t index);
+
+public:
+  explicit job_system(uint32_t thread_count = 0);
+  ~job_system();
+  job_system(const job_system &) = delete;
+  job_system &operator=(const job_system &) = delete;
+
+  static job_system &get();
+
+  void run(std::function<void()> func, job_counter *counter = nullptr);
+  void run_after(job_counter &dependency, std::function<void()> func,
+                 job_counter *counter = nullptr);
+  void wait(job_counter &counter);
+  void parallel_for(size_t count, const std::function<void(size_t)> &func,
+                    uint32_t max_threads = 0);
+  uint32_t get_thread_count();
+};
+} // namespace utils
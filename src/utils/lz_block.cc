@@ -0,0 +1,170 @@
+/**
+ * @file
+ * @author Ruben Pena <rubn.pena@gmail.com>
+ * @brief This file contains the implementation of the utils/lz_block
+ * functions
+ */
+
+#include <algorithm>
+#include <cstring>
+#include <limits>
+#include <lz_block.hh>
+#include <stdexcept>
+
+namespace utils {
+static constexpr size_t MIN_MATCH = 4;
+static constexpr size_t LAST_LITERALS = 5; // The format ends on literals
+static constexpr size_t MATCH_LIMIT = 12;  // No match starts past size - 12
+static constexpr size_t MAX_OFFSET = 65535;
+static constexpr uint32_t HASH_BITS = 16;
+
+static uint32_t read32(const uint8_t *data) {
+  uint32_t value;
+  std::memcpy(&value, data, sizeof(value));
+  return value;
+}
+
+static uint32_t hash(uint32_t sequence) {
+  return (sequence * 2654435761u) >> (32 - HASH_BITS);
+}
+
+/**
+ * @brief Lengths of 15 and more spill into extra bytes of 255 and a rest
+ */
+static void write_length(std::vector<uint8_t> &out, size_t length) {
+  for (; length >= 255; length -= 255) {
+    out.push_back(255);
+  }
+  out.push_back(static_cast<uint8_t>(length));
+}
+
+static void write_sequence(std::vector<uint8_t> &out, const uint8_t *literals,
+                           size_t literal_count, size_t offset,
+                           size_t match_length) {
+  size_t match_code = match_length >= MIN_MATCH ? match_length - MIN_MATCH : 0;
+  uint8_t token = static_cast<uint8_t>((std::min<size_t>(literal_count, 15)
+                                        << 4) |
+                                       std::min<size_t>(match_code, 15));
+  out.push_back(token);
+  if (literal_count >= 15) {
+    write_length(out, literal_count - 15);
+  }
+  out.insert(out.end(), literals, literals + literal_count);
+  if (match_length == 0)
+    return; // The last sequence, literals only
+
+  out.push_back(static_cast<uint8_t>(offset & 0xff));
+  out.push_back(static_cast<uint8_t>(offset >> 8));
+  if (match_code >= 15) {
+    write_length(out, match_code - 15);
+  }
+}
+
+std::vector<uint8_t> lz_compress(const uint8_t *data, size_t size) {
+  std::vector<uint8_t> out;
+  if (size == 0 || size > std::numeric_limits<uint32_t>::max())
+    return out; // Positions are stored in 32 bits
+  out.reserve(size);
+
+  std::vector<uint32_t> table(size_t(1) << HASH_BITS, 0); // Position + 1
+  size_t anchor = 0;
+  size_t position = 0;
+  while (size > MATCH_LIMIT && position + MATCH_LIMIT <= size) {
+    uint32_t sequence = read32(data + position);
+    uint32_t &slot = table[hash(sequence)];
+    size_t candidate = slot;
+    slot = static_cast<uint32_t>(position + 1);
+
+    if (candidate == 0 || position - (candidate - 1) > MAX_OFFSET ||
+        read32(data + candidate - 1) != sequence) {
+      position++;
+      continue;
+    }
+    candidate--;
+
+    size_t length = MIN_MATCH;
+    while (position + length < size - LAST_LITERALS &&
+           data[candidate + length] == data[position + length]) {
+      length++;
+    }
+    write_sequence(out, data + anchor, position - anchor,
+                   position - candidate, length);
+    position += length;
+    anchor = position;
+    if (out.size() >= size)
+      return {}; // Not worth it, stored as is
+  }
+
+  write_sequence(out, data + anchor, size - anchor, 0, 0);
+  if (out.size() >= size)
+    return {};
+  return out;
+}
+
+/**
+ * @brief Reads the extra bytes of a length whose 4 bit code is 15
+ */
+static size_t read_length(const uint8_t *&input, const uint8_t *end) {
+  size_t length = 0;
+  uint8_t byte;
+  do {
+    if (input == end) {
+      throw std::runtime_error("lz: truncated length");
+    }
+    byte = *input++;
+    length += byte;
+  } while (byte == 255);
+  return length;
+}
+
+void lz_decompress(const uint8_t *data, size_t size, uint8_t *target,
+                   size_t target_size) {
+  const uint8_t *input = data;
+  const uint8_t *input_end = data + size;
+  size_t written = 0;
+
+  while (input < input_end) {
+    uint8_t token = *input++;
+    size_t literal_count = token >> 4;
+    if (literal_count == 15) {
+      literal_count += read_length(input, input_end);
+    }
+    if (literal_count > static_cast<size_t>(input_end - input) ||
+        literal_count > target_size - written) {
+      throw std::runtime_error("lz: literals out of bounds");
+    }
+    if (literal_count > 0) {
+      std::memcpy(target + written, input, literal_count);
+    }
+    input += literal_count;
+    written += literal_count;
+    if (input == input_end)
+      break; // The last sequence has no match
+
+    if (input_end - input < 2) {
+      throw std::runtime_error("lz: truncated offset");
+    }
+    size_t offset = input[0] | (size_t(input[1]) << 8);
+    input += 2;
+    if (offset == 0 || offset > written) {
+      throw std::runtime_error("lz: match offset out of bounds");
+    }
+
+    size_t length = token & 15;
+    if (length == 15) {
+      length += read_length(input, input_end);
+    }
+    length += MIN_MATCH;
+    if (length > target_size - written) {
+      throw std::runtime_error("lz: match out of bounds");
+    }
+    for (size_t i = 0; i < length; i++, written++) {
+      target[written] = target[written - offset];
+    } // Byte by byte, the match may overlap what it writes
+  }
+
+  if (written != target_size) {
+    throw std::runtime_error("lz: decompressed size mismatch");
+  }
+}
+} // namespace utils
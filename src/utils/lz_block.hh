@@ -0,0 +1,40 @@
+/**
+ * @file
+ * @author Ruben Pena <rubn.pena@gmail.com>
+ * @brief This file contains the lz_compress and lz_decompress functions, a
+ * byte oriented LZ77 codec in the LZ4 block format. Util functions dont
+ * expect usage in a specific context
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace utils {
+/**
+ * @brief Compresses size bytes into one LZ4 block. Greedy single probe
+ * matching: fast to write, and decoding, which is what loading waits on,
+ * only copies bytes. Returns an empty vector if the block would not be
+ * smaller than the input
+ */
+std::vector<uint8_t> lz_compress(const uint8_t *data, size_t size);
+
+/**
+ * @brief Decompresses the LZ4 block in data into exactly target_size bytes
+ * at target. Throws on malformed or truncated input, it never reads or
+ * writes out of bounds
+ */
+void lz_decompress(const uint8_t *data, size_t size, uint8_t *target,
+                   size_t target_size);
+
+/**
+ * @brief Most bytes size bytes of LZ4 block can decompress to: a length
+ * extension byte adds at most 255. Lets a reader reject a claimed size
+ * before allocating for it
+ */
+inline uint64_t lz_max_decompressed_size(uint64_t size) {
+  return size * 255 + 16;
+}
+} // namespace utils
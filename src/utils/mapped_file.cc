@@ -0,0 +1,133 @@
+/**
+ * @file
+ * @author Ruben Pena <rubn.pena@gmail.com>
+ * @brief This file contains the implementation of the utils/mapped_file class
+ */
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <mapped_file.hh>
+#include <stdexcept>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <utility>
+
+namespace utils {
+file_view file_view::subview(size_t offset, size_t count) const {
+  if (offset > size || count > size - offset) {
+    throw std::out_of_range("file view out of range");
+  }
+  return {data + offset, count};
+}
+
+const uint32_t *file_view::words() const {
+  check(alignof(uint32_t), size);
+  if (size % sizeof(uint32_t) != 0) {
+    throw std::runtime_error("file view is not a whole number of words");
+  }
+  return reinterpret_cast<const uint32_t *>(data);
+}
+
+void file_view::check(size_t alignment, size_t bytes) const {
+  if (bytes > size) {
+    throw std::out_of_range("file view out of range");
+  }
+  if (reinterpret_cast<uintptr_t>(data) % alignment != 0) {
+    throw std::runtime_error("file view is misaligned");
+  }
+}
+
+mapped_file::mapped_file(const std::string &file_name, access_hint hint) {
+  int fd = open(file_name.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd < 0) {
+    throw std::runtime_error("failed to open " + file_name + ": " +
+                             std::strerror(errno));
+  }
+
+  struct stat file_stat;
+  if (fstat(fd, &file_stat) != 0) {
+    close(fd);
+    throw std::runtime_error("failed to stat " + file_name);
+  }
+  m_size = static_cast<size_t>(file_stat.st_size);
+
+  if (m_size > 0) {
+    void *address = mmap(nullptr, m_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (address == MAP_FAILED) {
+      close(fd);
+      throw std::runtime_error("failed to map " + file_name + ": " +
+                               std::strerror(errno));
+    }
+    m_data = static_cast<std::byte *>(address);
+  } // mmap rejects empty files, they stay as an empty view
+
+  close(fd); // The mapping keeps its own reference to the file
+  advise(hint);
+}
+
+mapped_file::~mapped_file() { unmap(); }
+
+mapped_file::mapped_file(mapped_file &&other) noexcept
+    : m_data(std::exchange(other.m_data, nullptr)),
+      m_size(std::exchange(other.m_size, 0)) {}
+
+mapped_file &mapped_file::operator=(mapped_file &&other) noexcept {
+  if (this != &other) {
+    unmap();
+    m_data = std::exchange(other.m_data, nullptr);
+    m_size = std::exchange(other.m_size, 0);
+  }
+  return *this;
+}
+
+void mapped_file::unmap() {
+  if (m_data != nullptr) {
+    munmap(m_data, m_size);
+    m_data = nullptr;
+    m_size = 0;
+  }
+}
+
+/**
+ * @brief Tells the kernel how a range of the file is going to be read, e.g.
+ * will_need before handing a region to a worker thread. The range is widened
+ * to page boundaries
+ */
+void mapped_file::advise(access_hint hint, size_t offset, size_t count) {
+  if (m_data == nullptr || offset >= m_size)
+    return;
+
+  int advice = MADV_NORMAL;
+  switch (hint) {
+  case access_hint::normal:
+    advice = MADV_NORMAL;
+    break;
+  case access_hint::sequential:
+    advice = MADV_SEQUENTIAL;
+    break;
+  case access_hint::random:
+    advice = MADV_RANDOM;
+    break;
+  case access_hint::will_need:
+    advice = MADV_WILLNEED;
+    break;
+  }
+
+  size_t page_size = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+  size_t begin = offset - offset % page_size;
+  size_t end = offset + std::min(count, m_size - offset);
+
+  madvise(m_data + begin, end - begin, advice); // Only a hint, ignore errors
+}
+
+const std::byte *mapped_file::data() const { return m_data; }
+
+size_t mapped_file::size() const { return m_size; }
+
+bool mapped_file::empty() const { return m_size == 0; }
+
+file_view mapped_file::view() const { return {m_data, m_size}; }
+} // namespace utils
@@ -0,0 +1,74 @@
+/**
+ * @file
+ * @author Ruben Pena <rubn.pena@gmail.com>
+ * @brief This file contains the mapped_file class, a read only memory mapped
+ * view of a file. Util functions dont expect usage in a specific context
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+namespace utils {
+/**
+ * @brief How the mapped bytes are going to be read, forwarded to madvise
+ */
+enum class access_hint { normal, sequential, random, will_need };
+
+/**
+ * @brief Non owning window into a mapped file. Valid while the mapped_file it
+ * came from is alive
+ */
+struct file_view {
+  const std::byte *data = nullptr;
+  size_t size = 0;
+
+  file_view subview(size_t offset, size_t count) const;
+  const uint32_t *words() const; // Throws if not 4 byte aligned
+
+  /**
+   * @brief Reinterprets the view as an array of T, checking alignment and
+   * bounds. T must be trivially copyable
+   */
+  template <typename T> const T *as(size_t count = 1) const {
+    check(alignof(T), sizeof(T) * count);
+    return reinterpret_cast<const T *>(data);
+  }
+
+private:
+  void check(size_t alignment, size_t bytes) const;
+};
+
+/**
+ * @class
+ * @brief Read only mmap of a whole file. The mapping starts on a page boundary
+ * so the data is at least 4 byte aligned, which is what SPIR-V and most GPU
+ * buffer layouts need. Unmapped on destruction, movable but not copyable
+ */
+class mapped_file {
+  std::byte *m_data = nullptr;
+  size_t m_size = 0;
+
+  void unmap();
+
+public:
+  mapped_file() = default;
+  explicit mapped_file(const std::string &file_name,
+                       access_hint hint = access_hint::sequential);
+  ~mapped_file();
+
+  mapped_file(const mapped_file &) = delete;
+  mapped_file &operator=(const mapped_file &) = delete;
+  mapped_file(mapped_file &&other) noexcept;
+  mapped_file &operator=(mapped_file &&other) noexcept;
+
+  void advise(access_hint hint, size_t offset = 0, size_t count = SIZE_MAX);
+
+  const std::byte *data() const;
+  size_t size() const;
+  bool empty() const;
+  file_view view() const;
+};
+} // namespace utils
@@ -0,0 +1,16 @@
+/**
+ * @file
+ * @author Ruben Pena <rubn.pena@gmail.com>
+ * @brief This file contains the implementation of the utils/parallel_for
+ * function
+ */
+
+#include <job_system.hh>
+#include <parallel_for.hh>
+
+namespace utils {
+void parallel_for(size_t count, const std::function<void(size_t)> &func,
+                  uint32_t thread_count) {
+  job_system::get().parallel_for(count, func, thread_count);
+}
+} // namespace utils
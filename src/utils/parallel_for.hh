@@ -0,0 +1,24 @@
+/**
+ * @file
+ * @author Ruben Pena <rubn.pena@gmail.com>
+ * @brief This file contains the parallel_for function. Util functions dont
+ * expect usage in a specific context
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+
+namespace utils {
+/**
+ * @brief Calls func(i) for every i in [0, count) on up to thread_count threads
+ * of the shared job_system, the calling one included. 0 uses every thread of
+ * the pool. Indices are handed out one at a time, so items of very different
+ * cost still balance. The first exception thrown by func is rethrown once
+ * every thread has stopped
+ */
+void parallel_for(size_t count, const std::function<void(size_t)> &func,
+                  uint32_t thread_count = 0);
+} // namespace utils
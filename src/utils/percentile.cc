@@ -0,0 +1,20 @@
+/**
+ * @file
+ * @author Ruben Pena <rubn.pena@gmail.com>
+ * @brief This file contains the implementation of the utils/percentile
+ * function
+ */
+
+#include <algorithm>
+#include <cmath>
+#include <percentile.hh>
+
+namespace utils {
+double percentile(const std::vector<double> &sorted, double fraction) {
+  if (sorted.empty())
+    return 0.0;
+
+  size_t rank = static_cast<size_t>(std::ceil(fraction * sorted.size()));
+  return sorted[std::clamp<size_t>(rank, 1, sorted.size()) - 1];
+}
+} // namespace utils
@@ -0,0 +1,18 @@
+/**
+ * @file
+ * @author Ruben Pena <rubn.pena@gmail.com>
+ * @brief This file contains the percentile function. Util functions dont
+ * expect usage in a specific context
+ */
+
+#pragma once
+
+#include <vector>
+
+namespace utils {
+/**
+ * @brief Nearest rank percentile of samples sorted in ascending order,
+ * fraction in [0, 1]. Returns 0 for no samples
+ */
+double percentile(const std::vector<double> &sorted, double fraction);
+} // namespace utils
@@ -1,31 +0,0 @@
-/**
- * @file
- * @author Ruben Pena <rubn.pena@gmail.com>
- * @brief This file contains the implementation of the utils/read_file function
- */
-
-#include <fstream>
-#include <read_file.hh>
-#include <stdexcept>
-#include <unistd.h>
-
-namespace utils {
-
-std::vector<char> read_file(const std::string &filename) {
-  std::ifstream file(filename, std::ios::ate | std::ios::binary);
-
-  if (!file.is_open()) {
-    throw std::runtime_error("failed to open file!");
-  }
-
-  size_t file_size = static_cast<size_t>(file.tellg());
-  std::vector<char> buffer(file_size);
-
-  file.seekg(0);
-  file.read(buffer.data(), file_size);
-
-  file.close();
-
-  return buffer;
-}
-} // namespace utils
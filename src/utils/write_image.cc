@@ -0,0 +1,36 @@
+/**
+ * @file
+ * @author Ruben Pena <rubn.pena@gmail.com>
+ * @brief This file contains the implementation of the utils/write_ppm function
+ */
+
+#include <fstream>
+#include <stdexcept>
+#include <write_image.hh>
+
+namespace utils {
+void write_ppm(const std::string &file_name, uint32_t width, uint32_t height,
+               const std::vector<uint8_t> &rgba) {
+  if (rgba.size() < static_cast<size_t>(width) * height * 4) {
+    throw std::runtime_error("not enough pixels to write the image");
+  }
+
+  std::ofstream file(file_name, std::ios::binary);
+  if (!file.is_open()) {
+    throw std::runtime_error("failed to open file!");
+  }
+
+  file << "P6\n" << width << " " << height << "\n255\n";
+
+  std::vector<char> row(static_cast<size_t>(width) * 3);
+  for (uint32_t y = 0; y < height; y++) {
+    const uint8_t *src = rgba.data() + static_cast<size_t>(y) * width * 4;
+    for (uint32_t x = 0; x < width; x++) {
+      row[x * 3 + 0] = static_cast<char>(src[x * 4 + 0]);
+      row[x * 3 + 1] = static_cast<char>(src[x * 4 + 1]);
+      row[x * 3 + 2] = static_cast<char>(src[x * 4 + 2]);
+    }
+    file.write(row.data(), row.size());
+  }
+}
+} // namespace utils
@@ -0,0 +1,21 @@
+/**
+ * @file
+ * @author Ruben Pena <rubn.pena@gmail.com>
+ * @brief This file contains the write_ppm funcion. Util functions dont expect
+ * usage in a specific context
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace utils {
+/**
+ * @brief Writes tightly packed RGBA8 pixels as a binary PPM image. The alpha
+ * channel is dropped
+ */
+void write_ppm(const std::string &file_name, uint32_t width, uint32_t height,
+               const std::vector<uint8_t> &rgba);
+} // namespace utils
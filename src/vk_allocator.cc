@@ -0,0 +1,608 @@
+/**
+ * @file
+ * @author Ruben Pena <rubn.pena@gmail.com>
+ * @brief This file contains the implementation of the vk_allocator class
+ */
+
+#include <algorithm>
+#include <stdexcept>
+#include <vk_allocator.hh>
+
+static VkDeviceSize align_up(VkDeviceSize value, VkDeviceSize alignment) {
+  return (value + alignment - 1) / alignment * alignment;
+}
+
+static VkDeviceSize next_power_of_two(VkDeviceSize value) {
+  VkDeviceSize result = 1;
+  while (result < value) {
+    result <<= 1;
+  }
+  return result;
+}
+
+//---------------buddy_allocator---------------------
+
+/**
+ * @brief Manages size bytes (a power of two) split down to min_block nodes
+ */
+void buddy_allocator::init(VkDeviceSize size, VkDeviceSize min_block) {
+  m_min_block = min_block;
+  m_max_order = 0;
+  while ((m_min_block << m_max_order) < size) {
+    m_max_order++;
+  }
+
+  m_free.assign(m_max_order + 1, {});
+  m_free[m_max_order].insert(0);
+  m_free_bytes = node_size(m_max_order);
+}
+
+std::optional<VkDeviceSize> buddy_allocator::allocate(VkDeviceSize size,
+                                                      VkDeviceSize alignment,
+                                                      uint32_t &order) {
+  VkDeviceSize needed = std::max({size, alignment, m_min_block});
+
+  order = 0;
+  while (node_size(order) < needed) {
+    if (++order > m_max_order)
+      return std::nullopt; // Bigger than the whole block
+  }
+
+  uint32_t found = order;
+  while (found <= m_max_order && m_free[found].empty()) {
+    found++;
+  }
+  if (found > m_max_order)
+    return std::nullopt;
+
+  VkDeviceSize offset = *m_free[found].begin();
+  m_free[found].erase(m_free[found].begin());
+
+  while (found > order) {
+    found--;
+    m_free[found].insert(offset + node_size(found));
+  } // Split, keeping the lower half and freeing the upper buddy
+
+  m_free_bytes -= node_size(order);
+  return offset;
+}
+
+void buddy_allocator::free(VkDeviceSize offset, uint32_t order) {
+  m_free_bytes += node_size(order);
+
+  while (order < m_max_order) {
+    VkDeviceSize buddy = offset ^ node_size(order);
+    auto it = m_free[order].find(buddy);
+    if (it == m_free[order].end())
+      break;
+
+    m_free[order].erase(it);
+    offset = std::min(offset, buddy);
+    order++;
+  } // Merge with the buddy while it is free
+
+  m_free[order].insert(offset);
+}
+
+VkDeviceSize buddy_allocator::node_size(uint32_t order) {
+  return m_min_block << order;
+}
+
+VkDeviceSize buddy_allocator::get_free_bytes() { return m_free_bytes; }
+
+VkDeviceSize buddy_allocator::get_largest_free() {
+  for (uint32_t order = m_max_order + 1; order-- > 0;) {
+    if (!m_free[order].empty())
+      return node_size(order);
+  }
+  return 0;
+}
+
+//---------------linear_allocator--------------------
+
+void linear_allocator::init(VkDeviceSize size) {
+  m_size = size;
+  reset();
+}
+
+std::optional<VkDeviceSize>
+linear_allocator::allocate(VkDeviceSize size, VkDeviceSize alignment,
+                           resource_kind kind, VkDeviceSize granularity) {
+  VkDeviceSize offset = align_up(m_offset, alignment);
+  if (m_last_kind.has_value() && m_last_kind.value() != kind) {
+    offset = align_up(offset, granularity);
+  } // Start on a fresh page when switching between linear and optimal
+
+  if (offset + size > m_size)
+    return std::nullopt;
+
+  m_offset = offset + size;
+  m_last_kind = kind;
+  return offset;
+}
+
+void linear_allocator::reset() {
+  m_offset = 0;
+  m_last_kind.reset();
+}
+
+VkDeviceSize linear_allocator::get_free_bytes() { return m_size - m_offset; }
+
+//---------------vk_allocator------------------------
+
+void vk_allocator::init(VkPhysicalDevice physical_device, VkDevice device,
+                        VkDeviceSize block_size) {
+  m_device = device;
+  m_block_size = next_power_of_two(block_size);
+
+  VkPhysicalDeviceProperties properties;
+  vkGetPhysicalDeviceProperties(physical_device, &properties);
+  m_granularity = std::max<VkDeviceSize>(
+      properties.limits.bufferImageGranularity, 1);
+  m_max_allocations = properties.limits.maxMemoryAllocationCount;
+  m_atom_size =
+      std::max<VkDeviceSize>(properties.limits.nonCoherentAtomSize, 1);
+
+  vkGetPhysicalDeviceMemoryProperties(physical_device, &m_memory_properties);
+  m_pools.resize(m_memory_properties.memoryTypeCount);
+  m_dedicated.resize(m_memory_properties.memoryTypeCount);
+}
+
+/**
+ * @brief Frees every block. All the resources bound to them must be destroyed
+ */
+void vk_allocator::destroy() {
+  std::lock_guard<std::mutex> lock(m_mutex);
+
+  for (auto &pool : m_pools) {
+    for (auto &block : pool) {
+      if (block)
+        free_block(*block);
+    }
+    pool.clear();
+  }
+
+  for (auto &arena : m_arenas) {
+    for (auto &block : arena.blocks) {
+      free_block(*block);
+    }
+  }
+  m_arenas.clear();
+  std::fill(m_dedicated.begin(), m_dedicated.end(), allocator_stats{});
+}
+
+uint32_t vk_allocator::find_memory_type(uint32_t type_filter,
+                                        VkMemoryPropertyFlags properties) {
+  for (uint32_t i = 0; i < m_memory_properties.memoryTypeCount; i++) {
+    if ((type_filter & (1 << i)) &&
+        (m_memory_properties.memoryTypes[i].propertyFlags & properties) ==
+            properties) {
+      return i;
+    }
+  }
+
+  throw std::runtime_error("failed to find suitable memory type");
+}
+
+/**
+ * @brief Host visible memory the CPU has to flush and invalidate by hand
+ */
+bool vk_allocator::is_non_coherent(uint32_t memory_type) {
+  VkMemoryPropertyFlags flags =
+      m_memory_properties.memoryTypes[memory_type].propertyFlags;
+  return (flags & VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT) &&
+         !(flags & VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
+}
+
+/**
+ * @brief Alignment of a sub-allocation of memory_type. Non coherent memory
+ * is flushed in whole atoms, so allocations never share one
+ */
+VkDeviceSize vk_allocator::get_alignment(uint32_t memory_type,
+                                         VkDeviceSize alignment) {
+  return is_non_coherent(memory_type) ? std::max(alignment, m_atom_size)
+                                      : alignment;
+}
+
+/**
+ * @brief Non coherent blocks are a whole number of atoms, so a flush range
+ * rounded out to atoms never passes their end
+ */
+std::unique_ptr<memory_block>
+vk_allocator::allocate_block(uint32_t memory_type, VkDeviceSize size) {
+  if (m_max_allocations != 0 && m_device_allocations >= m_max_allocations) {
+    throw std::runtime_error("maxMemoryAllocationCount reached");
+  }
+  if (is_non_coherent(memory_type)) {
+    size = align_up(size, m_atom_size);
+  }
+
+  auto block = std::make_unique<memory_block>();
+  block->size = size;
+
+  VkMemoryAllocateInfo alloc_info{};
+  alloc_info.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+  alloc_info.allocationSize = size;
+  alloc_info.memoryTypeIndex = memory_type;
+
+  if (vkAllocateMemory(m_device, &alloc_info, nullptr, &block->memory) !=
+      VK_SUCCESS) {
+    throw std::runtime_error("failed to allocate device memory");
+  }
+  m_device_allocations++;
+
+  if (m_memory_properties.memoryTypes[memory_type].propertyFlags &
+      VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT) {
+    if (vkMapMemory(m_device, block->memory, 0, VK_WHOLE_SIZE, 0,
+                    &block->mapped) != VK_SUCCESS) {
+      throw std::runtime_error("failed to map device memory");
+    }
+  } // Host visible blocks stay mapped for their whole life
+
+  return block;
+}
+
+void vk_allocator::free_block(memory_block &block) {
+  if (block.mapped != nullptr) {
+    vkUnmapMemory(m_device, block.memory);
+  }
+  vkFreeMemory(m_device, block.memory, nullptr);
+  m_device_allocations--;
+}
+
+allocation vk_allocator::allocate_dedicated(uint32_t memory_type,
+                                            VkDeviceSize size) {
+  std::unique_ptr<memory_block> block = allocate_block(memory_type, size);
+
+  allocation result;
+  result.memory = block->memory;
+  result.offset = 0;
+  result.size = size;
+  result.mapped = block->mapped;
+  result.strategy = allocation_strategy::dedicated;
+  result.memory_type = memory_type;
+
+  allocator_stats &stats = m_dedicated[memory_type];
+  stats.device_allocations++;
+  stats.allocations++;
+  stats.reserved_bytes += size;
+  stats.used_bytes += size;
+  return result; // The block only carried the handles, the memory lives on
+}
+
+/**
+ * @brief Allocates memory for a long lived resource from the buddy pool of the
+ * first memory type with the requested properties
+ */
+allocation vk_allocator::allocate(const VkMemoryRequirements &requirements,
+                                  VkMemoryPropertyFlags properties,
+                                  resource_kind kind) {
+  std::lock_guard<std::mutex> lock(m_mutex);
+
+  uint32_t memory_type =
+      find_memory_type(requirements.memoryTypeBits, properties);
+
+  if (requirements.size > m_block_size / 2) {
+    return allocate_dedicated(memory_type, requirements.size);
+  } // Would waste most of a block
+
+  VkDeviceSize size = requirements.size;
+  VkDeviceSize alignment = get_alignment(memory_type, requirements.alignment);
+  if (kind == resource_kind::optimal) {
+    size = align_up(size, m_granularity);
+    alignment = std::max(alignment, m_granularity);
+  } // Optimal images own whole granularity pages, nothing linear can share
+
+  auto &pool = m_pools[memory_type];
+  std::optional<VkDeviceSize> offset;
+  uint32_t order = 0;
+  uint32_t block_index = 0;
+
+  for (; block_index < pool.size(); block_index++) {
+    if (!pool[block_index])
+      continue;
+    offset = pool[block_index]->buddy.allocate(size, alignment, order);
+    if (offset.has_value())
+      break;
+  }
+
+  if (!offset.has_value()) {
+    std::unique_ptr<memory_block> block =
+        allocate_block(memory_type, m_block_size);
+    block->buddy.init(m_block_size, M_MIN_BUDDY_NODE);
+    offset = block->buddy.allocate(size, alignment, order);
+
+    auto empty_slot = std::find(pool.begin(), pool.end(), nullptr);
+    block_index = static_cast<uint32_t>(empty_slot - pool.begin());
+    if (empty_slot == pool.end()) {
+      pool.push_back(std::move(block));
+    } else {
+      *empty_slot = std::move(block);
+    } // Slots are reused so indices held by live allocations stay valid
+  }
+
+  memory_block &block = *pool[block_index];
+  block.allocation_count++;
+  block.used_bytes += requirements.size;
+
+  allocation result;
+  result.memory = block.memory;
+  result.offset = offset.value();
+  result.size = requirements.size;
+  result.mapped = block.mapped == nullptr
+                      ? nullptr
+                      : static_cast<char *>(block.mapped) + result.offset;
+  result.strategy = allocation_strategy::buddy;
+  result.memory_type = memory_type;
+  result.block = block_index;
+  result.order = order;
+  return result;
+}
+
+/**
+ * @brief Returns the memory of a buddy or dedicated allocation. Linear
+ * allocations are only released by resetting their arena
+ */
+void vk_allocator::free(allocation &allocation) {
+  if (allocation.memory == VK_NULL_HANDLE)
+    return;
+
+  std::lock_guard<std::mutex> lock(m_mutex);
+
+  if (allocation.strategy == allocation_strategy::dedicated) {
+    memory_block block;
+    block.memory = allocation.memory;
+    block.mapped = allocation.mapped;
+    free_block(block);
+
+    allocator_stats &stats = m_dedicated[allocation.memory_type];
+    stats.device_allocations--;
+    stats.allocations--;
+    stats.reserved_bytes -= allocation.size;
+    stats.used_bytes -= allocation.size;
+  } else if (allocation.strategy == allocation_strategy::buddy) {
+    auto &pool = m_pools[allocation.memory_type];
+    memory_block &block = *pool[allocation.block];
+    block.buddy.free(allocation.offset, allocation.order);
+    block.allocation_count--;
+    block.used_bytes -= allocation.size;
+
+    size_t live_blocks =
+        pool.size() - std::count(pool.begin(), pool.end(), nullptr);
+    if (block.allocation_count == 0 && live_blocks > 1) {
+      free_block(block);
+      pool[allocation.block].reset();
+    } // Keep one empty block around so a free/allocate pair does not thrash
+  }
+
+  allocation = {};
+}
+
+/**
+ * @brief Creates an arena for per frame data. Reset it once the frame that
+ * used it has finished on the GPU
+ */
+uint32_t vk_allocator::create_linear_arena(VkMemoryPropertyFlags properties,
+                                           VkDeviceSize block_size) {
+  std::lock_guard<std::mutex> lock(m_mutex);
+
+  linear_arena arena;
+  arena.memory_type = find_memory_type(~0u, properties);
+  arena.block_size = block_size;
+  m_arenas.push_back(std::move(arena));
+  return static_cast<uint32_t>(m_arenas.size() - 1);
+}
+
+allocation vk_allocator::allocate_linear(
+    uint32_t arena_index, const VkMemoryRequirements &requirements,
+    resource_kind kind) {
+  std::lock_guard<std::mutex> lock(m_mutex);
+
+  linear_arena &arena = m_arenas[arena_index];
+  if (!(requirements.memoryTypeBits & (1 << arena.memory_type))) {
+    throw std::runtime_error("resource not compatible with the arena memory");
+  }
+
+  VkDeviceSize alignment =
+      get_alignment(arena.memory_type, requirements.alignment);
+  std::optional<VkDeviceSize> offset;
+  uint32_t block_index = 0;
+  for (; block_index < arena.blocks.size(); block_index++) {
+    offset = arena.blocks[block_index]->linear.allocate(
+        requirements.size, alignment, kind, m_granularity);
+    if (offset.has_value())
+      break;
+  }
+
+  if (!offset.has_value()) {
+    VkDeviceSize size = std::max(arena.block_size, requirements.size);
+    std::unique_ptr<memory_block> block =
+        allocate_block(arena.memory_type, size);
+    block->linear.init(block->size);
+    offset = block->linear.allocate(requirements.size, alignment, kind,
+                                    m_granularity);
+    arena.blocks.push_back(std::move(block));
+    block_index = static_cast<uint32_t>(arena.blocks.size() - 1);
+  } // The arena grows and keeps the new block after resets
+
+  memory_block &block = *arena.blocks[block_index];
+  block.allocation_count++;
+  block.used_bytes += requirements.size;
+
+  allocation result;
+  result.memory = block.memory;
+  result.offset = offset.value();
+  result.size = requirements.size;
+  result.mapped = block.mapped == nullptr
+                      ? nullptr
+                      : static_cast<char *>(block.mapped) + result.offset;
+  result.strategy = allocation_strategy::linear;
+  result.memory_type = arena.memory_type;
+  result.block = block_index;
+  return result;
+}
+
+void vk_allocator::reset_linear_arena(uint32_t arena_index) {
+  std::lock_guard<std::mutex> lock(m_mutex);
+
+  for (auto &block : m_arenas[arena_index].blocks) {
+    block->linear.reset();
+    block->allocation_count = 0;
+    block->used_bytes = 0;
+  }
+}
+
+allocation vk_allocator::create_buffer(const VkBufferCreateInfo &create_info,
+                                       VkMemoryPropertyFlags properties,
+                                       VkBuffer &buffer) {
+  if (vkCreateBuffer(m_device, &create_info, nullptr, &buffer) != VK_SUCCESS) {
+    throw std::runtime_error("failed to create buffer");
+  }
+
+  VkMemoryRequirements requirements;
+  vkGetBufferMemoryRequirements(m_device, buffer, &requirements);
+
+  allocation result = allocate(requirements, properties, resource_kind::linear);
+  vkBindBufferMemory(m_device, buffer, result.memory, result.offset);
+  return result;
+}
+
+allocation vk_allocator::create_image(const VkImageCreateInfo &create_info,
+                                      VkMemoryPropertyFlags properties,
+                                      VkImage &image) {
+  if (vkCreateImage(m_device, &create_info, nullptr, &image) != VK_SUCCESS) {
+    throw std::runtime_error("failed to create image");
+  }
+
+  VkMemoryRequirements requirements;
+  vkGetImageMemoryRequirements(m_device, image, &requirements);
+
+  resource_kind kind = create_info.tiling == VK_IMAGE_TILING_OPTIMAL
+                           ? resource_kind::optimal
+                           : resource_kind::linear;
+  allocation result = allocate(requirements, properties, kind);
+  vkBindImageMemory(m_device, image, result.memory, result.offset);
+  return result;
+}
+
+void vk_allocator::destroy_buffer(VkBuffer buffer, allocation &allocation) {
+  vkDestroyBuffer(m_device, buffer, nullptr);
+  free(allocation);
+}
+
+void vk_allocator::destroy_image(VkImage image, allocation &allocation) {
+  vkDestroyImage(m_device, image, nullptr);
+  free(allocation);
+}
+
+/**
+ * @brief Makes CPU writes to size bytes at offset of allocation visible to
+ * the device. Nothing to do for coherent memory. The range is rounded out to
+ * nonCoherentAtomSize, which stays inside the allocation's own atoms
+ */
+void vk_allocator::flush(const allocation &allocation, VkDeviceSize offset,
+                         VkDeviceSize size) {
+  if (!is_non_coherent(allocation.memory_type))
+    return;
+
+  VkMappedMemoryRange range = get_atom_range(allocation, offset, size);
+  if (vkFlushMappedMemoryRanges(m_device, 1, &range) != VK_SUCCESS) {
+    throw std::runtime_error("failed to flush mapped memory");
+  }
+}
+
+/**
+ * @brief Makes device writes to size bytes at offset of allocation visible
+ * to the CPU, the counterpart of flush
+ */
+void vk_allocator::invalidate(const allocation &allocation,
+                              VkDeviceSize offset, VkDeviceSize size) {
+  if (!is_non_coherent(allocation.memory_type))
+    return;
+
+  VkMappedMemoryRange range = get_atom_range(allocation, offset, size);
+  if (vkInvalidateMappedMemoryRanges(m_device, 1, &range) != VK_SUCCESS) {
+    throw std::runtime_error("failed to invalidate mapped memory");
+  }
+}
+
+VkMappedMemoryRange vk_allocator::get_atom_range(const allocation &allocation,
+                                                 VkDeviceSize offset,
+                                                 VkDeviceSize size) {
+  if (size == VK_WHOLE_SIZE) {
+    size = allocation.size - offset;
+  }
+  VkDeviceSize begin = allocation.offset + offset;
+
+  VkMappedMemoryRange range{};
+  range.sType = VK_STRUCTURE_TYPE_MAPPED_MEMORY_RANGE;
+  range.memory = allocation.memory;
+  range.offset = begin / m_atom_size * m_atom_size;
+  range.size = align_up(begin + size, m_atom_size) - range.offset;
+  return range;
+}
+
+void vk_allocator::add_block_stats(allocator_stats &stats, memory_block &block,
+                                   bool linear) {
+  VkDeviceSize free_bytes =
+      linear ? block.linear.get_free_bytes() : block.buddy.get_free_bytes();
+  VkDeviceSize largest_free =
+      linear ? block.linear.get_free_bytes() : block.buddy.get_largest_free();
+
+  stats.device_allocations++;
+  stats.allocations += block.allocation_count;
+  stats.reserved_bytes += block.size;
+  stats.used_bytes += block.used_bytes;
+  stats.free_bytes += free_bytes;
+  stats.largest_free = std::max(stats.largest_free, largest_free);
+}
+
+/**
+ * @brief Usage of a single memory type
+ */
+allocator_stats vk_allocator::get_stats(uint32_t memory_type) {
+  std::lock_guard<std::mutex> lock(m_mutex);
+
+  allocator_stats stats = m_dedicated[memory_type];
+
+  for (auto &block : m_pools[memory_type]) {
+    if (block)
+      add_block_stats(stats, *block, false);
+  }
+  for (auto &arena : m_arenas) {
+    if (arena.memory_type != memory_type)
+      continue;
+    for (auto &block : arena.blocks) {
+      add_block_stats(stats, *block, true);
+    }
+  }
+
+  if (stats.free_bytes > 0) {
+    stats.fragmentation =
+        1.0f - static_cast<float>(stats.largest_free) / stats.free_bytes;
+  }
+  return stats;
+}
+
+/**
+ * @brief Usage of all the memory types together
+ */
+allocator_stats vk_allocator::get_stats() {
+  allocator_stats total;
+
+  for (uint32_t i = 0; i < m_pools.size(); i++) {
+    allocator_stats stats = get_stats(i);
+    total.device_allocations += stats.device_allocations;
+    total.allocations += stats.allocations;
+    total.reserved_bytes += stats.reserved_bytes;
+    total.used_bytes += stats.used_bytes;
+    total.free_bytes += stats.free_bytes;
+    total.largest_free = std::max(total.largest_free, stats.largest_free);
+  }
+
+  if (total.free_bytes > 0) {
+    total.fragmentation =
+        1.0f - static_cast<float>(total.largest_free) / total.free_bytes;
+  }
+  return total;
+}
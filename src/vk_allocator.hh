@@ -0,0 +1,180 @@
+/**
+ * @file
+ * @author Ruben Pena <rubn.pena@gmail.com>
+ * @brief This file contains the declaration of the vk_allocator class, the
+ * device memory sub-allocator used by every buffer and image of the renderer.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <set>
+#include <vector>
+#include <vulkan/vulkan.h>
+
+/**
+ * @brief Linear resources (buffers, linear images) and optimal images may not
+ * share a bufferImageGranularity page
+ */
+enum class resource_kind { linear, optimal };
+
+enum class allocation_strategy { buddy, linear, dedicated };
+
+/**
+ * @brief Sub-allocation handed out by vk_allocator. memory + offset is what
+ * gets bound, the rest is bookkeeping to free it
+ */
+struct allocation {
+  VkDeviceMemory memory = VK_NULL_HANDLE;
+  VkDeviceSize offset = 0;
+  VkDeviceSize size = 0;
+  void *mapped = nullptr; // Persistent mapping if the memory is host visible
+
+  allocation_strategy strategy = allocation_strategy::buddy;
+  uint32_t memory_type = 0;
+  uint32_t block = 0; // Index of the block in its pool or arena
+  uint32_t order = 0; // Buddy order of the allocated node
+};
+
+/**
+ * @class
+ * @brief Power of two buddy allocator over a range of offsets. Blocks are
+ * aligned to their own size, which also satisfies any alignment up to it
+ */
+class buddy_allocator {
+  VkDeviceSize m_min_block = 0;
+  uint32_t m_max_order = 0;
+  std::vector<std::set<VkDeviceSize>> m_free; // Free nodes by order
+  VkDeviceSize m_free_bytes = 0;
+
+public:
+  void init(VkDeviceSize size, VkDeviceSize min_block);
+  std::optional<VkDeviceSize> allocate(VkDeviceSize size,
+                                       VkDeviceSize alignment,
+                                       uint32_t &order);
+  void free(VkDeviceSize offset, uint32_t order);
+  VkDeviceSize node_size(uint32_t order);
+  VkDeviceSize get_free_bytes();
+  VkDeviceSize get_largest_free();
+};
+
+/**
+ * @class
+ * @brief Bump allocator for short lived data, released all at once by reset
+ */
+class linear_allocator {
+  VkDeviceSize m_size = 0;
+  VkDeviceSize m_offset = 0;
+  std::optional<resource_kind> m_last_kind;
+
+public:
+  void init(VkDeviceSize size);
+  std::optional<VkDeviceSize> allocate(VkDeviceSize size,
+                                       VkDeviceSize alignment,
+                                       resource_kind kind,
+                                       VkDeviceSize granularity);
+  void reset();
+  VkDeviceSize get_free_bytes();
+};
+
+struct memory_block {
+  VkDeviceMemory memory = VK_NULL_HANDLE;
+  VkDeviceSize size = 0;
+  void *mapped = nullptr;
+  buddy_allocator buddy;
+  linear_allocator linear;
+  uint32_t allocation_count = 0;
+  VkDeviceSize used_bytes = 0;
+};
+
+/**
+ * @brief Usage of one memory type, or of all of them
+ */
+struct allocator_stats {
+  uint32_t device_allocations = 0; // vkAllocateMemory calls alive
+  uint32_t allocations = 0;        // Sub-allocations alive
+  VkDeviceSize reserved_bytes = 0; // Size of all the VkDeviceMemory blocks
+  VkDeviceSize used_bytes = 0;     // Bytes requested by the allocations
+  VkDeviceSize free_bytes = 0;
+  VkDeviceSize largest_free = 0;
+  float fragmentation = 0.0f; // 1 - largest_free / free_bytes
+};
+
+/**
+ * @class
+ * @brief Carves large VkDeviceMemory blocks into sub-allocations so the
+ * renderer stays far from maxMemoryAllocationCount. Long lived resources use a
+ * buddy allocator per memory type pool, per frame data uses linear arenas that
+ * are reset once the frame is done, and resources bigger than half a block
+ * get their own dedicated allocation. Thread safe
+ */
+class vk_allocator {
+  static constexpr VkDeviceSize M_DEFAULT_BLOCK_SIZE = 64ull << 20;
+  static constexpr VkDeviceSize M_MIN_BUDDY_NODE = 256;
+
+  struct linear_arena {
+    uint32_t memory_type = 0;
+    VkDeviceSize block_size = 0;
+    std::vector<std::unique_ptr<memory_block>> blocks;
+  };
+
+  VkDevice m_device = VK_NULL_HANDLE;
+  VkPhysicalDeviceMemoryProperties m_memory_properties{};
+  VkDeviceSize m_granularity = 1;
+  uint32_t m_max_allocations = 0;
+  uint32_t m_device_allocations = 0;
+  VkDeviceSize m_atom_size = 1; // nonCoherentAtomSize
+  VkDeviceSize m_block_size = M_DEFAULT_BLOCK_SIZE;
+
+  std::mutex m_mutex;
+  std::vector<std::vector<std::unique_ptr<memory_block>>> m_pools; // Per type
+  std::vector<linear_arena> m_arenas;
+  std::vector<allocator_stats> m_dedicated; // Per type, no block behind them
+
+  uint32_t find_memory_type(uint32_t type_filter,
+                            VkMemoryPropertyFlags properties);
+  bool is_non_coherent(uint32_t memory_type);
+  VkDeviceSize get_alignment(uint32_t memory_type, VkDeviceSize alignment);
+  VkMappedMemoryRange get_atom_range(const allocation &allocation,
+                                     VkDeviceSize offset, VkDeviceSize size);
+  std::unique_ptr<memory_block> allocate_block(uint32_t memory_type,
+                                               VkDeviceSize size);
+  void free_block(memory_block &block);
+  allocation allocate_dedicated(uint32_t memory_type, VkDeviceSize size);
+  void add_block_stats(allocator_stats &stats, memory_block &block,
+                       bool linear);
+
+public:
+  void init(VkPhysicalDevice physical_device, VkDevice device,
+            VkDeviceSize block_size = M_DEFAULT_BLOCK_SIZE);
+  void destroy();
+
+  allocation allocate(const VkMemoryRequirements &requirements,
+                      VkMemoryPropertyFlags properties, resource_kind kind);
+  void free(allocation &allocation);
+
+  uint32_t create_linear_arena(VkMemoryPropertyFlags properties,
+                               VkDeviceSize block_size);
+  allocation allocate_linear(uint32_t arena,
+                             const VkMemoryRequirements &requirements,
+                             resource_kind kind);
+  void reset_linear_arena(uint32_t arena);
+
+  allocation create_buffer(const VkBufferCreateInfo &create_info,
+                           VkMemoryPropertyFlags properties, VkBuffer &buffer);
+  allocation create_image(const VkImageCreateInfo &create_info,
+                          VkMemoryPropertyFlags properties, VkImage &image);
+  void destroy_buffer(VkBuffer buffer, allocation &allocation);
+  void destroy_image(VkImage image, allocation &allocation);
+
+  void flush(const allocation &allocation, VkDeviceSize offset = 0,
+             VkDeviceSize size = VK_WHOLE_SIZE);
+  void invalidate(const allocation &allocation, VkDeviceSize offset = 0,
+                  VkDeviceSize size = VK_WHOLE_SIZE);
+
+  allocator_stats get_stats();
+  allocator_stats get_stats(uint32_t memory_type);
+};
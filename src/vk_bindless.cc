@@ -0,0 +1,216 @@
+/**
+ * @file
+ * @author Ruben Pena <rubn.pena@gmail.com>
+ * @brief This file contains the implementation of the bindless_heap class
+ */
+
+#include <algorithm>
+#include <stdexcept>
+#include <vk_bindless.hh>
+
+/**
+ * @brief Creates the layout, the pool and the set, with arrays as large as
+ * the device allows up to M_MAX_IMAGES and M_MAX_BUFFERS
+ */
+void bindless_heap::create(VkPhysicalDevice physical_device, VkDevice device) {
+  m_device = device;
+
+  VkPhysicalDeviceDescriptorIndexingProperties indexing_properties{};
+  indexing_properties.sType =
+      VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DESCRIPTOR_INDEXING_PROPERTIES;
+  VkPhysicalDeviceProperties2 properties{};
+  properties.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PROPERTIES_2;
+  properties.pNext = &indexing_properties;
+  vkGetPhysicalDeviceProperties2(physical_device, &properties);
+
+  m_image_capacity = std::min(
+      {M_MAX_IMAGES,
+       indexing_properties.maxPerStageDescriptorUpdateAfterBindSampledImages,
+       indexing_properties.maxDescriptorSetUpdateAfterBindSampledImages});
+  m_buffer_capacity = std::min(
+      {M_MAX_BUFFERS,
+       indexing_properties.maxPerStageDescriptorUpdateAfterBindStorageBuffers,
+       indexing_properties.maxDescriptorSetUpdateAfterBindStorageBuffers});
+
+  VkSamplerCreateInfo sampler_info{};
+  sampler_info.sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO;
+  sampler_info.magFilter = VK_FILTER_LINEAR;
+  sampler_info.minFilter = VK_FILTER_LINEAR;
+  sampler_info.mipmapMode = VK_SAMPLER_MIPMAP_MODE_LINEAR;
+  sampler_info.addressModeU = VK_SAMPLER_ADDRESS_MODE_REPEAT;
+  sampler_info.addressModeV = VK_SAMPLER_ADDRESS_MODE_REPEAT;
+  sampler_info.addressModeW = VK_SAMPLER_ADDRESS_MODE_REPEAT;
+  sampler_info.maxLod = VK_LOD_CLAMP_NONE;
+
+  if (vkCreateSampler(m_device, &sampler_info, nullptr, &m_sampler) !=
+      VK_SUCCESS) {
+    throw std::runtime_error("failed to create bindless sampler");
+  }
+
+  VkDescriptorSetLayoutBinding bindings[3]{};
+  bindings[IMAGE_BINDING].binding = IMAGE_BINDING;
+  bindings[IMAGE_BINDING].descriptorType = VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE;
+  bindings[IMAGE_BINDING].descriptorCount = m_image_capacity;
+  bindings[IMAGE_BINDING].stageFlags = VK_SHADER_STAGE_ALL;
+  bindings[SAMPLER_BINDING].binding = SAMPLER_BINDING;
+  bindings[SAMPLER_BINDING].descriptorType = VK_DESCRIPTOR_TYPE_SAMPLER;
+  bindings[SAMPLER_BINDING].descriptorCount = 1;
+  bindings[SAMPLER_BINDING].stageFlags = VK_SHADER_STAGE_ALL;
+  bindings[SAMPLER_BINDING].pImmutableSamplers = &m_sampler;
+  bindings[BUFFER_BINDING].binding = BUFFER_BINDING;
+  bindings[BUFFER_BINDING].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+  bindings[BUFFER_BINDING].descriptorCount = m_buffer_capacity;
+  bindings[BUFFER_BINDING].stageFlags = VK_SHADER_STAGE_ALL;
+
+  const VkDescriptorBindingFlags array_flags =
+      VK_DESCRIPTOR_BINDING_UPDATE_AFTER_BIND_BIT |
+      VK_DESCRIPTOR_BINDING_UPDATE_UNUSED_WHILE_PENDING_BIT |
+      VK_DESCRIPTOR_BINDING_PARTIALLY_BOUND_BIT;
+  VkDescriptorBindingFlags binding_flags[3] = {array_flags, 0, array_flags};
+
+  VkDescriptorSetLayoutBindingFlagsCreateInfo flags_info{};
+  flags_info.sType =
+      VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_BINDING_FLAGS_CREATE_INFO;
+  flags_info.bindingCount = 3;
+  flags_info.pBindingFlags = binding_flags;
+
+  VkDescriptorSetLayoutCreateInfo layout_info{};
+  layout_info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+  layout_info.pNext = &flags_info;
+  layout_info.flags =
+      VK_DESCRIPTOR_SET_LAYOUT_CREATE_UPDATE_AFTER_BIND_POOL_BIT;
+  layout_info.bindingCount = 3;
+  layout_info.pBindings = bindings;
+
+  if (vkCreateDescriptorSetLayout(m_device, &layout_info, nullptr,
+                                  &m_layout) != VK_SUCCESS) {
+    throw std::runtime_error("failed to create bindless set layout");
+  }
+
+  VkDescriptorPoolSize pool_sizes[3] = {
+      {VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE, m_image_capacity},
+      {VK_DESCRIPTOR_TYPE_SAMPLER, 1},
+      {VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, m_buffer_capacity}};
+
+  VkDescriptorPoolCreateInfo pool_info{};
+  pool_info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+  pool_info.flags = VK_DESCRIPTOR_POOL_CREATE_UPDATE_AFTER_BIND_BIT;
+  pool_info.maxSets = 1;
+  pool_info.poolSizeCount = 3;
+  pool_info.pPoolSizes = pool_sizes;
+
+  if (vkCreateDescriptorPool(m_device, &pool_info, nullptr, &m_pool) !=
+      VK_SUCCESS) {
+    throw std::runtime_error("failed to create bindless descriptor pool");
+  }
+
+  VkDescriptorSetAllocateInfo alloc_info{};
+  alloc_info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+  alloc_info.descriptorPool = m_pool;
+  alloc_info.descriptorSetCount = 1;
+  alloc_info.pSetLayouts = &m_layout;
+
+  if (vkAllocateDescriptorSets(m_device, &alloc_info, &m_set) != VK_SUCCESS) {
+    throw std::runtime_error("failed to allocate bindless descriptor set");
+  }
+}
+
+void bindless_heap::destroy() {
+  vkDestroyDescriptorPool(m_device, m_pool, nullptr); // Frees the set
+  vkDestroyDescriptorSetLayout(m_device, m_layout, nullptr);
+  vkDestroySampler(m_device, m_sampler, nullptr);
+  m_pool = VK_NULL_HANDLE;
+  m_layout = VK_NULL_HANDLE;
+  m_sampler = VK_NULL_HANDLE;
+  m_set = VK_NULL_HANDLE;
+}
+
+/**
+ * @brief Writes a view in SHADER_READ_ONLY_OPTIMAL layout into a free slot of
+ * the image array and returns its index
+ */
+uint32_t bindless_heap::add_image(VkImageView view) {
+  std::lock_guard<std::mutex> lock(m_mutex);
+
+  uint32_t index;
+  if (!m_free_images.empty()) {
+    index = m_free_images.back();
+    m_free_images.pop_back();
+  } else if (m_image_count < m_image_capacity) {
+    index = m_image_count++;
+  } else {
+    throw std::runtime_error("bindless image array is full");
+  }
+
+  VkDescriptorImageInfo image_info{};
+  image_info.imageView = view;
+  image_info.imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+
+  VkWriteDescriptorSet write{};
+  write.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+  write.dstSet = m_set;
+  write.dstBinding = IMAGE_BINDING;
+  write.dstArrayElement = index;
+  write.descriptorCount = 1;
+  write.descriptorType = VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE;
+  write.pImageInfo = &image_info;
+
+  vkUpdateDescriptorSets(m_device, 1, &write, 0, nullptr);
+  return index;
+}
+
+/**
+ * @brief Writes a storage buffer range into a free slot of the buffer array
+ * and returns its index
+ */
+uint32_t bindless_heap::add_buffer(VkBuffer buffer, VkDeviceSize offset,
+                                   VkDeviceSize range) {
+  std::lock_guard<std::mutex> lock(m_mutex);
+
+  uint32_t index;
+  if (!m_free_buffers.empty()) {
+    index = m_free_buffers.back();
+    m_free_buffers.pop_back();
+  } else if (m_buffer_count < m_buffer_capacity) {
+    index = m_buffer_count++;
+  } else {
+    throw std::runtime_error("bindless buffer array is full");
+  }
+
+  VkDescriptorBufferInfo buffer_info{};
+  buffer_info.buffer = buffer;
+  buffer_info.offset = offset;
+  buffer_info.range = range;
+
+  VkWriteDescriptorSet write{};
+  write.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+  write.dstSet = m_set;
+  write.dstBinding = BUFFER_BINDING;
+  write.dstArrayElement = index;
+  write.descriptorCount = 1;
+  write.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+  write.pBufferInfo = &buffer_info;
+
+  vkUpdateDescriptorSets(m_device, 1, &write, 0, nullptr);
+  return index;
+}
+
+/**
+ * @brief Frees the slot for reuse. The GPU must be done with it, the
+ * descriptor is left as is since the array is partially bound
+ */
+void bindless_heap::remove_image(uint32_t index) {
+  std::lock_guard<std::mutex> lock(m_mutex);
+  m_free_images.push_back(index);
+}
+
+void bindless_heap::remove_buffer(uint32_t index) {
+  std::lock_guard<std::mutex> lock(m_mutex);
+  m_free_buffers.push_back(index);
+}
+
+uint32_t bindless_heap::get_image_capacity() { return m_image_capacity; }
+
+VkDescriptorSetLayout bindless_heap::get_layout() { return m_layout; }
+
+VkDescriptorSet bindless_heap::get_set() { return m_set; }
@@ -0,0 +1,61 @@
+/**
+ * @file
+ * @author Ruben Pena <rubn.pena@gmail.com>
+ * @brief This file contains the declaration of the bindless_heap class, the
+ * descriptor set every shader reads its resources from.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <mutex>
+#include <vector>
+#include <vulkan/vulkan.h>
+
+/**
+ * @class
+ * @brief One update-after-bind descriptor set holding every sampled image and
+ * storage buffer of the renderer in large arrays. Resources are registered
+ * once and referred to by their array index, passed to the shaders through
+ * push constants or other buffers, so the set is bound once per command
+ * buffer no matter how many materials are drawn. Bindings:
+ * 0: texture2D[] images, 1: the shared linear sampler, 2: buffer[] storage
+ * buffers. Thread safe
+ */
+class bindless_heap {
+  static constexpr uint32_t M_MAX_IMAGES = 16384;
+  static constexpr uint32_t M_MAX_BUFFERS = 4096;
+
+  VkDevice m_device = VK_NULL_HANDLE;
+  VkSampler m_sampler = VK_NULL_HANDLE;
+  VkDescriptorSetLayout m_layout = VK_NULL_HANDLE;
+  VkDescriptorPool m_pool = VK_NULL_HANDLE;
+  VkDescriptorSet m_set = VK_NULL_HANDLE;
+
+  uint32_t m_image_capacity = 0;
+  uint32_t m_buffer_capacity = 0;
+  uint32_t m_image_count = 0; // High water marks, freed slots are reused
+  uint32_t m_buffer_count = 0;
+  std::vector<uint32_t> m_free_images;
+  std::vector<uint32_t> m_free_buffers;
+
+  std::mutex m_mutex;
+
+public:
+  static constexpr uint32_t IMAGE_BINDING = 0;
+  static constexpr uint32_t SAMPLER_BINDING = 1;
+  static constexpr uint32_t BUFFER_BINDING = 2;
+
+  void create(VkPhysicalDevice physical_device, VkDevice device);
+  void destroy();
+
+  uint32_t add_image(VkImageView view);
+  uint32_t add_buffer(VkBuffer buffer, VkDeviceSize offset = 0,
+                      VkDeviceSize range = VK_WHOLE_SIZE);
+  void remove_image(uint32_t index);
+  void remove_buffer(uint32_t index);
+
+  uint32_t get_image_capacity();
+  VkDescriptorSetLayout get_layout();
+  VkDescriptorSet get_set();
+};
@@ -0,0 +1,633 @@
+/**
+ * @file
+ * @author Ruben Pena <rubn.pena@gmail.com>
+ * @brief This file contains the implementation of the device_benchmark class
+ */
+
+#include <cmath>
+#include <create_shader_module.hh>
+#include <cstdio>
+#include <embedded_shaders.hh>
+#include <fstream>
+#include <iostream>
+#include <nlohmann/json.hpp>
+#include <stdexcept>
+#include <vector>
+#include <vk_allocator.hh>
+#include <vk_device_benchmark.hh>
+
+double device_timings::get_score() const {
+  return std::sqrt(fill_gpixels * compute_gflops);
+}
+
+/**
+ * @brief Every object the benchmark creates, so a failure half way through
+ * still releases the ones that exist
+ */
+struct benchmark_context {
+  VkDevice device = VK_NULL_HANDLE;
+  vk_allocator allocator;
+  bool allocator_ready = false;
+  VkCommandPool command_pool = VK_NULL_HANDLE;
+  VkFence fence = VK_NULL_HANDLE;
+  VkQueryPool timestamps = VK_NULL_HANDLE;
+
+  VkImage color_image = VK_NULL_HANDLE;
+  allocation color_allocation;
+  VkImageView color_view = VK_NULL_HANDLE;
+  VkRenderPass render_pass = VK_NULL_HANDLE;
+  VkFramebuffer framebuffer = VK_NULL_HANDLE;
+  VkShaderModule fill_shaders[2] = {VK_NULL_HANDLE, VK_NULL_HANDLE};
+  VkPipelineLayout fill_layout = VK_NULL_HANDLE;
+  VkPipeline fill_pipeline = VK_NULL_HANDLE;
+
+  VkBuffer result_buffer = VK_NULL_HANDLE;
+  allocation result_allocation;
+  VkDescriptorSetLayout set_layout = VK_NULL_HANDLE;
+  VkDescriptorPool descriptor_pool = VK_NULL_HANDLE;
+  VkShaderModule compute_shader = VK_NULL_HANDLE;
+  VkPipelineLayout compute_layout = VK_NULL_HANDLE;
+  VkPipeline compute_pipeline = VK_NULL_HANDLE;
+
+  void destroy() {
+    if (device == VK_NULL_HANDLE)
+      return;
+
+    vkDeviceWaitIdle(device);
+    vkDestroyPipeline(device, compute_pipeline, nullptr);
+    vkDestroyPipelineLayout(device, compute_layout, nullptr);
+    vkDestroyShaderModule(device, compute_shader, nullptr);
+    vkDestroyDescriptorPool(device, descriptor_pool, nullptr);
+    vkDestroyDescriptorSetLayout(device, set_layout, nullptr);
+    vkDestroyPipeline(device, fill_pipeline, nullptr);
+    vkDestroyPipelineLayout(device, fill_layout, nullptr);
+    vkDestroyShaderModule(device, fill_shaders[0], nullptr);
+    vkDestroyShaderModule(device, fill_shaders[1], nullptr);
+    vkDestroyFramebuffer(device, framebuffer, nullptr);
+    vkDestroyRenderPass(device, render_pass, nullptr);
+    vkDestroyImageView(device, color_view, nullptr);
+    if (allocator_ready) {
+      if (result_buffer != VK_NULL_HANDLE) {
+        allocator.destroy_buffer(result_buffer, result_allocation);
+      }
+      if (color_image != VK_NULL_HANDLE) {
+        allocator.destroy_image(color_image, color_allocation);
+      }
+      allocator.destroy();
+    }
+    vkDestroyQueryPool(device, timestamps, nullptr);
+    vkDestroyFence(device, fence, nullptr);
+    vkDestroyCommandPool(device, command_pool, nullptr);
+    vkDestroyDevice(device, nullptr);
+    device = VK_NULL_HANDLE;
+  }
+};
+
+static VkShaderModule load_shader(VkDevice device, const char *name) {
+  const utils::embedded_shader *shader = utils::find_embedded_shader(name);
+  if (shader == nullptr) {
+    throw std::runtime_error(std::string("missing built-in shader ") + name);
+  }
+  return utils::create_shader_module(shader->code, shader->size, device);
+}
+
+/**
+ * @brief Queue family that can draw, dispatch and write timestamps, or
+ * UINT32_MAX when there is none
+ */
+static uint32_t find_benchmark_family(VkPhysicalDevice physical_device) {
+  uint32_t family_count = 0;
+  vkGetPhysicalDeviceQueueFamilyProperties(physical_device, &family_count,
+                                           nullptr);
+  std::vector<VkQueueFamilyProperties> families(family_count);
+  vkGetPhysicalDeviceQueueFamilyProperties(physical_device, &family_count,
+                                           families.data());
+
+  VkQueueFlags required = VK_QUEUE_GRAPHICS_BIT | VK_QUEUE_COMPUTE_BIT;
+  for (uint32_t i = 0; i < family_count; i++) {
+    if ((families[i].queueFlags & required) == required &&
+        families[i].timestampValidBits > 0)
+      return i;
+  }
+  return UINT32_MAX;
+}
+
+void device_benchmark::set_cache_path(const std::string &path) {
+  m_cache_path = path;
+  m_cache.clear();
+  m_cache_loaded = false;
+}
+
+/**
+ * @brief Cached timings of the device, measured now if this device and driver
+ * were never seen before
+ */
+device_timings device_benchmark::measure(VkPhysicalDevice physical_device) {
+  if (!m_cache_loaded) {
+    load_cache();
+    m_cache_loaded = true;
+  }
+
+  std::string key = get_cache_key(physical_device);
+  auto cached = m_cache.find(key);
+  if (cached != m_cache.end())
+    return cached->second;
+
+  device_timings timings = run(physical_device);
+  if (timings.measured) {
+    m_cache[key] = timings;
+    save_cache();
+  }
+  return timings;
+}
+
+/**
+ * @brief Device UUID in hex followed by the driver version, a driver update
+ * invalidates the results
+ */
+std::string device_benchmark::get_cache_key(VkPhysicalDevice physical_device) {
+  VkPhysicalDeviceIDProperties id_properties{};
+  id_properties.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_ID_PROPERTIES;
+  VkPhysicalDeviceProperties2 properties{};
+  properties.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PROPERTIES_2;
+  properties.pNext = &id_properties;
+  vkGetPhysicalDeviceProperties2(physical_device, &properties);
+
+  std::string key;
+  char digits[3];
+  for (uint32_t i = 0; i < VK_UUID_SIZE; i++) {
+    std::snprintf(digits, sizeof(digits), "%02x", id_properties.deviceUUID[i]);
+    key += digits;
+  }
+  return key + "-" + std::to_string(properties.properties.driverVersion);
+}
+
+void device_benchmark::load_cache() {
+  if (m_cache_path.empty())
+    return;
+
+  std::ifstream file(m_cache_path);
+  if (!file)
+    return; // First launch, nothing cached yet
+
+  try {
+    nlohmann::json cache = nlohmann::json::parse(file);
+    for (const auto &[key, entry] : cache.at("devices").items()) {
+      device_timings timings;
+      timings.fill_gpixels = entry.at("fill_gpixels").get<double>();
+      timings.compute_gflops = entry.at("compute_gflops").get<double>();
+      timings.measured = true;
+      m_cache[key] = timings;
+    }
+  } catch (const std::exception &e) {
+    std::cerr << "device benchmark: discarding corrupt " << m_cache_path
+              << ": " << e.what() << std::endl;
+    m_cache.clear();
+  }
+}
+
+void device_benchmark::save_cache() {
+  if (m_cache_path.empty())
+    return;
+
+  nlohmann::json devices = nlohmann::json::object();
+  for (const auto &[key, timings] : m_cache) {
+    devices[key] = {{"fill_gpixels", timings.fill_gpixels},
+                    {"compute_gflops", timings.compute_gflops}};
+  }
+  nlohmann::json cache;
+  cache["devices"] = devices;
+
+  std::ofstream file(m_cache_path);
+  if (!file) {
+    std::cerr << "device benchmark: cannot write " << m_cache_path
+              << std::endl;
+    return;
+  }
+  file << cache.dump(2) << std::endl;
+}
+
+/**
+ * @brief Records the fill and compute passes once, submits them twice and
+ * times the second submission, the first one only warms up the driver
+ */
+device_timings device_benchmark::run(VkPhysicalDevice physical_device) {
+  device_timings timings;
+  uint32_t family = find_benchmark_family(physical_device);
+  if (family == UINT32_MAX)
+    return timings; // Nothing to time it with, ranked by capabilities
+
+  VkPhysicalDeviceProperties properties;
+  vkGetPhysicalDeviceProperties(physical_device, &properties);
+  uint32_t family_count = 0;
+  vkGetPhysicalDeviceQueueFamilyProperties(physical_device, &family_count,
+                                           nullptr);
+  std::vector<VkQueueFamilyProperties> families(family_count);
+  vkGetPhysicalDeviceQueueFamilyProperties(physical_device, &family_count,
+                                           families.data());
+  uint32_t valid_bits = families[family].timestampValidBits;
+  uint64_t valid_mask =
+      valid_bits >= 64 ? UINT64_MAX : (1ull << valid_bits) - 1;
+
+  benchmark_context context;
+  try {
+    float priority = 1.0f;
+    VkDeviceQueueCreateInfo queue_info{};
+    queue_info.sType = VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO;
+    queue_info.queueFamilyIndex = family;
+    queue_info.queueCount = 1;
+    queue_info.pQueuePriorities = &priority;
+
+    VkDeviceCreateInfo device_info{};
+    device_info.sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO;
+    device_info.queueCreateInfoCount = 1;
+    device_info.pQueueCreateInfos = &queue_info;
+    if (vkCreateDevice(physical_device, &device_info, nullptr,
+                       &context.device) != VK_SUCCESS) {
+      throw std::runtime_error("failed to create benchmark device");
+    }
+    VkDevice device = context.device;
+    VkQueue queue;
+    vkGetDeviceQueue(device, family, 0, &queue);
+
+    context.allocator.init(physical_device, device, 16ull << 20);
+    context.allocator_ready = true;
+
+    VkCommandPoolCreateInfo pool_info{};
+    pool_info.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+    pool_info.queueFamilyIndex = family;
+    if (vkCreateCommandPool(device, &pool_info, nullptr,
+                            &context.command_pool) != VK_SUCCESS) {
+      throw std::runtime_error("failed to create benchmark command pool");
+    }
+
+    VkFenceCreateInfo fence_info{};
+    fence_info.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
+    if (vkCreateFence(device, &fence_info, nullptr, &context.fence) !=
+        VK_SUCCESS) {
+      throw std::runtime_error("failed to create benchmark fence");
+    }
+
+    VkQueryPoolCreateInfo query_info{};
+    query_info.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO;
+    query_info.queryType = VK_QUERY_TYPE_TIMESTAMP;
+    query_info.queryCount = 4; // Begin and end of both passes
+    if (vkCreateQueryPool(device, &query_info, nullptr,
+                          &context.timestamps) != VK_SUCCESS) {
+      throw std::runtime_error("failed to create benchmark query pool");
+    }
+
+    //---------------Fill rate-------------------------
+    VkImageCreateInfo image_info{};
+    image_info.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+    image_info.imageType = VK_IMAGE_TYPE_2D;
+    image_info.format = VK_FORMAT_R8G8B8A8_UNORM;
+    image_info.extent = {M_FILL_EXTENT, M_FILL_EXTENT, 1};
+    image_info.mipLevels = 1;
+    image_info.arrayLayers = 1;
+    image_info.samples = VK_SAMPLE_COUNT_1_BIT;
+    image_info.tiling = VK_IMAGE_TILING_OPTIMAL;
+    image_info.usage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT;
+    image_info.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+    image_info.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+    context.color_allocation = context.allocator.create_image(
+        image_info, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, context.color_image);
+
+    VkImageViewCreateInfo view_info{};
+    view_info.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
+    view_info.image = context.color_image;
+    view_info.viewType = VK_IMAGE_VIEW_TYPE_2D;
+    view_info.format = image_info.format;
+    view_info.subresourceRange = {VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1};
+    if (vkCreateImageView(device, &view_info, nullptr, &context.color_view) !=
+        VK_SUCCESS) {
+      throw std::runtime_error("failed to create benchmark image view");
+    }
+
+    VkAttachmentDescription color_attachment{};
+    color_attachment.format = image_info.format;
+    color_attachment.samples = VK_SAMPLE_COUNT_1_BIT;
+    color_attachment.loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
+    color_attachment.storeOp = VK_ATTACHMENT_STORE_OP_STORE;
+    color_attachment.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+    color_attachment.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+    color_attachment.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+    color_attachment.finalLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+
+    VkAttachmentReference color_reference{
+        0, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL};
+    VkSubpassDescription subpass{};
+    subpass.pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS;
+    subpass.colorAttachmentCount = 1;
+    subpass.pColorAttachments = &color_reference;
+
+    VkRenderPassCreateInfo render_pass_info{};
+    render_pass_info.sType = VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO;
+    render_pass_info.attachmentCount = 1;
+    render_pass_info.pAttachments = &color_attachment;
+    render_pass_info.subpassCount = 1;
+    render_pass_info.pSubpasses = &subpass;
+    if (vkCreateRenderPass(device, &render_pass_info, nullptr,
+                           &context.render_pass) != VK_SUCCESS) {
+      throw std::runtime_error("failed to create benchmark render pass");
+    }
+
+    VkFramebufferCreateInfo framebuffer_info{};
+    framebuffer_info.sType = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO;
+    framebuffer_info.renderPass = context.render_pass;
+    framebuffer_info.attachmentCount = 1;
+    framebuffer_info.pAttachments = &context.color_view;
+    framebuffer_info.width = M_FILL_EXTENT;
+    framebuffer_info.height = M_FILL_EXTENT;
+    framebuffer_info.layers = 1;
+    if (vkCreateFramebuffer(device, &framebuffer_info, nullptr,
+                            &context.framebuffer) != VK_SUCCESS) {
+      throw std::runtime_error("failed to create benchmark framebuffer");
+    }
+
+    context.fill_shaders[0] = load_shader(device, "bench_fill.vert");
+    context.fill_shaders[1] = load_shader(device, "bench_fill.frag");
+
+    VkPipelineLayoutCreateInfo fill_layout_info{};
+    fill_layout_info.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+    if (vkCreatePipelineLayout(device, &fill_layout_info, nullptr,
+                               &context.fill_layout) != VK_SUCCESS) {
+      throw std::runtime_error("failed to create benchmark pipeline layout");
+    }
+
+    VkPipelineShaderStageCreateInfo fill_stages[2] = {};
+    fill_stages[0].sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+    fill_stages[0].stage = VK_SHADER_STAGE_VERTEX_BIT;
+    fill_stages[0].module = context.fill_shaders[0];
+    fill_stages[0].pName = "main";
+    fill_stages[1] = fill_stages[0];
+    fill_stages[1].stage = VK_SHADER_STAGE_FRAGMENT_BIT;
+    fill_stages[1].module = context.fill_shaders[1];
+
+    VkPipelineVertexInputStateCreateInfo vertex_input{};
+    vertex_input.sType =
+        VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO;
+
+    VkPipelineInputAssemblyStateCreateInfo input_assembly{};
+    input_assembly.sType =
+        VK_STRUCTURE_TYPE_PIPELINE_INPUT_ASSEMBLY_STATE_CREATE_INFO;
+    input_assembly.topology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST;
+
+    VkViewport viewport{0.0f, 0.0f, static_cast<float>(M_FILL_EXTENT),
+                        static_cast<float>(M_FILL_EXTENT), 0.0f, 1.0f};
+    VkRect2D scissor{{0, 0}, {M_FILL_EXTENT, M_FILL_EXTENT}};
+    VkPipelineViewportStateCreateInfo viewport_state{};
+    viewport_state.sType =
+        VK_STRUCTURE_TYPE_PIPELINE_VIEWPORT_STATE_CREATE_INFO;
+    viewport_state.viewportCount = 1;
+    viewport_state.pViewports = &viewport;
+    viewport_state.scissorCount = 1;
+    viewport_state.pScissors = &scissor;
+
+    VkPipelineRasterizationStateCreateInfo rasterizer{};
+    rasterizer.sType =
+        VK_STRUCTURE_TYPE_PIPELINE_RASTERIZATION_STATE_CREATE_INFO;
+    rasterizer.polygonMode = VK_POLYGON_MODE_FILL;
+    rasterizer.cullMode = VK_CULL_MODE_NONE;
+    rasterizer.lineWidth = 1.0f;
+
+    VkPipelineMultisampleStateCreateInfo multisampling{};
+    multisampling.sType =
+        VK_STRUCTURE_TYPE_PIPELINE_MULTISAMPLE_STATE_CREATE_INFO;
+    multisampling.rasterizationSamples = VK_SAMPLE_COUNT_1_BIT;
+
+    VkPipelineColorBlendAttachmentState blend_attachment{};
+    blend_attachment.blendEnable = VK_TRUE; // Every layer reads and writes
+    blend_attachment.srcColorBlendFactor = VK_BLEND_FACTOR_SRC_ALPHA;
+    blend_attachment.dstColorBlendFactor = VK_BLEND_FACTOR_ONE_MINUS_SRC_ALPHA;
+    blend_attachment.colorBlendOp = VK_BLEND_OP_ADD;
+    blend_attachment.srcAlphaBlendFactor = VK_BLEND_FACTOR_ONE;
+    blend_attachment.dstAlphaBlendFactor = VK_BLEND_FACTOR_ZERO;
+    blend_attachment.alphaBlendOp = VK_BLEND_OP_ADD;
+    blend_attachment.colorWriteMask =
+        VK_COLOR_COMPONENT_R_BIT | VK_COLOR_COMPONENT_G_BIT |
+        VK_COLOR_COMPONENT_B_BIT | VK_COLOR_COMPONENT_A_BIT;
+
+    VkPipelineColorBlendStateCreateInfo color_blending{};
+    color_blending.sType =
+        VK_STRUCTURE_TYPE_PIPELINE_COLOR_BLEND_STATE_CREATE_INFO;
+    color_blending.attachmentCount = 1;
+    color_blending.pAttachments = &blend_attachment;
+
+    VkGraphicsPipelineCreateInfo fill_pipeline_info{};
+    fill_pipeline_info.sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO;
+    fill_pipeline_info.stageCount = 2;
+    fill_pipeline_info.pStages = fill_stages;
+    fill_pipeline_info.pVertexInputState = &vertex_input;
+    fill_pipeline_info.pInputAssemblyState = &input_assembly;
+    fill_pipeline_info.pViewportState = &viewport_state;
+    fill_pipeline_info.pRasterizationState = &rasterizer;
+    fill_pipeline_info.pMultisampleState = &multisampling;
+    fill_pipeline_info.pColorBlendState = &color_blending;
+    fill_pipeline_info.layout = context.fill_layout;
+    fill_pipeline_info.renderPass = context.render_pass;
+    if (vkCreateGraphicsPipelines(device, VK_NULL_HANDLE, 1,
+                                  &fill_pipeline_info, nullptr,
+                                  &context.fill_pipeline) != VK_SUCCESS) {
+      throw std::runtime_error("failed to create benchmark fill pipeline");
+    }
+
+    //---------------Compute---------------------------
+    VkBufferCreateInfo buffer_info{};
+    buffer_info.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+    buffer_info.size = static_cast<VkDeviceSize>(M_COMPUTE_GROUPS) *
+                       M_COMPUTE_GROUP_SIZE * 4 * sizeof(float);
+    buffer_info.usage = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT;
+    buffer_info.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+    context.result_allocation = context.allocator.create_buffer(
+        buffer_info, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+        context.result_buffer);
+
+    VkDescriptorSetLayoutBinding binding{};
+    binding.binding = 0;
+    binding.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+    binding.descriptorCount = 1;
+    binding.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+
+    VkDescriptorSetLayoutCreateInfo set_layout_info{};
+    set_layout_info.sType =
+        VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+    set_layout_info.bindingCount = 1;
+    set_layout_info.pBindings = &binding;
+    if (vkCreateDescriptorSetLayout(device, &set_layout_info, nullptr,
+                                    &context.set_layout) != VK_SUCCESS) {
+      throw std::runtime_error("failed to create benchmark set layout");
+    }
+
+    VkDescriptorPoolSize pool_size{VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1};
+    VkDescriptorPoolCreateInfo descriptor_pool_info{};
+    descriptor_pool_info.sType =
+        VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+    descriptor_pool_info.maxSets = 1;
+    descriptor_pool_info.poolSizeCount = 1;
+    descriptor_pool_info.pPoolSizes = &pool_size;
+    if (vkCreateDescriptorPool(device, &descriptor_pool_info, nullptr,
+                               &context.descriptor_pool) != VK_SUCCESS) {
+      throw std::runtime_error("failed to create benchmark descriptor pool");
+    }
+
+    VkDescriptorSetAllocateInfo set_info{};
+    set_info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+    set_info.descriptorPool = context.descriptor_pool;
+    set_info.descriptorSetCount = 1;
+    set_info.pSetLayouts = &context.set_layout;
+    VkDescriptorSet descriptor_set;
+    if (vkAllocateDescriptorSets(device, &set_info, &descriptor_set) !=
+        VK_SUCCESS) {
+      throw std::runtime_error("failed to allocate benchmark descriptor set");
+    }
+
+    VkDescriptorBufferInfo result_info{context.result_buffer, 0,
+                                       VK_WHOLE_SIZE};
+    VkWriteDescriptorSet write{};
+    write.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+    write.dstSet = descriptor_set;
+    write.dstBinding = 0;
+    write.descriptorCount = 1;
+    write.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+    write.pBufferInfo = &result_info;
+    vkUpdateDescriptorSets(device, 1, &write, 0, nullptr);
+
+    context.compute_shader = load_shader(device, "bench_compute.comp");
+
+    VkPushConstantRange push_range{VK_SHADER_STAGE_COMPUTE_BIT, 0,
+                                   sizeof(uint32_t)};
+    VkPipelineLayoutCreateInfo compute_layout_info{};
+    compute_layout_info.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+    compute_layout_info.setLayoutCount = 1;
+    compute_layout_info.pSetLayouts = &context.set_layout;
+    compute_layout_info.pushConstantRangeCount = 1;
+    compute_layout_info.pPushConstantRanges = &push_range;
+    if (vkCreatePipelineLayout(device, &compute_layout_info, nullptr,
+                               &context.compute_layout) != VK_SUCCESS) {
+      throw std::runtime_error("failed to create benchmark pipeline layout");
+    }
+
+    VkComputePipelineCreateInfo compute_pipeline_info{};
+    compute_pipeline_info.sType =
+        VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
+    compute_pipeline_info.stage.sType =
+        VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+    compute_pipeline_info.stage.stage = VK_SHADER_STAGE_COMPUTE_BIT;
+    compute_pipeline_info.stage.module = context.compute_shader;
+    compute_pipeline_info.stage.pName = "main";
+    compute_pipeline_info.layout = context.compute_layout;
+    if (vkCreateComputePipelines(device, VK_NULL_HANDLE, 1,
+                                 &compute_pipeline_info, nullptr,
+                                 &context.compute_pipeline) != VK_SUCCESS) {
+      throw std::runtime_error("failed to create benchmark compute pipeline");
+    }
+
+    //---------------Recording-------------------------
+    VkCommandBufferAllocateInfo command_info{};
+    command_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+    command_info.commandPool = context.command_pool;
+    command_info.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+    command_info.commandBufferCount = 1;
+    VkCommandBuffer command_buffer;
+    if (vkAllocateCommandBuffers(device, &command_info, &command_buffer) !=
+        VK_SUCCESS) {
+      throw std::runtime_error("failed to allocate benchmark command buffer");
+    }
+
+    VkCommandBufferBeginInfo begin_info{};
+    begin_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+    vkBeginCommandBuffer(command_buffer, &begin_info);
+    vkCmdResetQueryPool(command_buffer, context.timestamps, 0, 4);
+
+    VkClearValue clear_value{};
+    VkRenderPassBeginInfo pass_info{};
+    pass_info.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
+    pass_info.renderPass = context.render_pass;
+    pass_info.framebuffer = context.framebuffer;
+    pass_info.renderArea = scissor;
+    pass_info.clearValueCount = 1;
+    pass_info.pClearValues = &clear_value;
+
+    vkCmdWriteTimestamp(command_buffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT,
+                        context.timestamps, 0);
+    vkCmdBeginRenderPass(command_buffer, &pass_info,
+                         VK_SUBPASS_CONTENTS_INLINE);
+    vkCmdBindPipeline(command_buffer, VK_PIPELINE_BIND_POINT_GRAPHICS,
+                      context.fill_pipeline);
+    vkCmdDraw(command_buffer, 3, M_FILL_LAYERS, 0, 0);
+    vkCmdEndRenderPass(command_buffer);
+    vkCmdWriteTimestamp(command_buffer, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT,
+                        context.timestamps, 1);
+
+    vkCmdPipelineBarrier(command_buffer, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT,
+                         VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, 0, 0, nullptr, 0,
+                         nullptr, 0, nullptr); // Passes must not overlap
+
+    uint32_t iterations = M_COMPUTE_ITERATIONS;
+    vkCmdWriteTimestamp(command_buffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT,
+                        context.timestamps, 2);
+    vkCmdBindPipeline(command_buffer, VK_PIPELINE_BIND_POINT_COMPUTE,
+                      context.compute_pipeline);
+    vkCmdBindDescriptorSets(command_buffer, VK_PIPELINE_BIND_POINT_COMPUTE,
+                            context.compute_layout, 0, 1, &descriptor_set, 0,
+                            nullptr);
+    vkCmdPushConstants(command_buffer, context.compute_layout,
+                       VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(iterations),
+                       &iterations);
+    vkCmdDispatch(command_buffer, M_COMPUTE_GROUPS, 1, 1);
+    vkCmdWriteTimestamp(command_buffer, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT,
+                        context.timestamps, 3);
+
+    if (vkEndCommandBuffer(command_buffer) != VK_SUCCESS) {
+      throw std::runtime_error("failed to record benchmark command buffer");
+    }
+
+    VkSubmitInfo submit_info{};
+    submit_info.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+    submit_info.commandBufferCount = 1;
+    submit_info.pCommandBuffers = &command_buffer;
+    for (int run = 0; run < 2; run++) {
+      vkResetFences(device, 1, &context.fence);
+      if (vkQueueSubmit(queue, 1, &submit_info, context.fence) !=
+              VK_SUCCESS ||
+          vkWaitForFences(device, 1, &context.fence, VK_TRUE, UINT64_MAX) !=
+              VK_SUCCESS) {
+        throw std::runtime_error("benchmark submission failed");
+      }
+    } // The first run pays for lazy shader compilation and memory commits
+
+    uint64_t ticks[4];
+    if (vkGetQueryPoolResults(device, context.timestamps, 0, 4, sizeof(ticks),
+                              ticks, sizeof(uint64_t),
+                              VK_QUERY_RESULT_64_BIT |
+                                  VK_QUERY_RESULT_WAIT_BIT) != VK_SUCCESS) {
+      throw std::runtime_error("failed to read benchmark timestamps");
+    }
+
+    double period = properties.limits.timestampPeriod;
+    double fill_ns = ((ticks[1] - ticks[0]) & valid_mask) * period;
+    double compute_ns = ((ticks[3] - ticks[2]) & valid_mask) * period;
+    double pixels = static_cast<double>(M_FILL_EXTENT) * M_FILL_EXTENT *
+                    M_FILL_LAYERS;
+    double flops = static_cast<double>(M_COMPUTE_GROUPS) *
+                   M_COMPUTE_GROUP_SIZE * M_COMPUTE_ITERATIONS *
+                   M_FLOPS_PER_ITERATION;
+    if (fill_ns > 0.0 && compute_ns > 0.0) {
+      timings.fill_gpixels = pixels / fill_ns; // Per ns is billions per s
+      timings.compute_gflops = flops / compute_ns;
+      timings.measured = true;
+    }
+  } catch (...) {
+    context.destroy();
+    throw;
+  }
+  context.destroy();
+
+  if (timings.measured) {
+    std::cerr << "Benchmarked " << properties.deviceName << ": fill "
+              << timings.fill_gpixels << " Gpixel/s, compute "
+              << timings.compute_gflops << " GFLOPS" << std::endl;
+  }
+  return timings;
+}
@@ -0,0 +1,56 @@
+/**
+ * @file
+ * @author Ruben Pena <rubn.pena@gmail.com>
+ * @brief This file contains the declaration of the device_benchmark class, a
+ * short fill rate and compute micro-benchmark used to rank physical devices.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <vulkan/vulkan.h>
+
+/**
+ * @brief Throughput measured on one device. Unmeasured results score 0
+ */
+struct device_timings {
+  double fill_gpixels = 0.0;   // Blended pixels per second, in billions
+  double compute_gflops = 0.0; // FMA throughput of a compute dispatch
+  bool measured = false;
+
+  /**
+   * @brief Geometric mean of both rates, so neither unit dominates
+   */
+  double get_score() const;
+};
+
+/**
+ * @class
+ * @brief Runs a few blended full screen triangles and an FMA bound compute
+ * dispatch on a temporary logical device, timed with timestamp queries. The
+ * results are cached per device UUID and driver version in a JSON file, so
+ * the benchmark only runs the first time a device or driver is seen
+ */
+class device_benchmark {
+  static constexpr uint32_t M_FILL_EXTENT = 1024; // Square color target
+  static constexpr uint32_t M_FILL_LAYERS = 32;   // Full screen triangles
+  static constexpr uint32_t M_COMPUTE_GROUPS = 1024;
+  static constexpr uint32_t M_COMPUTE_GROUP_SIZE = 64; // As in the shader
+  static constexpr uint32_t M_COMPUTE_ITERATIONS = 1024;
+  static constexpr uint32_t M_FLOPS_PER_ITERATION = 32; // 4 vec4 FMA chains
+
+  std::string m_cache_path; // Empty: measured every time
+  std::unordered_map<std::string, device_timings> m_cache;
+  bool m_cache_loaded = false;
+
+  static std::string get_cache_key(VkPhysicalDevice physical_device);
+  void load_cache();
+  void save_cache();
+  device_timings run(VkPhysicalDevice physical_device);
+
+public:
+  void set_cache_path(const std::string &path);
+  device_timings measure(VkPhysicalDevice physical_device);
+};
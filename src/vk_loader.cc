@@ -9,20 +9,43 @@
 #define GLFW_INCLUDE_VULKAN
 #include <GLFW/glfw3.h>
 #include <algorithm>
+#include <chrono>
 #include <create_shader_module.hh>
+#include <cstddef>
 #include <cstdint>
 #include <cstdlib>
 #include <cstring>
+#include <embedded_shaders.hh>
+#include <frustum.hh>
 #include <limits.h>
+#include <job_system.hh>
 #include <map>
-#include <read_file.hh>
+#include <numeric>
+#include <parallel_for.hh>
 #include <set>
 #include <stdexcept>
 #include <vector>
 #include <vk_loader.hh>
 #include <vulkan/vulkan_core.h>
 
-void vk_loader::init_vulkan() { create_instance(); }
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+
+/**
+ * @brief Creates the instance. In headless mode no surface is ever created, so
+ * neither the GLFW instance extensions nor the swap chain device extension are
+ * requested
+ */
+void vk_loader::init_vulkan(bool headless) {
+  m_headless = headless;
+
+  m_device_extensions.clear();
+  if (!m_headless) {
+    m_device_extensions.push_back(VK_KHR_SWAPCHAIN_EXTENSION_NAME);
+  }
+
+  create_instance();
+}
 
 /**
  * @brief This function creates the instance of vulkan,
@@ -38,16 +61,12 @@ void vk_loader::create_instance() {
   VkApplicationInfo app_info{};
   app_info.sType = VK_STRUCTURE_TYPE_APPLICATION_INFO;
   app_info.pApplicationName = "render-toy";
+  app_info.apiVersion = VK_API_VERSION_1_3; // Core dynamic rendering if any
 
   VkInstanceCreateInfo create_info{};
   create_info.sType = VK_STRUCTURE_TYPE_INSTANCE_CREATE_INFO;
   create_info.pApplicationInfo = &app_info;
 
-  uint32_t glfw_extension_count = 0;
-  const char **glfw_extensions;
-
-  glfw_extensions = glfwGetRequiredInstanceExtensions(&glfw_extension_count);
-
   auto extensions = get_required_extensions();
   create_info.enabledExtensionCount = static_cast<uint32_t>(extensions.size());
   create_info.ppEnabledExtensionNames = extensions.data();
@@ -113,6 +132,10 @@ std::vector<VkPhysicalDevice> vk_loader::get_physical_devices() {
 
 VkDevice vk_loader::get_logical_device() { return m_logical_device; }
 
+VkExtent2D vk_loader::get_extent() { return m_swapchain_extent; }
+
+bool vk_loader::is_headless() { return m_headless; }
+
 /**
  * @brief This function will return true if and only if all the validation layer
  * specified in m_validation_layers are available
@@ -144,11 +167,13 @@ bool vk_loader::check_validation_layer_support() {
 }
 
 std::vector<const char *> vk_loader::get_required_extensions() {
-  uint32_t glfw_extension_count = 0;
-  const char **glfw_extensions;
-  glfw_extensions = glfwGetRequiredInstanceExtensions(&glfw_extension_count);
-  std::vector<const char *> extensions(glfw_extensions,
-                                       glfw_extensions + glfw_extension_count);
+  std::vector<const char *> extensions;
+  if (!m_headless) {
+    uint32_t glfw_extension_count = 0;
+    const char **glfw_extensions;
+    glfw_extensions = glfwGetRequiredInstanceExtensions(&glfw_extension_count);
+    extensions.assign(glfw_extensions, glfw_extensions + glfw_extension_count);
+  } // No window system integration when rendering offscreen
   if (M_ENABLE_VALIDATION_LAYERS) {
     extensions.push_back(VK_EXT_DEBUG_UTILS_EXTENSION_NAME);
   }
@@ -192,19 +217,37 @@ void vk_loader::create_surface(GLFWwindow *window) {
   }
 }
 
+/**
+ * @brief True if the device has every feature the renderer can not work
+ * without. The device type does not matter, integrated GPUs and CPU
+ * implementations are accepted and ranked below discrete GPUs
+ */
 bool vk_loader::is_device_suitable(VkPhysicalDevice device) {
-  // TODO: Once the app is more complete actually implement this function with
-  // the requirements of the pipeline created by the user
-
   VkPhysicalDeviceProperties device_properties;
-  VkPhysicalDeviceFeatures device_features;
   vkGetPhysicalDeviceProperties(device, &device_properties);
-  vkGetPhysicalDeviceFeatures(device, &device_features);
 
-  if (!(device_properties.deviceType == VK_PHYSICAL_DEVICE_TYPE_DISCRETE_GPU &&
-        device_features.geometryShader))
+  if (device_properties.apiVersion < VK_API_VERSION_1_2)
     return false;
 
+  VkPhysicalDeviceVulkan12Features vulkan_12_features{};
+  vulkan_12_features.sType =
+      VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_12_FEATURES;
+  VkPhysicalDeviceFeatures2 features_2{};
+  features_2.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2;
+  features_2.pNext = &vulkan_12_features;
+  vkGetPhysicalDeviceFeatures2(device, &features_2);
+
+  if (!vulkan_12_features.timelineSemaphore)
+    return false; // Uploads are tracked with timeline semaphores
+
+  if (!vulkan_12_features.runtimeDescriptorArray ||
+      !vulkan_12_features.descriptorBindingPartiallyBound ||
+      !vulkan_12_features.descriptorBindingSampledImageUpdateAfterBind ||
+      !vulkan_12_features.descriptorBindingStorageBufferUpdateAfterBind ||
+      !vulkan_12_features.descriptorBindingUpdateUnusedWhilePending ||
+      !vulkan_12_features.shaderSampledImageArrayNonUniformIndexing)
+    return false; // Resources are bound through the bindless heap
+
   queue_family_indices indices = find_queue_families(device);
   if (!indices.is_complete())
     return false;
@@ -212,6 +255,9 @@ bool vk_loader::is_device_suitable(VkPhysicalDevice device) {
   if (!check_device_extension_support(device))
     return false;
 
+  if (m_headless)
+    return true; // No surface, nothing else to check
+
   bool swap_chain_suitable = false;
 
   if (check_device_extension_support(device)) {
@@ -244,6 +290,33 @@ bool vk_loader::check_device_extension_support(VkPhysicalDevice device) {
   return required_extensions.empty();
 }
 
+bool vk_loader::is_device_extension_available(VkPhysicalDevice device,
+                                              const char *extension) {
+  uint32_t extension_count;
+  vkEnumerateDeviceExtensionProperties(device, nullptr, &extension_count,
+                                       nullptr);
+  std::vector<VkExtensionProperties> available_extensions(extension_count);
+  vkEnumerateDeviceExtensionProperties(device, nullptr, &extension_count,
+                                       available_extensions.data());
+
+  for (const auto &available : available_extensions) {
+    if (std::strcmp(available.extensionName, extension) == 0)
+      return true;
+  }
+  return false;
+}
+
+/**
+ * @brief True if the extension was enabled on the logical device
+ */
+bool vk_loader::has_device_extension(const char *extension) {
+  for (const char *enabled : m_enabled_device_extensions) {
+    if (std::strcmp(enabled, extension) == 0)
+      return true;
+  }
+  return false;
+}
+
 swap_chain_support_details
 vk_loader::query_swap_chain_support(VkPhysicalDevice device) {
   swap_chain_support_details details;
@@ -273,7 +346,32 @@ vk_loader::query_swap_chain_support(VkPhysicalDevice device) {
 }
 
 /**
- * @brief Find all the physical devices and stores them in the internal list
+ * @brief Draws through VK_KHR_dynamic_rendering when the device supports it,
+ * render pass and framebuffer objects otherwise. Set before the logical
+ * device is created
+ */
+void vk_loader::set_dynamic_rendering(bool enabled) {
+  m_use_dynamic_rendering = enabled;
+}
+
+/**
+ * @brief True if the device was created with dynamic rendering enabled
+ */
+bool vk_loader::is_dynamic_rendering() { return m_dynamic_rendering; }
+
+/**
+ * @brief Enables the micro-benchmark in the ranking of the physical devices.
+ * Its results are cached at cache_path, empty keeps them in memory only
+ */
+void vk_loader::set_device_benchmark(bool enabled,
+                                     const std::string &cache_path) {
+  m_benchmark_devices = enabled;
+  m_device_benchmark.set_cache_path(cache_path);
+}
+
+/**
+ * @brief Find all the physical devices and stores them in the internal list,
+ * then ranks them
  */
 void vk_loader::find_physical_devices() {
   uint32_t device_count = 0;
@@ -295,55 +393,128 @@ void vk_loader::find_physical_devices() {
   if (m_physical_devices.empty()) {
     throw std::runtime_error("Failed to find a GPU with required features");
   }
+  rank_physical_devices();
 }
 
 /**
  * @brief Change the physical device to use.
  */
 void vk_loader::pick_physical_device(uint32_t id) {
+  if (id >= m_physical_devices.size()) {
+    throw std::runtime_error("no physical device " + std::to_string(id));
+  }
   m_selected_physical_device = m_physical_devices[id];
 }
 
 void vk_loader::pick_best_physical_device() {
-  // Use an ordered map to automatically sort candidates by increasing score
-  std::multimap<int, VkPhysicalDevice> candidates;
-
-  for (const auto &device : m_physical_devices) {
-    int score = rate_physical_device(device);
-    candidates.insert(std::make_pair(score, device));
-  }
-
-  // Check if the best candidate is suitable at all
-  if (candidates.rbegin()->first > 0) {
-    m_selected_physical_device = candidates.rbegin()->second;
-  } else {
+  if (m_device_ranking.empty()) {
     throw std::runtime_error("failed to find a suitable GPU!");
   }
+  m_selected_physical_device = m_device_ranking.front().device;
 }
 
+/**
+ * @brief Scores a suitable device by what it offers the renderer, for when
+ * there are no benchmark results. The device type dominates, then come the
+ * GPU culling path, a dedicated transfer queue and the device local memory
+ */
 int vk_loader::rate_physical_device(VkPhysicalDevice device) {
-
   VkPhysicalDeviceProperties device_properties;
-  VkPhysicalDeviceFeatures device_features;
   vkGetPhysicalDeviceProperties(device, &device_properties);
-  vkGetPhysicalDeviceFeatures(device, &device_features);
 
   int score = 0;
+  switch (device_properties.deviceType) {
+  case VK_PHYSICAL_DEVICE_TYPE_DISCRETE_GPU:
+    score += 40000;
+    break;
+  case VK_PHYSICAL_DEVICE_TYPE_INTEGRATED_GPU:
+    score += 30000;
+    break;
+  case VK_PHYSICAL_DEVICE_TYPE_VIRTUAL_GPU:
+    score += 20000;
+    break;
+  case VK_PHYSICAL_DEVICE_TYPE_CPU:
+    score += 10000;
+    break;
+  default:
+    break;
+  }
 
-  // Discrete GPUs have a significant performance advantage
-  if (device_properties.deviceType == VK_PHYSICAL_DEVICE_TYPE_DISCRETE_GPU) {
-    score += 1000;
+  VkPhysicalDeviceVulkan12Features vulkan_12_features{};
+  vulkan_12_features.sType =
+      VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_12_FEATURES;
+  VkPhysicalDeviceFeatures2 features_2{};
+  features_2.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2;
+  features_2.pNext = &vulkan_12_features;
+  vkGetPhysicalDeviceFeatures2(device, &features_2);
+
+  if (vulkan_12_features.drawIndirectCount &&
+      features_2.features.multiDrawIndirect &&
+      features_2.features.drawIndirectFirstInstance) {
+    score += 5000;
+  } // Can cull on the GPU
+
+  if (find_queue_families(device).transfer_family.has_value()) {
+    score += 2000;
+  } // Uploads do not compete with the frames
+
+  VkPhysicalDeviceMemoryProperties memory_properties;
+  vkGetPhysicalDeviceMemoryProperties(device, &memory_properties);
+  VkDeviceSize device_local = 0;
+  for (uint32_t i = 0; i < memory_properties.memoryHeapCount; i++) {
+    const VkMemoryHeap &heap = memory_properties.memoryHeaps[i];
+    if (heap.flags & VK_MEMORY_HEAP_DEVICE_LOCAL_BIT) {
+      device_local = std::max(device_local, heap.size);
+    }
   }
+  score += static_cast<int>(std::min<VkDeviceSize>(device_local >> 30, 32)) *
+           100; // GiB, capped so it never outweighs the rest
 
-  // Maximum possible size of textures affects graphics quality
-  score += device_properties.limits.maxImageDimension2D;
+  return score;
+}
 
-  // Application can't function without geometry shaders
-  if (!device_features.geometryShader) {
-    return 0;
+/**
+ * @brief Sorts the suitable devices best first. With the benchmark enabled
+ * the measured throughput decides and the capability score only breaks ties,
+ * a device that could not be measured goes after every measured one
+ */
+void vk_loader::rank_physical_devices() {
+  m_device_ranking.clear();
+  for (uint32_t i = 0; i < m_physical_devices.size(); i++) {
+    VkPhysicalDevice device = m_physical_devices[i];
+    VkPhysicalDeviceProperties properties;
+    vkGetPhysicalDeviceProperties(device, &properties);
+
+    ranked_device ranked;
+    ranked.device = device;
+    ranked.index = i;
+    ranked.name = properties.deviceName;
+    ranked.type = properties.deviceType;
+    ranked.capability_score = rate_physical_device(device);
+
+    if (m_benchmark_devices) {
+      try {
+        ranked.timings = m_device_benchmark.measure(device);
+      } catch (const std::exception &e) {
+        std::cerr << "device benchmark failed on " << ranked.name << ": "
+                  << e.what() << std::endl;
+      } // Still usable, ranked by its capabilities
+    }
+    m_device_ranking.push_back(ranked);
   }
 
-  return score;
+  std::stable_sort(m_device_ranking.begin(), m_device_ranking.end(),
+                   [](const ranked_device &a, const ranked_device &b) {
+                     double a_score = a.timings.get_score();
+                     double b_score = b.timings.get_score();
+                     if (a_score != b_score)
+                       return a_score > b_score;
+                     return a.capability_score > b.capability_score;
+                   });
+}
+
+const std::vector<ranked_device> &vk_loader::get_device_ranking() {
+  return m_device_ranking;
 }
 
 queue_family_indices vk_loader::find_queue_families(VkPhysicalDevice device) {
@@ -363,12 +534,16 @@ queue_family_indices vk_loader::find_queue_families(VkPhysicalDevice device) {
       indices.graphics_family = i;
     }
 
-    VkBool32 present_support = false;
-    vkGetPhysicalDeviceSurfaceSupportKHR(device, i, m_surface,
-                                         &present_support);
-    if (present_support) {
-      indices.present_family = i;
-    }
+    if (m_surface == VK_NULL_HANDLE) {
+      indices.present_family = indices.graphics_family;
+    } else {
+      VkBool32 present_support = false;
+      vkGetPhysicalDeviceSurfaceSupportKHR(device, i, m_surface,
+                                           &present_support);
+      if (present_support) {
+        indices.present_family = i;
+      }
+    } // Without a surface nothing is presented, the graphics queue is enough
 
     if (indices.is_complete())
       break;
@@ -376,6 +551,15 @@ queue_family_indices vk_loader::find_queue_families(VkPhysicalDevice device) {
     i++;
   }
 
+  for (uint32_t j = 0; j < queue_families.size(); j++) {
+    if ((queue_families[j].queueFlags & VK_QUEUE_TRANSFER_BIT) &&
+        !(queue_families[j].queueFlags &
+          (VK_QUEUE_GRAPHICS_BIT | VK_QUEUE_COMPUTE_BIT))) {
+      indices.transfer_family = j;
+      break;
+    }
+  } // Usually the copy engines, they run alongside the graphics work
+
   return indices;
 }
 
@@ -386,6 +570,9 @@ void vk_loader::create_logical_device() {
   std::vector<VkDeviceQueueCreateInfo> queue_create_infos;
   std::set<uint32_t> unique_queue_families = {indices.graphics_family.value(),
                                               indices.present_family.value()};
+  if (indices.transfer_family.has_value()) {
+    unique_queue_families.insert(indices.transfer_family.value());
+  }
   float queue_priority = 1.0f;
   for (uint32_t queue_family : unique_queue_families) {
     VkDeviceQueueCreateInfo queue_create_info{};
@@ -396,7 +583,48 @@ void vk_loader::create_logical_device() {
     queue_create_infos.push_back(queue_create_info);
   }
 
-  VkPhysicalDeviceFeatures device_features{}; // TODO: Add required features
+  VkPhysicalDeviceProperties properties;
+  vkGetPhysicalDeviceProperties(m_selected_physical_device, &properties);
+  bool core_rendering = properties.apiVersion >= VK_API_VERSION_1_3;
+  bool rendering_available =
+      core_rendering ||
+      is_device_extension_available(m_selected_physical_device,
+                                    VK_KHR_DYNAMIC_RENDERING_EXTENSION_NAME);
+
+  VkPhysicalDeviceDynamicRenderingFeatures supported_rendering{};
+  supported_rendering.sType =
+      VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DYNAMIC_RENDERING_FEATURES;
+  VkPhysicalDeviceVulkan12Features supported_12_features{};
+  supported_12_features.sType =
+      VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_12_FEATURES;
+  if (rendering_available) {
+    supported_12_features.pNext = &supported_rendering;
+  } // Only chained where the device knows the structure
+  VkPhysicalDeviceFeatures2 supported_features_2{};
+  supported_features_2.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2;
+  supported_features_2.pNext = &supported_12_features;
+  vkGetPhysicalDeviceFeatures2(m_selected_physical_device,
+                               &supported_features_2);
+  const VkPhysicalDeviceFeatures &supported_features =
+      supported_features_2.features;
+
+  VkPhysicalDeviceFeatures device_features{};
+  device_features.pipelineStatisticsQuery =
+      supported_features.pipelineStatisticsQuery; // Optional, for profiling
+  device_features.inheritedQueries = supported_features.inheritedQueries;
+
+  bool gpu_culling = supported_12_features.drawIndirectCount &&
+                     supported_features.multiDrawIndirect &&
+                     supported_features.drawIndirectFirstInstance;
+  if (m_cull_mode == cull_mode::gpu && !gpu_culling) {
+    std::cerr << "GPU culling is not supported, culling on the CPU"
+              << std::endl;
+    m_cull_mode = cull_mode::cpu;
+  }
+  if (m_cull_mode == cull_mode::gpu) {
+    device_features.multiDrawIndirect = VK_TRUE;
+    device_features.drawIndirectFirstInstance = VK_TRUE;
+  } // The draws culled on the GPU are issued by one indirect count draw
 
   VkDeviceCreateInfo create_info{};
   create_info.sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO;
@@ -406,9 +634,48 @@ void vk_loader::create_logical_device() {
 
   create_info.pEnabledFeatures = &device_features;
 
+  VkPhysicalDeviceVulkan12Features vulkan_12_features{};
+  vulkan_12_features.sType =
+      VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_12_FEATURES;
+  vulkan_12_features.timelineSemaphore = VK_TRUE;
+  vulkan_12_features.runtimeDescriptorArray = VK_TRUE;
+  vulkan_12_features.descriptorBindingPartiallyBound = VK_TRUE;
+  vulkan_12_features.descriptorBindingSampledImageUpdateAfterBind = VK_TRUE;
+  vulkan_12_features.descriptorBindingStorageBufferUpdateAfterBind = VK_TRUE;
+  vulkan_12_features.descriptorBindingUpdateUnusedWhilePending = VK_TRUE;
+  vulkan_12_features.shaderSampledImageArrayNonUniformIndexing = VK_TRUE;
+  vulkan_12_features.drawIndirectCount =
+      m_cull_mode == cull_mode::gpu ? VK_TRUE : VK_FALSE;
+  create_info.pNext = &vulkan_12_features;
+
+  m_dynamic_rendering = m_use_dynamic_rendering &&
+                        supported_rendering.dynamicRendering == VK_TRUE;
+  if (m_use_dynamic_rendering && !m_dynamic_rendering) {
+    std::cerr << "Dynamic rendering is not supported, using render passes"
+              << std::endl;
+  }
+  VkPhysicalDeviceDynamicRenderingFeatures rendering_features{};
+  rendering_features.sType =
+      VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DYNAMIC_RENDERING_FEATURES;
+  rendering_features.dynamicRendering = VK_TRUE;
+  if (m_dynamic_rendering) {
+    vulkan_12_features.pNext = &rendering_features;
+  }
+
+  m_enabled_device_extensions = m_device_extensions;
+  for (const char *extension : m_optional_device_extensions) {
+    if (is_device_extension_available(m_selected_physical_device, extension)) {
+      m_enabled_device_extensions.push_back(extension);
+    }
+  } // Optional extensions only enable extra functionality
+  if (m_dynamic_rendering && !core_rendering) {
+    m_enabled_device_extensions.push_back(
+        VK_KHR_DYNAMIC_RENDERING_EXTENSION_NAME);
+  }
+
   create_info.enabledExtensionCount =
-      static_cast<uint32_t>(m_device_extensions.size());
-  create_info.ppEnabledExtensionNames = m_device_extensions.data();
+      static_cast<uint32_t>(m_enabled_device_extensions.size());
+  create_info.ppEnabledExtensionNames = m_enabled_device_extensions.data();
 
   if (M_ENABLE_VALIDATION_LAYERS) {
     create_info.enabledLayerCount =
@@ -428,6 +695,101 @@ void vk_loader::create_logical_device() {
 
   vkGetDeviceQueue(m_logical_device, indices.present_family.value(), 0,
                    &m_present_queue);
+
+  vkGetDeviceQueue(m_logical_device,
+                   indices.transfer_family.value_or(
+                       indices.graphics_family.value()),
+                   0, &m_transfer_queue);
+
+  if (m_dynamic_rendering) {
+    m_cmd_begin_rendering = reinterpret_cast<PFN_vkCmdBeginRendering>(
+        vkGetDeviceProcAddr(m_logical_device, core_rendering
+                                                  ? "vkCmdBeginRendering"
+                                                  : "vkCmdBeginRenderingKHR"));
+    m_cmd_end_rendering = reinterpret_cast<PFN_vkCmdEndRendering>(
+        vkGetDeviceProcAddr(m_logical_device, core_rendering
+                                                  ? "vkCmdEndRendering"
+                                                  : "vkCmdEndRenderingKHR"));
+    m_dynamic_rendering =
+        m_cmd_begin_rendering != nullptr && m_cmd_end_rendering != nullptr;
+  } // Core and extension entry points share their signature
+
+  m_allocator.init(m_selected_physical_device, m_logical_device);
+}
+
+vk_allocator &vk_loader::get_allocator() { return m_allocator; }
+
+/**
+ * @brief Creates the staging ring on the transfer queue. Without a transfer
+ * family the uploads go through the graphics queue, sharing its lock
+ */
+void vk_loader::create_staging_ring() {
+  queue_family_indices indices =
+      find_queue_families(m_selected_physical_device);
+  uint32_t graphics_family = indices.graphics_family.value();
+  uint32_t transfer_family = indices.transfer_family.value_or(graphics_family);
+
+  m_staging.create(m_selected_physical_device, m_logical_device, m_allocator,
+                   m_transfer_queue,
+                   m_transfer_queue == m_graphics_queue ? &m_queue_mutex
+                                                        : nullptr,
+                   transfer_family, graphics_family);
+}
+
+staging_ring &vk_loader::get_staging_ring() { return m_staging; }
+
+/**
+ * @brief Creates the bindless heap and the pipeline layout every pipeline
+ * shares: the heap set and one push constant range visible to every stage, so
+ * the set stays bound across pipeline changes
+ */
+void vk_loader::create_bindless_heap() {
+  m_bindless.create(m_selected_physical_device, m_logical_device);
+
+  VkPushConstantRange push_constant_range{};
+  push_constant_range.stageFlags = M_PUSH_CONSTANT_STAGES;
+  push_constant_range.offset = 0;
+  push_constant_range.size = M_PUSH_CONSTANT_SIZE;
+
+  VkDescriptorSetLayout set_layout = m_bindless.get_layout();
+  VkPipelineLayoutCreateInfo pipeline_layout_info{};
+  pipeline_layout_info.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+  pipeline_layout_info.setLayoutCount = 1;
+  pipeline_layout_info.pSetLayouts = &set_layout;
+  pipeline_layout_info.pushConstantRangeCount = 1;
+  pipeline_layout_info.pPushConstantRanges = &push_constant_range;
+
+  if (vkCreatePipelineLayout(m_logical_device, &pipeline_layout_info, nullptr,
+                             &m_pipeline_layout) != VK_SUCCESS) {
+    throw std::runtime_error("Failed to create pipeline layout");
+  }
+}
+
+bindless_heap &vk_loader::get_bindless_heap() { return m_bindless; }
+
+/**
+ * @brief Creates the streamer the scene textures go through. Needs the
+ * staging ring, the bindless heap and the pipeline cache
+ */
+void vk_loader::create_texture_streamer() {
+  m_textures.create(m_selected_physical_device, m_logical_device, m_allocator,
+                    m_staging, m_bindless, m_pipeline_cache.get());
+}
+
+texture_streamer &vk_loader::get_texture_streamer() { return m_textures; }
+
+/**
+ * @brief Creates the pipeline cache used by every pipeline, loading it from
+ * path, and the registry that builds the graphics pipelines into it. An empty
+ * path keeps the cache in memory only
+ */
+void vk_loader::create_pipeline_cache(const std::string &path) {
+  m_pipeline_cache.create(
+      m_selected_physical_device, m_logical_device, path,
+      has_device_extension(VK_EXT_PIPELINE_CREATION_FEEDBACK_EXTENSION_NAME));
+  m_pipelines.create(m_logical_device, [this](const pipeline_desc &desc) {
+    return create_graphics_pipeline(desc);
+  });
 }
 
 VkSurfaceFormatKHR vk_loader::choose_swap_surface_format(
@@ -442,11 +804,30 @@ VkSurfaceFormatKHR vk_loader::choose_swap_surface_format(
   return available_formats[0];
 }
 
+/**
+ * @brief First mode of the goal's preference list the surface supports. FIFO
+ * is always supported and ends every list
+ */
 VkPresentModeKHR vk_loader::choose_swap_present_mode(
     const std::vector<VkPresentModeKHR> &available_present_modes) {
-  for (const auto &available_present_mode : available_present_modes) {
-    if (available_present_mode == VK_PRESENT_MODE_MAILBOX_KHR) {
-      return available_present_mode;
+  std::vector<VkPresentModeKHR> preferred;
+  switch (m_present_goal) {
+  case present_goal::latency:
+    preferred = {VK_PRESENT_MODE_MAILBOX_KHR, VK_PRESENT_MODE_IMMEDIATE_KHR};
+    break; // Newest frame out first, tearing over waiting for vblank
+  case present_goal::balanced:
+    preferred = {VK_PRESENT_MODE_MAILBOX_KHR};
+    break;
+  case present_goal::throughput:
+    preferred = {VK_PRESENT_MODE_FIFO_RELAXED_KHR};
+    break; // Every frame shown, late ones do not wait a whole refresh
+  }
+
+  for (auto mode : preferred) {
+    if (std::find(available_present_modes.begin(),
+                  available_present_modes.end(),
+                  mode) != available_present_modes.end()) {
+      return mode;
     }
   }
   return VK_PRESENT_MODE_FIFO_KHR;
@@ -476,7 +857,12 @@ vk_loader::choose_swap_extent(const VkSurfaceCapabilitiesKHR &capabilities,
   }
 }
 
+/**
+ * @brief Creates the swap chain for the current size of window. An existing
+ * swap chain is handed over as oldSwapchain, the caller retires it
+ */
 void vk_loader::create_swap_chain(GLFWwindow *window) {
+  m_window = window;
   swap_chain_support_details swap_chain_support =
       query_swap_chain_support(m_selected_physical_device);
 
@@ -487,11 +873,27 @@ void vk_loader::create_swap_chain(GLFWwindow *window) {
   VkExtent2D extent =
       choose_swap_extent(swap_chain_support.capabilities, window);
 
-  uint32_t image_count = swap_chain_support.capabilities.minImageCount + 1;
-  if (swap_chain_support.capabilities.maxImageCount > 0 &&
-      image_count > swap_chain_support.capabilities.maxImageCount) {
-    uint32_t image_count = swap_chain_support.capabilities.maxImageCount;
+  const VkSurfaceCapabilitiesKHR &capabilities =
+      swap_chain_support.capabilities;
+  uint32_t image_count = m_requested_image_count;
+  if (image_count == 0) {
+    switch (m_present_goal) {
+    case present_goal::latency:
+      image_count = capabilities.minImageCount +
+                    (present_mode == VK_PRESENT_MODE_MAILBOX_KHR ? 1 : 0);
+      break; // Mailbox needs a spare image to replace the queued one
+    case present_goal::balanced:
+      image_count = capabilities.minImageCount + 1;
+      break;
+    case present_goal::throughput:
+      image_count = capabilities.minImageCount + 2;
+      break;
+    }
   }
+  image_count = std::max(image_count, capabilities.minImageCount);
+  if (capabilities.maxImageCount > 0) {
+    image_count = std::min(image_count, capabilities.maxImageCount);
+  } // 0: no upper limit
 
   VkSwapchainCreateInfoKHR create_info{};
   create_info.sType = VK_STRUCTURE_TYPE_SWAPCHAIN_CREATE_INFO_KHR;
@@ -522,7 +924,7 @@ void vk_loader::create_swap_chain(GLFWwindow *window) {
   create_info.compositeAlpha = VK_COMPOSITE_ALPHA_OPAQUE_BIT_KHR;
   create_info.presentMode = present_mode;
   create_info.clipped = VK_TRUE;
-  create_info.oldSwapchain = VK_NULL_HANDLE;
+  create_info.oldSwapchain = m_swapchain; // Null on the first creation
   if (vkCreateSwapchainKHR(m_logical_device, &create_info, nullptr,
                            &m_swapchain) != VK_SUCCESS) {
     throw std::runtime_error("failed to create swap chain");
@@ -535,6 +937,7 @@ void vk_loader::create_swap_chain(GLFWwindow *window) {
 
   m_swapchain_image_format = surface_format.format;
   m_swapchain_extent = extent;
+  m_present_mode = present_mode;
 }
 
 void vk_loader::create_swap_chain_image_views() {
@@ -563,29 +966,324 @@ void vk_loader::create_swap_chain_image_views() {
   }
 }
 
+/**
+ * @brief Builds the default triangle pipeline right away, it is also what is
+ * drawn while the scene pipelines are compiling
+ */
 void vk_loader::create_def_graphics_pipeline() {
-  std::string vert_path = "shaders/def.vert";
-  std::string frag_path = "shaders/def.frag";
+  const utils::embedded_shader *vert_shader =
+      utils::find_embedded_shader("def.vert");
+  const utils::embedded_shader *frag_shader =
+      utils::find_embedded_shader("def.frag");
+  if (vert_shader == nullptr || frag_shader == nullptr) {
+    throw std::runtime_error("default shaders are not embedded");
+  } // Compiled at build time, no glslc nor file I/O at startup
+
+  m_graphics_pipeline = m_pipelines.get(get_def_desc(
+      pipeline_shader::from_code(vert_shader->code, vert_shader->size),
+      pipeline_shader::from_code(frag_shader->code, frag_shader->size),
+      get_pipeline_targets()));
+}
 
-  std::string command = "./shaders/compile_shader.sh ";
-  std::string comman_vert = command + vert_path;
-  std::string comman_frag = command + frag_path;
+/**
+ * @brief Reads the swap chain state, main thread only
+ */
+pipeline_targets vk_loader::get_pipeline_targets() {
+  pipeline_targets targets;
+  targets.color_format = m_swapchain_image_format;
+  targets.depth_format = m_depth_format;
+  targets.render_pass = m_render_pass;
+  targets.layout = m_pipeline_layout;
+  return targets;
+}
+
+/**
+ * @brief Hands the current targets to the reloader thread. Called from the
+ * main thread whenever they may have changed
+ */
+void vk_loader::publish_pipeline_targets() {
+  pipeline_targets targets = get_pipeline_targets();
+  std::lock_guard<std::mutex> lock(m_reload_mutex);
+  m_reload_targets = targets;
+}
+
+/**
+ * @brief The default triangle: no vertex input and no depth test
+ */
+pipeline_desc vk_loader::get_def_desc(const pipeline_shader &vert,
+                                      const pipeline_shader &frag,
+                                      const pipeline_targets &targets) {
+  pipeline_desc desc;
+  desc.vert = vert;
+  desc.frag = frag;
+  desc.color_format = targets.color_format;
+  desc.depth_format = targets.depth_format;
+  desc.render_pass = targets.render_pass;
+  desc.layout = targets.layout;
+  return desc;
+}
+
+/**
+ * @brief Draws the meshes of the scene: interleaved vertices, the transforms
+ * and material indices in push constants, textures from the bindless heap and
+ * depth testing. Only queued here, it compiles while the scene loads and the
+ * default triangle is drawn until it is ready
+ */
+void vk_loader::create_mesh_pipeline() {
+  const utils::embedded_shader *vert_shader =
+      utils::find_embedded_shader("mesh.vert");
+  const utils::embedded_shader *frag_shader =
+      utils::find_embedded_shader("mesh.frag");
+  if (vert_shader == nullptr || frag_shader == nullptr) {
+    throw std::runtime_error("mesh shaders are not embedded");
+  }
 
-  int result_vert = std::system(comman_vert.c_str());
-  int result_frag = std::system(comman_frag.c_str()); // Compile the shaders
+  m_mesh_desc = get_mesh_desc(
+      pipeline_shader::from_code(vert_shader->code, vert_shader->size),
+      pipeline_shader::from_code(frag_shader->code, frag_shader->size),
+      get_pipeline_targets());
+  m_mesh_pipeline = m_pipelines.request(m_mesh_desc);
+}
 
-  // TODO: Encapsulate shader compilation into a util function
+pipeline_desc vk_loader::get_mesh_desc(const pipeline_shader &vert,
+                                       const pipeline_shader &frag,
+                                       const pipeline_targets &targets) {
+  pipeline_desc desc = get_def_desc(vert, frag, targets);
+
+  VkVertexInputBindingDescription binding{};
+  binding.binding = 0;
+  binding.stride = sizeof(assets::vertex);
+  binding.inputRate = VK_VERTEX_INPUT_RATE_VERTEX;
+  desc.bindings.push_back(binding);
+
+  VkVertexInputAttributeDescription attributes[3]{};
+  attributes[0].location = 0;
+  attributes[0].format = VK_FORMAT_R32G32B32_SFLOAT;
+  attributes[0].offset = offsetof(assets::vertex, position);
+  attributes[1].location = 1;
+  attributes[1].format = VK_FORMAT_R32G32B32_SFLOAT;
+  attributes[1].offset = offsetof(assets::vertex, normal);
+  attributes[2].location = 2;
+  attributes[2].format = VK_FORMAT_R32G32_SFLOAT;
+  attributes[2].offset = offsetof(assets::vertex, uv);
+  desc.attributes.assign(std::begin(attributes), std::end(attributes));
+
+  desc.depth_test = true;
+  desc.depth_write = true;
+  return desc;
+}
 
-  auto vert_shader_code = utils::read_file("shaders/def.vert.spv");
-  auto frag_shader_code = utils::read_file("shaders/def.frag.spv");
+/**
+ * @brief Installs the scene pipelines the registry finished since the last
+ * frame. Called before recording, like the reloaded pipelines
+ */
+void vk_loader::poll_pipelines() {
+  if (m_mesh_pipeline == VK_NULL_HANDLE && m_mesh_desc.vert.code != nullptr) {
+    m_mesh_pipeline = m_pipelines.request(m_mesh_desc);
+  }
+}
 
-  VkShaderModule vert_shader_module =
-      utils::crete_shader_module(vert_shader_code, m_logical_device);
-  VkShaderModule frag_shader_module =
-      utils::crete_shader_module(frag_shader_code, m_logical_device);
+/**
+ * @brief Blocks until every queued pipeline is built, so the next frame draws
+ * the scene and not the fallback. For headless runs and benchmarks
+ */
+void vk_loader::wait_pipelines() {
+  m_pipelines.wait_idle();
+  poll_pipelines();
+}
 
-  m_def_shader[0] = vert_shader_module;
-  m_def_shader[1] = frag_shader_module;
+/**
+ * @brief Culls the objects of the scene against the view frustum and writes
+ * the indirect draws of the visible ones
+ */
+void vk_loader::create_cull_pipeline() {
+  if (m_cull_mode != cull_mode::gpu)
+    return;
+
+  const utils::embedded_shader *shader =
+      utils::find_embedded_shader("cull.comp");
+  if (shader == nullptr) {
+    throw std::runtime_error("culling shader is not embedded");
+  }
+
+  m_cull_shader = utils::create_shader_module(shader->code, shader->size,
+                                              m_logical_device);
+  m_cull_pipeline = build_cull_pipeline(m_cull_shader);
+}
+
+VkPipeline vk_loader::build_cull_pipeline(VkShaderModule shader) {
+  VkComputePipelineCreateInfo pipeline_info{};
+  pipeline_info.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
+  pipeline_info.stage.sType =
+      VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+  pipeline_info.stage.stage = VK_SHADER_STAGE_COMPUTE_BIT;
+  pipeline_info.stage.module = shader;
+  pipeline_info.stage.pName = "main";
+  pipeline_info.layout = m_pipeline_layout;
+
+  creation_feedback feedback;
+  if (m_pipeline_cache.is_feedback_supported()) {
+    pipeline_info.pNext = feedback.chain(1, nullptr);
+  }
+
+  VkPipeline pipeline;
+  auto start = std::chrono::steady_clock::now();
+  if (vkCreateComputePipelines(m_logical_device, m_pipeline_cache.get(), 1,
+                               &pipeline_info, nullptr,
+                               &pipeline) != VK_SUCCESS) {
+    throw std::runtime_error("failed to create culling pipeline");
+  }
+  std::chrono::duration<double, std::milli> elapsed =
+      std::chrono::steady_clock::now() - start;
+
+  std::lock_guard<std::mutex> lock(m_pipeline_stats_mutex);
+  m_pipeline_creation_ms += elapsed.count();
+  m_pipeline_cache.record(feedback);
+  return pipeline;
+}
+
+/**
+ * @brief Watches directory and rebuilds the pipelines of the shaders edited
+ * there. glslc and the pipeline creation run on the reloader thread, the new
+ * pipelines are swapped in at the start of a frame and the old ones destroyed
+ * once the frames using them are done, so the frame loop never waits for a
+ * reload
+ */
+void vk_loader::start_shader_reload(const std::string &directory) {
+  publish_pipeline_targets();
+  m_shader_reloader.start(directory, [this](const std::string &shader) {
+    rebuild_pipeline(shader);
+  });
+}
+
+/**
+ * @brief Builds the pipeline that uses shader with the latest code of all its
+ * stages and queues it for the next frame. Runs on the reloader thread
+ */
+void vk_loader::rebuild_pipeline(const std::string &shader) {
+  std::string program = shader.substr(0, shader.find('.'));
+  std::vector<std::string> stages;
+  VkPipeline *target = nullptr;
+  if (program == "def") {
+    stages = {"def.vert", "def.frag"};
+    target = &m_graphics_pipeline;
+  } else if (program == "mesh") {
+    stages = {"mesh.vert", "mesh.frag"};
+    target = &m_mesh_pipeline;
+  } else if (program == "cull" && m_cull_mode == cull_mode::gpu) {
+    stages = {"cull.comp"};
+    target = &m_cull_pipeline;
+  } else {
+    return; // Not used by the renderer, e.g. the device benchmark
+  }
+
+  std::vector<std::vector<uint32_t>> code;
+  for (const auto &stage : stages) {
+    code.push_back(m_shader_reloader.get_code(stage));
+  }
+
+  VkPipeline pipeline = VK_NULL_HANDLE;
+  if (target == &m_cull_pipeline) {
+    VkShaderModule module = utils::create_shader_module(
+        code[0].data(), code[0].size() * sizeof(uint32_t), m_logical_device);
+    try {
+      pipeline = build_cull_pipeline(module);
+    } catch (...) {
+      vkDestroyShaderModule(m_logical_device, module, nullptr);
+      throw;
+    }
+    vkDestroyShaderModule(m_logical_device, module, nullptr);
+  } else {
+    pipeline_shader vert = pipeline_shader::from_code(
+        code[0].data(), code[0].size() * sizeof(uint32_t));
+    pipeline_shader frag = pipeline_shader::from_code(
+        code[1].data(), code[1].size() * sizeof(uint32_t));
+    pipeline_targets targets;
+    {
+      std::lock_guard<std::mutex> lock(m_reload_mutex);
+      targets = m_reload_targets;
+    } // The swap chain state itself belongs to the main thread
+    pipeline = create_graphics_pipeline(
+        target == &m_graphics_pipeline ? get_def_desc(vert, frag, targets)
+                                       : get_mesh_desc(vert, frag, targets));
+  } // Built outside the registry, the reload owns it until it is retired
+
+  std::lock_guard<std::mutex> lock(m_reload_mutex);
+  for (auto &pending : m_reloaded_pipelines) {
+    if (pending.target == target) {
+      vkDestroyPipeline(m_logical_device, pending.pipeline, nullptr);
+      pending.pipeline = pipeline;
+      return;
+    }
+  } // Replaced before any frame used it
+  m_reloaded_pipelines.push_back({target, pipeline});
+}
+
+/**
+ * @brief Swaps in the pipelines rebuilt since the last frame. Called before
+ * recording, so a frame never mixes old and new pipelines
+ */
+void vk_loader::swap_reloaded_pipelines() {
+  std::vector<reloaded_pipeline> reloaded;
+  {
+    std::lock_guard<std::mutex> lock(m_reload_mutex);
+    reloaded.swap(m_reloaded_pipelines);
+  }
+
+  for (const auto &pipeline : reloaded) {
+    if (*pipeline.target != VK_NULL_HANDLE) {
+      m_retired_pipelines.push_back({*pipeline.target, m_frame_number});
+    } // The registry may still be compiling the first version
+    *pipeline.target = pipeline.pipeline;
+  }
+}
+
+/**
+ * @brief Destroys the replaced pipelines no frame can be using anymore, with
+ * the same margin as the retired swap chains
+ */
+void vk_loader::destroy_retired_pipelines(bool wait_idle) {
+  auto done = [&](const retired_pipeline &retired) {
+    return wait_idle ||
+           m_frame_number >= retired.frame_number + m_frames_in_flight;
+  };
+
+  for (const auto &retired : m_retired_pipelines) {
+    if (done(retired) && !m_pipelines.evict(retired.pipeline)) {
+      vkDestroyPipeline(m_logical_device, retired.pipeline, nullptr);
+    } // The first versions belong to the registry, reloads to us
+  }
+  m_retired_pipelines.erase(std::remove_if(m_retired_pipelines.begin(),
+                                           m_retired_pipelines.end(), done),
+                            m_retired_pipelines.end());
+}
+
+/**
+ * @brief Builds the graphics pipeline desc describes. The shader modules only
+ * live for the call. Reads nothing but desc and the pipeline cache, so the
+ * registry and the reloads call it from their own threads
+ */
+VkPipeline vk_loader::create_graphics_pipeline(const pipeline_desc &desc) {
+  VkShaderModule vert_shader_module = utils::create_shader_module(
+      desc.vert.code, desc.vert.size, m_logical_device);
+  VkShaderModule frag_shader_module = VK_NULL_HANDLE;
+  try {
+    frag_shader_module = utils::create_shader_module(
+        desc.frag.code, desc.frag.size, m_logical_device);
+  } catch (...) {
+    vkDestroyShaderModule(m_logical_device, vert_shader_module, nullptr);
+    throw;
+  }
+
+  VkPipelineVertexInputStateCreateInfo vertex_input{};
+  vertex_input.sType =
+      VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO;
+  vertex_input.vertexBindingDescriptionCount =
+      static_cast<uint32_t>(desc.bindings.size());
+  vertex_input.pVertexBindingDescriptions = desc.bindings.data();
+  vertex_input.vertexAttributeDescriptionCount =
+      static_cast<uint32_t>(desc.attributes.size());
+  vertex_input.pVertexAttributeDescriptions = desc.attributes.data();
 
   VkPipelineShaderStageCreateInfo vert_shader_stage_info{};
   vert_shader_stage_info.sType =
@@ -599,7 +1297,7 @@ void vk_loader::create_def_graphics_pipeline() {
       VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
   frag_shader_stage_info.stage = VK_SHADER_STAGE_FRAGMENT_BIT;
   frag_shader_stage_info.module = frag_shader_module;
-  vert_shader_stage_info.pName = "main";
+  frag_shader_stage_info.pName = "main";
 
   VkPipelineShaderStageCreateInfo shader_stages[] = {vert_shader_stage_info,
                                                      frag_shader_stage_info};
@@ -613,49 +1311,28 @@ void vk_loader::create_def_graphics_pipeline() {
       static_cast<uint32_t>(dynamic_states.size());
   dynamic_state.pDynamicStates = dynamic_states.data();
 
-  VkPipelineVertexInputStateCreateInfo vertex_input_info{};
-  vertex_input_info.sType =
-      VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO;
-  vertex_input_info.vertexBindingDescriptionCount = 0;
-  vertex_input_info.pVertexBindingDescriptions = nullptr;
-  vertex_input_info.vertexAttributeDescriptionCount = 0;
-  vertex_input_info.pVertexAttributeDescriptions = nullptr;
-
   VkPipelineInputAssemblyStateCreateInfo input_assembly{};
   input_assembly.sType =
       VK_STRUCTURE_TYPE_PIPELINE_INPUT_ASSEMBLY_STATE_CREATE_INFO;
-  input_assembly.topology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST;
+  input_assembly.topology = desc.topology;
   input_assembly.primitiveRestartEnable = VK_FALSE;
 
-  VkViewport viewport{};
-  viewport.x = 0.0f;
-  viewport.y = 0.0f;
-  viewport.width = static_cast<float>(m_swapchain_extent.width);
-  viewport.height = static_cast<float>(m_swapchain_extent.height);
-  viewport.minDepth = 0.0f;
-  viewport.maxDepth = 1.0f;
-
-  VkRect2D scissor{};
-  scissor.offset = {0, 0};
-  scissor.extent = m_swapchain_extent;
-
   VkPipelineViewportStateCreateInfo viewport_state{};
   viewport_state.sType = VK_STRUCTURE_TYPE_PIPELINE_VIEWPORT_STATE_CREATE_INFO;
   viewport_state.viewportCount = 1;
-  viewport_state.pViewports = &viewport;
   viewport_state.scissorCount = 1;
-  viewport_state.pScissors = &scissor;
+  // Both are dynamic, the pipeline does not depend on the swap chain extent
 
   VkPipelineRasterizationStateCreateInfo rasterizer{};
   rasterizer.sType = VK_STRUCTURE_TYPE_PIPELINE_RASTERIZATION_STATE_CREATE_INFO;
   rasterizer.depthClampEnable = VK_FALSE;
 
   rasterizer.rasterizerDiscardEnable = VK_FALSE;
-  rasterizer.polygonMode = VK_POLYGON_MODE_FILL;
+  rasterizer.polygonMode = desc.polygon_mode;
   rasterizer.lineWidth = 1.0f;
 
-  rasterizer.cullMode = VK_CULL_MODE_BACK_BIT;
-  rasterizer.frontFace = VK_FRONT_FACE_CLOCKWISE;
+  rasterizer.cullMode = desc.cull_mode;
+  rasterizer.frontFace = desc.front_face;
   rasterizer.depthBiasEnable = VK_FALSE;
 
   VkPipelineMultisampleStateCreateInfo multisampling{};
@@ -664,11 +1341,26 @@ void vk_loader::create_def_graphics_pipeline() {
   multisampling.sampleShadingEnable = VK_FALSE;
   multisampling.rasterizationSamples = VK_SAMPLE_COUNT_1_BIT;
 
+  VkPipelineDepthStencilStateCreateInfo depth_stencil{};
+  depth_stencil.sType =
+      VK_STRUCTURE_TYPE_PIPELINE_DEPTH_STENCIL_STATE_CREATE_INFO;
+  depth_stencil.depthTestEnable = desc.depth_test ? VK_TRUE : VK_FALSE;
+  depth_stencil.depthWriteEnable = desc.depth_write ? VK_TRUE : VK_FALSE;
+  depth_stencil.depthCompareOp = desc.depth_compare;
+
   VkPipelineColorBlendAttachmentState color_blend_attachment{};
   color_blend_attachment.colorWriteMask =
       VK_COLOR_COMPONENT_R_BIT | VK_COLOR_COMPONENT_G_BIT |
       VK_COLOR_COMPONENT_B_BIT | VK_COLOR_COMPONENT_A_BIT;
-  color_blend_attachment.blendEnable = VK_FALSE;
+  color_blend_attachment.blendEnable = desc.blend ? VK_TRUE : VK_FALSE;
+  color_blend_attachment.srcColorBlendFactor = VK_BLEND_FACTOR_SRC_ALPHA;
+  color_blend_attachment.dstColorBlendFactor =
+      VK_BLEND_FACTOR_ONE_MINUS_SRC_ALPHA;
+  color_blend_attachment.colorBlendOp = VK_BLEND_OP_ADD;
+  color_blend_attachment.srcAlphaBlendFactor = VK_BLEND_FACTOR_ONE;
+  color_blend_attachment.dstAlphaBlendFactor =
+      VK_BLEND_FACTOR_ONE_MINUS_SRC_ALPHA;
+  color_blend_attachment.alphaBlendOp = VK_BLEND_OP_ADD;
 
   VkPipelineColorBlendStateCreateInfo color_blending{};
   color_blending.sType =
@@ -677,61 +1369,116 @@ void vk_loader::create_def_graphics_pipeline() {
   color_blending.attachmentCount = 1;
   color_blending.pAttachments = &color_blend_attachment;
 
-  VkPipelineLayoutCreateInfo pipeline_layout_info{};
-  pipeline_layout_info.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
-
-  if (vkCreatePipelineLayout(m_logical_device, &pipeline_layout_info, nullptr,
-                             &m_pipeline_layout) != VK_SUCCESS) {
-    throw std::runtime_error("Failed to create pipeline layout");
-  }
-
   VkGraphicsPipelineCreateInfo pipeline_info{};
   pipeline_info.sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO;
   pipeline_info.stageCount = 2;
   pipeline_info.pStages = shader_stages;
-  pipeline_info.pVertexInputState = &vertex_input_info;
+  pipeline_info.pVertexInputState = &vertex_input;
   pipeline_info.pInputAssemblyState = &input_assembly;
   pipeline_info.pViewportState = &viewport_state;
   pipeline_info.pRasterizationState = &rasterizer;
   pipeline_info.pMultisampleState = &multisampling;
-  pipeline_info.pDepthStencilState = nullptr;
+  pipeline_info.pDepthStencilState = &depth_stencil;
   pipeline_info.pColorBlendState = &color_blending;
   pipeline_info.pDynamicState = &dynamic_state;
-  pipeline_info.layout = m_pipeline_layout;
-  pipeline_info.renderPass = m_render_pass;
+  pipeline_info.layout = desc.layout;
+  pipeline_info.renderPass = desc.render_pass; // Null with dynamic rendering
   pipeline_info.subpass = 0;
 
-  if (vkCreateGraphicsPipelines(m_logical_device, VK_NULL_HANDLE, 1,
-                                &pipeline_info, nullptr,
-                                &m_graphics_pipeline) != VK_SUCCESS) {
+  VkPipelineRenderingCreateInfo rendering_info{};
+  rendering_info.sType = VK_STRUCTURE_TYPE_PIPELINE_RENDERING_CREATE_INFO;
+  rendering_info.colorAttachmentCount = 1;
+  rendering_info.pColorAttachmentFormats = &desc.color_format;
+  rendering_info.depthAttachmentFormat = desc.depth_format;
+  if (desc.render_pass == VK_NULL_HANDLE) {
+    pipeline_info.pNext = &rendering_info;
+  } // The attachment formats take the place of the render pass
+
+  creation_feedback feedback;
+  if (m_pipeline_cache.is_feedback_supported()) {
+    pipeline_info.pNext =
+        feedback.chain(pipeline_info.stageCount, pipeline_info.pNext);
+  }
+
+  VkPipeline pipeline;
+  auto start = std::chrono::steady_clock::now();
+  VkResult result = vkCreateGraphicsPipelines(
+      m_logical_device, m_pipeline_cache.get(), 1, &pipeline_info, nullptr,
+      &pipeline);
+  vkDestroyShaderModule(m_logical_device, vert_shader_module, nullptr);
+  vkDestroyShaderModule(m_logical_device, frag_shader_module, nullptr);
+  if (result != VK_SUCCESS) {
     throw std::runtime_error("failed to create graphics pipeine");
   }
+  std::chrono::duration<double, std::milli> elapsed =
+      std::chrono::steady_clock::now() - start;
+
+  std::lock_guard<std::mutex> lock(m_pipeline_stats_mutex);
+  m_pipeline_creation_ms += elapsed.count();
+  m_pipeline_cache.record(feedback);
+  return pipeline;
 }
 
+/**
+ * @brief Picks the depth format and creates the render pass. With dynamic
+ * rendering there is no render pass object, the attachments are given when
+ * the rendering begins
+ */
 void vk_loader::create_render_pass() {
+  m_depth_format = find_depth_format();
+  m_depth_aspect = VK_IMAGE_ASPECT_DEPTH_BIT;
+  if (m_depth_format != VK_FORMAT_D32_SFLOAT) {
+    m_depth_aspect |= VK_IMAGE_ASPECT_STENCIL_BIT;
+  } // Layout transitions must cover both aspects of combined formats
+
+  if (m_dynamic_rendering)
+    return;
+
   VkAttachmentDescription color_attachment{};
   color_attachment.format = m_swapchain_image_format;
   color_attachment.samples = VK_SAMPLE_COUNT_1_BIT;
 
-  color_attachment.loadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
-  color_attachment.storeOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
-
-  color_attachment.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
-  color_attachment.finalLayout = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
+  color_attachment.loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
+  color_attachment.storeOp = VK_ATTACHMENT_STORE_OP_STORE;
+
+  color_attachment.initialLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+  color_attachment.finalLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+
+  VkAttachmentDescription depth_attachment{};
+  depth_attachment.format = m_depth_format;
+  depth_attachment.samples = VK_SAMPLE_COUNT_1_BIT;
+  depth_attachment.loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
+  depth_attachment.storeOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+  depth_attachment.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+  depth_attachment.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+  depth_attachment.initialLayout =
+      VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
+  depth_attachment.finalLayout =
+      VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
+  // The frame graph records every transition and dependency around the pass,
+  // the same barriers on both paths
 
   VkAttachmentReference color_attachment_ref{};
   color_attachment_ref.attachment = 0;
   color_attachment_ref.layout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
 
+  VkAttachmentReference depth_attachment_ref{};
+  depth_attachment_ref.attachment = 1;
+  depth_attachment_ref.layout =
+      VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
+
   VkSubpassDescription subpass{};
   subpass.pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS;
   subpass.colorAttachmentCount = 1;
   subpass.pColorAttachments = &color_attachment_ref;
+  subpass.pDepthStencilAttachment = &depth_attachment_ref;
+
+  VkAttachmentDescription attachments[] = {color_attachment, depth_attachment};
 
   VkRenderPassCreateInfo render_pass_info{};
   render_pass_info.sType = VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO;
-  render_pass_info.attachmentCount = 1;
-  render_pass_info.pAttachments = &color_attachment;
+  render_pass_info.attachmentCount = 2;
+  render_pass_info.pAttachments = attachments;
   render_pass_info.subpassCount = 1;
   render_pass_info.pSubpasses = &subpass;
 
@@ -741,16 +1488,113 @@ void vk_loader::create_render_pass() {
   }
 }
 
+/**
+ * @brief First format of the candidates usable as an optimal tiling depth
+ * attachment. The spec guarantees at least one of them is
+ */
+VkFormat vk_loader::find_depth_format() {
+  const VkFormat candidates[] = {VK_FORMAT_D32_SFLOAT,
+                                 VK_FORMAT_D32_SFLOAT_S8_UINT,
+                                 VK_FORMAT_D24_UNORM_S8_UINT};
+
+  for (VkFormat format : candidates) {
+    VkFormatProperties properties;
+    vkGetPhysicalDeviceFormatProperties(m_selected_physical_device, format,
+                                        &properties);
+    if (properties.optimalTilingFeatures &
+        VK_FORMAT_FEATURE_DEPTH_STENCIL_ATTACHMENT_BIT)
+      return format;
+  }
+
+  throw std::runtime_error("failed to find a depth format");
+}
+
+/**
+ * @brief Declares the passes of a frame and compiles them. The depth target
+ * is a transient of the graph, shared by every frame: the graph orders the
+ * frames that clear it. The transients of a previous build must have been
+ * taken if a frame may still use them
+ */
+void vk_loader::build_frame_graph() {
+  m_graph.init(m_logical_device, m_allocator);
+  m_graph.reset();
+
+  rg_state target_initial{VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT |
+                              VK_PIPELINE_STAGE_TRANSFER_BIT,
+                          0, VK_IMAGE_LAYOUT_UNDEFINED};
+  // The acquire semaphore is waited on at the color output stage, a headless
+  // target was last read by the read back copy
+  rg_state target_final;
+  if (!m_headless) {
+    target_final = {VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, 0,
+                    VK_IMAGE_LAYOUT_PRESENT_SRC_KHR};
+  }
+  m_target_resource = m_graph.import_image("target", VK_IMAGE_ASPECT_COLOR_BIT,
+                                           target_initial, target_final);
+  m_depth_resource = m_graph.create_image(
+      "depth", {m_depth_format, m_swapchain_extent, m_depth_aspect});
+
+  bool gpu_culling = m_cull_mode == cull_mode::gpu && !m_scene.empty();
+  if (gpu_culling) {
+    m_draw_commands_resource = m_graph.import_buffer(
+        "draw_commands", {VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT, 0,
+                          VK_IMAGE_LAYOUT_UNDEFINED}); // Previous frame
+    m_graph.set_buffer(m_draw_commands_resource,
+                       m_scene.get_draw_command_buffer());
+
+    uint32_t reset = m_graph.add_pass("cull_reset", [this](VkCommandBuffer cb) {
+      vkCmdFillBuffer(cb, m_scene.get_draw_command_buffer(),
+                      gpu_draw_commands::COUNT_OFFSET, sizeof(uint32_t), 0);
+    });
+    m_graph.write(reset, m_draw_commands_resource, rg_usage::transfer_dst);
+
+    uint32_t cull = m_graph.add_pass(
+        "cull", [this](VkCommandBuffer cb) { record_culling(cb); });
+    m_graph.read_write(cull, m_draw_commands_resource, rg_usage::storage);
+  }
+
+  uint32_t main = m_graph.add_pass(
+      "main", [this](VkCommandBuffer cb) { record_main_pass(cb); });
+  m_graph.write(main, m_target_resource, rg_usage::color_attachment);
+  m_graph.write(main, m_depth_resource, rg_usage::depth_attachment);
+  if (gpu_culling) {
+    m_graph.read(main, m_draw_commands_resource, rg_usage::indirect);
+  }
+
+  if (m_headless) {
+    m_readback_resource = m_graph.import_buffer(
+        "readback", {}, {VK_PIPELINE_STAGE_HOST_BIT, VK_ACCESS_HOST_READ_BIT,
+                         VK_IMAGE_LAYOUT_UNDEFINED});
+
+    uint32_t readback = m_graph.add_pass(
+        "readback", [this](VkCommandBuffer cb) { record_readback(cb); });
+    m_graph.read(readback, m_target_resource, rg_usage::transfer_src);
+    m_graph.write(readback, m_readback_resource, rg_usage::transfer_dst);
+  } // Copy the frame to host memory, the buffer is bound every frame
+
+  m_graph.compile();
+}
+
+/**
+ * @brief Builds the frame graph, which creates the depth target, and, on the
+ * render pass path, one framebuffer per swap chain image. Dynamic rendering
+ * needs no framebuffer objects
+ */
 void vk_loader::create_framebuffers() {
+  build_frame_graph();
+  if (m_dynamic_rendering)
+    return;
+
   m_swapchain_framebuffers.resize(m_swapchain_image_views.size());
+  VkImageView depth_view = m_graph.get_image_view(m_depth_resource);
 
   for (size_t i = 0; i < m_swapchain_image_views.size(); ++i) {
-    VkImageView attachments[] = {m_swapchain_image_views[i]};
+    VkImageView attachments[] = {m_swapchain_image_views[i], depth_view};
 
     VkFramebufferCreateInfo framebuffer_info{};
     framebuffer_info.sType = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO;
     framebuffer_info.renderPass = m_render_pass;
-    framebuffer_info.attachmentCount = 1;
+    framebuffer_info.attachmentCount = 2;
     framebuffer_info.pAttachments = attachments;
     framebuffer_info.width = m_swapchain_extent.width;
     framebuffer_info.height = m_swapchain_extent.height;
@@ -763,27 +1607,905 @@ void vk_loader::create_framebuffers() {
   }
 }
 
+/**
+ * @brief Creates the device local images used as render targets when there is
+ * no swap chain. The frames are copied back to buffers of the frame arenas.
+ * The images take the place of the swap chain images so the image views,
+ * render pass and framebuffers are created the same way in both modes. There
+ * is one target per frame in flight so consecutive frames never share one
+ */
+void vk_loader::create_offscreen_targets(VkExtent2D extent) {
+  m_swapchain_image_format = VK_FORMAT_R8G8B8A8_UNORM;
+  m_swapchain_extent = extent;
+
+  m_swapchain_images.resize(m_frames_in_flight);
+  m_offscreen_allocations.resize(m_swapchain_images.size());
+
+  for (size_t i = 0; i < m_swapchain_images.size(); i++) {
+    VkImageCreateInfo image_info{};
+    image_info.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+    image_info.imageType = VK_IMAGE_TYPE_2D;
+    image_info.format = m_swapchain_image_format;
+    image_info.extent = {extent.width, extent.height, 1};
+    image_info.mipLevels = 1;
+    image_info.arrayLayers = 1;
+    image_info.samples = VK_SAMPLE_COUNT_1_BIT;
+    image_info.tiling = VK_IMAGE_TILING_OPTIMAL;
+    image_info.usage =
+        VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT;
+    image_info.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+    image_info.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+
+    m_offscreen_allocations[i] = m_allocator.create_image(
+        image_info, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, m_swapchain_images[i]);
+  }
+}
+
+void vk_loader::set_viewport_and_scissor(VkCommandBuffer command_buffer) {
+  VkViewport viewport{};
+  viewport.x = 0.0f;
+  viewport.y = 0.0f;
+  viewport.width = static_cast<float>(m_swapchain_extent.width);
+  viewport.height = static_cast<float>(m_swapchain_extent.height);
+  viewport.minDepth = 0.0f;
+  viewport.maxDepth = 1.0f;
+  vkCmdSetViewport(command_buffer, 0, 1, &viewport);
+
+  VkRect2D scissor{};
+  scissor.offset = {0, 0};
+  scissor.extent = m_swapchain_extent;
+  vkCmdSetScissor(command_buffer, 0, 1, &scissor);
+}
+
+/**
+ * @brief Binds the mesh pipeline, the bindless set, the geometry and the push
+ * constants. Needed once per command buffer
+ */
+void vk_loader::bind_scene(VkCommandBuffer command_buffer) {
+  vkCmdBindPipeline(command_buffer, VK_PIPELINE_BIND_POINT_GRAPHICS,
+                    m_mesh_pipeline);
+  VkDescriptorSet bindless_set = m_bindless.get_set();
+  vkCmdBindDescriptorSets(command_buffer, VK_PIPELINE_BIND_POINT_GRAPHICS,
+                          m_pipeline_layout, 0, 1, &bindless_set, 0, nullptr);
+
+  VkBuffer vertex_buffer = m_scene.get_vertex_buffer();
+  VkDeviceSize offset = 0;
+  vkCmdBindVertexBuffers(command_buffer, 0, 1, &vertex_buffer, &offset);
+  vkCmdBindIndexBuffer(command_buffer, m_scene.get_index_buffer(), 0,
+                       VK_INDEX_TYPE_UINT32);
+
+  mesh_push_constants constants;
+  constants.view_proj = m_view_proj;
+  constants.object_buffer = m_scene.get_object_buffer_index();
+  constants.material_buffer = m_scene.get_material_buffer_index();
+  constants.texture_lod_buffer = m_textures.get_lod_buffer_index();
+  vkCmdPushConstants(command_buffer, m_pipeline_layout, M_PUSH_CONSTANT_STAGES,
+                     0, sizeof(constants), &constants);
+}
+
+/**
+ * @brief Records draw_count draws of the visible list, starting at first_draw
+ */
+void vk_loader::record_scene_draws(VkCommandBuffer command_buffer,
+                                   size_t first_draw, size_t draw_count) {
+  bind_scene(command_buffer);
+
+  const std::vector<draw_item> &draws = m_scene.get_draws();
+  for (size_t i = first_draw; i < first_draw + draw_count; i++) {
+    uint32_t object = m_visible_draws[i];
+    const draw_item &draw = draws[object];
+    vkCmdDrawIndexed(command_buffer, draw.index_count, 1, draw.first_index,
+                     draw.vertex_offset, object);
+  }
+}
+
+/**
+ * @brief Dispatches the culling shader over every object, after the
+ * cull_reset pass cleared the visible draw count. The frame graph orders it
+ * after the previous frame's indirect draw and before this frame's one
+ */
+void vk_loader::record_culling(VkCommandBuffer command_buffer) {
+  uint32_t object_count = static_cast<uint32_t>(m_scene.get_draws().size());
+
+  vkCmdBindPipeline(command_buffer, VK_PIPELINE_BIND_POINT_COMPUTE,
+                    m_cull_pipeline);
+  VkDescriptorSet bindless_set = m_bindless.get_set();
+  vkCmdBindDescriptorSets(command_buffer, VK_PIPELINE_BIND_POINT_COMPUTE,
+                          m_pipeline_layout, 0, 1, &bindless_set, 0, nullptr);
+
+  utils::frustum frustum = utils::extract_frustum(m_view_proj);
+  cull_push_constants constants;
+  std::copy(std::begin(frustum.planes), std::end(frustum.planes),
+            constants.planes);
+  constants.object_buffer = m_scene.get_object_buffer_index();
+  constants.draw_command_buffer = m_scene.get_draw_command_buffer_index();
+  constants.object_count = object_count;
+  vkCmdPushConstants(command_buffer, m_pipeline_layout, M_PUSH_CONSTANT_STAGES,
+                     0, sizeof(constants), &constants);
+
+  vkCmdDispatch(command_buffer,
+                (object_count + M_CULL_GROUP_SIZE - 1) / M_CULL_GROUP_SIZE, 1,
+                1);
+}
+
+/**
+ * @brief Splits the visible draws in slice_count contiguous slices recorded
+ * concurrently into secondary command buffers, then executes them in order.
+ * Each slice records from its own pool, so no pool is ever touched by two
+ * threads at once
+ */
+void vk_loader::record_scene_slices(VkCommandBuffer command_buffer,
+                                    frame_data &frame, uint32_t image_index,
+                                    uint32_t slice_count) {
+  size_t draw_count = m_visible_draws.size();
+
+  VkCommandBufferInheritanceRenderingInfo inheritance_rendering{};
+  inheritance_rendering.sType =
+      VK_STRUCTURE_TYPE_COMMAND_BUFFER_INHERITANCE_RENDERING_INFO;
+  inheritance_rendering.colorAttachmentCount = 1;
+  inheritance_rendering.pColorAttachmentFormats = &m_swapchain_image_format;
+  inheritance_rendering.depthAttachmentFormat = m_depth_format;
+  inheritance_rendering.rasterizationSamples = VK_SAMPLE_COUNT_1_BIT;
+
+  VkCommandBufferInheritanceInfo inheritance_info{};
+  inheritance_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_INHERITANCE_INFO;
+  if (m_dynamic_rendering) {
+    inheritance_info.pNext = &inheritance_rendering;
+  } else {
+    inheritance_info.renderPass = m_render_pass;
+    inheritance_info.subpass = 0;
+    inheritance_info.framebuffer = m_swapchain_framebuffers[image_index];
+  }
+  inheritance_info.pipelineStatistics =
+      m_profiler.get_inherited_statistics(); // Active around the pass
+
+  utils::parallel_for(
+      slice_count,
+      [&](size_t slice) {
+        vkResetCommandPool(m_logical_device, frame.slice_pools[slice], 0);
+        VkCommandBuffer secondary = frame.slice_buffers[slice];
+
+        VkCommandBufferBeginInfo begin_info{};
+        begin_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+        begin_info.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT |
+                           VK_COMMAND_BUFFER_USAGE_RENDER_PASS_CONTINUE_BIT;
+        begin_info.pInheritanceInfo = &inheritance_info;
+
+        if (vkBeginCommandBuffer(secondary, &begin_info) != VK_SUCCESS) {
+          throw std::runtime_error("failed to begin secondary command buffer");
+        }
+
+        size_t first = draw_count * slice / slice_count;
+        size_t last = draw_count * (slice + 1) / slice_count;
+        set_viewport_and_scissor(secondary); // Dynamic state is not inherited
+        record_scene_draws(secondary, first, last - first);
+
+        if (vkEndCommandBuffer(secondary) != VK_SUCCESS) {
+          throw std::runtime_error("failed to record secondary command buffer");
+        }
+      },
+      slice_count);
+
+  vkCmdExecuteCommands(command_buffer, slice_count, frame.slice_buffers.data());
+}
+
+/**
+ * @brief Uploads the scene geometry and frames the camera on its bounds. The
+ * scene is drawn from the next frame on, replacing the default triangle
+ */
+void vk_loader::load_scene(const assets::scene_data &scene) {
+  vkDeviceWaitIdle(m_logical_device); // The old buffers may still be in use
+  m_scene.upload(m_logical_device, m_allocator, m_staging, m_bindless,
+                 m_textures, scene);
+
+  for (auto framebuffer : m_swapchain_framebuffers) {
+    vkDestroyFramebuffer(m_logical_device, framebuffer, nullptr);
+  }
+  m_swapchain_framebuffers.clear();
+  create_framebuffers(); // The graph gains the culling passes
+
+  m_camera_center = (scene.bounds_min + scene.bounds_max) * 0.5f;
+  m_camera_radius =
+      std::max(glm::length(scene.bounds_max - scene.bounds_min) * 0.5f, 0.01f);
+  update_camera();
+}
+
+/**
+ * @brief Frames the scene bounds with the aspect ratio of the current extent
+ */
+void vk_loader::update_camera() {
+  float aspect = static_cast<float>(m_swapchain_extent.width) /
+                 static_cast<float>(m_swapchain_extent.height);
+
+  glm::mat4 view = glm::lookAt(
+      m_camera_center +
+          glm::vec3(0.0f, m_camera_radius * 0.5f, m_camera_radius * 2.0f),
+      m_camera_center, glm::vec3(0.0f, 1.0f, 0.0f));
+  glm::mat4 projection =
+      glm::perspective(glm::radians(45.0f), aspect, m_camera_radius * 0.01f,
+                       m_camera_radius * 10.0f);
+  projection[1][1] *= -1.0f; // Vulkan clip space Y points down
+
+  m_view_proj = projection * view;
+}
+
+gpu_scene &vk_loader::get_scene() { return m_scene; }
+
+present_goal parse_present_goal(const std::string &name) {
+  if (name == "latency")
+    return present_goal::latency;
+  if (name == "balanced")
+    return present_goal::balanced;
+  if (name == "throughput")
+    return present_goal::throughput;
+  throw std::runtime_error("unknown present goal: " + name);
+}
+
+/**
+ * @brief Picks the present mode and, unless image_count is given, the number
+ * of swap chain images. Must be called before set_frames_in_flight and before
+ * the swap chain is created
+ */
+void vk_loader::set_present_goal(present_goal goal, uint32_t image_count) {
+  m_present_goal = goal;
+  m_requested_image_count = image_count;
+}
+
+/**
+ * @brief Changes the number of frames the CPU may record ahead of the GPU, 0
+ * picks it from the present goal. Must be called before the offscreen targets
+ * and frame resources are created
+ */
+void vk_loader::set_frames_in_flight(uint32_t count) {
+  if (count == 0) {
+    switch (m_present_goal) {
+    case present_goal::latency:
+      count = 1; // Input is never older than the frame being drawn
+      break;
+    case present_goal::balanced:
+      count = 2;
+      break;
+    case present_goal::throughput:
+      count = 3;
+      break;
+    }
+  }
+  m_frames_in_flight = count;
+}
+
+uint32_t vk_loader::get_frames_in_flight() { return m_frames_in_flight; }
+
+uint32_t vk_loader::get_swapchain_image_count() {
+  return static_cast<uint32_t>(m_swapchain_images.size());
+}
+
+VkPresentModeKHR vk_loader::get_present_mode() { return m_present_mode; }
+
+/**
+ * @brief Threads of the job system the draw list is recorded on, 0 uses all
+ * of them. Capped at 16, past that the submission dominates anyway
+ */
+void vk_loader::set_recording_threads(uint32_t count) {
+  if (count == 0) {
+    count = utils::job_system::get().get_thread_count();
+  }
+  m_recording_threads = std::clamp(count, 1u, 16u);
+}
+
+cull_mode parse_cull_mode(const std::string &name) {
+  if (name == "none")
+    return cull_mode::none;
+  if (name == "cpu")
+    return cull_mode::cpu;
+  if (name == "gpu")
+    return cull_mode::gpu;
+  throw std::runtime_error("unknown culling mode: " + name);
+}
+
+/**
+ * @brief Where the scene is culled. Must be called before the logical device
+ * is created, gpu falls back to cpu when the device cannot draw indirect
+ * counts
+ */
+void vk_loader::set_cull_mode(cull_mode mode) { m_cull_mode = mode; }
+
+cull_mode vk_loader::get_cull_mode() { return m_cull_mode; }
+
+void vk_loader::create_frame_resources() {
+  queue_family_indices indices =
+      find_queue_families(m_selected_physical_device);
+
+  m_frames.resize(m_frames_in_flight);
+
+  for (auto &frame : m_frames) {
+    VkCommandPoolCreateInfo pool_info{};
+    pool_info.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+    pool_info.flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT;
+    pool_info.queueFamilyIndex = indices.graphics_family.value();
+
+    if (vkCreateCommandPool(m_logical_device, &pool_info, nullptr,
+                            &frame.command_pool) != VK_SUCCESS) {
+      throw std::runtime_error("failed to create command pool");
+    }
+
+    VkCommandBufferAllocateInfo alloc_info{};
+    alloc_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+    alloc_info.commandPool = frame.command_pool;
+    alloc_info.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+    alloc_info.commandBufferCount = 1;
+
+    if (vkAllocateCommandBuffers(m_logical_device, &alloc_info,
+                                 &frame.command_buffer) != VK_SUCCESS) {
+      throw std::runtime_error("failed to allocate command buffers");
+    }
+
+    frame.arena = m_allocator.create_linear_arena(
+        VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
+            VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+        M_FRAME_ARENA_SIZE); // No memory until the first allocation
+
+    frame.slice_pools.resize(m_recording_threads);
+    frame.slice_buffers.resize(m_recording_threads);
+    for (uint32_t slice = 0; slice < m_recording_threads; slice++) {
+      if (vkCreateCommandPool(m_logical_device, &pool_info, nullptr,
+                              &frame.slice_pools[slice]) != VK_SUCCESS) {
+        throw std::runtime_error("failed to create command pool");
+      }
+
+      VkCommandBufferAllocateInfo slice_info{};
+      slice_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+      slice_info.commandPool = frame.slice_pools[slice];
+      slice_info.level = VK_COMMAND_BUFFER_LEVEL_SECONDARY;
+      slice_info.commandBufferCount = 1;
+
+      if (vkAllocateCommandBuffers(m_logical_device, &slice_info,
+                                   &frame.slice_buffers[slice]) !=
+          VK_SUCCESS) {
+        throw std::runtime_error("failed to allocate command buffers");
+      }
+    } // Pools are externally synchronized, one per slice and frame
+
+    VkFenceCreateInfo fence_info{};
+    fence_info.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
+    fence_info.flags = VK_FENCE_CREATE_SIGNALED_BIT; // First wait returns
+
+    VkSemaphoreCreateInfo semaphore_info{};
+    semaphore_info.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+
+    if (vkCreateFence(m_logical_device, &fence_info, nullptr,
+                      &frame.in_flight_fence) != VK_SUCCESS ||
+        vkCreateSemaphore(m_logical_device, &semaphore_info, nullptr,
+                          &frame.image_available) != VK_SUCCESS) {
+      throw std::runtime_error("failed to create frame sync objects");
+    }
+  }
+
+  if (m_headless)
+    return; // Nothing is acquired nor presented
+
+  create_render_finished_semaphores();
+}
+
+void vk_loader::create_render_finished_semaphores() {
+  m_render_finished.resize(m_swapchain_images.size());
+  for (auto &semaphore : m_render_finished) {
+    VkSemaphoreCreateInfo semaphore_info{};
+    semaphore_info.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+
+    if (vkCreateSemaphore(m_logical_device, &semaphore_info, nullptr,
+                          &semaphore) != VK_SUCCESS) {
+      throw std::runtime_error("failed to create frame sync objects");
+    }
+  } // Per image, the presentation engine releases them in image order
+}
+
+/**
+ * @brief Asks for the swap chain to be recreated before the next frame
+ */
+void vk_loader::notify_resized() { m_swapchain_stale = true; }
+
+/**
+ * @brief Builds a new swap chain from the old one, with its image views,
+ * depth targets and framebuffers. The old resources are retired, not
+ * destroyed, frames still in flight may use them. Returns false while the
+ * window is minimized
+ */
+bool vk_loader::recreate_swap_chain() {
+  int width = 0;
+  int height = 0;
+  glfwGetFramebufferSize(m_window, &width, &height);
+  if (width == 0 || height == 0)
+    return false; // Nothing to present to
+
+  retired_swapchain retired;
+  retired.swapchain = m_swapchain;
+  retired.image_views.swap(m_swapchain_image_views);
+  retired.framebuffers.swap(m_swapchain_framebuffers);
+  retired.transients = m_graph.take_transients();
+  retired.render_finished.swap(m_render_finished);
+  retired.frame_number = m_frame_number;
+  m_retired_swapchains.push_back(std::move(retired));
+
+  create_swap_chain(m_window); // The render pass format is kept
+  create_swap_chain_image_views();
+  create_framebuffers();
+  create_render_finished_semaphores();
+  update_camera();
+  publish_pipeline_targets();
+
+  m_swapchain_stale = false;
+  return true;
+}
+
+/**
+ * @brief Destroys the retired swap chains no frame can be using anymore.
+ * Frames finish in order and the fence of frame_number - frames_in_flight has
+ * been waited on, one more frame of margin covers the last present
+ */
+void vk_loader::destroy_retired_swapchains(bool wait_idle) {
+  auto done = [&](const retired_swapchain &retired) {
+    return wait_idle ||
+           m_frame_number >= retired.frame_number + m_frames_in_flight;
+  };
+
+  for (auto &retired : m_retired_swapchains) {
+    if (!done(retired))
+      continue;
+
+    for (auto framebuffer : retired.framebuffers) {
+      vkDestroyFramebuffer(m_logical_device, framebuffer, nullptr);
+    }
+    m_graph.destroy_transients(retired.transients);
+    for (auto image_view : retired.image_views) {
+      vkDestroyImageView(m_logical_device, image_view, nullptr);
+    }
+    for (auto semaphore : retired.render_finished) {
+      vkDestroySemaphore(m_logical_device, semaphore, nullptr);
+    }
+    vkDestroySwapchainKHR(m_logical_device, retired.swapchain, nullptr);
+  }
+
+  m_retired_swapchains.erase(std::remove_if(m_retired_swapchains.begin(),
+                                            m_retired_swapchains.end(), done),
+                             m_retired_swapchains.end());
+}
+
+/**
+ * @brief Creates the query pools that time the passes of every frame in
+ * flight, pipeline statistics are only gathered if asked for and supported
+ */
+void vk_loader::create_profiler(bool pipeline_statistics) {
+  queue_family_indices indices =
+      find_queue_families(m_selected_physical_device);
+
+  m_profiler.create(m_selected_physical_device, m_logical_device,
+                    indices.graphics_family.value(), m_frames_in_flight,
+                    pipeline_statistics);
+}
+
+gpu_profiler &vk_loader::get_profiler() { return m_profiler; }
+
+render_graph_stats vk_loader::get_render_graph_stats() {
+  return m_graph.get_stats();
+}
+
+/**
+ * @brief Time spent inside vkCreateGraphicsPipelines since the device was
+ * created
+ */
+double vk_loader::get_pipeline_creation_ms() {
+  std::lock_guard<std::mutex> lock(m_pipeline_stats_mutex);
+  return m_pipeline_creation_ms;
+}
+
+pipeline_registry_stats vk_loader::get_pipeline_registry_stats() {
+  return m_pipelines.get_stats();
+}
+
+/**
+ * @brief Begins drawing into the target image_index, clearing color and
+ * depth. The frame graph has already moved both to their attachment layouts
+ */
+void vk_loader::begin_main_pass(VkCommandBuffer command_buffer,
+                                uint32_t image_index, bool secondaries) {
+  VkClearValue clear_values[2]{};
+  clear_values[0].color = {{0.0f, 0.0f, 0.0f, 1.0f}};
+  clear_values[1].depthStencil = {1.0f, 0};
+
+  if (!m_dynamic_rendering) {
+    VkRenderPassBeginInfo render_pass_info{};
+    render_pass_info.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
+    render_pass_info.renderPass = m_render_pass;
+    render_pass_info.framebuffer = m_swapchain_framebuffers[image_index];
+    render_pass_info.renderArea.offset = {0, 0};
+    render_pass_info.renderArea.extent = m_swapchain_extent;
+    render_pass_info.clearValueCount = 2;
+    render_pass_info.pClearValues = clear_values;
+    vkCmdBeginRenderPass(command_buffer, &render_pass_info,
+                         secondaries
+                             ? VK_SUBPASS_CONTENTS_SECONDARY_COMMAND_BUFFERS
+                             : VK_SUBPASS_CONTENTS_INLINE);
+    return;
+  }
+
+  VkRenderingAttachmentInfo color_attachment{};
+  color_attachment.sType = VK_STRUCTURE_TYPE_RENDERING_ATTACHMENT_INFO;
+  color_attachment.imageView = m_swapchain_image_views[image_index];
+  color_attachment.imageLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+  color_attachment.loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
+  color_attachment.storeOp = VK_ATTACHMENT_STORE_OP_STORE;
+  color_attachment.clearValue = clear_values[0];
+
+  VkRenderingAttachmentInfo depth_attachment{};
+  depth_attachment.sType = VK_STRUCTURE_TYPE_RENDERING_ATTACHMENT_INFO;
+  depth_attachment.imageView = m_graph.get_image_view(m_depth_resource);
+  depth_attachment.imageLayout =
+      VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
+  depth_attachment.loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
+  depth_attachment.storeOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+  depth_attachment.clearValue = clear_values[1];
+
+  VkRenderingInfo rendering_info{};
+  rendering_info.sType = VK_STRUCTURE_TYPE_RENDERING_INFO;
+  rendering_info.flags =
+      secondaries ? VK_RENDERING_CONTENTS_SECONDARY_COMMAND_BUFFERS_BIT : 0;
+  rendering_info.renderArea.offset = {0, 0};
+  rendering_info.renderArea.extent = m_swapchain_extent;
+  rendering_info.layerCount = 1;
+  rendering_info.colorAttachmentCount = 1;
+  rendering_info.pColorAttachments = &color_attachment;
+  rendering_info.pDepthAttachment = &depth_attachment;
+  m_cmd_begin_rendering(command_buffer, &rendering_info);
+}
+
+void vk_loader::end_main_pass(VkCommandBuffer command_buffer) {
+  if (m_dynamic_rendering) {
+    m_cmd_end_rendering(command_buffer);
+  } else {
+    vkCmdEndRenderPass(command_buffer);
+  }
+}
+
+/**
+ * @brief The main pass of the frame graph: the scene, or the default triangle
+ * until one is loaded and its pipeline compiled, with the draws picked by
+ * record_command_buffer
+ */
+void vk_loader::record_main_pass(VkCommandBuffer command_buffer) {
+  uint32_t image_index = m_recording_image_index;
+  uint32_t slice_count = m_recording_slices;
+  bool gpu_culling = m_cull_mode == cull_mode::gpu && !m_scene.empty();
+
+  begin_main_pass(command_buffer, image_index, slice_count > 1);
+  if (slice_count > 1) {
+    record_scene_slices(command_buffer, m_frames[m_current_frame],
+                        image_index, slice_count);
+  } else {
+    set_viewport_and_scissor(command_buffer);
+
+    if (m_scene.empty() || m_mesh_pipeline == VK_NULL_HANDLE) {
+      vkCmdBindPipeline(command_buffer, VK_PIPELINE_BIND_POINT_GRAPHICS,
+                        m_graphics_pipeline);
+      vkCmdDraw(command_buffer, 3, 1, 0, 0);
+    } else if (gpu_culling) {
+      bind_scene(command_buffer);
+      VkBuffer draw_commands = m_scene.get_draw_command_buffer();
+      vkCmdDrawIndexedIndirectCount(
+          command_buffer, draw_commands, gpu_draw_commands::COMMANDS_OFFSET,
+          draw_commands, gpu_draw_commands::COUNT_OFFSET,
+          static_cast<uint32_t>(m_recording_draws), gpu_draw_commands::STRIDE);
+    } else {
+      record_scene_draws(command_buffer, 0, m_recording_draws);
+    } // The default triangle until a scene can be drawn
+  } // Small draw lists are not worth waking the other threads
+  end_main_pass(command_buffer);
+}
+
+/**
+ * @brief Copies the headless target into the read back buffer of the frame
+ */
+void vk_loader::record_readback(VkCommandBuffer command_buffer) {
+  VkBufferImageCopy region{};
+  region.bufferOffset = 0;
+  region.bufferRowLength = 0;
+  region.bufferImageHeight = 0;
+  region.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+  region.imageSubresource.mipLevel = 0;
+  region.imageSubresource.baseArrayLayer = 0;
+  region.imageSubresource.layerCount = 1;
+  region.imageOffset = {0, 0, 0};
+  region.imageExtent = {m_swapchain_extent.width, m_swapchain_extent.height,
+                        1};
+
+  vkCmdCopyImageToBuffer(command_buffer,
+                         m_swapchain_images[m_recording_image_index],
+                         VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+                         m_frames[m_current_frame].readback_buffer, 1, &region);
+}
+
+/**
+ * @brief Releases what the frame allocated the last time its slot was used,
+ * the fence has signaled so the GPU is done with it, and allocates this
+ * frame's read back buffer from the slot's arena
+ */
+void vk_loader::reset_frame_data(frame_data &frame) {
+  vkDestroyBuffer(m_logical_device, frame.readback_buffer, nullptr);
+  frame.readback_buffer = VK_NULL_HANDLE;
+  frame.readback_allocation = {};
+  m_allocator.reset_linear_arena(frame.arena);
+
+  if (!m_headless)
+    return;
+
+  VkBufferCreateInfo buffer_info{};
+  buffer_info.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+  buffer_info.size = static_cast<VkDeviceSize>(m_swapchain_extent.width) *
+                     m_swapchain_extent.height * 4;
+  buffer_info.usage = VK_BUFFER_USAGE_TRANSFER_DST_BIT;
+  buffer_info.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+
+  if (vkCreateBuffer(m_logical_device, &buffer_info, nullptr,
+                     &frame.readback_buffer) != VK_SUCCESS) {
+    throw std::runtime_error("failed to create read back buffer");
+  }
+
+  VkMemoryRequirements requirements;
+  vkGetBufferMemoryRequirements(m_logical_device, frame.readback_buffer,
+                                &requirements);
+  frame.readback_allocation = m_allocator.allocate_linear(
+      frame.arena, requirements, resource_kind::linear);
+  vkBindBufferMemory(m_logical_device, frame.readback_buffer,
+                     frame.readback_allocation.memory,
+                     frame.readback_allocation.offset);
+  m_graph.set_buffer(m_readback_resource, frame.readback_buffer);
+}
+
+/**
+ * @brief Picks the draws of the frame and records the frame graph into the
+ * target image_index
+ */
+void vk_loader::record_command_buffer(VkCommandBuffer command_buffer,
+                                      uint32_t image_index,
+                                      upload_wait &uploads) {
+  VkCommandBufferBeginInfo begin_info{};
+  begin_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+  begin_info.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+
+  if (vkBeginCommandBuffer(command_buffer, &begin_info) != VK_SUCCESS) {
+    throw std::runtime_error("failed to begin recording command buffer");
+  }
+
+  m_profiler.begin_frame(command_buffer, m_current_frame);
+  uploads.record(command_buffer); // Take ownership of the uploaded resources
+  m_textures.record(command_buffer);
+
+  size_t draw_count = m_scene.empty() ? 0 : m_scene.get_draws().size();
+  bool gpu_culling = m_cull_mode == cull_mode::gpu && draw_count > 0;
+  if (!gpu_culling && draw_count > 0) {
+    if (m_cull_mode == cull_mode::cpu) {
+      utils::cull(utils::extract_frustum(m_view_proj), m_scene.get_bounds(),
+                  m_visible_draws);
+    } else {
+      m_visible_draws.resize(draw_count);
+      std::iota(m_visible_draws.begin(), m_visible_draws.end(), 0u);
+    }
+    draw_count = m_visible_draws.size();
+  } // The draws recorded from the CPU, by index
+  uint32_t slice_count = static_cast<uint32_t>(std::min<size_t>(
+      m_recording_threads, draw_count / M_MIN_DRAWS_PER_SLICE));
+  if (gpu_culling || m_mesh_pipeline == VK_NULL_HANDLE) {
+    slice_count = 1; // A single indirect draw, or the fallback triangle
+  }
+
+  m_recording_image_index = image_index;
+  m_recording_slices = slice_count;
+  m_recording_draws = draw_count;
+  m_graph.set_image(m_target_resource, m_swapchain_images[image_index],
+                    m_swapchain_image_views[image_index]);
+  m_graph.execute(command_buffer, &m_profiler); // One timed pass per node
+
+  if (vkEndCommandBuffer(command_buffer) != VK_SUCCESS) {
+    throw std::runtime_error("failed to record command buffer");
+  }
+}
+
+/**
+ * @brief Records and submits the next frame. Only the fence of the frame slot
+ * being reused is waited on, so the CPU records frame N+1 while the GPU is
+ * still executing frame N. In headless mode each slot renders into its own
+ * offscreen target and nothing is acquired or presented. Returns false if no
+ * frame was submitted: the window is minimized or the swap chain was out of
+ * date
+ */
+bool vk_loader::draw_frame() {
+  frame_data &frame = m_frames[m_current_frame];
+
+  vkWaitForFences(m_logical_device, 1, &frame.in_flight_fence, VK_TRUE,
+                  UINT64_MAX);
+  destroy_retired_swapchains(false);
+  destroy_retired_pipelines(false);
+  swap_reloaded_pipelines();
+  poll_pipelines();
+
+  uint32_t image_index = m_current_frame;
+  if (!m_headless) {
+    if (m_swapchain_stale && !recreate_swap_chain())
+      return false; // Minimized, the fence stays signaled for the next try
+
+    VkResult result = vkAcquireNextImageKHR(
+        m_logical_device, m_swapchain, UINT64_MAX, frame.image_available,
+        VK_NULL_HANDLE, &image_index);
+    if (result == VK_ERROR_OUT_OF_DATE_KHR) {
+      m_swapchain_stale = true;
+      return false; // Nothing acquired, nothing signaled
+    }
+    if (result != VK_SUCCESS && result != VK_SUBOPTIMAL_KHR) {
+      throw std::runtime_error("failed to acquire swap chain image");
+    }
+  }
+
+  vkResetFences(m_logical_device, 1, &frame.in_flight_fence);
+  vkResetCommandPool(m_logical_device, frame.command_pool, 0);
+  reset_frame_data(frame);
+
+  m_textures.stream(); // This frame generates the mips of what goes now
+  m_staging.flush();   // Everything uploaded so far is usable by this frame
+  upload_wait uploads = m_staging.take_wait();
+  record_command_buffer(frame.command_buffer, image_index, uploads);
+
+  std::vector<VkSemaphore> wait_semaphores;
+  std::vector<VkPipelineStageFlags> wait_stages;
+  std::vector<uint64_t> wait_values; // Ignored for binary semaphores
+  if (!m_headless) {
+    wait_semaphores.push_back(frame.image_available);
+    wait_stages.push_back(VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT);
+    wait_values.push_back(0);
+  }
+  if (uploads.value != 0) {
+    wait_semaphores.push_back(m_staging.get_timeline());
+    wait_stages.push_back(uploads.stages);
+    wait_values.push_back(uploads.value);
+  }
+
+  VkTimelineSemaphoreSubmitInfo timeline_info{};
+  timeline_info.sType = VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO;
+  timeline_info.waitSemaphoreValueCount =
+      static_cast<uint32_t>(wait_values.size());
+  timeline_info.pWaitSemaphoreValues = wait_values.data();
+
+  VkSubmitInfo submit_info{};
+  submit_info.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+  submit_info.pNext = &timeline_info;
+  submit_info.waitSemaphoreCount =
+      static_cast<uint32_t>(wait_semaphores.size());
+  submit_info.pWaitSemaphores = wait_semaphores.data();
+  submit_info.pWaitDstStageMask = wait_stages.data();
+  submit_info.commandBufferCount = 1;
+  submit_info.pCommandBuffers = &frame.command_buffer;
+  if (!m_headless) {
+    submit_info.signalSemaphoreCount = 1;
+    submit_info.pSignalSemaphores = &m_render_finished[image_index];
+  }
+
+  std::unique_lock<std::mutex> queue_lock(m_queue_mutex);
+  if (vkQueueSubmit(m_graphics_queue, 1, &submit_info,
+                    frame.in_flight_fence) != VK_SUCCESS) {
+    throw std::runtime_error("failed to submit draw command buffer");
+  }
+
+  m_last_submitted_frame = m_current_frame;
+  m_frame_submitted = true;
+  m_frame_number++;
+  m_current_frame = (m_current_frame + 1) % m_frames_in_flight;
+
+  if (m_headless)
+    return true;
+
+  VkPresentInfoKHR present_info{};
+  present_info.sType = VK_STRUCTURE_TYPE_PRESENT_INFO_KHR;
+  present_info.waitSemaphoreCount = 1;
+  present_info.pWaitSemaphores = &m_render_finished[image_index];
+  present_info.swapchainCount = 1;
+  present_info.pSwapchains = &m_swapchain;
+  present_info.pImageIndices = &image_index;
+
+  VkResult result = vkQueuePresentKHR(m_present_queue, &present_info);
+  queue_lock.unlock();
+  if (result == VK_ERROR_OUT_OF_DATE_KHR || result == VK_SUBOPTIMAL_KHR) {
+    m_swapchain_stale = true; // Recreated before the next acquire
+  } else if (result != VK_SUCCESS) {
+    throw std::runtime_error("failed to present swap chain image");
+  }
+  return true;
+}
+
+/**
+ * @brief Returns a copy of the last submitted offscreen frame as tightly packed
+ * RGBA8 rows. Waits for that frame only, not for the whole device
+ */
+std::vector<uint8_t> vk_loader::read_back_frame() {
+  if (!m_frame_submitted ||
+      m_frames[m_last_submitted_frame].readback_allocation.mapped == nullptr) {
+    throw std::runtime_error("no headless frame to read back");
+  }
+  frame_data &frame = m_frames[m_last_submitted_frame];
+
+  vkWaitForFences(m_logical_device, 1, &frame.in_flight_fence, VK_TRUE,
+                  UINT64_MAX);
+
+  size_t size = static_cast<size_t>(m_swapchain_extent.width) *
+                m_swapchain_extent.height * 4;
+  m_allocator.invalidate(frame.readback_allocation, 0, size);
+  const uint8_t *pixels =
+      static_cast<const uint8_t *>(frame.readback_allocation.mapped);
+  return std::vector<uint8_t>(pixels, pixels + size);
+}
+
+void vk_loader::wait_idle() { vkDeviceWaitIdle(m_logical_device); }
+
 void vk_loader::destroy_vulkan() {
+  m_shader_reloader.stop(); // No pipeline is built past this point
+  vkDeviceWaitIdle(m_logical_device);
+  destroy_retired_swapchains(true);
+  swap_reloaded_pipelines();
+  destroy_retired_pipelines(true);
+
+  m_profiler.destroy();
+
+  for (auto &frame : m_frames) {
+    vkDestroyFence(m_logical_device, frame.in_flight_fence, nullptr);
+    vkDestroySemaphore(m_logical_device, frame.image_available, nullptr);
+    vkDestroyCommandPool(m_logical_device, frame.command_pool, nullptr);
+    for (auto pool : frame.slice_pools) {
+      vkDestroyCommandPool(m_logical_device, pool, nullptr);
+    }
+    vkDestroyBuffer(m_logical_device, frame.readback_buffer, nullptr);
+  } // The arenas go with the allocator
+  for (auto semaphore : m_render_finished) {
+    vkDestroySemaphore(m_logical_device, semaphore, nullptr);
+  }
 
   for (auto framebuffer : m_swapchain_framebuffers) {
     vkDestroyFramebuffer(m_logical_device, framebuffer, nullptr);
   }
+  m_graph.destroy();
+  m_scene.destroy(m_allocator);
+  m_textures.destroy();
 
-  vkDestroyPipeline(m_logical_device, m_graphics_pipeline, nullptr);
+  vkDestroyPipeline(m_logical_device, m_cull_pipeline, nullptr);
+  vkDestroyShaderModule(m_logical_device, m_cull_shader, nullptr);
+
+  for (VkPipeline pipeline : {m_graphics_pipeline, m_mesh_pipeline}) {
+    if (pipeline != VK_NULL_HANDLE && !m_pipelines.evict(pipeline)) {
+      vkDestroyPipeline(m_logical_device, pipeline, nullptr);
+    } // Reloaded replacements are ours, not the registry's
+  }
+  m_pipelines.destroy();
+  m_pipeline_cache.destroy(); // Written back to disk
   vkDestroyPipelineLayout(m_logical_device, m_pipeline_layout, nullptr);
+  m_bindless.destroy(); // After every user of its set layout
   vkDestroyRenderPass(m_logical_device, m_render_pass, nullptr);
   for (auto image_view : m_swapchain_image_views) {
     vkDestroyImageView(m_logical_device, image_view, nullptr);
   }
-  vkDestroySwapchainKHR(m_logical_device, m_swapchain, nullptr);
 
-  vkDestroyShaderModule(m_logical_device, m_def_shader[0], nullptr);
-  vkDestroyShaderModule(m_logical_device, m_def_shader[1], nullptr);
+  if (m_headless) {
+    for (size_t i = 0; i < m_swapchain_images.size(); i++) {
+      m_allocator.destroy_image(m_swapchain_images[i],
+                                m_offscreen_allocations[i]);
+    }
+  } else {
+    vkDestroySwapchainKHR(m_logical_device, m_swapchain, nullptr);
+  } // Offscreen targets are owned by us, swap chain images are not
 
+  m_staging.destroy();
+  m_allocator.destroy(); // Every resource bound to its blocks is gone by now
   vkDestroyDevice(m_logical_device, nullptr);
   if (M_ENABLE_VALIDATION_LAYERS) {
     destroy_debug_utils_messenger_ext(m_instance, m_debug_messenger, nullptr);
   }
-  vkDestroySurfaceKHR(m_instance, m_surface, nullptr);
+  if (m_surface != VK_NULL_HANDLE) {
+    vkDestroySurfaceKHR(m_instance, m_surface, nullptr);
+  }
   vkDestroyInstance(m_instance, nullptr);
 }
@@ -9,20 +9,152 @@
 #include <GLFW/glfw3.h>
 #include <cstdint>
 #include <iostream>
+#include <mutex>
 #include <optional>
+#include <string>
 #include <vector>
 #include <vulkan/vulkan.h>
+#include <vk_allocator.hh>
+#include <vk_bindless.hh>
+#include <vk_device_benchmark.hh>
+#include <vk_pipeline_cache.hh>
+#include <vk_pipeline_registry.hh>
+#include <vk_profiler.hh>
+#include <vk_render_graph.hh>
+#include <vk_scene.hh>
+#include <vk_shader_reloader.hh>
+#include <vk_staging_ring.hh>
+#include <vk_texture_streamer.hh>
 #include <vulkan/vulkan_core.h>
 
 struct queue_family_indices {
   std::optional<uint32_t> graphics_family;
   std::optional<uint32_t> present_family;
+  std::optional<uint32_t> transfer_family; // Transfer only, when there is one
 
   bool is_complete() {
     return graphics_family.has_value() && present_family.has_value();
   }
 };
 
+/**
+ * @brief Resources owned by a single frame in flight. Each frame records into
+ * its own pool so resetting it never touches a command buffer the GPU may
+ * still be executing
+ */
+struct frame_data {
+  VkCommandPool command_pool = VK_NULL_HANDLE;
+  VkCommandBuffer command_buffer = VK_NULL_HANDLE;
+  VkFence in_flight_fence = VK_NULL_HANDLE; // Signaled when the GPU is done
+  VkSemaphore image_available = VK_NULL_HANDLE; // Swap chain image acquired
+  std::vector<VkCommandPool> slice_pools; // One per recording slice
+  std::vector<VkCommandBuffer> slice_buffers; // Secondaries, same order
+  uint32_t arena = 0; // Per frame allocations, reset once the fence signals
+  VkBuffer readback_buffer = VK_NULL_HANDLE; // Headless copy of the frame
+  allocation readback_allocation;             // Persistently mapped
+};
+
+/**
+ * @brief Swap chain resources replaced on resize. They are destroyed once
+ * every frame submitted before the replacement has finished, so resizing
+ * never waits for the device to go idle
+ */
+struct retired_swapchain {
+  VkSwapchainKHR swapchain = VK_NULL_HANDLE;
+  std::vector<VkImageView> image_views;
+  std::vector<VkFramebuffer> framebuffers;
+  rg_transients transients; // Depth target of the frame graph
+  std::vector<VkSemaphore> render_finished;
+  uint64_t frame_number = 0; // First frame that no longer uses them
+};
+
+/**
+ * @brief Pipeline rebuilt from reloaded shaders, swapped in at the start of
+ * the next frame
+ */
+struct reloaded_pipeline {
+  VkPipeline *target = nullptr; // Member it replaces
+  VkPipeline pipeline = VK_NULL_HANDLE;
+};
+
+/**
+ * @brief What the graphics pipelines render into, copied for the reloader
+ * thread so it never reads the swap chain state the main thread rewrites
+ */
+struct pipeline_targets {
+  VkFormat color_format = VK_FORMAT_UNDEFINED;
+  VkFormat depth_format = VK_FORMAT_UNDEFINED;
+  VkRenderPass render_pass = VK_NULL_HANDLE; // Null with dynamic rendering
+  VkPipelineLayout layout = VK_NULL_HANDLE;
+};
+
+/**
+ * @brief Pipeline replaced by a reload, destroyed like a retired swap chain
+ */
+struct retired_pipeline {
+  VkPipeline pipeline = VK_NULL_HANDLE;
+  uint64_t frame_number = 0; // First frame that no longer uses it
+};
+
+/**
+ * @brief Push constants of the mesh pipeline, pushed once per command buffer.
+ * Per draw data is read from the object buffer through gl_InstanceIndex
+ */
+struct mesh_push_constants {
+  glm::mat4 view_proj;
+  uint32_t object_buffer = 0;   // Bindless buffer indices
+  uint32_t material_buffer = 0;
+  uint32_t texture_lod_buffer = 0;
+};
+
+/**
+ * @brief Push constants of the culling compute pipeline
+ */
+struct cull_push_constants {
+  glm::vec4 planes[6]; // World space frustum
+  uint32_t object_buffer = 0;
+  uint32_t draw_command_buffer = 0;
+  uint32_t object_count = 0;
+};
+
+/**
+ * @brief What the presentation is tuned for. latency keeps one frame in
+ * flight and presents the newest frame as soon as possible, throughput queues
+ * more images and frames so the GPU never waits for the CPU, balanced sits in
+ * between
+ */
+enum class present_goal { latency, balanced, throughput };
+
+/**
+ * @brief Parses "latency", "balanced" or "throughput", throws on anything else
+ */
+present_goal parse_present_goal(const std::string &name);
+
+/**
+ * @brief Where the draws outside the view are discarded. cpu tests the SoA
+ * bounds of the scene with SIMD before recording, gpu culls in a compute pass
+ * feeding vkCmdDrawIndexedIndirectCount
+ */
+enum class cull_mode { none, cpu, gpu };
+
+/**
+ * @brief Parses "none", "cpu" or "gpu", throws on anything else
+ */
+cull_mode parse_cull_mode(const std::string &name);
+
+/**
+ * @brief A suitable physical device and how it scored. index is its position
+ * in the suitable device list, the one pick_physical_device takes
+ */
+struct ranked_device {
+  VkPhysicalDevice device = VK_NULL_HANDLE;
+  uint32_t index = 0;
+  std::string name;
+  VkPhysicalDeviceType type = VK_PHYSICAL_DEVICE_TYPE_OTHER;
+  int capability_score = 0;
+  device_timings timings; // Unmeasured unless the benchmark is enabled
+};
+
 struct swap_chain_support_details {
   VkSurfaceCapabilitiesKHR capabilities;
   std::vector<VkSurfaceFormatKHR> formats;
@@ -38,6 +170,12 @@ class vk_loader {
   static constexpr bool M_ENABLE_VALIDATION_LAYERS = true;
 #endif // Enable validation layers only in debug
 
+  static constexpr VkShaderStageFlags M_PUSH_CONSTANT_STAGES =
+      VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT |
+      VK_SHADER_STAGE_COMPUTE_BIT; // One range shared by every pipeline
+  static constexpr uint32_t M_PUSH_CONSTANT_SIZE = 128; // Guaranteed minimum
+  static constexpr uint32_t M_CULL_GROUP_SIZE = 64;     // As in cull.comp
+
   static VKAPI_ATTR VkBool32 VKAPI_CALL
   m_debug_callback(VkDebugUtilsMessageSeverityFlagBitsEXT message_severity,
                    VkDebugUtilsMessageTypeFlagsEXT message_type,
@@ -56,32 +194,99 @@ class vk_loader {
   VkInstance m_instance; // Instance
 
   std::vector<VkPhysicalDevice> m_physical_devices;
+  std::vector<ranked_device> m_device_ranking; // Best first
+  device_benchmark m_device_benchmark;
+  bool m_benchmark_devices = false;
   VkPhysicalDevice m_selected_physical_device =
       VK_NULL_HANDLE; // Physical devices
 
   VkDevice m_logical_device = VK_NULL_HANDLE; // Logical device
   VkQueue m_graphics_queue;
   VkQueue m_present_queue;
+  VkQueue m_transfer_queue; // Graphics queue when there is no transfer family
 
   const std::vector<const char *> m_validation_layers = {
       "VK_LAYER_KHRONOS_validation"};
 
   VkDebugUtilsMessengerEXT m_debug_messenger; // Debug
 
-  const std::vector<const char *> m_device_extensions = {
-      VK_KHR_SWAPCHAIN_EXTENSION_NAME};
+  std::vector<const char *> m_device_extensions; // Filled on init_vulkan
+  const std::vector<const char *> m_optional_device_extensions = {
+      VK_EXT_PIPELINE_CREATION_FEEDBACK_EXTENSION_NAME};
+  std::vector<const char *> m_enabled_device_extensions; // Device extensions
 
-  VkSurfaceKHR m_surface;
-  VkSwapchainKHR m_swapchain;
+  bool m_headless = false; // Render offscreen without a surface
+
+  VkSurfaceKHR m_surface = VK_NULL_HANDLE;
+  GLFWwindow *m_window = nullptr; // Swap chain extent source
+  VkSwapchainKHR m_swapchain = VK_NULL_HANDLE;
+  bool m_swapchain_stale = false; // Resized or out of date, recreate it
+  present_goal m_present_goal = present_goal::balanced;
+  uint32_t m_requested_image_count = 0; // 0: picked from the goal
+  std::vector<retired_swapchain> m_retired_swapchains;
   std::vector<VkImage> m_swapchain_images;
   std::vector<VkImageView> m_swapchain_image_views;
   std::vector<VkFramebuffer> m_swapchain_framebuffers;
   VkFormat m_swapchain_image_format;
   VkExtent2D m_swapchain_extent;
-  VkShaderModule m_def_shader[2];
-  VkRenderPass m_render_pass;
-  VkPipelineLayout m_pipeline_layout;
+  VkPresentModeKHR m_present_mode = VK_PRESENT_MODE_FIFO_KHR;
+  VkRenderPass m_render_pass = VK_NULL_HANDLE; // Render pass path only
+  bool m_use_dynamic_rendering = true; // Requested, if the device has it
+  bool m_dynamic_rendering = false;    // Enabled on the logical device
+  PFN_vkCmdBeginRendering m_cmd_begin_rendering = nullptr; // Core or KHR
+  PFN_vkCmdEndRendering m_cmd_end_rendering = nullptr;
+  VkPipelineLayout m_pipeline_layout; // Bindless set and push constants
   VkPipeline m_graphics_pipeline;
+  pipeline_desc m_mesh_desc;
+  VkPipeline m_mesh_pipeline = VK_NULL_HANDLE; // Null while it compiles
+  VkShaderModule m_cull_shader = VK_NULL_HANDLE;
+  VkPipeline m_cull_pipeline = VK_NULL_HANDLE;
+  cull_mode m_cull_mode = cull_mode::gpu;
+
+  VkFormat m_depth_format;
+  VkImageAspectFlags m_depth_aspect = VK_IMAGE_ASPECT_DEPTH_BIT;
+  pipeline_cache m_pipeline_cache;
+  pipeline_registry m_pipelines; // Owns the default and mesh pipelines
+  double m_pipeline_creation_ms = 0.0;
+  std::mutex m_pipeline_stats_mutex; // Reloads build pipelines off-thread
+  shader_reloader m_shader_reloader;
+  std::mutex m_reload_mutex; // Guards the reloaded pipelines and targets
+  pipeline_targets m_reload_targets;
+  std::vector<reloaded_pipeline> m_reloaded_pipelines;
+  std::vector<retired_pipeline> m_retired_pipelines;
+
+  vk_allocator m_allocator; // Every buffer and image memory comes from here
+  std::mutex m_queue_mutex; // Guards the graphics queue if uploads share it
+  staging_ring m_staging;
+  bindless_heap m_bindless; // Every texture and storage buffer
+  texture_streamer m_textures;
+  gpu_profiler m_profiler; // Timings of the passes of every frame
+  render_graph m_graph; // Passes of a frame, rebuilt with the targets
+  uint32_t m_target_resource = 0; // Graph resources
+  uint32_t m_depth_resource = 0;
+  uint32_t m_draw_commands_resource = 0;
+  uint32_t m_readback_resource = 0;
+  gpu_scene m_scene;
+  glm::mat4 m_view_proj = glm::mat4(1.0f); // Camera framing the scene
+  glm::vec3 m_camera_center = glm::vec3(0.0f);
+  float m_camera_radius = 1.0f;
+
+  std::vector<allocation> m_offscreen_allocations; // Headless render targets
+
+  uint32_t m_frames_in_flight = 2;
+  uint32_t m_recording_threads = 1; // Slices the draw list is recorded in
+  std::vector<uint32_t> m_visible_draws; // Recorded from the CPU this frame
+  static constexpr uint32_t M_MIN_DRAWS_PER_SLICE = 64; // Below: one thread
+  static constexpr VkDeviceSize M_FRAME_ARENA_SIZE = 16ull << 20; // Grows
+  std::vector<frame_data> m_frames;
+  std::vector<VkSemaphore> m_render_finished; // One per swap chain image
+  uint32_t m_current_frame = 0;
+  uint32_t m_last_submitted_frame = 0;
+  uint64_t m_frame_number = 0; // Frames submitted so far
+  bool m_frame_submitted = false; // Frame loop
+  uint32_t m_recording_image_index = 0; // Read by the graph passes
+  uint32_t m_recording_slices = 1;
+  size_t m_recording_draws = 0;
 
   //---------------Member methods----------------------
   void create_instance();
@@ -104,8 +309,11 @@ class vk_loader {
 
   bool is_device_suitable(VkPhysicalDevice device);
   bool check_device_extension_support(VkPhysicalDevice device);
+  bool is_device_extension_available(VkPhysicalDevice device,
+                                     const char *extension);
   swap_chain_support_details query_swap_chain_support(VkPhysicalDevice device);
-  int rate_physical_device(VkPhysicalDevice device); // Physical devices
+  int rate_physical_device(VkPhysicalDevice device);
+  void rank_physical_devices(); // Physical devices
 
   queue_family_indices find_queue_families(VkPhysicalDevice device);
   VkPresentModeKHR choose_swap_present_mode(
@@ -115,23 +323,100 @@ class vk_loader {
   VkSurfaceFormatKHR choose_swap_surface_format(
       const std::vector<VkSurfaceFormatKHR> available_formats); // Swap chain
 
+  VkFormat find_depth_format();
+  void build_frame_graph();
+  void create_render_finished_semaphores();
+  bool recreate_swap_chain();
+  void destroy_retired_swapchains(bool wait_idle);
+  void update_camera();
+  pipeline_targets get_pipeline_targets();
+  void publish_pipeline_targets();
+  pipeline_desc get_def_desc(const pipeline_shader &vert,
+                             const pipeline_shader &frag,
+                             const pipeline_targets &targets);
+  pipeline_desc get_mesh_desc(const pipeline_shader &vert,
+                              const pipeline_shader &frag,
+                              const pipeline_targets &targets);
+  void poll_pipelines();
+  VkPipeline build_cull_pipeline(VkShaderModule shader);
+  void rebuild_pipeline(const std::string &shader);
+  void swap_reloaded_pipelines();
+  void destroy_retired_pipelines(bool wait_idle);
+  VkPipeline create_graphics_pipeline(const pipeline_desc &desc);
+  void record_command_buffer(VkCommandBuffer command_buffer,
+                             uint32_t image_index, upload_wait &uploads);
+  void begin_main_pass(VkCommandBuffer command_buffer, uint32_t image_index,
+                       bool secondaries);
+  void end_main_pass(VkCommandBuffer command_buffer);
+  void record_main_pass(VkCommandBuffer command_buffer);
+  void record_readback(VkCommandBuffer command_buffer);
+  void reset_frame_data(frame_data &frame);
+  void set_viewport_and_scissor(VkCommandBuffer command_buffer);
+  void record_culling(VkCommandBuffer command_buffer);
+  void bind_scene(VkCommandBuffer command_buffer);
+  void record_scene_draws(VkCommandBuffer command_buffer, size_t first_draw,
+                          size_t draw_count);
+  void record_scene_slices(VkCommandBuffer command_buffer,
+                           frame_data &frame, uint32_t image_index,
+                           uint32_t slice_count); // Rendering
+
 public:
   //---------------Public methods----------------------
-  void init_vulkan();
+  void init_vulkan(bool headless = false);
   void setup_debug_messenger();
   void create_surface(GLFWwindow *window);
+  void set_device_benchmark(bool enabled, const std::string &cache_path);
+  void set_dynamic_rendering(bool enabled);
+  bool is_dynamic_rendering();
   void find_physical_devices();
+  const std::vector<ranked_device> &get_device_ranking();
   void pick_physical_device(uint32_t id = 0);
   void pick_best_physical_device();
   void create_logical_device();
+  vk_allocator &get_allocator();
+  void create_staging_ring();
+  staging_ring &get_staging_ring();
+  void create_bindless_heap();
+  bindless_heap &get_bindless_heap();
+  void create_texture_streamer();
+  texture_streamer &get_texture_streamer();
+  void create_pipeline_cache(const std::string &path);
   void create_swap_chain(GLFWwindow *window);
+  void notify_resized();
   void create_swap_chain_image_views();
   void create_render_pass();
   void create_def_graphics_pipeline();
+  void create_mesh_pipeline();
+  void create_cull_pipeline();
+  void start_shader_reload(const std::string &directory);
   void create_framebuffers();
+  void create_offscreen_targets(VkExtent2D extent);
+  void set_present_goal(present_goal goal, uint32_t image_count = 0);
+  void set_frames_in_flight(uint32_t count);
+  uint32_t get_frames_in_flight();
+  uint32_t get_swapchain_image_count();
+  VkPresentModeKHR get_present_mode();
+  void set_recording_threads(uint32_t count);
+  void set_cull_mode(cull_mode mode);
+  cull_mode get_cull_mode();
+  void create_frame_resources();
+  void create_profiler(bool pipeline_statistics);
+  gpu_profiler &get_profiler();
+  render_graph_stats get_render_graph_stats();
+  double get_pipeline_creation_ms();
+  void wait_pipelines();
+  pipeline_registry_stats get_pipeline_registry_stats();
+  bool draw_frame();
+  std::vector<uint8_t> read_back_frame();
+  void wait_idle();
+  void load_scene(const assets::scene_data &scene);
+  gpu_scene &get_scene();
+  VkExtent2D get_extent();
+  bool is_headless();
   VkInstance get_vk_instance();
   VkPhysicalDevice get_selected_physical_device();
   std::vector<VkPhysicalDevice> get_physical_devices();
   VkDevice get_logical_device();
+  bool has_device_extension(const char *extension);
   void destroy_vulkan();
 };
@@ -0,0 +1,223 @@
+/**
+ * @file
+ * @author Ruben Pena <rubn.pena@gmail.com>
+ * @brief This file contains the implementation of the pipeline_cache class
+ */
+
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <mapped_file.hh>
+#include <stdexcept>
+#include <unistd.h>
+#include <vk_pipeline_cache.hh>
+
+const void *creation_feedback::chain(uint32_t stage_count, const void *next) {
+  m_pipeline = {};
+  m_stages.assign(stage_count, VkPipelineCreationFeedbackEXT{});
+
+  m_info = {};
+  m_info.sType = VK_STRUCTURE_TYPE_PIPELINE_CREATION_FEEDBACK_CREATE_INFO_EXT;
+  m_info.pNext = next;
+  m_info.pPipelineCreationFeedback = &m_pipeline;
+  m_info.pipelineStageCreationFeedbackCount = stage_count;
+  m_info.pPipelineStageCreationFeedbacks = m_stages.data();
+  return &m_info;
+}
+
+const VkPipelineCreationFeedbackEXT &
+creation_feedback::get_pipeline_feedback() {
+  return m_pipeline;
+}
+
+/**
+ * @brief Creates the cache, seeded with the blob at path when it was written
+ * by this exact device and driver
+ */
+void pipeline_cache::create(VkPhysicalDevice physical_device, VkDevice device,
+                            const std::string &path, bool feedback_supported) {
+  m_device = device;
+  m_path = path;
+  m_feedback_supported = feedback_supported;
+  vkGetPhysicalDeviceProperties(physical_device, &m_properties);
+
+  utils::mapped_file blob = load_blob(); // Driver reads straight from it
+
+  VkPipelineCacheCreateInfo create_info{};
+  create_info.sType = VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO;
+  if (!blob.empty()) {
+    create_info.initialDataSize = blob.size() - sizeof(file_header);
+    create_info.pInitialData = blob.data() + sizeof(file_header);
+  }
+
+  if (vkCreatePipelineCache(m_device, &create_info, nullptr, &m_cache) !=
+      VK_SUCCESS) {
+    create_info.initialDataSize = 0;
+    create_info.pInitialData = nullptr;
+    if (vkCreatePipelineCache(m_device, &create_info, nullptr, &m_cache) !=
+        VK_SUCCESS) {
+      throw std::runtime_error("failed to create pipeline cache");
+    }
+  } // The driver may still refuse data we could not validate, start empty
+}
+
+/**
+ * @brief Maps the file (header included), or returns an empty mapping when
+ * there is no usable cache on disk
+ */
+utils::mapped_file pipeline_cache::load_blob() {
+  if (m_path.empty())
+    return {};
+
+  utils::mapped_file blob;
+  try {
+    blob = utils::mapped_file(m_path, utils::access_hint::will_need);
+  } catch (const std::exception &) {
+    return {}; // First launch, nothing cached yet
+  }
+
+  if (!is_blob_valid(blob.view())) {
+    std::cerr << "pipeline cache: discarding stale or corrupt " << m_path
+              << std::endl;
+    return {};
+  }
+
+  return blob;
+}
+
+bool pipeline_cache::is_blob_valid(const utils::file_view &blob) {
+  if (blob.size < sizeof(file_header))
+    return false;
+
+  file_header header;
+  std::memcpy(&header, blob.data, sizeof(header));
+
+  if (header.magic != M_MAGIC || header.version != M_VERSION ||
+      header.vendor_id != m_properties.vendorID ||
+      header.device_id != m_properties.deviceID ||
+      header.driver_version != m_properties.driverVersion ||
+      std::memcmp(header.uuid, m_properties.pipelineCacheUUID,
+                  VK_UUID_SIZE) != 0)
+    return false; // Written by another device or driver
+
+  const std::byte *data = blob.data + sizeof(file_header);
+  size_t data_size = blob.size - sizeof(file_header);
+  if (header.data_size != data_size ||
+      header.checksum != checksum(data, data_size))
+    return false; // Truncated or corrupt
+
+  VkPipelineCacheHeaderVersionOne vk_header;
+  if (data_size < sizeof(vk_header))
+    return false;
+  std::memcpy(&vk_header, data, sizeof(vk_header));
+
+  return vk_header.headerSize >= sizeof(vk_header) &&
+         vk_header.headerSize <= data_size &&
+         vk_header.headerVersion == VK_PIPELINE_CACHE_HEADER_VERSION_ONE &&
+         vk_header.vendorID == m_properties.vendorID &&
+         vk_header.deviceID == m_properties.deviceID &&
+         std::memcmp(vk_header.pipelineCacheUUID,
+                     m_properties.pipelineCacheUUID, VK_UUID_SIZE) == 0;
+  // The driver checks this too, but not every driver does it carefully
+}
+
+uint64_t pipeline_cache::checksum(const void *data, size_t size) {
+  const uint8_t *bytes = static_cast<const uint8_t *>(data);
+  uint64_t hash = 0xcbf29ce484222325ull;
+  for (size_t i = 0; i < size; i++) {
+    hash ^= bytes[i];
+    hash *= 0x100000001b3ull;
+  }
+  return hash;
+}
+
+/**
+ * @brief Writes the cache to a temporary file and renames it over the old one,
+ * so a crash mid-write never leaves a half written cache behind
+ */
+void pipeline_cache::save() {
+  if (m_path.empty() || m_cache == VK_NULL_HANDLE)
+    return;
+
+  size_t data_size = 0;
+  if (vkGetPipelineCacheData(m_device, m_cache, &data_size, nullptr) !=
+      VK_SUCCESS)
+    return;
+
+  std::vector<char> data(data_size);
+  if (vkGetPipelineCacheData(m_device, m_cache, &data_size, data.data()) !=
+      VK_SUCCESS)
+    return;
+  data.resize(data_size);
+
+  file_header header{};
+  header.magic = M_MAGIC;
+  header.version = M_VERSION;
+  header.vendor_id = m_properties.vendorID;
+  header.device_id = m_properties.deviceID;
+  header.driver_version = m_properties.driverVersion;
+  std::memcpy(header.uuid, m_properties.pipelineCacheUUID, VK_UUID_SIZE);
+  header.data_size = data.size();
+  header.checksum = checksum(data.data(), data.size());
+
+  std::string tmp_path = m_path + ".tmp";
+  FILE *file = std::fopen(tmp_path.c_str(), "wb");
+  if (file == nullptr) {
+    std::cerr << "pipeline cache: failed to write " << tmp_path << std::endl;
+    return;
+  }
+
+  bool written =
+      std::fwrite(&header, sizeof(header), 1, file) == 1 &&
+      std::fwrite(data.data(), 1, data.size(), file) == data.size() &&
+      std::fflush(file) == 0 && fsync(fileno(file)) == 0;
+  written = std::fclose(file) == 0 && written;
+
+  if (!written || std::rename(tmp_path.c_str(), m_path.c_str()) != 0) {
+    std::remove(tmp_path.c_str());
+    std::cerr << "pipeline cache: failed to write " << m_path << std::endl;
+  }
+}
+
+/**
+ * @brief Saves and destroys the cache
+ */
+void pipeline_cache::destroy() {
+  if (m_cache == VK_NULL_HANDLE)
+    return;
+
+  save();
+
+  if (m_feedback_supported) {
+    std::cerr << "pipeline cache: " << m_hits << " hits, " << m_misses
+              << " misses" << std::endl;
+  }
+
+  vkDestroyPipelineCache(m_device, m_cache, nullptr);
+  m_cache = VK_NULL_HANDLE;
+}
+
+/**
+ * @brief Counts the result of a pipeline creation as a cache hit or miss
+ */
+void pipeline_cache::record(creation_feedback &feedback) {
+  const VkPipelineCreationFeedbackEXT &result =
+      feedback.get_pipeline_feedback();
+  if (!(result.flags & VK_PIPELINE_CREATION_FEEDBACK_VALID_BIT_EXT))
+    return;
+
+  if (result.flags &
+      VK_PIPELINE_CREATION_FEEDBACK_APPLICATION_PIPELINE_CACHE_HIT_BIT_EXT) {
+    m_hits++;
+  } else {
+    m_misses++;
+  }
+}
+
+bool pipeline_cache::is_feedback_supported() { return m_feedback_supported; }
+
+uint32_t pipeline_cache::get_hits() { return m_hits; }
+
+uint32_t pipeline_cache::get_misses() { return m_misses; }
+
+VkPipelineCache pipeline_cache::get() { return m_cache; }
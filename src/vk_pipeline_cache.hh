@@ -0,0 +1,78 @@
+/**
+ * @file
+ * @author Ruben Pena <rubn.pena@gmail.com>
+ * @brief This file contains the declaration of the pipeline_cache class, a
+ * VkPipelineCache persisted on disk between launches.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <mapped_file.hh>
+#include <string>
+#include <vector>
+#include <vulkan/vulkan.h>
+
+/**
+ * @class
+ * @brief Chains VK_EXT_pipeline_creation_feedback into a pipeline create info
+ * so the driver reports whether the pipeline came from the cache. Must outlive
+ * the vkCreate*Pipelines call
+ */
+class creation_feedback {
+  VkPipelineCreationFeedbackEXT m_pipeline{};
+  std::vector<VkPipelineCreationFeedbackEXT> m_stages;
+  VkPipelineCreationFeedbackCreateInfoEXT m_info{};
+
+public:
+  const void *chain(uint32_t stage_count, const void *next);
+  const VkPipelineCreationFeedbackEXT &get_pipeline_feedback();
+};
+
+/**
+ * @class
+ * @brief Owns the VkPipelineCache used for every pipeline of the renderer.
+ * The blob is stored behind a header keyed on the vendor, device, driver
+ * version and pipelineCacheUUID. Anything that does not match exactly, or
+ * fails the checksum, is discarded and the cache starts empty
+ */
+class pipeline_cache {
+  static constexpr uint32_t M_MAGIC = 0x43505452; // "RTPC"
+  static constexpr uint32_t M_VERSION = 1;
+
+  struct file_header {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t vendor_id;
+    uint32_t device_id;
+    uint32_t driver_version;
+    uint8_t uuid[VK_UUID_SIZE];
+    uint64_t data_size;
+    uint64_t checksum; // FNV-1a of the cache data
+  };
+
+  VkDevice m_device = VK_NULL_HANDLE;
+  VkPipelineCache m_cache = VK_NULL_HANDLE;
+  VkPhysicalDeviceProperties m_properties{};
+  std::string m_path; // Empty path disables persistence
+  bool m_feedback_supported = false;
+
+  uint32_t m_hits = 0;
+  uint32_t m_misses = 0;
+
+  utils::mapped_file load_blob();
+  bool is_blob_valid(const utils::file_view &blob);
+  static uint64_t checksum(const void *data, size_t size);
+
+public:
+  void create(VkPhysicalDevice physical_device, VkDevice device,
+              const std::string &path, bool feedback_supported);
+  void save();
+  void destroy();
+
+  void record(creation_feedback &feedback);
+  bool is_feedback_supported();
+  uint32_t get_hits();
+  uint32_t get_misses();
+  VkPipelineCache get();
+};
@@ -0,0 +1,288 @@
+/**
+ * @file
+ * @author Ruben Pena <rubn.pena@gmail.com>
+ * @brief This file contains the implementation of the pipeline_registry class
+ */
+
+#include <algorithm>
+#include <cstring>
+#include <exception>
+#include <iostream>
+#include <stdexcept>
+#include <vk_pipeline_registry.hh>
+
+static constexpr uint64_t FNV_OFFSET = 0xcbf29ce484222325ull;
+static constexpr uint64_t FNV_PRIME = 0x100000001b3ull;
+
+/**
+ * @brief Folds size bytes into an FNV-1a hash
+ */
+static void mix(uint64_t &hash, const void *data, size_t size) {
+  const uint8_t *bytes = static_cast<const uint8_t *>(data);
+  for (size_t i = 0; i < size; i++) {
+    hash = (hash ^ bytes[i]) * FNV_PRIME;
+  }
+}
+
+template <typename T> static void mix(uint64_t &hash, const T &value) {
+  mix(hash, &value, sizeof(value));
+}
+
+pipeline_shader pipeline_shader::from_code(const uint32_t *code,
+                                           size_t size) {
+  pipeline_shader shader;
+  shader.code = code;
+  shader.size = size;
+  shader.hash = FNV_OFFSET;
+  mix(shader.hash, code, size);
+  return shader;
+}
+
+bool pipeline_shader::operator==(const pipeline_shader &other) const {
+  return size == other.size && hash == other.hash &&
+         (code == other.code || std::memcmp(code, other.code, size) == 0);
+}
+
+static bool operator==(const VkVertexInputBindingDescription &a,
+                       const VkVertexInputBindingDescription &b) {
+  return a.binding == b.binding && a.stride == b.stride &&
+         a.inputRate == b.inputRate;
+}
+
+static bool operator==(const VkVertexInputAttributeDescription &a,
+                       const VkVertexInputAttributeDescription &b) {
+  return a.location == b.location && a.binding == b.binding &&
+         a.format == b.format && a.offset == b.offset;
+}
+
+/**
+ * @brief Same fields as hash, what a hit is confirmed with
+ */
+bool pipeline_desc::operator==(const pipeline_desc &other) const {
+  return vert == other.vert && frag == other.frag &&
+         bindings == other.bindings && attributes == other.attributes &&
+         topology == other.topology && polygon_mode == other.polygon_mode &&
+         cull_mode == other.cull_mode && front_face == other.front_face &&
+         depth_test == other.depth_test && depth_write == other.depth_write &&
+         depth_compare == other.depth_compare && blend == other.blend &&
+         color_format == other.color_format &&
+         depth_format == other.depth_format &&
+         render_pass == other.render_pass && layout == other.layout;
+}
+
+/**
+ * @brief Hashes the fields one by one, padding bytes never reach the hash
+ */
+uint64_t pipeline_desc::hash() const {
+  uint64_t hash = FNV_OFFSET;
+  mix(hash, vert.hash);
+  mix(hash, frag.hash);
+  for (const auto &binding : bindings) {
+    mix(hash, binding.binding);
+    mix(hash, binding.stride);
+    mix(hash, binding.inputRate);
+  }
+  mix(hash, static_cast<uint32_t>(bindings.size()));
+  for (const auto &attribute : attributes) {
+    mix(hash, attribute.location);
+    mix(hash, attribute.binding);
+    mix(hash, attribute.format);
+    mix(hash, attribute.offset);
+  }
+  mix(hash, static_cast<uint32_t>(attributes.size()));
+  mix(hash, topology);
+  mix(hash, polygon_mode);
+  mix(hash, cull_mode);
+  mix(hash, front_face);
+  mix(hash, static_cast<uint8_t>(depth_test));
+  mix(hash, static_cast<uint8_t>(depth_write));
+  mix(hash, depth_compare);
+  mix(hash, static_cast<uint8_t>(blend));
+  mix(hash, color_format);
+  mix(hash, depth_format);
+  mix(hash, render_pass);
+  mix(hash, layout);
+  return hash;
+}
+
+/**
+ * @brief build turns a desc into a pipeline, it is called from the compile
+ * threads and from get, concurrently
+ */
+void pipeline_registry::create(
+    VkDevice device, std::function<VkPipeline(const pipeline_desc &)> build,
+    uint32_t thread_count) {
+  m_device = device;
+  m_build = std::move(build);
+  m_stop = false;
+  for (uint32_t i = 0; i < std::max(thread_count, 1u); i++) {
+    m_threads.emplace_back([this]() { compile_loop(); });
+  }
+}
+
+/**
+ * @brief Stops the compile threads, dropping the queued pipelines, and
+ * destroys every pipeline built. None may be in use by the device
+ */
+void pipeline_registry::destroy() {
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_stop = true;
+    m_queue.clear();
+  }
+  m_work.notify_all();
+  for (auto &thread : m_threads) {
+    thread.join();
+  }
+  m_threads.clear();
+
+  for (auto &[hash, built] : m_entries) {
+    if (built.pipeline != VK_NULL_HANDLE) {
+      vkDestroyPipeline(m_device, built.pipeline, nullptr);
+    }
+  }
+  m_entries.clear();
+  m_stats = {};
+}
+
+/**
+ * @brief Returns the pipeline of desc, building it on the calling thread if
+ * nobody asked for it before, or waiting for the compile threads if it is
+ * queued. Throws if it could not be built
+ */
+VkPipeline pipeline_registry::get(const pipeline_desc &desc) {
+  uint64_t key = desc.hash();
+  std::unique_lock<std::mutex> lock(m_mutex);
+  m_stats.requests++;
+
+  entry *found = find(key, desc);
+  if (found == nullptr) {
+    found = &m_entries.emplace(key, entry{desc})->second;
+    m_stats.pending++;
+    lock.unlock();
+    build(*found);
+    lock.lock();
+  } else {
+    m_stats.deduplicated++;
+  }
+
+  entry &existing = *found;
+  m_built.wait(lock,
+               [&]() { return existing.state != entry_state::queued; });
+  if (existing.state == entry_state::failed) {
+    throw std::runtime_error("failed to build pipeline");
+  }
+  return existing.pipeline;
+}
+
+/**
+ * @brief Returns the pipeline of desc if it is built, otherwise queues it,
+ * unless it already is, and returns VK_NULL_HANDLE. Never blocks on a
+ * compilation. Polling while a pipeline is pending counts as a request each
+ * time
+ */
+VkPipeline pipeline_registry::request(const pipeline_desc &desc) {
+  uint64_t key = desc.hash();
+  std::lock_guard<std::mutex> lock(m_mutex);
+  m_stats.requests++;
+
+  entry *found = find(key, desc);
+  if (found != nullptr) {
+    m_stats.deduplicated++;
+    return found->pipeline; // Null until ready, or if it failed
+  }
+
+  m_queue.push_back(&m_entries.emplace(key, entry{desc})->second);
+  m_stats.pending++;
+  m_work.notify_one();
+  return VK_NULL_HANDLE;
+}
+
+/**
+ * @brief Blocks until every queued pipeline is built or failed
+ */
+void pipeline_registry::wait_idle() {
+  std::unique_lock<std::mutex> lock(m_mutex);
+  m_built.wait(lock, [&]() { return m_stats.pending == 0; });
+}
+
+/**
+ * @brief Destroys pipeline and forgets its state, so the next request builds
+ * it again. Returns false if the registry does not own it. The device must be
+ * done with it
+ */
+bool pipeline_registry::evict(VkPipeline pipeline) {
+  std::lock_guard<std::mutex> lock(m_mutex);
+  for (auto it = m_entries.begin(); it != m_entries.end(); ++it) {
+    if (it->second.pipeline != pipeline ||
+        it->second.state != entry_state::ready)
+      continue;
+
+    vkDestroyPipeline(m_device, pipeline, nullptr);
+    m_entries.erase(it);
+    return true;
+  }
+  return false;
+}
+
+pipeline_registry_stats pipeline_registry::get_stats() {
+  std::lock_guard<std::mutex> lock(m_mutex);
+  return m_stats;
+}
+
+/**
+ * @brief The entry of desc, whose hash is key, or null. Called under the lock
+ */
+pipeline_registry::entry *pipeline_registry::find(uint64_t key,
+                                                  const pipeline_desc &desc) {
+  auto [first, last] = m_entries.equal_range(key);
+  for (auto it = first; it != last; ++it) {
+    if (it->second.desc == desc)
+      return &it->second;
+  } // Anything else in the range is a hash collision
+  return nullptr;
+}
+
+void pipeline_registry::compile_loop() {
+  for (;;) {
+    entry *queued = nullptr;
+    {
+      std::unique_lock<std::mutex> lock(m_mutex);
+      m_work.wait(lock, [&]() { return m_stop || !m_queue.empty(); });
+      if (m_stop)
+        return;
+      queued = m_queue.front();
+      m_queue.pop_front();
+    }
+    build(*queued);
+  }
+}
+
+/**
+ * @brief Builds a queued entry outside the lock. Failures are printed and
+ * leave the entry failed, requests then keep getting VK_NULL_HANDLE
+ */
+void pipeline_registry::build(entry &queued) {
+  VkPipeline pipeline = VK_NULL_HANDLE;
+  bool built = true;
+  try {
+    pipeline = m_build(queued.desc);
+  } catch (const std::exception &e) {
+    std::cerr << "Pipeline " << std::hex << queued.desc.hash() << std::dec
+              << " failed to build: " << e.what() << std::endl;
+    built = false;
+  } // The desc never changes once queued, it is read without the lock
+
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    queued.pipeline = pipeline;
+    queued.state = built ? entry_state::ready : entry_state::failed;
+    m_stats.pending--;
+    if (built) {
+      m_stats.built++;
+    } else {
+      m_stats.failed++;
+    }
+  }
+  m_built.notify_all();
+}
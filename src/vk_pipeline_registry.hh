@@ -0,0 +1,117 @@
+/**
+ * @file
+ * @author Ruben Pena <rubn.pena@gmail.com>
+ * @brief This file contains the declaration of the pipeline_registry class,
+ * the graphics pipelines of the renderer keyed on their full state.
+ */
+
+#pragma once
+
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+#include <vulkan/vulkan.h>
+
+/**
+ * @brief SPIR-V of one stage. The code is not owned, it must stay valid until
+ * the pipelines using it are built. hash covers the words, not the pointer
+ */
+struct pipeline_shader {
+  const uint32_t *code = nullptr;
+  size_t size = 0; // In bytes
+  uint64_t hash = 0;
+
+  static pipeline_shader from_code(const uint32_t *code, size_t size);
+  bool operator==(const pipeline_shader &other) const; // Compares the words
+};
+
+/**
+ * @brief Everything a graphics pipeline of the renderer is built from.
+ * Viewport and scissor are always dynamic. With a null render pass the
+ * formats are given through dynamic rendering
+ */
+struct pipeline_desc {
+  pipeline_shader vert;
+  pipeline_shader frag;
+  std::vector<VkVertexInputBindingDescription> bindings;
+  std::vector<VkVertexInputAttributeDescription> attributes;
+  VkPrimitiveTopology topology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST;
+  VkPolygonMode polygon_mode = VK_POLYGON_MODE_FILL;
+  VkCullModeFlags cull_mode = VK_CULL_MODE_BACK_BIT;
+  VkFrontFace front_face = VK_FRONT_FACE_CLOCKWISE;
+  bool depth_test = false;
+  bool depth_write = false;
+  VkCompareOp depth_compare = VK_COMPARE_OP_LESS;
+  bool blend = false; // Straight alpha blending
+  VkFormat color_format = VK_FORMAT_UNDEFINED;
+  VkFormat depth_format = VK_FORMAT_UNDEFINED;
+  VkRenderPass render_pass = VK_NULL_HANDLE;
+  VkPipelineLayout layout = VK_NULL_HANDLE;
+
+  uint64_t hash() const;
+  bool operator==(const pipeline_desc &other) const;
+};
+
+struct pipeline_registry_stats {
+  uint32_t requests = 0;     // get and request calls
+  uint32_t deduplicated = 0; // Served by a pipeline already built or queued
+  uint32_t built = 0;
+  uint32_t failed = 0;
+  uint32_t pending = 0; // Queued or being built right now
+};
+
+/**
+ * @class
+ * @brief Builds each distinct graphics pipeline once. Pipelines are keyed on
+ * the 64 bit hash of their whole pipeline_desc, so identical states share one
+ * VkPipeline whoever asks for it. Entries keep their desc and a hit compares
+ * it, so colliding states still get pipelines of their own. request never
+ * blocks: a missing pipeline is queued for the registry's own compile
+ * threads and VK_NULL_HANDLE is returned until it is ready, the caller draws
+ * with a fallback meanwhile.
+ * The threads are not the job system's, so a frame waiting on its recording
+ * jobs never ends up running a compile. The registry owns every pipeline
+ */
+class pipeline_registry {
+  enum class entry_state { queued, ready, failed };
+
+  struct entry {
+    pipeline_desc desc;
+    VkPipeline pipeline = VK_NULL_HANDLE;
+    entry_state state = entry_state::queued;
+  };
+
+  VkDevice m_device = VK_NULL_HANDLE;
+  std::function<VkPipeline(const pipeline_desc &)> m_build;
+  std::vector<std::thread> m_threads;
+
+  std::mutex m_mutex; // Guards everything below
+  std::condition_variable m_work;  // Queue not empty, or stopping
+  std::condition_variable m_built; // An entry left the queued state
+  std::unordered_multimap<uint64_t, entry> m_entries; // Hash, then desc
+  std::deque<entry *> m_queue; // Entries never move, the map is node based
+  pipeline_registry_stats m_stats;
+  bool m_stop = false;
+
+  entry *find(uint64_t key, const pipeline_desc &desc);
+  void compile_loop();
+  void build(entry &queued);
+
+public:
+  void create(VkDevice device,
+              std::function<VkPipeline(const pipeline_desc &)> build,
+              uint32_t thread_count = 2);
+  void destroy();
+
+  VkPipeline get(const pipeline_desc &desc);
+  VkPipeline request(const pipeline_desc &desc);
+  void wait_idle();
+  bool evict(VkPipeline pipeline);
+  pipeline_registry_stats get_stats();
+};
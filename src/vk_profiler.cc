@@ -0,0 +1,277 @@
+/**
+ * @file
+ * @author Ruben Pena <rubn.pena@gmail.com>
+ * @brief This file contains the implementation of the gpu_profiler class
+ */
+
+#include <algorithm>
+#include <fstream>
+#include <nlohmann/json.hpp>
+#include <percentile.hh>
+#include <stdexcept>
+#include <vk_profiler.hh>
+
+/**
+ * @brief Creates the query pools of every frame in flight. Without timestamp
+ * support on the queue family the profiler records nothing
+ */
+void gpu_profiler::create(VkPhysicalDevice physical_device, VkDevice device,
+                          uint32_t queue_family, uint32_t frame_count,
+                          bool pipeline_statistics) {
+  m_device = device;
+
+  VkPhysicalDeviceProperties properties;
+  vkGetPhysicalDeviceProperties(physical_device, &properties);
+  m_period_ns = properties.limits.timestampPeriod;
+
+  uint32_t family_count = 0;
+  vkGetPhysicalDeviceQueueFamilyProperties(physical_device, &family_count,
+                                           nullptr);
+  std::vector<VkQueueFamilyProperties> families(family_count);
+  vkGetPhysicalDeviceQueueFamilyProperties(physical_device, &family_count,
+                                           families.data());
+  uint32_t valid_bits = families.at(queue_family).timestampValidBits;
+  m_timestamps_supported = valid_bits > 0;
+  m_valid_mask = valid_bits >= 64 ? UINT64_MAX : (1ull << valid_bits) - 1;
+
+  VkPhysicalDeviceFeatures features;
+  vkGetPhysicalDeviceFeatures(physical_device, &features);
+  m_statistics_enabled = pipeline_statistics &&
+                         features.pipelineStatisticsQuery == VK_TRUE &&
+                         features.inheritedQueries == VK_TRUE;
+  // Passes recorded in secondary command buffers inherit the active query
+
+  if (!m_timestamps_supported)
+    return;
+
+  m_frames.resize(frame_count);
+  for (auto &frame : m_frames) {
+    VkQueryPoolCreateInfo pool_info{};
+    pool_info.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO;
+    pool_info.queryType = VK_QUERY_TYPE_TIMESTAMP;
+    pool_info.queryCount = M_MAX_PASSES * 2;
+
+    if (vkCreateQueryPool(m_device, &pool_info, nullptr, &frame.timestamps) !=
+        VK_SUCCESS) {
+      throw std::runtime_error("failed to create timestamp query pool");
+    }
+
+    if (!m_statistics_enabled)
+      continue;
+
+    pool_info.queryType = VK_QUERY_TYPE_PIPELINE_STATISTICS;
+    pool_info.queryCount = M_MAX_PASSES;
+    pool_info.pipelineStatistics = M_STATISTICS;
+
+    if (vkCreateQueryPool(m_device, &pool_info, nullptr, &frame.statistics) !=
+        VK_SUCCESS) {
+      throw std::runtime_error("failed to create statistics query pool");
+    }
+  }
+}
+
+void gpu_profiler::destroy() {
+  for (auto &frame : m_frames) {
+    vkDestroyQueryPool(m_device, frame.timestamps, nullptr);
+    vkDestroyQueryPool(m_device, frame.statistics, nullptr);
+  }
+  m_frames.clear();
+  m_recording = nullptr;
+}
+
+/**
+ * @brief Reads back what the frame slot recorded the last time it was used and
+ * resets its queries. The caller must have waited on the slot's fence
+ */
+void gpu_profiler::begin_frame(VkCommandBuffer command_buffer,
+                               uint32_t frame_index) {
+  if (!m_timestamps_supported)
+    return;
+
+  m_recording = &m_frames.at(frame_index);
+  collect(*m_recording);
+
+  vkCmdResetQueryPool(command_buffer, m_recording->timestamps, 0,
+                      M_MAX_PASSES * 2);
+  if (m_statistics_enabled) {
+    vkCmdResetQueryPool(command_buffer, m_recording->statistics, 0,
+                        M_MAX_PASSES);
+  } // Resets must be recorded outside of render passes
+}
+
+/**
+ * @brief Starts timing a pass, returns the query to hand to end_pass. Passes
+ * over the per frame limit are not timed
+ */
+uint32_t gpu_profiler::begin_pass(VkCommandBuffer command_buffer,
+                                  const std::string &name) {
+  if (m_recording == nullptr || m_recording->passes.size() >= M_MAX_PASSES)
+    return M_NO_PASS;
+
+  uint32_t query = static_cast<uint32_t>(m_recording->passes.size());
+  m_recording->passes.push_back(get_pass_id(name));
+
+  vkCmdWriteTimestamp(command_buffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT,
+                      m_recording->timestamps, query * 2);
+  if (m_statistics_enabled) {
+    vkCmdBeginQuery(command_buffer, m_recording->statistics, query, 0);
+  }
+  return query;
+}
+
+void gpu_profiler::end_pass(VkCommandBuffer command_buffer, uint32_t query) {
+  if (query == M_NO_PASS)
+    return;
+
+  if (m_statistics_enabled) {
+    vkCmdEndQuery(command_buffer, m_recording->statistics, query);
+  }
+  vkCmdWriteTimestamp(command_buffer, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT,
+                      m_recording->timestamps, query * 2 + 1);
+}
+
+/**
+ * @brief Reads back every frame slot. Only valid once the device is idle, for
+ * the last frames before a report
+ */
+void gpu_profiler::collect_pending() {
+  for (auto &frame : m_frames) {
+    collect(frame);
+  }
+}
+
+void gpu_profiler::collect(frame_queries &frame) {
+  uint32_t count = static_cast<uint32_t>(frame.passes.size());
+  if (count == 0)
+    return;
+
+  std::vector<uint64_t> timestamps(count * 4); // Value, availability pairs
+  vkGetQueryPoolResults(m_device, frame.timestamps, 0, count * 2,
+                        timestamps.size() * sizeof(uint64_t),
+                        timestamps.data(), 2 * sizeof(uint64_t),
+                        VK_QUERY_RESULT_64_BIT |
+                            VK_QUERY_RESULT_WITH_AVAILABILITY_BIT);
+
+  const uint32_t statistics_stride = M_STATISTIC_COUNT + 1;
+  std::vector<uint64_t> statistics;
+  if (m_statistics_enabled) {
+    statistics.resize(count * statistics_stride);
+    vkGetQueryPoolResults(m_device, frame.statistics, 0, count,
+                          statistics.size() * sizeof(uint64_t),
+                          statistics.data(),
+                          statistics_stride * sizeof(uint64_t),
+                          VK_QUERY_RESULT_64_BIT |
+                              VK_QUERY_RESULT_WITH_AVAILABILITY_BIT);
+  } // VK_NOT_READY only means some availability words are zero
+
+  for (uint32_t i = 0; i < count; i++) {
+    pass_history &pass = m_passes[frame.passes[i]];
+    const uint64_t *pair = timestamps.data() + i * 4;
+    if (pair[1] != 0 && pair[3] != 0) {
+      uint64_t ticks = (pair[2] - pair[0]) & m_valid_mask;
+      pass.last_ms = ticks * m_period_ns * 1e-6;
+      if (pass.samples.size() < M_HISTORY) {
+        pass.samples.push_back(pass.last_ms);
+      } else {
+        pass.samples[pass.next] = pass.last_ms;
+      }
+      pass.next = (pass.next + 1) % M_HISTORY;
+    }
+
+    if (m_statistics_enabled) {
+      const uint64_t *counters = statistics.data() + i * statistics_stride;
+      if (counters[M_STATISTIC_COUNT] != 0)
+        pass.statistics.assign(counters, counters + M_STATISTIC_COUNT);
+    }
+  }
+
+  frame.passes.clear();
+}
+
+uint32_t gpu_profiler::get_pass_id(const std::string &name) {
+  auto [it, inserted] = m_pass_ids.try_emplace(
+      name, static_cast<uint32_t>(m_passes.size()));
+  if (inserted) {
+    pass_history pass;
+    pass.name = name;
+    m_passes.push_back(std::move(pass));
+  }
+  return it->second;
+}
+
+std::vector<pass_stats> gpu_profiler::get_stats() {
+  std::vector<pass_stats> result;
+
+  for (const auto &pass : m_passes) {
+    if (pass.samples.empty())
+      continue;
+
+    std::vector<double> sorted = pass.samples;
+    std::sort(sorted.begin(), sorted.end());
+
+    pass_stats stats;
+    stats.name = pass.name;
+    stats.sample_count = static_cast<uint32_t>(sorted.size());
+    stats.last_ms = pass.last_ms;
+    stats.min_ms = sorted.front();
+    for (double sample : sorted) {
+      stats.avg_ms += sample;
+    }
+    stats.avg_ms /= sorted.size();
+    stats.p99_ms = utils::percentile(sorted, 0.99);
+    stats.statistics = pass.statistics;
+    result.push_back(std::move(stats));
+  }
+  return result;
+}
+
+const std::vector<std::string> &gpu_profiler::get_statistic_names() {
+  static const std::vector<std::string> names = {
+      "input_assembly_vertices", "input_assembly_primitives",
+      "vertex_shader_invocations", "clipping_invocations",
+      "clipping_primitives", "fragment_shader_invocations",
+      "compute_shader_invocations"}; // Bit order of the query flags
+  return names;
+}
+
+void gpu_profiler::write_json(const std::string &path) {
+  nlohmann::json passes = nlohmann::json::array();
+
+  for (const auto &stats : get_stats()) {
+    nlohmann::json pass;
+    pass["name"] = stats.name;
+    pass["samples"] = stats.sample_count;
+    pass["last_ms"] = stats.last_ms;
+    pass["min_ms"] = stats.min_ms;
+    pass["avg_ms"] = stats.avg_ms;
+    pass["p99_ms"] = stats.p99_ms;
+
+    if (!stats.statistics.empty()) {
+      nlohmann::json statistics;
+      for (uint32_t i = 0; i < M_STATISTIC_COUNT; i++) {
+        statistics[get_statistic_names()[i]] = stats.statistics[i];
+      }
+      pass["statistics"] = statistics;
+    }
+    passes.push_back(pass);
+  }
+
+  nlohmann::json report;
+  report["passes"] = passes;
+
+  std::ofstream file(path);
+  if (!file) {
+    throw std::runtime_error("failed to open " + path);
+  }
+  file << report.dump(2) << std::endl;
+}
+
+bool gpu_profiler::is_enabled() { return m_timestamps_supported; }
+
+/**
+ * @brief Statistics secondary command buffers must declare they inherit, since
+ * the query may be active when they are executed
+ */
+VkQueryPipelineStatisticFlags gpu_profiler::get_inherited_statistics() {
+  return m_statistics_enabled ? M_STATISTICS : 0;
+}
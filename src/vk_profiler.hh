@@ -0,0 +1,97 @@
+/**
+ * @file
+ * @author Ruben Pena <rubn.pena@gmail.com>
+ * @brief This file contains the declaration of the gpu_profiler class, GPU
+ * timings and pipeline statistics of every recorded pass.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include <vulkan/vulkan.h>
+
+/**
+ * @brief Rolling GPU time of one pass over its last samples, in milliseconds.
+ * statistics holds the counters of the last sample, in the order of
+ * gpu_profiler::get_statistic_names, and is empty when they are disabled
+ */
+struct pass_stats {
+  std::string name;
+  uint32_t sample_count = 0;
+  double last_ms = 0.0;
+  double min_ms = 0.0;
+  double avg_ms = 0.0;
+  double p99_ms = 0.0;
+  std::vector<uint64_t> statistics;
+};
+
+/**
+ * @class
+ * @brief Wraps the passes of a frame in timestamp query pairs and, optionally,
+ * pipeline statistics queries. Every frame in flight owns its query pools and
+ * they are read back when the frame slot is reused: its fence was already
+ * waited on, so the results are there and the CPU never stalls on them.
+ * Passes must not nest
+ */
+class gpu_profiler {
+  static constexpr uint32_t M_MAX_PASSES = 32;  // Per frame
+  static constexpr uint32_t M_HISTORY = 256;    // Samples kept per pass
+  static constexpr uint32_t M_STATISTIC_COUNT = 7;
+  static constexpr uint32_t M_NO_PASS = UINT32_MAX;
+  static constexpr VkQueryPipelineStatisticFlags M_STATISTICS =
+      VK_QUERY_PIPELINE_STATISTIC_INPUT_ASSEMBLY_VERTICES_BIT |
+      VK_QUERY_PIPELINE_STATISTIC_INPUT_ASSEMBLY_PRIMITIVES_BIT |
+      VK_QUERY_PIPELINE_STATISTIC_VERTEX_SHADER_INVOCATIONS_BIT |
+      VK_QUERY_PIPELINE_STATISTIC_CLIPPING_INVOCATIONS_BIT |
+      VK_QUERY_PIPELINE_STATISTIC_CLIPPING_PRIMITIVES_BIT |
+      VK_QUERY_PIPELINE_STATISTIC_FRAGMENT_SHADER_INVOCATIONS_BIT |
+      VK_QUERY_PIPELINE_STATISTIC_COMPUTE_SHADER_INVOCATIONS_BIT;
+
+  struct frame_queries {
+    VkQueryPool timestamps = VK_NULL_HANDLE; // Begin and end of every pass
+    VkQueryPool statistics = VK_NULL_HANDLE;
+    std::vector<uint32_t> passes; // Pass recorded by each query, in order
+  };
+
+  struct pass_history {
+    std::string name;
+    std::vector<double> samples; // Ring of the last M_HISTORY timings
+    uint32_t next = 0;
+    double last_ms = 0.0;
+    std::vector<uint64_t> statistics;
+  };
+
+  VkDevice m_device = VK_NULL_HANDLE;
+  bool m_timestamps_supported = false;
+  bool m_statistics_enabled = false;
+  double m_period_ns = 1.0;  // Nanoseconds per timestamp tick
+  uint64_t m_valid_mask = 0; // timestampValidBits of the queue family
+
+  std::vector<frame_queries> m_frames;
+  frame_queries *m_recording = nullptr;
+  std::vector<pass_history> m_passes;
+  std::unordered_map<std::string, uint32_t> m_pass_ids;
+
+  void collect(frame_queries &frame);
+  uint32_t get_pass_id(const std::string &name);
+
+public:
+  void create(VkPhysicalDevice physical_device, VkDevice device,
+              uint32_t queue_family, uint32_t frame_count,
+              bool pipeline_statistics);
+  void destroy();
+
+  void begin_frame(VkCommandBuffer command_buffer, uint32_t frame_index);
+  uint32_t begin_pass(VkCommandBuffer command_buffer, const std::string &name);
+  void end_pass(VkCommandBuffer command_buffer, uint32_t query);
+  void collect_pending();
+
+  std::vector<pass_stats> get_stats();
+  static const std::vector<std::string> &get_statistic_names();
+  void write_json(const std::string &path);
+  bool is_enabled();
+  VkQueryPipelineStatisticFlags get_inherited_statistics();
+};
@@ -0,0 +1,649 @@
+/**
+ * @file
+ * @author Ruben Pena <rubn.pena@gmail.com>
+ * @brief This file contains the implementation of the render_graph class
+ */
+
+#include <algorithm>
+#include <stdexcept>
+#include <vk_render_graph.hh>
+
+static constexpr VkAccessFlags WRITE_ACCESS =
+    VK_ACCESS_SHADER_WRITE_BIT | VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT |
+    VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT |
+    VK_ACCESS_TRANSFER_WRITE_BIT | VK_ACCESS_HOST_WRITE_BIT |
+    VK_ACCESS_MEMORY_WRITE_BIT;
+
+void render_graph::init(VkDevice device, vk_allocator &allocator) {
+  m_device = device;
+  m_allocator = &allocator;
+}
+
+/**
+ * @brief Drops every pass and resource. Transient images still owned by the
+ * graph are destroyed, take them first if a frame may still be using them
+ */
+void render_graph::reset() {
+  destroy_transients(m_transients);
+  m_resources.clear();
+  m_passes.clear();
+  m_final = {};
+  m_stats = {};
+}
+
+void render_graph::destroy() { reset(); }
+
+/**
+ * @brief Image owned outside the graph, e.g. a swap chain image, bound each
+ * frame with set_image. initial is where it is when the frame starts, final
+ * where the frame must leave it. Images with a final state are outputs
+ */
+uint32_t render_graph::import_image(const std::string &name,
+                                    VkImageAspectFlags aspect,
+                                    const rg_state &initial,
+                                    const rg_state &final) {
+  resource image;
+  image.name = name;
+  image.desc.aspect = aspect;
+  image.initial = initial;
+  image.final = final;
+  m_resources.push_back(image);
+  return static_cast<uint32_t>(m_resources.size() - 1);
+}
+
+/**
+ * @brief Buffer owned outside the graph, bound with set_buffer. Buffers with
+ * a final state are outputs
+ */
+uint32_t render_graph::import_buffer(const std::string &name,
+                                     const rg_state &initial,
+                                     const rg_state &final) {
+  resource buffer;
+  buffer.name = name;
+  buffer.image = false;
+  buffer.initial = initial;
+  buffer.final = final;
+  m_resources.push_back(buffer);
+  return static_cast<uint32_t>(m_resources.size() - 1);
+}
+
+/**
+ * @brief Image created by compile and discarded at the end of the frame. Its
+ * contents are undefined on first use
+ */
+uint32_t render_graph::create_image(const std::string &name,
+                                    const rg_image_desc &desc) {
+  resource image;
+  image.name = name;
+  image.imported = false;
+  image.desc = desc;
+  m_resources.push_back(image);
+  return static_cast<uint32_t>(m_resources.size() - 1);
+}
+
+/**
+ * @brief Adds a pass after the ones already added. record is called every
+ * frame with the barriers the pass needs already recorded
+ */
+uint32_t render_graph::add_pass(const std::string &name,
+                                std::function<void(VkCommandBuffer)> record) {
+  pass added;
+  added.name = name;
+  added.record = std::move(record);
+  m_passes.push_back(std::move(added));
+  return static_cast<uint32_t>(m_passes.size() - 1);
+}
+
+void render_graph::read(uint32_t pass, uint32_t resource, rg_usage usage) {
+  add_access(pass, resource, usage, true, false);
+}
+
+void render_graph::write(uint32_t pass, uint32_t resource, rg_usage usage) {
+  add_access(pass, resource, usage, false, true);
+}
+
+/**
+ * @brief The pass needs the previous contents and modifies them, e.g. an
+ * atomic counter
+ */
+void render_graph::read_write(uint32_t pass, uint32_t resource,
+                              rg_usage usage) {
+  add_access(pass, resource, usage, true, true);
+}
+
+void render_graph::add_access(uint32_t pass_index, uint32_t resource_index,
+                              rg_usage usage, bool read, bool write) {
+  pass &target = m_passes.at(pass_index);
+  resource &used = m_resources.at(resource_index);
+
+  for (auto &existing : target.accesses) {
+    if (existing.resource != resource_index)
+      continue;
+    if (existing.usage != usage) {
+      throw std::runtime_error("render graph: " + used.name +
+                               " used in two ways by " + target.name);
+    }
+    existing.read |= read;
+    existing.write |= write;
+    return;
+  } // One state per resource and pass
+
+  if (used.image && !used.imported) {
+    used.usage |= get_image_usage(usage);
+  }
+  target.accesses.push_back({resource_index, usage, read, write});
+}
+
+rg_state render_graph::get_state(rg_usage usage, bool write) {
+  rg_state state;
+  switch (usage) {
+  case rg_usage::color_attachment:
+    state.stages = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
+    state.access = VK_ACCESS_COLOR_ATTACHMENT_READ_BIT |
+                   (write ? VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT : 0);
+    state.layout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+    break;
+  case rg_usage::depth_attachment:
+    state.stages = VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT |
+                   VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT;
+    state.access = VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_READ_BIT |
+                   (write ? VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT : 0);
+    state.layout = write ? VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL
+                         : VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL;
+    break;
+  case rg_usage::sampled:
+    state.stages = VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT |
+                   VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT;
+    state.access = VK_ACCESS_SHADER_READ_BIT;
+    state.layout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+    break;
+  case rg_usage::storage:
+    state.stages = VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT;
+    state.access =
+        VK_ACCESS_SHADER_READ_BIT | (write ? VK_ACCESS_SHADER_WRITE_BIT : 0);
+    state.layout = VK_IMAGE_LAYOUT_GENERAL;
+    break;
+  case rg_usage::transfer_src:
+    state.stages = VK_PIPELINE_STAGE_TRANSFER_BIT;
+    state.access = VK_ACCESS_TRANSFER_READ_BIT;
+    state.layout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+    break;
+  case rg_usage::transfer_dst:
+    state.stages = VK_PIPELINE_STAGE_TRANSFER_BIT;
+    state.access = VK_ACCESS_TRANSFER_WRITE_BIT;
+    state.layout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+    break;
+  case rg_usage::indirect:
+    state.stages = VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT;
+    state.access = VK_ACCESS_INDIRECT_COMMAND_READ_BIT;
+    break;
+  }
+  return state;
+}
+
+VkImageUsageFlags render_graph::get_image_usage(rg_usage usage) {
+  switch (usage) {
+  case rg_usage::color_attachment:
+    return VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT;
+  case rg_usage::depth_attachment:
+    return VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT;
+  case rg_usage::sampled:
+    return VK_IMAGE_USAGE_SAMPLED_BIT;
+  case rg_usage::storage:
+    return VK_IMAGE_USAGE_STORAGE_BIT;
+  case rg_usage::transfer_src:
+    return VK_IMAGE_USAGE_TRANSFER_SRC_BIT;
+  case rg_usage::transfer_dst:
+    return VK_IMAGE_USAGE_TRANSFER_DST_BIT;
+  case rg_usage::indirect:
+    break;
+  }
+  return 0;
+}
+
+/**
+ * @brief Culls the passes, creates the transient images and plans the
+ * barriers. Transient images of a previous compilation must have been taken
+ * or destroyed
+ */
+void render_graph::compile() {
+  destroy_transients(m_transients);
+  m_stats = {};
+  m_stats.pass_count = static_cast<uint32_t>(m_passes.size());
+  for (auto &planned : m_passes) {
+    planned.before = {};
+  }
+  m_final = {};
+
+  cull_passes();
+  compute_lifetimes();
+  create_transients();
+  plan_barriers();
+}
+
+/**
+ * @brief Walks the passes backwards from the outputs: a pass is kept if it
+ * writes something an output or a kept pass depends on
+ */
+void render_graph::cull_passes() {
+  std::vector<bool> needed(m_resources.size(), false);
+  for (size_t i = 0; i < m_resources.size(); i++) {
+    const resource &output = m_resources[i];
+    needed[i] = output.imported &&
+                (output.final.stages != 0 ||
+                 output.final.layout != VK_IMAGE_LAYOUT_UNDEFINED);
+  }
+
+  for (auto it = m_passes.rbegin(); it != m_passes.rend(); ++it) {
+    bool keep = false;
+    for (const auto &used : it->accesses) {
+      keep |= used.write && needed[used.resource];
+    }
+
+    it->culled = !keep;
+    if (!keep) {
+      m_stats.culled_pass_count++;
+      continue;
+    }
+    for (const auto &used : it->accesses) {
+      if (used.read) {
+        needed[used.resource] = true;
+      }
+    }
+  }
+}
+
+void render_graph::compute_lifetimes() {
+  for (auto &used : m_resources) {
+    used.first_pass = UINT32_MAX;
+    used.last_pass = 0;
+    used.slot = UINT32_MAX;
+  }
+
+  for (uint32_t i = 0; i < m_passes.size(); i++) {
+    if (m_passes[i].culled)
+      continue;
+    for (const auto &used : m_passes[i].accesses) {
+      resource &lifetime = m_resources[used.resource];
+      lifetime.first_pass = std::min(lifetime.first_pass, i);
+      lifetime.last_pass = std::max(lifetime.last_pass, i);
+    }
+  }
+}
+
+/**
+ * @brief Creates the transient images and places them in aliasing slots,
+ * largest first: an image joins the first slot whose occupants are all dead
+ * before it is born or born after it dies, and whose memory types it can
+ * use. Each slot is one allocation every occupant is bound to
+ */
+void render_graph::create_transients() {
+  struct slot {
+    VkMemoryRequirements requirements{0, 1, ~0u};
+    std::vector<uint32_t> occupants;
+  };
+
+  std::vector<uint32_t> transients;
+  std::vector<VkMemoryRequirements> requirements(m_resources.size());
+  for (uint32_t i = 0; i < m_resources.size(); i++) {
+    resource &image = m_resources[i];
+    if (image.imported || image.first_pass == UINT32_MAX)
+      continue; // Only used by culled passes
+
+    VkImageCreateInfo image_info{};
+    image_info.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+    image_info.imageType = VK_IMAGE_TYPE_2D;
+    image_info.format = image.desc.format;
+    image_info.extent = {image.desc.extent.width, image.desc.extent.height, 1};
+    image_info.mipLevels = 1;
+    image_info.arrayLayers = 1;
+    image_info.samples = VK_SAMPLE_COUNT_1_BIT;
+    image_info.tiling = VK_IMAGE_TILING_OPTIMAL;
+    image_info.usage = image.usage;
+    image_info.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+    image_info.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+
+    if (vkCreateImage(m_device, &image_info, nullptr, &image.vk_image) !=
+        VK_SUCCESS) {
+      throw std::runtime_error("render graph: failed to create " +
+                               image.name);
+    }
+    m_transients.images.push_back(image.vk_image);
+    vkGetImageMemoryRequirements(m_device, image.vk_image, &requirements[i]);
+    m_stats.unaliased_bytes += requirements[i].size;
+    transients.push_back(i);
+  }
+
+  std::stable_sort(transients.begin(), transients.end(),
+                   [&](uint32_t a, uint32_t b) {
+                     return requirements[a].size > requirements[b].size;
+                   });
+
+  std::vector<slot> slots;
+  for (uint32_t index : transients) {
+    resource &image = m_resources[index];
+    const VkMemoryRequirements &needs = requirements[index];
+
+    for (uint32_t s = 0; s < slots.size() && image.slot == UINT32_MAX; s++) {
+      if ((slots[s].requirements.memoryTypeBits & needs.memoryTypeBits) == 0)
+        continue;
+
+      bool overlaps = false;
+      for (uint32_t occupant : slots[s].occupants) {
+        const resource &other = m_resources[occupant];
+        overlaps |= image.first_pass <= other.last_pass &&
+                    other.first_pass <= image.last_pass;
+      }
+      if (!overlaps) {
+        image.slot = s;
+      }
+    }
+    if (image.slot == UINT32_MAX) {
+      image.slot = static_cast<uint32_t>(slots.size());
+      slots.emplace_back();
+    }
+
+    VkMemoryRequirements &shared = slots[image.slot].requirements;
+    shared.size = std::max(shared.size, needs.size);
+    shared.alignment = std::max(shared.alignment, needs.alignment);
+    shared.memoryTypeBits &= needs.memoryTypeBits;
+    slots[image.slot].occupants.push_back(index);
+  }
+
+  for (const auto &memory : slots) {
+    m_transients.allocations.push_back(
+        m_allocator->allocate(memory.requirements,
+                              VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+                              resource_kind::optimal));
+    m_stats.transient_bytes += memory.requirements.size;
+  }
+
+  for (uint32_t index : transients) {
+    resource &image = m_resources[index];
+    const allocation &memory = m_transients.allocations[image.slot];
+    if (vkBindImageMemory(m_device, image.vk_image, memory.memory,
+                          memory.offset) != VK_SUCCESS) {
+      throw std::runtime_error("render graph: failed to bind " + image.name);
+    }
+
+    VkImageViewCreateInfo view_info{};
+    view_info.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
+    view_info.image = image.vk_image;
+    view_info.viewType = VK_IMAGE_VIEW_TYPE_2D;
+    view_info.format = image.desc.format;
+    view_info.subresourceRange = {image.desc.aspect, 0, 1, 0, 1};
+    if (vkCreateImageView(m_device, &view_info, nullptr, &image.view) !=
+        VK_SUCCESS) {
+      throw std::runtime_error("render graph: failed to create view of " +
+                               image.name);
+    }
+    m_transients.views.push_back(image.view);
+  }
+}
+
+/**
+ * @brief Replays the accesses of the kept passes in order and records the
+ * barriers each one needs. Imported resources start from their initial
+ * state. A transient image starts after the last use of the image that held
+ * its memory before it, or, for the first one, after the last use of the slot
+ * in the previous frame
+ */
+void render_graph::plan_barriers() {
+  std::vector<rg_state> last_use(m_resources.size());
+  for (const auto &kept : m_passes) {
+    if (kept.culled)
+      continue;
+    for (const auto &used : kept.accesses) {
+      last_use[used.resource] = get_state(used.usage, used.write);
+      last_use[used.resource].access &=
+          used.write ? WRITE_ACCESS : 0; // Reads need no availability
+    }
+  }
+
+  std::vector<tracked_state> states(m_resources.size());
+  for (uint32_t i = 0; i < m_resources.size(); i++) {
+    const resource &used = m_resources[i];
+    rg_state initial = used.initial;
+
+    if (!used.imported && used.slot != UINT32_MAX) {
+      uint32_t previous = i;
+      for (uint32_t j = 0; j < m_resources.size(); j++) {
+        const resource &other = m_resources[j];
+        if (other.imported || other.slot != used.slot)
+          continue;
+        bool before = other.last_pass < used.first_pass;
+        bool closer = previous == i ||
+                      m_resources[previous].last_pass >= used.first_pass ||
+                      other.last_pass > m_resources[previous].last_pass;
+        if (before && closer) {
+          previous = j;
+        }
+      } // Latest occupant that dies before this one is born
+
+      if (previous == i) {
+        for (uint32_t j = 0; j < m_resources.size(); j++) {
+          const resource &other = m_resources[j];
+          if (!other.imported && other.slot == used.slot &&
+              other.last_pass >= m_resources[previous].last_pass) {
+            previous = j;
+          }
+        }
+      } // None: the last occupant, from the previous frame
+      initial = last_use[previous];
+      initial.layout = VK_IMAGE_LAYOUT_UNDEFINED; // Contents are discarded
+    }
+
+    states[i].layout = initial.layout;
+    states[i].write_stages = initial.stages;
+    states[i].write_access = initial.access;
+  }
+
+  for (auto &kept : m_passes) {
+    if (kept.culled)
+      continue;
+    for (const auto &used : kept.accesses) {
+      transition(states[used.resource], used.resource,
+                 get_state(used.usage, used.write), used.write, kept.before);
+    }
+  }
+
+  for (uint32_t i = 0; i < m_resources.size(); i++) {
+    const resource &output = m_resources[i];
+    if (output.imported && (output.final.stages != 0 ||
+                            output.final.layout != VK_IMAGE_LAYOUT_UNDEFINED)) {
+      transition(states[i], i, output.final, false, m_final);
+    }
+  }
+
+  auto count = [&](const barrier_batch &batch) {
+    if (batch.src_stages == 0)
+      return;
+    m_stats.barrier_batches++;
+    for (const auto &planned : batch.barriers) {
+      if (m_resources[planned.resource].image) {
+        m_stats.image_barriers++;
+      } else {
+        m_stats.buffer_barriers++;
+      }
+    }
+  };
+  for (const auto &kept : m_passes) {
+    count(kept.before);
+  }
+  count(m_final);
+}
+
+/**
+ * @brief Moves a resource to target. Writes and layout changes wait for every
+ * earlier read and write, reads only wait for the last write and only if it
+ * was not made visible to their stages yet. Execution dependencies without
+ * a layout change or writes to flush need no barrier structure, only stages
+ */
+void render_graph::transition(tracked_state &state, uint32_t resource_index,
+                              const rg_state &target, bool write,
+                              barrier_batch &batch) {
+  bool image = m_resources[resource_index].image;
+  bool layout_change = image && target.layout != state.layout;
+
+  barrier planned;
+  planned.resource = resource_index;
+  planned.old_layout = state.layout;
+  planned.new_layout = image ? target.layout : state.layout;
+  bool dependency = false;
+
+  if (write || layout_change) {
+    VkPipelineStageFlags src_stages = state.read_stages | state.write_stages;
+    if (src_stages != 0 || layout_change) {
+      batch.src_stages |=
+          src_stages != 0 ? src_stages : VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT;
+      dependency = true;
+    }
+    planned.src_access = state.write_access;
+
+    state.layout = planned.new_layout;
+    state.write_stages = target.stages;
+    state.write_access = write ? target.access & WRITE_ACCESS : 0;
+    state.read_stages = write ? 0 : target.stages;
+    state.visible_stages = target.stages;
+    state.visible_access = target.access;
+  } else {
+    bool unseen = (target.stages & ~state.visible_stages) != 0 ||
+                  (target.access & ~state.visible_access) != 0;
+    if (state.write_stages != 0 && unseen) {
+      batch.src_stages |= state.write_stages;
+      planned.src_access = state.write_access;
+      state.visible_stages |= target.stages;
+      state.visible_access |= target.access;
+      dependency = true;
+    }
+    state.read_stages |= target.stages;
+  }
+
+  if (!dependency)
+    return;
+
+  batch.dst_stages |= target.stages != 0
+                          ? target.stages
+                          : VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT;
+  planned.dst_access = target.access;
+  if (layout_change || planned.src_access != 0) {
+    batch.barriers.push_back(planned);
+  }
+}
+
+void render_graph::set_image(uint32_t resource_index, VkImage image,
+                             VkImageView view) {
+  m_resources.at(resource_index).vk_image = image;
+  m_resources.at(resource_index).view = view;
+}
+
+void render_graph::set_buffer(uint32_t resource_index, VkBuffer buffer) {
+  m_resources.at(resource_index).vk_buffer = buffer;
+}
+
+VkImage render_graph::get_image(uint32_t resource_index) {
+  return m_resources.at(resource_index).vk_image;
+}
+
+VkImageView render_graph::get_image_view(uint32_t resource_index) {
+  return m_resources.at(resource_index).view;
+}
+
+void render_graph::record_batch(VkCommandBuffer command_buffer,
+                                const barrier_batch &batch) {
+  if (batch.src_stages == 0)
+    return;
+
+  std::vector<VkImageMemoryBarrier> image_barriers;
+  std::vector<VkBufferMemoryBarrier> buffer_barriers;
+  for (const auto &planned : batch.barriers) {
+    const resource &used = m_resources[planned.resource];
+    if (used.image) {
+      VkImageMemoryBarrier barrier{};
+      barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+      barrier.srcAccessMask = planned.src_access;
+      barrier.dstAccessMask = planned.dst_access;
+      barrier.oldLayout = planned.old_layout;
+      barrier.newLayout = planned.new_layout;
+      barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+      barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+      barrier.image = used.vk_image;
+      barrier.subresourceRange = {used.desc.aspect, 0,
+                                  VK_REMAINING_MIP_LEVELS, 0,
+                                  VK_REMAINING_ARRAY_LAYERS};
+      image_barriers.push_back(barrier);
+    } else {
+      VkBufferMemoryBarrier barrier{};
+      barrier.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+      barrier.srcAccessMask = planned.src_access;
+      barrier.dstAccessMask = planned.dst_access;
+      barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+      barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+      barrier.buffer = used.vk_buffer;
+      barrier.offset = 0;
+      barrier.size = VK_WHOLE_SIZE;
+      buffer_barriers.push_back(barrier);
+    }
+  }
+
+  vkCmdPipelineBarrier(command_buffer, batch.src_stages, batch.dst_stages, 0,
+                       0, nullptr,
+                       static_cast<uint32_t>(buffer_barriers.size()),
+                       buffer_barriers.data(),
+                       static_cast<uint32_t>(image_barriers.size()),
+                       image_barriers.data());
+}
+
+/**
+ * @brief Records the kept passes in order, each preceded by its barriers and,
+ * with a profiler, wrapped in a pass named after it
+ */
+void render_graph::execute(VkCommandBuffer command_buffer,
+                           gpu_profiler *profiler) {
+  for (auto &kept : m_passes) {
+    if (kept.culled)
+      continue;
+
+    uint32_t query = 0;
+    if (profiler != nullptr) {
+      query = profiler->begin_pass(command_buffer, kept.name);
+    }
+    record_batch(command_buffer, kept.before);
+    kept.record(command_buffer);
+    if (profiler != nullptr) {
+      profiler->end_pass(command_buffer, query);
+    }
+  }
+  record_batch(command_buffer, m_final);
+}
+
+/**
+ * @brief Hands the transient images over to the caller, the graph forgets
+ * them. Used to keep them alive until the frames using them are done
+ */
+rg_transients render_graph::take_transients() {
+  rg_transients taken = std::move(m_transients);
+  m_transients = {};
+  for (auto &used : m_resources) {
+    if (!used.imported) {
+      used.vk_image = VK_NULL_HANDLE;
+      used.view = VK_NULL_HANDLE;
+    }
+  }
+  return taken;
+}
+
+void render_graph::destroy_transients(rg_transients &transients) {
+  for (auto view : transients.views) {
+    vkDestroyImageView(m_device, view, nullptr);
+  }
+  for (auto image : transients.images) {
+    vkDestroyImage(m_device, image, nullptr);
+  }
+  for (auto &memory : transients.allocations) {
+    m_allocator->free(memory);
+  }
+  transients = {};
+}
+
+render_graph_stats render_graph::get_stats() { return m_stats; }
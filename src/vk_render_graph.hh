@@ -0,0 +1,189 @@
+/**
+ * @file
+ * @author Ruben Pena <rubn.pena@gmail.com>
+ * @brief This file contains the declaration of the render_graph class, the
+ * passes of a frame with the resources they read and write.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <vector>
+#include <vk_allocator.hh>
+#include <vk_profiler.hh>
+#include <vulkan/vulkan.h>
+
+/**
+ * @brief How a pass uses a resource. Each usage implies the pipeline stages,
+ * the access mask and, for images, the layout and the image usage flag
+ */
+enum class rg_usage {
+  color_attachment,
+  depth_attachment,
+  sampled,
+  storage,
+  transfer_src,
+  transfer_dst,
+  indirect
+};
+
+/**
+ * @brief Synchronization state of a resource outside the graph: where it is
+ * when the frame starts, or where it has to be when the frame ends. No stages
+ * means no dependency
+ */
+struct rg_state {
+  VkPipelineStageFlags stages = 0;
+  VkAccessFlags access = 0;
+  VkImageLayout layout = VK_IMAGE_LAYOUT_UNDEFINED;
+};
+
+/**
+ * @brief Image created and owned by the graph, alive only between its first
+ * and last use in the frame
+ */
+struct rg_image_desc {
+  VkFormat format = VK_FORMAT_UNDEFINED;
+  VkExtent2D extent = {0, 0};
+  VkImageAspectFlags aspect = VK_IMAGE_ASPECT_COLOR_BIT;
+};
+
+/**
+ * @brief Transient images and the memory they alias, handed out on
+ * recompilation so they can outlive the frames still using them
+ */
+struct rg_transients {
+  std::vector<VkImage> images;
+  std::vector<VkImageView> views;
+  std::vector<allocation> allocations; // One per aliasing slot
+};
+
+struct render_graph_stats {
+  uint32_t pass_count = 0;
+  uint32_t culled_pass_count = 0;
+  uint32_t barrier_batches = 0; // vkCmdPipelineBarrier calls per frame
+  uint32_t image_barriers = 0;
+  uint32_t buffer_barriers = 0;
+  VkDeviceSize transient_bytes = 0; // Memory bound to the transient images
+  VkDeviceSize unaliased_bytes = 0; // What they would take without aliasing
+};
+
+/**
+ * @class
+ * @brief Passes declare the resources they read and write, in the order they
+ * run. compile culls the passes nothing depends on, creates the transient
+ * images with the memory of those whose lifetimes do not overlap aliased, and
+ * plans the barriers: one vkCmdPipelineBarrier at most before each pass, with
+ * the layout transitions and only the dependencies the accesses need. The
+ * plan is reused every frame, imported resources are bound again each frame
+ * with set_image and set_buffer before execute
+ */
+class render_graph {
+  struct resource {
+    std::string name;
+    bool image = true;
+    bool imported = true;
+    rg_image_desc desc;
+    VkImageUsageFlags usage = 0; // Transient images, from the declarations
+    rg_state initial;            // Imported resources
+    rg_state final;
+    VkImage vk_image = VK_NULL_HANDLE;
+    VkImageView view = VK_NULL_HANDLE;
+    VkBuffer vk_buffer = VK_NULL_HANDLE;
+    uint32_t first_pass = UINT32_MAX; // Lifetime among the kept passes
+    uint32_t last_pass = 0;
+    uint32_t slot = UINT32_MAX; // Aliasing slot of transient images
+  };
+
+  struct access {
+    uint32_t resource = 0;
+    rg_usage usage = rg_usage::sampled;
+    bool read = false;
+    bool write = false;
+  };
+
+  struct barrier {
+    uint32_t resource = 0;
+    VkAccessFlags src_access = 0;
+    VkAccessFlags dst_access = 0;
+    VkImageLayout old_layout = VK_IMAGE_LAYOUT_UNDEFINED;
+    VkImageLayout new_layout = VK_IMAGE_LAYOUT_UNDEFINED;
+  };
+
+  struct barrier_batch {
+    VkPipelineStageFlags src_stages = 0;
+    VkPipelineStageFlags dst_stages = 0;
+    std::vector<barrier> barriers;
+  };
+
+  struct pass {
+    std::string name;
+    std::function<void(VkCommandBuffer)> record;
+    std::vector<access> accesses;
+    bool culled = false;
+    barrier_batch before; // Recorded right before the pass
+  };
+
+  /**
+   * @brief Where the last write is and who read or saw it since
+   */
+  struct tracked_state {
+    VkImageLayout layout = VK_IMAGE_LAYOUT_UNDEFINED;
+    VkPipelineStageFlags write_stages = 0;
+    VkAccessFlags write_access = 0;
+    VkPipelineStageFlags read_stages = 0;
+    VkPipelineStageFlags visible_stages = 0;
+    VkAccessFlags visible_access = 0;
+  };
+
+  VkDevice m_device = VK_NULL_HANDLE;
+  vk_allocator *m_allocator = nullptr;
+  std::vector<resource> m_resources;
+  std::vector<pass> m_passes;
+  barrier_batch m_final; // Takes the outputs to their final state
+  rg_transients m_transients;
+  render_graph_stats m_stats;
+
+  static rg_state get_state(rg_usage usage, bool write);
+  static VkImageUsageFlags get_image_usage(rg_usage usage);
+  void add_access(uint32_t pass, uint32_t resource, rg_usage usage, bool read,
+                  bool write);
+  void cull_passes();
+  void compute_lifetimes();
+  void create_transients();
+  void plan_barriers();
+  void transition(tracked_state &state, uint32_t resource,
+                  const rg_state &target, bool write, barrier_batch &batch);
+  void record_batch(VkCommandBuffer command_buffer,
+                    const barrier_batch &batch);
+
+public:
+  void init(VkDevice device, vk_allocator &allocator);
+  void reset();
+  void destroy();
+
+  uint32_t import_image(const std::string &name, VkImageAspectFlags aspect,
+                        const rg_state &initial, const rg_state &final = {});
+  uint32_t import_buffer(const std::string &name, const rg_state &initial,
+                         const rg_state &final = {});
+  uint32_t create_image(const std::string &name, const rg_image_desc &desc);
+
+  uint32_t add_pass(const std::string &name,
+                    std::function<void(VkCommandBuffer)> record);
+  void read(uint32_t pass, uint32_t resource, rg_usage usage);
+  void write(uint32_t pass, uint32_t resource, rg_usage usage);
+  void read_write(uint32_t pass, uint32_t resource, rg_usage usage);
+
+  void compile();
+  void set_image(uint32_t resource, VkImage image, VkImageView view);
+  void set_buffer(uint32_t resource, VkBuffer buffer);
+  VkImage get_image(uint32_t resource);
+  VkImageView get_image_view(uint32_t resource);
+  void execute(VkCommandBuffer command_buffer, gpu_profiler *profiler);
+
+  rg_transients take_transients();
+  void destroy_transients(rg_transients &transients);
+  render_graph_stats get_stats();
+};
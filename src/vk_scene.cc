@@ -0,0 +1,213 @@
+/**
+ * @file
+ * @author Ruben Pena <rubn.pena@gmail.com>
+ * @brief This file contains the implementation of the gpu_scene class
+ */
+
+#include <algorithm>
+#include <glm/geometric.hpp>
+#include <stdexcept>
+#include <vk_scene.hh>
+
+/**
+ * @brief Creates the buffers and queues the copies, the textures stream in
+ * over the next frames. The buffers are usable by the first frame submitted
+ * after the next staging flush
+ */
+void gpu_scene::upload(VkDevice device, vk_allocator &allocator,
+                       staging_ring &staging, bindless_heap &bindless,
+                       texture_streamer &textures,
+                       const assets::scene_data &scene) {
+  destroy(allocator);
+  if (scene.vertices.empty() || scene.indices.empty())
+    return;
+
+  m_device = device;
+  m_bindless = &bindless;
+  m_textures = &textures;
+
+  VkDeviceSize vertex_size = sizeof(assets::vertex) * scene.vertices.size();
+  VkDeviceSize index_size = sizeof(uint32_t) * scene.indices.size();
+
+  VkBufferCreateInfo buffer_info{};
+  buffer_info.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+  buffer_info.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+
+  buffer_info.size = vertex_size;
+  buffer_info.usage =
+      VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT;
+  m_vertex_allocation = allocator.create_buffer(
+      buffer_info, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, m_vertex_buffer);
+
+  buffer_info.size = index_size;
+  buffer_info.usage =
+      VK_BUFFER_USAGE_INDEX_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT;
+  m_index_allocation = allocator.create_buffer(
+      buffer_info, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, m_index_buffer);
+
+  staging.upload_buffer(m_vertex_buffer, 0, scene.vertices.data(), vertex_size,
+                        VK_PIPELINE_STAGE_VERTEX_INPUT_BIT,
+                        VK_ACCESS_VERTEX_ATTRIBUTE_READ_BIT);
+  staging.upload_buffer(m_index_buffer, 0, scene.indices.data(), index_size,
+                        VK_PIPELINE_STAGE_VERTEX_INPUT_BIT,
+                        VK_ACCESS_INDEX_READ_BIT);
+
+  std::vector<int32_t> image_textures = textures.add(scene.images);
+
+  std::vector<gpu_material> materials;
+  materials.reserve(scene.materials.size() + 1);
+  for (const auto &material : scene.materials) {
+    gpu_material gpu;
+    gpu.base_color = material.base_color;
+    if (material.base_color_image >= 0 &&
+        static_cast<size_t>(material.base_color_image) < image_textures.size())
+      gpu.base_color_texture = image_textures[material.base_color_image];
+    materials.push_back(gpu);
+  }
+  uint32_t default_material = static_cast<uint32_t>(materials.size());
+  materials.push_back(gpu_material{}); // For primitives without material
+
+  VkDeviceSize material_size = sizeof(gpu_material) * materials.size();
+  buffer_info.size = material_size;
+  buffer_info.usage =
+      VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT;
+  m_material_allocation = allocator.create_buffer(
+      buffer_info, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, m_material_buffer);
+  staging.upload_buffer(m_material_buffer, 0, materials.data(), material_size,
+                        VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT,
+                        VK_ACCESS_SHADER_READ_BIT);
+  m_material_buffer_index = bindless.add_buffer(m_material_buffer);
+
+  m_primitives = scene.primitives;
+  for (const auto &instance : scene.instances) {
+    const assets::mesh &mesh = scene.meshes[instance.mesh];
+    for (uint32_t p = 0; p < mesh.primitive_count; p++) {
+      const assets::primitive &range =
+          scene.primitives[mesh.first_primitive + p];
+
+      draw_item draw;
+      draw.index_count = range.index_count;
+      draw.first_index = range.first_index;
+      draw.vertex_offset = static_cast<int32_t>(range.first_vertex);
+      draw.primitive = mesh.first_primitive + p;
+      draw.material =
+          range.material >= 0 &&
+                  static_cast<size_t>(range.material) < scene.materials.size()
+              ? static_cast<uint32_t>(range.material)
+              : default_material; // Also for out of range materials
+      draw.transform = instance.transform;
+
+      glm::vec3 center = (range.bounds_min + range.bounds_max) * 0.5f;
+      float radius = glm::length(range.bounds_max - range.bounds_min) * 0.5f;
+      float scale = std::max({glm::length(glm::vec3(instance.transform[0])),
+                              glm::length(glm::vec3(instance.transform[1])),
+                              glm::length(glm::vec3(instance.transform[2]))});
+      glm::vec3 world_center =
+          glm::vec3(instance.transform * glm::vec4(center, 1.0f));
+      draw.sphere = glm::vec4(world_center, radius * scale);
+      m_draws.push_back(draw);
+
+      glm::vec3 extent = (range.bounds_max - range.bounds_min) * 0.5f;
+      glm::vec3 world_extent =
+          glm::abs(glm::vec3(instance.transform[0])) * extent.x +
+          glm::abs(glm::vec3(instance.transform[1])) * extent.y +
+          glm::abs(glm::vec3(instance.transform[2])) * extent.z;
+      m_bounds.push_back(draw.sphere, world_center - world_extent,
+                         world_center + world_extent);
+    }
+  }
+
+  // Never 0 bytes, a scene without instances still gets a buffer to bind
+  std::vector<gpu_object> objects(std::max<size_t>(m_draws.size(), 1));
+  for (size_t i = 0; i < m_draws.size(); i++) {
+    objects[i].transform = m_draws[i].transform;
+    objects[i].sphere = m_draws[i].sphere;
+    objects[i].index_count = m_draws[i].index_count;
+    objects[i].first_index = m_draws[i].first_index;
+    objects[i].vertex_offset = m_draws[i].vertex_offset;
+    objects[i].material = m_draws[i].material;
+  }
+
+  VkDeviceSize object_size = sizeof(gpu_object) * objects.size();
+  buffer_info.size = object_size;
+  buffer_info.usage =
+      VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT;
+  m_object_allocation = allocator.create_buffer(
+      buffer_info, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, m_object_buffer);
+  staging.upload_buffer(m_object_buffer, 0, objects.data(), object_size,
+                        VK_PIPELINE_STAGE_VERTEX_SHADER_BIT |
+                            VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                        VK_ACCESS_SHADER_READ_BIT);
+  m_object_buffer_index = bindless.add_buffer(m_object_buffer);
+
+  buffer_info.size = gpu_draw_commands::COMMANDS_OFFSET +
+                     gpu_draw_commands::STRIDE * m_draws.size();
+  buffer_info.usage = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT |
+                      VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT |
+                      VK_BUFFER_USAGE_TRANSFER_DST_BIT;
+  m_draw_command_allocation = allocator.create_buffer(
+      buffer_info, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, m_draw_command_buffer);
+  m_draw_command_buffer_index = bindless.add_buffer(m_draw_command_buffer);
+
+  m_bounds_min = scene.bounds_min;
+  m_bounds_max = scene.bounds_max;
+}
+
+/**
+ * @brief Frees the buffers and textures and their bindless slots. The GPU must
+ * be done with them
+ */
+void gpu_scene::destroy(vk_allocator &allocator) {
+  if (m_vertex_buffer != VK_NULL_HANDLE) {
+    allocator.destroy_buffer(m_vertex_buffer, m_vertex_allocation);
+    allocator.destroy_buffer(m_index_buffer, m_index_allocation);
+    m_bindless->remove_buffer(m_material_buffer_index);
+    allocator.destroy_buffer(m_material_buffer, m_material_allocation);
+    m_bindless->remove_buffer(m_object_buffer_index);
+    allocator.destroy_buffer(m_object_buffer, m_object_allocation);
+    m_bindless->remove_buffer(m_draw_command_buffer_index);
+    allocator.destroy_buffer(m_draw_command_buffer,
+                             m_draw_command_allocation);
+  }
+  if (m_textures != nullptr) {
+    m_textures->clear();
+  }
+  m_vertex_buffer = VK_NULL_HANDLE;
+  m_index_buffer = VK_NULL_HANDLE;
+  m_material_buffer = VK_NULL_HANDLE;
+  m_object_buffer = VK_NULL_HANDLE;
+  m_draw_command_buffer = VK_NULL_HANDLE;
+  m_primitives.clear();
+  m_draws.clear();
+  m_bounds.clear();
+}
+
+bool gpu_scene::empty() { return m_draws.empty(); }
+
+VkBuffer gpu_scene::get_vertex_buffer() { return m_vertex_buffer; }
+
+VkBuffer gpu_scene::get_index_buffer() { return m_index_buffer; }
+
+uint32_t gpu_scene::get_material_buffer_index() {
+  return m_material_buffer_index;
+}
+
+uint32_t gpu_scene::get_object_buffer_index() { return m_object_buffer_index; }
+
+VkBuffer gpu_scene::get_draw_command_buffer() { return m_draw_command_buffer; }
+
+uint32_t gpu_scene::get_draw_command_buffer_index() {
+  return m_draw_command_buffer_index;
+}
+
+const std::vector<assets::primitive> &gpu_scene::get_primitives() {
+  return m_primitives;
+}
+
+const std::vector<draw_item> &gpu_scene::get_draws() { return m_draws; }
+
+const utils::bounds_soa &gpu_scene::get_bounds() { return m_bounds; }
+
+glm::vec3 gpu_scene::get_bounds_min() { return m_bounds_min; }
+
+glm::vec3 gpu_scene::get_bounds_max() { return m_bounds_max; }
@@ -0,0 +1,122 @@
+/**
+ * @file
+ * @author Ruben Pena <rubn.pena@gmail.com>
+ * @brief This file contains the declaration of the gpu_scene class, the GPU
+ * copy of a loaded scene.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <frustum.hh>
+#include <glm/mat4x4.hpp>
+#include <scene.hh>
+#include <vector>
+#include <vk_allocator.hh>
+#include <vk_bindless.hh>
+#include <vk_staging_ring.hh>
+#include <vk_texture_streamer.hh>
+#include <vulkan/vulkan.h>
+
+/**
+ * @brief One vkCmdDrawIndexed worth of state. Every draw reads the same
+ * vertex and index buffers, only the offsets, the transform and the material
+ * index change
+ */
+struct draw_item {
+  uint32_t index_count = 0;
+  uint32_t first_index = 0;
+  int32_t vertex_offset = 0;
+  uint32_t primitive = 0;
+  uint32_t material = 0; // Into the material buffer
+  glm::mat4 transform = glm::mat4(1.0f);
+  glm::vec4 sphere = glm::vec4(0.0f); // World space bounds, w: radius
+};
+
+/**
+ * @brief A draw as the shaders read it from the bindless object buffer,
+ * std430 layout. Draws use their object index as firstInstance, so the vertex
+ * shader finds its object through gl_InstanceIndex
+ */
+struct gpu_object {
+  glm::mat4 transform = glm::mat4(1.0f);
+  glm::vec4 sphere = glm::vec4(0.0f);
+  uint32_t index_count = 0;
+  uint32_t first_index = 0;
+  int32_t vertex_offset = 0;
+  uint32_t material = 0;
+};
+
+/**
+ * @brief Layout of the buffer the culling shader fills: the visible draw
+ * count, then one command per visible object
+ */
+struct gpu_draw_commands {
+  static constexpr VkDeviceSize COUNT_OFFSET = 0;
+  static constexpr VkDeviceSize COMMANDS_OFFSET = 16;
+  static constexpr uint32_t STRIDE = sizeof(VkDrawIndexedIndirectCommand);
+};
+
+/**
+ * @brief Material as the shaders read it from the bindless material buffer,
+ * std430 layout
+ */
+struct gpu_material {
+  glm::vec4 base_color = glm::vec4(1.0f);
+  int32_t base_color_texture = -1; // Bindless image index, -1: none
+  uint32_t pad[3] = {0, 0, 0};
+};
+
+/**
+ * @class
+ * @brief Owns one device local vertex buffer and one index buffer holding the
+ * geometry of every mesh of the scene, filled through the staging ring, plus
+ * the flat list of draws of every mesh instance. Textures are handed to the
+ * texture streamer, they and the material and object buffers are registered
+ * in the bindless heap, draws only carry indices. The draw command buffer is
+ * written by the GPU culling pass
+ */
+class gpu_scene {
+  VkBuffer m_vertex_buffer = VK_NULL_HANDLE;
+  allocation m_vertex_allocation;
+  VkBuffer m_index_buffer = VK_NULL_HANDLE;
+  allocation m_index_allocation;
+  VkBuffer m_material_buffer = VK_NULL_HANDLE;
+  allocation m_material_allocation;
+  uint32_t m_material_buffer_index = 0; // Bindless buffer index
+  VkBuffer m_object_buffer = VK_NULL_HANDLE;
+  allocation m_object_allocation;
+  uint32_t m_object_buffer_index = 0;
+  VkBuffer m_draw_command_buffer = VK_NULL_HANDLE; // gpu_draw_commands
+  allocation m_draw_command_allocation;
+  uint32_t m_draw_command_buffer_index = 0;
+
+  VkDevice m_device = VK_NULL_HANDLE;
+  bindless_heap *m_bindless = nullptr;
+  texture_streamer *m_textures = nullptr;
+
+  std::vector<assets::primitive> m_primitives;
+  std::vector<draw_item> m_draws;
+  utils::bounds_soa m_bounds; // World space, per draw, for CPU culling
+  glm::vec3 m_bounds_min = glm::vec3(0.0f);
+  glm::vec3 m_bounds_max = glm::vec3(0.0f);
+
+public:
+  void upload(VkDevice device, vk_allocator &allocator, staging_ring &staging,
+              bindless_heap &bindless, texture_streamer &textures,
+              const assets::scene_data &scene);
+  void destroy(vk_allocator &allocator);
+
+  bool empty();
+  VkBuffer get_vertex_buffer();
+  VkBuffer get_index_buffer();
+  uint32_t get_material_buffer_index();
+  uint32_t get_object_buffer_index();
+  VkBuffer get_draw_command_buffer();
+  uint32_t get_draw_command_buffer_index();
+  const std::vector<assets::primitive> &get_primitives();
+  const std::vector<draw_item> &get_draws();
+  const utils::bounds_soa &get_bounds();
+  glm::vec3 get_bounds_min();
+  glm::vec3 get_bounds_max();
+};
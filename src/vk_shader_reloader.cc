@@ -0,0 +1,177 @@
+/**
+ * @file
+ * @author Ruben Pena <rubn.pena@gmail.com>
+ * @brief This file contains the implementation of the shader_reloader class
+ */
+
+#include <cerrno>
+#include <cstdlib>
+#include <embedded_shaders.hh>
+#include <exception>
+#include <fcntl.h>
+#include <filesystem>
+#include <iostream>
+#include <mapped_file.hh>
+#include <spawn.h>
+#include <stdexcept>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <vk_shader_reloader.hh>
+
+extern char **environ;
+
+shader_reloader::~shader_reloader() { stop(); }
+
+/**
+ * @brief Starts watching directory. glslc is taken from the Vulkan SDK if
+ * VULKAN_SDK is set, from the PATH otherwise
+ */
+void shader_reloader::start(
+    const std::string &directory,
+    std::function<void(const std::string &)> on_compiled) {
+  stop();
+  m_watcher.watch(directory);
+  m_directory = directory;
+  m_on_compiled = std::move(on_compiled);
+
+  m_compiler = "glslc";
+  const char *sdk = std::getenv("VULKAN_SDK");
+  if (sdk != nullptr &&
+      std::filesystem::exists(std::filesystem::path(sdk) / "bin" / "glslc")) {
+    m_compiler = (std::filesystem::path(sdk) / "bin" / "glslc").string();
+  }
+
+  m_running = true;
+  m_thread = std::thread([this]() { run(); });
+}
+
+void shader_reloader::stop() {
+  m_running = false;
+  if (m_thread.joinable()) {
+    m_thread.join();
+  }
+  m_watcher.close();
+}
+
+bool shader_reloader::is_running() { return m_running; }
+
+/**
+ * @brief SPIR-V of the last successful compilation of name, or the embedded
+ * one if it was never reloaded. Throws if there is neither
+ */
+std::vector<uint32_t> shader_reloader::get_code(const std::string &name) {
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    auto found = m_code.find(name);
+    if (found != m_code.end())
+      return found->second;
+  }
+
+  const utils::embedded_shader *shader = utils::find_embedded_shader(name);
+  if (shader == nullptr) {
+    throw std::runtime_error("no code for shader " + name);
+  }
+  return std::vector<uint32_t>(shader->code,
+                               shader->code + shader->size / sizeof(uint32_t));
+}
+
+void shader_reloader::run() {
+  while (m_running) {
+    for (const auto &name : m_watcher.wait_changes(M_POLL_MS)) {
+      std::string extension = std::filesystem::path(name).extension().string();
+      if (extension != ".vert" && extension != ".frag" && extension != ".comp")
+        continue; // Editor backups, compile_shader.sh...
+
+      std::vector<uint32_t> code;
+      std::string log;
+      if (!compile(name, code, log)) {
+        std::cerr << "Shader " << name << " failed to compile, keeping the "
+                  << "previous version:\n"
+                  << log << std::endl;
+        continue;
+      }
+      {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_code[name] = std::move(code);
+      }
+
+      try {
+        m_on_compiled(name);
+      } catch (const std::exception &e) {
+        std::cerr << "Shader " << name << " reloaded but not applied: "
+                  << e.what() << std::endl;
+      } // A bad pipeline must not take the renderer down
+    }
+  }
+}
+
+/**
+ * @brief Runs glslc on the source into a temporary file and reads the SPIR-V
+ * back. log receives everything glslc printed. glslc is spawned with an argv
+ * array, never through a shell, the file names come from the watched
+ * directory and may contain anything
+ */
+bool shader_reloader::compile(const std::string &name,
+                              std::vector<uint32_t> &code, std::string &log) {
+  std::filesystem::path source = std::filesystem::path(m_directory) / name;
+  std::filesystem::path output =
+      std::filesystem::temp_directory_path() /
+      ("render-toy-" + std::to_string(getpid()) + "-" + name + ".spv");
+
+  std::string source_arg = source.string();
+  std::string output_arg = output.string();
+  char output_flag[] = "-o";
+  char *argv[] = {m_compiler.data(), source_arg.data(), output_flag,
+                  output_arg.data(), nullptr};
+
+  int pipe_fds[2];
+  if (pipe2(pipe_fds, O_CLOEXEC) != 0) {
+    log = "failed to create a pipe for " + m_compiler;
+    return false;
+  }
+
+  posix_spawn_file_actions_t actions;
+  posix_spawn_file_actions_init(&actions);
+  posix_spawn_file_actions_adddup2(&actions, pipe_fds[1], STDOUT_FILENO);
+  posix_spawn_file_actions_adddup2(&actions, pipe_fds[1], STDERR_FILENO);
+
+  pid_t pid = 0;
+  int spawned = posix_spawnp(&pid, argv[0], &actions, nullptr, argv, environ);
+  posix_spawn_file_actions_destroy(&actions);
+  close(pipe_fds[1]); // The child has its own copy, EOF once it exits
+  if (spawned != 0) {
+    close(pipe_fds[0]);
+    log = "failed to run " + m_compiler;
+    return false;
+  }
+
+  char buffer[512];
+  ssize_t count = 0;
+  while ((count = read(pipe_fds[0], buffer, sizeof(buffer))) != 0) {
+    if (count < 0 && errno == EINTR)
+      continue;
+    if (count < 0)
+      break;
+    log.append(buffer, static_cast<size_t>(count));
+  }
+  close(pipe_fds[0]);
+
+  int status = 0;
+  pid_t waited = 0;
+  do {
+    waited = waitpid(pid, &status, 0);
+  } while (waited < 0 && errno == EINTR);
+  if (waited != pid || !WIFEXITED(status) || WEXITSTATUS(status) != 0)
+    return false;
+
+  try {
+    utils::mapped_file spirv(output.string());
+    const uint32_t *words = spirv.view().words();
+    code.assign(words, words + spirv.size() / sizeof(uint32_t));
+  } catch (const std::exception &e) {
+    log += e.what();
+  }
+  std::error_code error;
+  std::filesystem::remove(output, error);
+  return !code.empty();
+}
@@ -0,0 +1,53 @@
+/**
+ * @file
+ * @author Ruben Pena <rubn.pena@gmail.com>
+ * @brief This file contains the declaration of the shader_reloader class, the
+ * background compilation of the shaders edited while the renderer runs.
+ */
+
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <file_watcher.hh>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+/**
+ * @class
+ * @brief Watches the shader sources and compiles the ones that change to
+ * SPIR-V with glslc, on its own thread. on_compiled runs on that thread after
+ * each successful compilation, with the file name, e.g. "mesh.frag". The
+ * latest SPIR-V of every shader, reloaded or embedded, is kept by name.
+ * Compilation errors are printed and leave the previous code in place
+ */
+class shader_reloader {
+  static constexpr int M_POLL_MS = 100; // Checks for stop this often
+
+  utils::file_watcher m_watcher;
+  std::string m_directory;
+  std::string m_compiler;
+  std::function<void(const std::string &)> m_on_compiled;
+  std::thread m_thread;
+  std::atomic<bool> m_running{false};
+
+  std::mutex m_mutex; // Guards the code
+  std::unordered_map<std::string, std::vector<uint32_t>> m_code;
+
+  void run();
+  bool compile(const std::string &name, std::vector<uint32_t> &code,
+               std::string &log);
+
+public:
+  ~shader_reloader();
+
+  void start(const std::string &directory,
+             std::function<void(const std::string &)> on_compiled);
+  void stop();
+  bool is_running();
+  std::vector<uint32_t> get_code(const std::string &name);
+};
@@ -0,0 +1,441 @@
+/**
+ * @file
+ * @author Ruben Pena <rubn.pena@gmail.com>
+ * @brief This file contains the implementation of the staging_ring class
+ */
+
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+#include <vk_staging_ring.hh>
+
+static uint64_t align_up(uint64_t value, uint64_t alignment) {
+  return (value + alignment - 1) / alignment * alignment;
+}
+
+/**
+ * @brief Records the acquire half of the queue family ownership transfers
+ */
+void upload_wait::record(VkCommandBuffer command_buffer) {
+  if (buffer_barriers.empty() && image_barriers.empty())
+    return;
+
+  vkCmdPipelineBarrier(command_buffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT,
+                       stages, 0, 0, nullptr,
+                       static_cast<uint32_t>(buffer_barriers.size()),
+                       buffer_barriers.data(),
+                       static_cast<uint32_t>(image_barriers.size()),
+                       image_barriers.data());
+}
+
+/**
+ * @brief Creates the ring buffer, its command pool and the timeline semaphore.
+ * queue_mutex guards the queue when it is shared with the graphics submissions
+ */
+void staging_ring::create(VkPhysicalDevice physical_device, VkDevice device,
+                          vk_allocator &allocator, VkQueue queue,
+                          std::mutex *queue_mutex, uint32_t transfer_family,
+                          uint32_t graphics_family, VkDeviceSize size) {
+  m_device = device;
+  m_allocator = &allocator;
+  m_queue = queue;
+  m_queue_mutex = queue_mutex;
+  m_transfer_family = transfer_family;
+  m_graphics_family = graphics_family;
+
+  VkPhysicalDeviceProperties properties;
+  vkGetPhysicalDeviceProperties(physical_device, &properties);
+  m_copy_alignment = std::max<VkDeviceSize>(
+      properties.limits.optimalBufferCopyOffsetAlignment, 16);
+  m_size = align_up(size, m_copy_alignment);
+
+  VkBufferCreateInfo buffer_info{};
+  buffer_info.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+  buffer_info.size = m_size;
+  buffer_info.usage = VK_BUFFER_USAGE_TRANSFER_SRC_BIT;
+  buffer_info.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+
+  m_allocation = m_allocator->create_buffer(
+      buffer_info,
+      VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
+          VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+      m_buffer);
+
+  VkCommandPoolCreateInfo pool_info{};
+  pool_info.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+  pool_info.flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT |
+                    VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT;
+  pool_info.queueFamilyIndex = m_transfer_family;
+
+  if (vkCreateCommandPool(m_device, &pool_info, nullptr, &m_command_pool) !=
+      VK_SUCCESS) {
+    throw std::runtime_error("failed to create staging command pool");
+  }
+
+  VkSemaphoreTypeCreateInfo type_info{};
+  type_info.sType = VK_STRUCTURE_TYPE_SEMAPHORE_TYPE_CREATE_INFO;
+  type_info.semaphoreType = VK_SEMAPHORE_TYPE_TIMELINE;
+  type_info.initialValue = 0;
+
+  VkSemaphoreCreateInfo semaphore_info{};
+  semaphore_info.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+  semaphore_info.pNext = &type_info;
+
+  if (vkCreateSemaphore(m_device, &semaphore_info, nullptr, &m_timeline) !=
+      VK_SUCCESS) {
+    throw std::runtime_error("failed to create staging timeline semaphore");
+  }
+}
+
+/**
+ * @brief Submits what is left, waits for every upload and frees everything
+ */
+void staging_ring::destroy() {
+  if (m_timeline == VK_NULL_HANDLE)
+    return;
+
+  uint64_t last = flush();
+  wait(last);
+
+  std::lock_guard<std::mutex> lock(m_mutex);
+  retire(false);
+
+  vkDestroySemaphore(m_device, m_timeline, nullptr);
+  vkDestroyCommandPool(m_device, m_command_pool, nullptr);
+  m_allocator->destroy_buffer(m_buffer, m_allocation);
+  m_timeline = VK_NULL_HANDLE;
+  m_free_command_buffers.clear();
+}
+
+/**
+ * @brief Returns the ring position of size free bytes. Submits the batch being
+ * recorded and waits for the oldest one when the ring is full
+ */
+VkDeviceSize staging_ring::reserve(VkDeviceSize size, VkDeviceSize alignment) {
+  for (;;) {
+    uint64_t offset = align_up(m_head, alignment);
+    if (offset % m_size + size > m_size) {
+      offset = align_up(offset, m_size);
+    } // Never straddle the end of the ring, skip to the start
+
+    if (m_recording.command_buffer == VK_NULL_HANDLE && m_in_flight.empty()) {
+      m_tail = offset;
+    } // Idle, the skipped bytes at the end are not in use either
+
+    if (offset + size - m_tail <= m_size) {
+      m_head = offset + size;
+      return offset % m_size;
+    }
+
+    if (m_recording.command_buffer != VK_NULL_HANDLE) {
+      submit();
+    } // Its bytes can only be reclaimed once it has run
+    retire(true);
+  }
+}
+
+/**
+ * @brief Reclaims the ring space and command buffers of the finished batches.
+ * With wait set, blocks until at least the oldest batch has finished
+ */
+void staging_ring::retire(bool wait) {
+  uint64_t completed = 0;
+  vkGetSemaphoreCounterValue(m_device, m_timeline, &completed);
+
+  if (wait && !m_in_flight.empty() && m_in_flight.front().value > completed) {
+    VkSemaphoreWaitInfo wait_info{};
+    wait_info.sType = VK_STRUCTURE_TYPE_SEMAPHORE_WAIT_INFO;
+    wait_info.semaphoreCount = 1;
+    wait_info.pSemaphores = &m_timeline;
+    wait_info.pValues = &m_in_flight.front().value;
+    vkWaitSemaphores(m_device, &wait_info, UINT64_MAX);
+    completed = m_in_flight.front().value;
+  }
+
+  while (!m_in_flight.empty() && m_in_flight.front().value <= completed) {
+    m_tail = m_in_flight.front().end;
+    m_free_command_buffers.push_back(m_in_flight.front().command_buffer);
+    m_in_flight.pop_front();
+  }
+}
+
+VkCommandBuffer staging_ring::get_command_buffer() {
+  if (m_recording.command_buffer != VK_NULL_HANDLE)
+    return m_recording.command_buffer;
+
+  if (m_free_command_buffers.empty()) {
+    VkCommandBufferAllocateInfo alloc_info{};
+    alloc_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+    alloc_info.commandPool = m_command_pool;
+    alloc_info.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+    alloc_info.commandBufferCount = 1;
+
+    VkCommandBuffer command_buffer;
+    if (vkAllocateCommandBuffers(m_device, &alloc_info, &command_buffer) !=
+        VK_SUCCESS) {
+      throw std::runtime_error("failed to allocate staging command buffer");
+    }
+    m_free_command_buffers.push_back(command_buffer);
+  }
+
+  m_recording.command_buffer = m_free_command_buffers.back();
+  m_free_command_buffers.pop_back();
+
+  VkCommandBufferBeginInfo begin_info{};
+  begin_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+  begin_info.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+
+  if (vkBeginCommandBuffer(m_recording.command_buffer, &begin_info) !=
+      VK_SUCCESS) {
+    throw std::runtime_error("failed to begin staging command buffer");
+  } // Begin implicitly resets it
+  return m_recording.command_buffer;
+}
+
+/**
+ * @brief Submits the batch being recorded, signaling the next timeline value
+ */
+void staging_ring::submit() {
+  if (vkEndCommandBuffer(m_recording.command_buffer) != VK_SUCCESS) {
+    throw std::runtime_error("failed to record staging command buffer");
+  }
+
+  m_recording.value = m_next_value++;
+  m_recording.end = m_head;
+
+  VkTimelineSemaphoreSubmitInfo timeline_info{};
+  timeline_info.sType = VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO;
+  timeline_info.signalSemaphoreValueCount = 1;
+  timeline_info.pSignalSemaphoreValues = &m_recording.value;
+
+  VkSubmitInfo submit_info{};
+  submit_info.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+  submit_info.pNext = &timeline_info;
+  submit_info.commandBufferCount = 1;
+  submit_info.pCommandBuffers = &m_recording.command_buffer;
+  submit_info.signalSemaphoreCount = 1;
+  submit_info.pSignalSemaphores = &m_timeline;
+
+  VkResult result;
+  if (m_queue_mutex != nullptr) {
+    std::lock_guard<std::mutex> queue_lock(*m_queue_mutex);
+    result = vkQueueSubmit(m_queue, 1, &submit_info, VK_NULL_HANDLE);
+  } else {
+    result = vkQueueSubmit(m_queue, 1, &submit_info, VK_NULL_HANDLE);
+  }
+  if (result != VK_SUCCESS) {
+    throw std::runtime_error("failed to submit staging command buffer");
+  }
+
+  m_pending_wait.value = m_recording.value;
+  m_pending_wait.stages |= m_recording_wait.stages;
+  m_pending_wait.buffer_barriers.insert(
+      m_pending_wait.buffer_barriers.end(),
+      m_recording_wait.buffer_barriers.begin(),
+      m_recording_wait.buffer_barriers.end());
+  m_pending_wait.image_barriers.insert(
+      m_pending_wait.image_barriers.end(),
+      m_recording_wait.image_barriers.begin(),
+      m_recording_wait.image_barriers.end()); // Next frame acquires them
+
+  m_in_flight.push_back(m_recording);
+  m_recording = {};
+  m_recording_wait = {};
+}
+
+/**
+ * @brief Copies data into offset of buffer. Uploads bigger than a quarter of
+ * the ring are split so the copies keep flowing while the CPU waits for space.
+ * Returns the timeline value signaled once the data is in place
+ */
+uint64_t staging_ring::upload_buffer(VkBuffer buffer, VkDeviceSize offset,
+                                     const void *data, VkDeviceSize size,
+                                     VkPipelineStageFlags dst_stage,
+                                     VkAccessFlags dst_access) {
+  std::lock_guard<std::mutex> lock(m_mutex);
+
+  const uint8_t *bytes = static_cast<const uint8_t *>(data);
+  VkDeviceSize max_chunk = m_size / 4;
+
+  for (VkDeviceSize done = 0; done < size;) {
+    VkDeviceSize chunk = std::min(size - done, max_chunk);
+    VkDeviceSize ring_offset = reserve(chunk, m_copy_alignment);
+    std::memcpy(static_cast<uint8_t *>(m_allocation.mapped) + ring_offset,
+                bytes + done, chunk);
+    m_allocator->flush(m_allocation, ring_offset, chunk);
+
+    VkBufferCopy region{};
+    region.srcOffset = ring_offset;
+    region.dstOffset = offset + done;
+    region.size = chunk;
+    vkCmdCopyBuffer(get_command_buffer(), m_buffer, buffer, 1, &region);
+    done += chunk;
+  }
+
+  m_recording_wait.stages |= dst_stage;
+
+  if (m_transfer_family != m_graphics_family) {
+    VkBufferMemoryBarrier barrier{};
+    barrier.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+    barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    barrier.srcQueueFamilyIndex = m_transfer_family;
+    barrier.dstQueueFamilyIndex = m_graphics_family;
+    barrier.buffer = buffer;
+    barrier.offset = offset;
+    barrier.size = size;
+
+    vkCmdPipelineBarrier(get_command_buffer(), VK_PIPELINE_STAGE_TRANSFER_BIT,
+                         VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, 0, 0, nullptr,
+                         1, &barrier, 0, nullptr); // Release
+
+    barrier.srcAccessMask = 0;
+    barrier.dstAccessMask = dst_access;
+    m_recording_wait.buffer_barriers.push_back(barrier);
+  } // Same family, the semaphore wait alone makes the writes visible
+
+  return m_next_value;
+}
+
+/**
+ * @brief Copies tightly packed texels into mip_level of the first layer of
+ * image and leaves it in final_layout. The previous contents of that level
+ * are discarded. The level is copied in one piece, so it can be at most
+ * get_max_image_size() bytes. Returns the timeline value signaled once the
+ * data is in place
+ */
+uint64_t staging_ring::upload_image(VkImage image, VkExtent3D extent,
+                                    uint32_t mip_level, const void *data,
+                                    VkDeviceSize size,
+                                    VkImageLayout final_layout,
+                                    VkPipelineStageFlags dst_stage,
+                                    VkAccessFlags dst_access) {
+  if (size > get_max_image_size()) {
+    throw std::runtime_error("image upload bigger than half the staging ring");
+  }
+
+  std::lock_guard<std::mutex> lock(m_mutex);
+
+  VkDeviceSize ring_offset = reserve(size, m_copy_alignment);
+  std::memcpy(static_cast<uint8_t *>(m_allocation.mapped) + ring_offset, data,
+              size);
+  m_allocator->flush(m_allocation, ring_offset, size);
+
+  VkCommandBuffer command_buffer = get_command_buffer();
+
+  VkImageMemoryBarrier barrier{};
+  barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+  barrier.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+  barrier.oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+  barrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+  barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+  barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+  barrier.image = image;
+  barrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+  barrier.subresourceRange.baseMipLevel = mip_level;
+  barrier.subresourceRange.levelCount = 1;
+  barrier.subresourceRange.baseArrayLayer = 0;
+  barrier.subresourceRange.layerCount = 1;
+
+  vkCmdPipelineBarrier(command_buffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT,
+                       VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, nullptr, 0,
+                       nullptr, 1, &barrier);
+
+  VkBufferImageCopy region{};
+  region.bufferOffset = ring_offset;
+  region.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+  region.imageSubresource.mipLevel = mip_level;
+  region.imageSubresource.baseArrayLayer = 0;
+  region.imageSubresource.layerCount = 1;
+  region.imageExtent = extent;
+
+  vkCmdCopyBufferToImage(command_buffer, m_buffer, image,
+                         VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &region);
+
+  barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+  barrier.dstAccessMask = 0;
+  barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+  barrier.newLayout = final_layout;
+  if (m_transfer_family != m_graphics_family) {
+    barrier.srcQueueFamilyIndex = m_transfer_family;
+    barrier.dstQueueFamilyIndex = m_graphics_family;
+  } // Release, the layout transition happens once across both halves
+
+  vkCmdPipelineBarrier(command_buffer, VK_PIPELINE_STAGE_TRANSFER_BIT,
+                       VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, 0, 0, nullptr, 0,
+                       nullptr, 1, &barrier);
+
+  m_recording_wait.stages |= dst_stage;
+
+  if (m_transfer_family != m_graphics_family) {
+    barrier.srcAccessMask = 0;
+    barrier.dstAccessMask = dst_access;
+    m_recording_wait.image_barriers.push_back(barrier);
+  }
+
+  return m_next_value;
+}
+
+/**
+ * @brief Submits the uploads recorded so far. Returns the timeline value of
+ * the last submission, 0 if nothing was ever submitted
+ */
+uint64_t staging_ring::flush() {
+  std::lock_guard<std::mutex> lock(m_mutex);
+
+  if (m_recording.command_buffer != VK_NULL_HANDLE) {
+    submit();
+  }
+  retire(false);
+  return m_next_value - 1;
+}
+
+/**
+ * @brief Hands the acquires and the wait of every flushed upload to the next
+ * graphics submission
+ */
+upload_wait staging_ring::take_wait() {
+  std::lock_guard<std::mutex> lock(m_mutex);
+
+  upload_wait wait = std::move(m_pending_wait);
+  m_pending_wait = {};
+  return wait;
+}
+
+bool staging_ring::is_complete(uint64_t value) {
+  uint64_t completed = 0;
+  vkGetSemaphoreCounterValue(m_device, m_timeline, &completed);
+  return completed >= value;
+}
+
+/**
+ * @brief Blocks until the upload that returned value is done, submitting it
+ * first if it is still being recorded
+ */
+void staging_ring::wait(uint64_t value) {
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (value >= m_next_value && m_recording.command_buffer != VK_NULL_HANDLE) {
+      submit();
+    }
+    if (value >= m_next_value)
+      return; // Nothing will ever signal it
+  }
+
+  VkSemaphoreWaitInfo wait_info{};
+  wait_info.sType = VK_STRUCTURE_TYPE_SEMAPHORE_WAIT_INFO;
+  wait_info.semaphoreCount = 1;
+  wait_info.pSemaphores = &m_timeline;
+  wait_info.pValues = &value;
+  vkWaitSemaphores(m_device, &wait_info, UINT64_MAX);
+}
+
+VkSemaphore staging_ring::get_timeline() { return m_timeline; }
+
+VkDeviceSize staging_ring::get_size() { return m_size; }
+
+/**
+ * @brief Largest image level upload_image accepts. Buffer uploads are split
+ * and have no limit, levels are not, and half the ring keeps one from having
+ * to wait for the whole ring to drain
+ */
+VkDeviceSize staging_ring::get_max_image_size() { return m_size / 2; }
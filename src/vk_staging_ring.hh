@@ -0,0 +1,104 @@
+/**
+ * @file
+ * @author Ruben Pena <rubn.pena@gmail.com>
+ * @brief This file contains the declaration of the staging_ring class, used
+ * to stream buffer and image data to the GPU from the transfer queue.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <vector>
+#include <vk_allocator.hh>
+#include <vulkan/vulkan.h>
+
+/**
+ * @brief What the next graphics submission needs before it can use the
+ * uploaded data: the ownership acquire barriers to record and the timeline
+ * value to wait on. An empty upload_wait records and waits on nothing
+ */
+struct upload_wait {
+  uint64_t value = 0;
+  VkPipelineStageFlags stages = 0;
+  std::vector<VkBufferMemoryBarrier> buffer_barriers;
+  std::vector<VkImageMemoryBarrier> image_barriers;
+
+  void record(VkCommandBuffer command_buffer);
+};
+
+/**
+ * @class
+ * @brief Persistently mapped ring buffer the uploads are copied into. The
+ * copies are batched into a single command buffer that is submitted to the
+ * transfer queue on flush, and each submission signals the next value of a
+ * timeline semaphore. Ring space is reclaimed once the semaphore reaches the
+ * value of the batch that used it, so the CPU only waits when the ring is
+ * full. When the transfer queue is in another family the resources are
+ * released to the graphics family and acquired by the next frame. Thread safe
+ */
+class staging_ring {
+  static constexpr VkDeviceSize M_DEFAULT_SIZE = 32ull << 20;
+
+  struct batch {
+    VkCommandBuffer command_buffer = VK_NULL_HANDLE;
+    uint64_t value = 0; // Timeline value signaled when the copies are done
+    uint64_t end = 0;   // Ring head when the batch was submitted
+  };
+
+  VkDevice m_device = VK_NULL_HANDLE;
+  vk_allocator *m_allocator = nullptr;
+  VkQueue m_queue = VK_NULL_HANDLE;
+  std::mutex *m_queue_mutex = nullptr; // Set when the queue is shared
+  uint32_t m_transfer_family = 0;
+  uint32_t m_graphics_family = 0;
+  VkDeviceSize m_copy_alignment = 16;
+
+  VkBuffer m_buffer = VK_NULL_HANDLE;
+  allocation m_allocation;
+  VkDeviceSize m_size = 0;
+  uint64_t m_head = 0; // Monotonic byte counters, position is % m_size
+  uint64_t m_tail = 0;
+
+  VkCommandPool m_command_pool = VK_NULL_HANDLE;
+  std::vector<VkCommandBuffer> m_free_command_buffers;
+  VkSemaphore m_timeline = VK_NULL_HANDLE;
+  uint64_t m_next_value = 1;
+
+  batch m_recording;          // Command buffer is null until the first copy
+  std::deque<batch> m_in_flight;
+  upload_wait m_recording_wait; // Acquires for the batch being recorded
+  upload_wait m_pending_wait;   // Acquires for flushed batches
+
+  std::mutex m_mutex;
+
+  VkDeviceSize reserve(VkDeviceSize size, VkDeviceSize alignment);
+  void retire(bool wait);
+  VkCommandBuffer get_command_buffer();
+  void submit();
+
+public:
+  void create(VkPhysicalDevice physical_device, VkDevice device,
+              vk_allocator &allocator, VkQueue queue, std::mutex *queue_mutex,
+              uint32_t transfer_family, uint32_t graphics_family,
+              VkDeviceSize size = M_DEFAULT_SIZE);
+  void destroy();
+
+  uint64_t upload_buffer(VkBuffer buffer, VkDeviceSize offset,
+                         const void *data, VkDeviceSize size,
+                         VkPipelineStageFlags dst_stage,
+                         VkAccessFlags dst_access);
+  uint64_t upload_image(VkImage image, VkExtent3D extent, uint32_t mip_level,
+                        const void *data, VkDeviceSize size,
+                        VkImageLayout final_layout,
+                        VkPipelineStageFlags dst_stage,
+                        VkAccessFlags dst_access);
+  uint64_t flush();
+  upload_wait take_wait();
+  bool is_complete(uint64_t value);
+  void wait(uint64_t value);
+  VkSemaphore get_timeline();
+  VkDeviceSize get_size();
+  VkDeviceSize get_max_image_size();
+};
@@ -0,0 +1,652 @@
+/**
+ * @file
+ * @author Ruben Pena <rubn.pena@gmail.com>
+ * @brief This file contains the implementation of the texture_streamer class
+ */
+
+#include <algorithm>
+#include <create_shader_module.hh>
+#include <cstring>
+#include <embedded_shaders.hh>
+#include <iostream>
+#include <map>
+#include <parallel_for.hh>
+#include <stdexcept>
+#include <vk_texture_streamer.hh>
+
+static constexpr VkFormatFeatureFlags BLIT_FEATURES =
+    VK_FORMAT_FEATURE_BLIT_SRC_BIT | VK_FORMAT_FEATURE_BLIT_DST_BIT |
+    VK_FORMAT_FEATURE_SAMPLED_IMAGE_FILTER_LINEAR_BIT;
+static constexpr uint32_t MIP_GROUP_SIZE = 8; // mip.comp local size
+
+static VkFormat get_format(assets::pixel_format format) {
+  return format == assets::pixel_format::rgba32_float
+             ? VK_FORMAT_R32G32B32A32_SFLOAT
+             : VK_FORMAT_R8G8B8A8_SRGB;
+}
+
+/**
+ * @brief Level level of image. Baked scenes come with their mips, which are
+ * copied as they are; otherwise the closest level available, image's own or
+ * from, a level already cut from it, is downsampled the rest of the way
+ */
+static assets::image_data get_level(const assets::image_data &image,
+                                    uint32_t level,
+                                    const assets::image_data *from,
+                                    uint32_t from_level) {
+  uint32_t baked = static_cast<uint32_t>(
+      std::min(static_cast<size_t>(level), image.mips.size()));
+  assets::image_data target;
+  if (from != nullptr && from_level > baked) {
+    target = *from;
+    baked = from_level;
+  } else {
+    target.name = image.name;
+    target.format = image.format;
+    target.width = std::max(image.width >> baked, 1u);
+    target.height = std::max(image.height >> baked, 1u);
+    target.rgba = baked == 0 ? image.rgba : image.mips[baked - 1];
+  }
+  for (uint32_t i = baked; i < level; i++) {
+    target = assets::downsample(target);
+  }
+  return target;
+}
+
+static VkExtent3D get_level_extent(VkExtent2D extent, uint32_t level) {
+  return {std::max(extent.width >> level, 1u),
+          std::max(extent.height >> level, 1u), 1};
+}
+
+static uint32_t get_level_count(uint32_t width, uint32_t height) {
+  uint32_t levels = 1;
+  while ((std::max(width, height) >> levels) > 0) {
+    levels++;
+  }
+  return levels;
+}
+
+static void image_barrier(VkCommandBuffer command_buffer, VkImage image,
+                          uint32_t base_level, uint32_t level_count,
+                          VkImageLayout old_layout, VkImageLayout new_layout,
+                          VkPipelineStageFlags src_stage,
+                          VkAccessFlags src_access,
+                          VkPipelineStageFlags dst_stage,
+                          VkAccessFlags dst_access) {
+  VkImageMemoryBarrier barrier{};
+  barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+  barrier.srcAccessMask = src_access;
+  barrier.dstAccessMask = dst_access;
+  barrier.oldLayout = old_layout;
+  barrier.newLayout = new_layout;
+  barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+  barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+  barrier.image = image;
+  barrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+  barrier.subresourceRange.baseMipLevel = base_level;
+  barrier.subresourceRange.levelCount = level_count;
+  barrier.subresourceRange.baseArrayLayer = 0;
+  barrier.subresourceRange.layerCount = 1;
+
+  vkCmdPipelineBarrier(command_buffer, src_stage, dst_stage, 0, 0, nullptr, 0,
+                       nullptr, 1, &barrier);
+}
+
+/**
+ * @brief Creates the compute fallback and the lod buffer, one float for each
+ * slot of the bindless image array
+ */
+void texture_streamer::create(VkPhysicalDevice physical_device,
+                              VkDevice device, vk_allocator &allocator,
+                              staging_ring &staging, bindless_heap &bindless,
+                              VkPipelineCache pipeline_cache) {
+  m_device = device;
+  m_allocator = &allocator;
+  m_staging = &staging;
+  m_bindless = &bindless;
+
+  for (auto format : {assets::pixel_format::rgba8_srgb,
+                      assets::pixel_format::rgba32_float}) {
+    VkFormatProperties properties;
+    vkGetPhysicalDeviceFormatProperties(physical_device, get_format(format),
+                                        &properties);
+    m_features[static_cast<int>(format)] = properties.optimalTilingFeatures;
+  }
+
+  VkDescriptorSetLayoutBinding bindings[2]{};
+  for (uint32_t i = 0; i < 2; i++) {
+    bindings[i].binding = i;
+    bindings[i].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
+    bindings[i].descriptorCount = 1;
+    bindings[i].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+  } // 0: the source level, 1: the level generated
+
+  VkDescriptorSetLayoutCreateInfo layout_info{};
+  layout_info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+  layout_info.bindingCount = 2;
+  layout_info.pBindings = bindings;
+  if (vkCreateDescriptorSetLayout(m_device, &layout_info, nullptr,
+                                  &m_mip_set_layout) != VK_SUCCESS) {
+    throw std::runtime_error("failed to create mip set layout");
+  }
+
+  VkDescriptorPoolSize pool_size = {VK_DESCRIPTOR_TYPE_STORAGE_IMAGE,
+                                    2 * M_MAX_MIP_SETS};
+  VkDescriptorPoolCreateInfo pool_info{};
+  pool_info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+  pool_info.maxSets = M_MAX_MIP_SETS;
+  pool_info.poolSizeCount = 1;
+  pool_info.pPoolSizes = &pool_size;
+  if (vkCreateDescriptorPool(m_device, &pool_info, nullptr, &m_mip_pool) !=
+      VK_SUCCESS) {
+    throw std::runtime_error("failed to create mip descriptor pool");
+  }
+
+  VkPipelineLayoutCreateInfo pipeline_layout_info{};
+  pipeline_layout_info.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+  pipeline_layout_info.setLayoutCount = 1;
+  pipeline_layout_info.pSetLayouts = &m_mip_set_layout;
+  if (vkCreatePipelineLayout(m_device, &pipeline_layout_info, nullptr,
+                             &m_mip_layout) != VK_SUCCESS) {
+    throw std::runtime_error("failed to create mip pipeline layout");
+  }
+
+  const utils::embedded_shader *shader =
+      utils::find_embedded_shader("mip.comp");
+  if (shader == nullptr) {
+    throw std::runtime_error("mip shader is not embedded");
+  }
+  VkShaderModule module =
+      utils::create_shader_module(shader->code, shader->size, m_device);
+
+  VkComputePipelineCreateInfo pipeline_info{};
+  pipeline_info.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
+  pipeline_info.stage.sType =
+      VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+  pipeline_info.stage.stage = VK_SHADER_STAGE_COMPUTE_BIT;
+  pipeline_info.stage.module = module;
+  pipeline_info.stage.pName = "main";
+  pipeline_info.layout = m_mip_layout;
+  VkResult result = vkCreateComputePipelines(
+      m_device, pipeline_cache, 1, &pipeline_info, nullptr, &m_mip_pipeline);
+  vkDestroyShaderModule(m_device, module, nullptr);
+  if (result != VK_SUCCESS) {
+    throw std::runtime_error("failed to create mip pipeline");
+  }
+
+  VkBufferCreateInfo buffer_info{};
+  buffer_info.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+  buffer_info.size = sizeof(float) * m_bindless->get_image_capacity();
+  buffer_info.usage =
+      VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT;
+  buffer_info.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+  m_lod_allocation = m_allocator->create_buffer(
+      buffer_info, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, m_lod_buffer);
+  m_lod_buffer_index = m_bindless->add_buffer(m_lod_buffer);
+  m_lod_buffer_cleared = false; // By the first recorded frame
+}
+
+/**
+ * @brief Destroys the textures too. The device must be done with them
+ */
+void texture_streamer::destroy() {
+  clear();
+  m_bindless->remove_buffer(m_lod_buffer_index);
+  m_allocator->destroy_buffer(m_lod_buffer, m_lod_allocation);
+  vkDestroyPipeline(m_device, m_mip_pipeline, nullptr);
+  vkDestroyPipelineLayout(m_device, m_mip_layout, nullptr);
+  vkDestroyDescriptorPool(m_device, m_mip_pool, nullptr); // Frees the sets
+  vkDestroyDescriptorSetLayout(m_device, m_mip_set_layout, nullptr);
+  m_lod_buffer = VK_NULL_HANDLE;
+  m_mip_pipeline = VK_NULL_HANDLE;
+  m_mip_layout = VK_NULL_HANDLE;
+  m_mip_pool = VK_NULL_HANDLE;
+  m_mip_set_layout = VK_NULL_HANDLE;
+}
+
+/**
+ * @brief Creates a texture per image and queues its uploads. Returns the
+ * bindless index of each, -1 for the empty images. Images whose top level
+ * does not fit in one staging ring image upload are halved until it does
+ */
+std::vector<int32_t>
+texture_streamer::add(const std::vector<assets::image_data> &images) {
+  struct prepared {
+    uint32_t top_level = 0; // Levels of the source dropped to fit the ring
+    uint32_t level_count = 0;
+    mip_path path = mip_path::none;
+    assets::image_data top;
+    assets::image_data coarse;
+    uint32_t coarse_level = 0; // 0: the top level is coarse enough
+  };
+
+  std::vector<prepared> textures(images.size());
+  for (size_t i = 0; i < images.size(); i++) {
+    const assets::image_data &image = images[i];
+    if (image.rgba.empty())
+      continue;
+
+    prepared &target = textures[i];
+    VkDeviceSize texel_size = assets::get_texel_size(image.format);
+    uint32_t width = image.width;
+    uint32_t height = image.height;
+    while (VkDeviceSize(width) * height * texel_size >
+               m_staging->get_max_image_size() &&
+           (width > 1 || height > 1)) {
+      width = std::max(width / 2, 1u);
+      height = std::max(height / 2, 1u);
+      target.top_level++;
+    }
+    target.level_count = get_level_count(width, height);
+    target.path = choose_path(image.format, target.level_count);
+    if (target.path == mip_path::none) {
+      target.level_count = 1;
+    } else if (target.path == mip_path::compute) {
+      m_mip_set_count += target.level_count - 1;
+    } // Paths are picked up front, the compute sets are a shared budget
+  }
+
+  utils::parallel_for(images.size(), [&](size_t i) {
+    prepared &target = textures[i];
+    if (images[i].rgba.empty())
+      return;
+
+    target.top = get_level(images[i], target.top_level, nullptr, 0);
+    if (target.level_count == 1)
+      return;
+
+    VkExtent2D extent = {target.top.width, target.top.height};
+    while (std::max(extent.width, extent.height) > M_COARSE_SIZE) {
+      extent = {std::max(extent.width / 2, 1u),
+                std::max(extent.height / 2, 1u)};
+      target.coarse_level++;
+    }
+    if (target.coarse_level > 0) {
+      target.coarse = get_level(images[i],
+                                target.top_level + target.coarse_level,
+                                &target.top, target.top_level);
+    }
+  }); // The texels are copied, the scene data can go once this returns
+
+  std::vector<int32_t> indices(images.size(), -1);
+  for (size_t i = 0; i < images.size(); i++) {
+    prepared &source = textures[i];
+    if (images[i].rgba.empty())
+      continue;
+    if (source.top_level > 0) {
+      std::cerr << "Texture " << images[i].name << " is too big for the "
+                << "staging ring, uploading it at level " << source.top_level
+                << std::endl;
+    }
+
+    uint32_t index =
+        create_texture(source.top, source.level_count, source.path);
+    indices[i] = static_cast<int32_t>(m_textures[index].bindless_index);
+    if (source.coarse_level > 0) {
+      m_coarse.push_back(
+          {index, source.coarse_level, std::move(source.coarse.rgba)});
+    }
+    m_top.push_back({index, 0, std::move(source.top.rgba)});
+  }
+  return indices;
+}
+
+/**
+ * @brief Destroys every texture and drops the pending uploads. The device
+ * must be done with them
+ */
+void texture_streamer::clear() {
+  for (auto &target : m_textures) {
+    m_bindless->remove_image(target.bindless_index);
+    vkDestroyImageView(m_device, target.view, nullptr);
+    for (auto view : target.level_views) {
+      vkDestroyImageView(m_device, view, nullptr);
+    }
+    m_allocator->destroy_image(target.image, target.image_allocation);
+  }
+  if (m_mip_set_count > 0) {
+    vkResetDescriptorPool(m_device, m_mip_pool, 0);
+    m_mip_set_count = 0;
+  }
+
+  m_textures.clear();
+  m_added.clear();
+  m_coarse.clear();
+  m_top.clear();
+  m_uploaded.clear(); // Their copies are done, nobody waits on them now
+  m_stats = {};
+}
+
+/**
+ * @brief Queues the next uploads in the staging ring, coarse levels first, up
+ * to the frame budget. At least one goes each frame whatever its size. Must
+ * be called before the staging ring is flushed for the frame recording the
+ * mips
+ */
+void texture_streamer::stream() {
+  VkDeviceSize streamed = 0;
+  for (auto *queue : {&m_coarse, &m_top}) {
+    while (!queue->empty()) {
+      level_upload &next = queue->front();
+      VkDeviceSize size = next.texels.size();
+      if (streamed > 0 && streamed + size > m_budget)
+        return;
+
+      texture &target = m_textures[next.texture];
+      m_staging->upload_image(
+          target.image, get_level_extent(target.extent, next.level),
+          next.level, next.texels.data(), size,
+          VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, VK_PIPELINE_STAGE_TRANSFER_BIT,
+          VK_ACCESS_TRANSFER_READ_BIT);
+      streamed += size;
+      m_stats.streamed_bytes += size;
+
+      m_uploaded.push_back({next.texture, next.level, {}});
+      queue->pop_front();
+    }
+  }
+}
+
+/**
+ * @brief Generates the mips below the levels uploaded for this frame and
+ * publishes the new resident levels in the lod buffer. Recorded before any
+ * pass samples the textures
+ */
+void texture_streamer::record(VkCommandBuffer command_buffer) {
+  if (m_lod_buffer_cleared && m_added.empty() && m_uploaded.empty())
+    return;
+
+  std::map<uint32_t, float> lods; // Bindless index, each written once
+  for (uint32_t index : m_added) {
+    lods[m_textures[index].bindless_index] = -1.0f;
+  }
+  m_added.clear();
+
+  for (const auto &uploaded : m_uploaded) {
+    texture &target = m_textures[uploaded.texture];
+    uint32_t end = target.resident_level; // The levels below are valid
+    if (target.path == mip_path::compute) {
+      record_dispatches(command_buffer, target, uploaded.level, end);
+    } else {
+      record_blits(command_buffer, target, uploaded.level, end);
+    }
+    target.resident_level = uploaded.level;
+    lods[target.bindless_index] = static_cast<float>(uploaded.level);
+  }
+  m_uploaded.clear();
+
+  VkBufferMemoryBarrier barrier{};
+  barrier.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+  barrier.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+  barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+  barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+  barrier.buffer = m_lod_buffer;
+  barrier.offset = 0;
+  barrier.size = VK_WHOLE_SIZE;
+  vkCmdPipelineBarrier(command_buffer, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT,
+                       VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, nullptr, 1,
+                       &barrier, 0, nullptr); // Earlier frames read it
+
+  if (!m_lod_buffer_cleared) {
+    const float none = -1.0f;
+    uint32_t bits;
+    std::memcpy(&bits, &none, sizeof(bits));
+    vkCmdFillBuffer(command_buffer, m_lod_buffer, 0, VK_WHOLE_SIZE, bits);
+    m_lod_buffer_cleared = true;
+
+    barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    vkCmdPipelineBarrier(command_buffer, VK_PIPELINE_STAGE_TRANSFER_BIT,
+                         VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, nullptr, 1,
+                         &barrier, 0, nullptr);
+  }
+  for (const auto &[index, lod] : lods) {
+    vkCmdUpdateBuffer(command_buffer, m_lod_buffer, sizeof(float) * index,
+                      sizeof(float), &lod);
+  }
+
+  barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+  barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+  vkCmdPipelineBarrier(command_buffer, VK_PIPELINE_STAGE_TRANSFER_BIT,
+                       VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, 0, 0, nullptr, 1,
+                       &barrier, 0, nullptr);
+}
+
+void texture_streamer::set_budget(VkDeviceSize bytes) { m_budget = bytes; }
+
+/**
+ * @brief True until every level has been uploaded and its mips generated
+ */
+bool texture_streamer::is_streaming() {
+  return !m_coarse.empty() || !m_top.empty() || !m_uploaded.empty();
+}
+
+uint32_t texture_streamer::get_lod_buffer_index() {
+  return m_lod_buffer_index;
+}
+
+texture_stats texture_streamer::get_stats() {
+  texture_stats stats = m_stats;
+  stats.texture_count = static_cast<uint32_t>(m_textures.size());
+  stats.pending_uploads = static_cast<uint32_t>(m_coarse.size() + m_top.size());
+  return stats;
+}
+
+/**
+ * @brief Blits need the format to be a linear filtered blit source and
+ * destination. The compute fallback is written for float texels, and each of
+ * its levels takes a descriptor set. Anything else keeps only its top level
+ */
+texture_streamer::mip_path
+texture_streamer::choose_path(assets::pixel_format format,
+                              uint32_t level_count) {
+  if (level_count == 1)
+    return mip_path::none;
+
+  VkFormatFeatureFlags features = m_features[static_cast<int>(format)];
+  if ((features & BLIT_FEATURES) == BLIT_FEATURES)
+    return mip_path::blit;
+
+  if (format == assets::pixel_format::rgba32_float &&
+      (features & VK_FORMAT_FEATURE_STORAGE_IMAGE_BIT) != 0 &&
+      m_mip_set_count + level_count - 1 <= M_MAX_MIP_SETS)
+    return mip_path::compute;
+  return mip_path::none;
+}
+
+uint32_t texture_streamer::create_texture(const assets::image_data &top,
+                                          uint32_t level_count,
+                                          mip_path path) {
+  texture target;
+  target.extent = {top.width, top.height};
+  target.level_count = level_count;
+  target.path = path;
+  target.resident_level = level_count;
+
+  VkImageCreateInfo image_info{};
+  image_info.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+  image_info.imageType = VK_IMAGE_TYPE_2D;
+  image_info.format = get_format(top.format);
+  image_info.extent = {top.width, top.height, 1};
+  image_info.mipLevels = level_count;
+  image_info.arrayLayers = 1;
+  image_info.samples = VK_SAMPLE_COUNT_1_BIT;
+  image_info.tiling = VK_IMAGE_TILING_OPTIMAL;
+  image_info.usage = VK_IMAGE_USAGE_SAMPLED_BIT |
+                     VK_IMAGE_USAGE_TRANSFER_DST_BIT |
+                     VK_IMAGE_USAGE_TRANSFER_SRC_BIT;
+  if (path == mip_path::compute) {
+    image_info.usage |= VK_IMAGE_USAGE_STORAGE_BIT;
+  }
+  image_info.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+  image_info.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+
+  target.image_allocation = m_allocator->create_image(
+      image_info, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, target.image);
+  target.view = create_view(target.image, image_info.format, 0, level_count);
+  if (path == mip_path::compute) {
+    for (uint32_t level = 0; level < level_count; level++) {
+      target.level_views.push_back(
+          create_view(target.image, image_info.format, level, 1));
+    }
+    create_mip_sets(target);
+  }
+  target.bindless_index = m_bindless->add_image(target.view);
+
+  m_textures.push_back(std::move(target));
+  uint32_t index = static_cast<uint32_t>(m_textures.size() - 1);
+  m_added.push_back(index);
+  return index;
+}
+
+VkImageView texture_streamer::create_view(VkImage image, VkFormat format,
+                                          uint32_t base_level,
+                                          uint32_t level_count) {
+  VkImageViewCreateInfo view_info{};
+  view_info.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
+  view_info.image = image;
+  view_info.viewType = VK_IMAGE_VIEW_TYPE_2D;
+  view_info.format = format;
+  view_info.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+  view_info.subresourceRange.baseMipLevel = base_level;
+  view_info.subresourceRange.levelCount = level_count;
+  view_info.subresourceRange.baseArrayLayer = 0;
+  view_info.subresourceRange.layerCount = 1;
+
+  VkImageView view;
+  if (vkCreateImageView(m_device, &view_info, nullptr, &view) != VK_SUCCESS) {
+    throw std::runtime_error("failed to create texture image view");
+  }
+  return view;
+}
+
+/**
+ * @brief One set per generated level, written once: the views never change
+ * and the sets are only bound by the frame generating that level
+ */
+void texture_streamer::create_mip_sets(texture &target) {
+  uint32_t set_count = target.level_count - 1;
+  std::vector<VkDescriptorSetLayout> layouts(set_count, m_mip_set_layout);
+  VkDescriptorSetAllocateInfo alloc_info{};
+  alloc_info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+  alloc_info.descriptorPool = m_mip_pool;
+  alloc_info.descriptorSetCount = set_count;
+  alloc_info.pSetLayouts = layouts.data();
+
+  target.mip_sets.resize(set_count);
+  if (vkAllocateDescriptorSets(m_device, &alloc_info,
+                               target.mip_sets.data()) != VK_SUCCESS) {
+    throw std::runtime_error("failed to allocate mip descriptor sets");
+  }
+
+  std::vector<VkDescriptorImageInfo> image_infos(2 * set_count);
+  std::vector<VkWriteDescriptorSet> writes(2 * set_count);
+  for (uint32_t i = 0; i < 2 * set_count; i++) {
+    image_infos[i].imageView = target.level_views[i / 2 + i % 2];
+    image_infos[i].imageLayout = VK_IMAGE_LAYOUT_GENERAL;
+
+    writes[i].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+    writes[i].dstSet = target.mip_sets[i / 2];
+    writes[i].dstBinding = i % 2;
+    writes[i].descriptorCount = 1;
+    writes[i].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
+    writes[i].pImageInfo = &image_infos[i];
+  }
+  vkUpdateDescriptorSets(m_device, static_cast<uint32_t>(writes.size()),
+                         writes.data(), 0, nullptr);
+}
+
+/**
+ * @brief Blits each level in [level + 1, end) from the one above, then hands
+ * [level, end) to the fragment shaders. level is in TRANSFER_SRC_OPTIMAL,
+ * straight out of the staging ring, and the levels generated were never
+ * sampled
+ */
+void texture_streamer::record_blits(VkCommandBuffer command_buffer,
+                                    texture &target, uint32_t level,
+                                    uint32_t end) {
+  for (uint32_t i = level + 1; i < end; i++) {
+    image_barrier(command_buffer, target.image, i, 1,
+                  VK_IMAGE_LAYOUT_UNDEFINED,
+                  VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+                  VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, 0,
+                  VK_PIPELINE_STAGE_TRANSFER_BIT,
+                  VK_ACCESS_TRANSFER_WRITE_BIT);
+
+    VkExtent3D source = get_level_extent(target.extent, i - 1);
+    VkExtent3D destination = get_level_extent(target.extent, i);
+    VkImageBlit blit{};
+    blit.srcSubresource = {VK_IMAGE_ASPECT_COLOR_BIT, i - 1, 0, 1};
+    blit.srcOffsets[1] = {static_cast<int32_t>(source.width),
+                          static_cast<int32_t>(source.height), 1};
+    blit.dstSubresource = {VK_IMAGE_ASPECT_COLOR_BIT, i, 0, 1};
+    blit.dstOffsets[1] = {static_cast<int32_t>(destination.width),
+                          static_cast<int32_t>(destination.height), 1};
+    vkCmdBlitImage(command_buffer, target.image,
+                   VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, target.image,
+                   VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &blit,
+                   VK_FILTER_LINEAR);
+
+    image_barrier(command_buffer, target.image, i, 1,
+                  VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+                  VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+                  VK_PIPELINE_STAGE_TRANSFER_BIT, VK_ACCESS_TRANSFER_WRITE_BIT,
+                  VK_PIPELINE_STAGE_TRANSFER_BIT, VK_ACCESS_TRANSFER_READ_BIT);
+    m_stats.blit_mips++;
+  }
+
+  image_barrier(command_buffer, target.image, level, end - level,
+                VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+                VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+                VK_PIPELINE_STAGE_TRANSFER_BIT, VK_ACCESS_TRANSFER_WRITE_BIT,
+                VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT,
+                VK_ACCESS_SHADER_READ_BIT);
+}
+
+/**
+ * @brief The compute fallback of record_blits, every level in GENERAL while
+ * the chain is generated
+ */
+void texture_streamer::record_dispatches(VkCommandBuffer command_buffer,
+                                         texture &target, uint32_t level,
+                                         uint32_t end) {
+  image_barrier(command_buffer, target.image, level, 1,
+                VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, VK_IMAGE_LAYOUT_GENERAL,
+                VK_PIPELINE_STAGE_TRANSFER_BIT, 0,
+                VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                VK_ACCESS_SHADER_READ_BIT);
+  if (level + 1 < end) {
+    image_barrier(command_buffer, target.image, level + 1, end - level - 1,
+                  VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_GENERAL,
+                  VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, 0,
+                  VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                  VK_ACCESS_SHADER_WRITE_BIT);
+  }
+
+  vkCmdBindPipeline(command_buffer, VK_PIPELINE_BIND_POINT_COMPUTE,
+                    m_mip_pipeline);
+  for (uint32_t i = level + 1; i < end; i++) {
+    vkCmdBindDescriptorSets(command_buffer, VK_PIPELINE_BIND_POINT_COMPUTE,
+                            m_mip_layout, 0, 1, &target.mip_sets[i - 1], 0,
+                            nullptr);
+    VkExtent3D extent = get_level_extent(target.extent, i);
+    vkCmdDispatch(command_buffer,
+                  (extent.width + MIP_GROUP_SIZE - 1) / MIP_GROUP_SIZE,
+                  (extent.height + MIP_GROUP_SIZE - 1) / MIP_GROUP_SIZE, 1);
+
+    image_barrier(command_buffer, target.image, i, 1, VK_IMAGE_LAYOUT_GENERAL,
+                  VK_IMAGE_LAYOUT_GENERAL,
+                  VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                  VK_ACCESS_SHADER_WRITE_BIT,
+                  VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                  VK_ACCESS_SHADER_READ_BIT);
+    m_stats.compute_mips++;
+  }
+
+  image_barrier(command_buffer, target.image, level, end - level,
+                VK_IMAGE_LAYOUT_GENERAL,
+                VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+                VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                VK_ACCESS_SHADER_WRITE_BIT,
+                VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT,
+                VK_ACCESS_SHADER_READ_BIT);
+}
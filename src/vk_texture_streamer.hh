@@ -0,0 +1,117 @@
+/**
+ * @file
+ * @author Ruben Pena <rubn.pena@gmail.com>
+ * @brief This file contains the declaration of the texture_streamer class,
+ * the textures of the scene uploaded progressively with GPU generated mips.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <deque>
+#include <scene.hh>
+#include <vector>
+#include <vk_allocator.hh>
+#include <vk_bindless.hh>
+#include <vk_staging_ring.hh>
+#include <vulkan/vulkan.h>
+
+struct texture_stats {
+  uint32_t texture_count = 0;
+  uint32_t pending_uploads = 0;
+  VkDeviceSize streamed_bytes = 0;
+  uint32_t blit_mips = 0;    // Levels generated with vkCmdBlitImage
+  uint32_t compute_mips = 0; // Levels generated by the compute fallback
+};
+
+/**
+ * @class
+ * @brief Owns the textures of the scene. Every texture gets its full mip
+ * chain, but only two levels ever cross the staging ring: a coarse one, at
+ * most M_COARSE_SIZE texels wide, and then the top one. Both are cut on the
+ * job system when the texture is added, and the levels below each are
+ * generated on the graphics queue, by blitting or, for formats the device
+ * cannot blit with a linear filter, by a compute shader. Uploads are paced
+ * by a per frame byte budget, so a scene shows coarse textures on its first
+ * frames and sharpens over the next ones. Shaders clamp the sampled level
+ * with the lod buffer, indexed by bindless image: the finest resident level,
+ * or negative while nothing is. Used from the render thread only
+ */
+class texture_streamer {
+  static constexpr uint32_t M_COARSE_SIZE = 64;
+  static constexpr VkDeviceSize M_DEFAULT_BUDGET = 8ull << 20; // Per frame
+  static constexpr uint32_t M_MAX_MIP_SETS = 1024; // Compute fallback levels
+
+  enum class mip_path { blit, compute, none };
+
+  struct texture {
+    VkImage image = VK_NULL_HANDLE;
+    allocation image_allocation;
+    VkImageView view = VK_NULL_HANDLE; // Every level, sampled
+    uint32_t bindless_index = 0;
+    VkExtent2D extent = {0, 0};
+    uint32_t level_count = 1;
+    mip_path path = mip_path::none;
+    std::vector<VkImageView> level_views; // Compute fallback, one per level
+    std::vector<VkDescriptorSet> mip_sets; // Compute fallback, level i to i+1
+    uint32_t resident_level = 0; // level_count while nothing is resident
+  };
+
+  struct level_upload {
+    uint32_t texture = 0;
+    uint32_t level = 0;
+    std::vector<uint8_t> texels; // Dropped once uploaded
+  };
+
+  VkDevice m_device = VK_NULL_HANDLE;
+  vk_allocator *m_allocator = nullptr;
+  staging_ring *m_staging = nullptr;
+  bindless_heap *m_bindless = nullptr;
+  VkFormatFeatureFlags m_features[2] = {0, 0}; // Per assets::pixel_format
+
+  VkDescriptorSetLayout m_mip_set_layout = VK_NULL_HANDLE;
+  VkDescriptorPool m_mip_pool = VK_NULL_HANDLE;
+  uint32_t m_mip_set_count = 0;
+  VkPipelineLayout m_mip_layout = VK_NULL_HANDLE;
+  VkPipeline m_mip_pipeline = VK_NULL_HANDLE;
+
+  VkBuffer m_lod_buffer = VK_NULL_HANDLE; // float per bindless image
+  allocation m_lod_allocation;
+  uint32_t m_lod_buffer_index = 0;
+  bool m_lod_buffer_cleared = false;
+
+  VkDeviceSize m_budget = M_DEFAULT_BUDGET;
+  std::vector<texture> m_textures;
+  std::vector<uint32_t> m_added;        // Lods to reset before first use
+  std::deque<level_upload> m_coarse;    // Uploaded before any top level
+  std::deque<level_upload> m_top;
+  std::vector<level_upload> m_uploaded; // Mips to generate this frame
+  texture_stats m_stats;
+
+  mip_path choose_path(assets::pixel_format format, uint32_t level_count);
+  uint32_t create_texture(const assets::image_data &top, uint32_t level_count,
+                          mip_path path);
+  VkImageView create_view(VkImage image, VkFormat format, uint32_t base_level,
+                          uint32_t level_count);
+  void create_mip_sets(texture &target);
+  void record_blits(VkCommandBuffer command_buffer, texture &target,
+                    uint32_t level, uint32_t end);
+  void record_dispatches(VkCommandBuffer command_buffer, texture &target,
+                         uint32_t level, uint32_t end);
+
+public:
+  void create(VkPhysicalDevice physical_device, VkDevice device,
+              vk_allocator &allocator, staging_ring &staging,
+              bindless_heap &bindless, VkPipelineCache pipeline_cache);
+  void destroy();
+
+  std::vector<int32_t> add(const std::vector<assets::image_data> &images);
+  void clear();
+  void stream();
+  void record(VkCommandBuffer command_buffer);
+
+  void set_budget(VkDeviceSize bytes);
+  bool is_streaming();
+  uint32_t get_lod_buffer_index();
+  texture_stats get_stats();
+};